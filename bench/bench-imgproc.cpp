@@ -0,0 +1,579 @@
+//
+// imgproc kernels on realistic resolutions: aifil implementation vs. OpenCV
+// baseline, SIMD kernels (on every instruction set) vs. plain scalar loops.
+// Every benchmark takes resolution index (CIF..4K) and, where it matters,
+// channels count; bytes/s are counted for input data.
+//
+#include "imgproc/imgproc.hpp"
+#include "imgproc/filter.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef AIFIL_BENCH_SSE
+#include "imgproc/sse/simd-dispatch.hpp"
+
+// imgproc/sse/sse-imgproc.cpp
+void sse_sqrt_sum_of_squares(float* src_x, float* src_y, float* dst, uint32_t count);
+extern "C" void sse_gradient_c1(int height, int width, float *pdx, float *pdy,
+	float *pangle, float *pmag);
+extern "C" void sse_integral_c10_64f(int height, int width, float *src, double *dst);
+extern "C" void sse_integral_c10_32s(int height, int width, uint8_t *src, int *dst);
+#endif
+
+using namespace aifil;
+
+namespace {
+
+struct Resolution
+{
+	const char *name;
+	int width;
+	int height;
+};
+
+const Resolution resolutions[] = {
+	{"CIF", 352, 288},
+	{"VGA", 640, 480},
+	{"HD", 1280, 720},
+	{"FHD", 1920, 1080},
+	{"4K", 3840, 2160}};
+const int resolutions_count = sizeof(resolutions) / sizeof(resolutions[0]);
+
+void all_resolutions(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({"res"});
+	for (int r = 0; r < resolutions_count; ++r)
+		b->Arg(r);
+}
+
+// slow kernels: up to FHD
+void small_resolutions(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({"res"});
+	for (int r = 0; r < resolutions_count - 1; ++r)
+		b->Arg(r);
+}
+
+void resolutions_and_channels(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({"res", "ch"});
+	const int channels[] = {1, 3, 10};
+	for (int r = 0; r < resolutions_count; ++r)
+		for (int ch: channels)
+			b->Args({r, ch});
+}
+
+#ifdef AIFIL_BENCH_SSE
+// dispatched kernels on every instruction set, see simd-dispatch.hpp
+void resolutions_and_simd(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({"res", "simd"});
+	for (int r = 0; r < resolutions_count; ++r)
+		for (int level = SIMD_SSE2; level <= SIMD_AVX512; ++level)
+			b->Args({r, level});
+}
+
+// false (and benchmark is skipped) if cpu has no such instruction set
+bool set_simd_level(benchmark::State &state)
+{
+	int level = int(state.range(1));
+	if (simd_set_level(level) == level)
+		return true;
+	state.SkipWithError("instruction set is not supported");
+	return false;
+}
+#endif
+
+// gradient is implemented for 1 and 3 channels
+void gradient_args(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({"res", "ch"});
+	for (int r = 0; r < resolutions_count; ++r)
+	{
+		b->Args({r, 1});
+		b->Args({r, 3});
+	}
+}
+
+const Resolution& resolution(benchmark::State &state)
+{
+	const Resolution &res = resolutions[state.range(0)];
+	state.SetLabel(res.name);
+	return res;
+}
+
+// deterministic noise, same for every run
+cv::Mat random_mat(const Resolution &res, int type, double low, double high)
+{
+	cv::Mat m(res.height, res.width, type);
+	cv::RNG rng(2017);
+	rng.fill(m, cv::RNG::UNIFORM, low, high);
+	return m;
+}
+
+// must be called after the loop
+void set_counters(benchmark::State &state, const Resolution &res, size_t bytes_per_pixel)
+{
+	int64_t pixels = int64_t(res.width) * res.height;
+	state.SetItemsProcessed(state.iterations() * pixels);
+	state.SetBytesProcessed(state.iterations() * pixels * int64_t(bytes_per_pixel));
+	state.counters["pixels/s"] = benchmark::Counter(double(pixels),
+		benchmark::Counter::kIsIterationInvariantRate);
+}
+
+}  // namespace
+
+// integral images
+
+static void integrate_8u(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	int ch = int(state.range(1));
+	cv::Mat src = random_mat(res, CV_8UC(ch), 0, 256);
+	cv::Mat dst;
+	for (auto _: state)
+	{
+		imgproc::integrate(src, dst);
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, ch);
+}
+BENCHMARK(integrate_8u)->Apply(resolutions_and_channels);
+
+static void integrate_8u_opencv(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	int ch = int(state.range(1));
+	cv::Mat src = random_mat(res, CV_8UC(ch), 0, 256);
+	cv::Mat dst;
+	for (auto _: state)
+	{
+		cv::integral(src, dst, CV_32S);
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, ch);
+}
+BENCHMARK(integrate_8u_opencv)->Apply(resolutions_and_channels);
+
+static void integrate_32f(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	int ch = int(state.range(1));
+	cv::Mat src = random_mat(res, CV_32FC(ch), 0, 1);
+	cv::Mat dst;
+	for (auto _: state)
+	{
+		imgproc::integrate(src, dst);
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, ch * sizeof(float));
+}
+BENCHMARK(integrate_32f)->Apply(resolutions_and_channels);
+
+static void integrate_32f_opencv(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	int ch = int(state.range(1));
+	cv::Mat src = random_mat(res, CV_32FC(ch), 0, 1);
+	cv::Mat dst;
+	for (auto _: state)
+	{
+		cv::integral(src, dst, CV_64F);
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, ch * sizeof(float));
+}
+BENCHMARK(integrate_32f_opencv)->Apply(resolutions_and_channels);
+
+// straightforward N-channel integral: scalar baseline for SSE versions
+template <typename S, typename D>
+static void integral_scalar(const S *src, D *dst, int height, int width, int ch)
+{
+	int sum_step = (width + 1) * ch;
+	std::fill(dst, dst + sum_step, D(0));
+	std::vector<D> row_sum(ch);
+	for (int y = 0; y < height; ++y)
+	{
+		const S *psrc = src + size_t(y) * width * ch;
+		D *prev = dst + size_t(y) * sum_step;
+		D *pdst = prev + sum_step;
+		std::fill(row_sum.begin(), row_sum.end(), D(0));
+		std::fill(pdst, pdst + ch, D(0));
+		for (int x = 0; x < width; ++x)
+			for (int c = 0; c < ch; ++c)
+			{
+				row_sum[c] += psrc[x * ch + c];
+				pdst[(x + 1) * ch + c] = prev[(x + 1) * ch + c] + row_sum[c];
+			}
+	}
+}
+
+static void integral_c10_32s_scalar(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	cv::Mat src = random_mat(res, CV_8UC(10), 0, 256);
+	cv::Mat dst(res.height + 1, res.width + 1, CV_32SC(10));
+	for (auto _: state)
+	{
+		integral_scalar(src.data, (int*)dst.data, res.height, res.width, 10);
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, 10);
+}
+BENCHMARK(integral_c10_32s_scalar)->Apply(all_resolutions);
+
+static void integral_c10_64f_scalar(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	cv::Mat src = random_mat(res, CV_32FC(10), 0, 1);
+	cv::Mat dst(res.height + 1, res.width + 1, CV_64FC(10));
+	for (auto _: state)
+	{
+		integral_scalar((const float*)src.data, (double*)dst.data, res.height, res.width, 10);
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, 10 * sizeof(float));
+}
+BENCHMARK(integral_c10_64f_scalar)->Apply(all_resolutions);
+
+#ifdef AIFIL_BENCH_SSE
+static void integral_c10_32s_sse(benchmark::State &state)
+{
+	if (!set_simd_level(state))
+		return;
+	const Resolution &res = resolution(state);
+	cv::Mat src = random_mat(res, CV_8UC(10), 0, 256);
+	cv::Mat dst(res.height + 1, res.width + 1, CV_32SC(10));
+	for (auto _: state)
+	{
+		sse_integral_c10_32s(res.height, res.width, src.data, (int*)dst.data);
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, 10);
+}
+BENCHMARK(integral_c10_32s_sse)->Apply(resolutions_and_simd);
+
+static void integral_c10_64f_sse(benchmark::State &state)
+{
+	if (!set_simd_level(state))
+		return;
+	const Resolution &res = resolution(state);
+	cv::Mat src = random_mat(res, CV_32FC(10), 0, 1);
+	cv::Mat dst(res.height + 1, res.width + 1, CV_64FC(10));
+	for (auto _: state)
+	{
+		sse_integral_c10_64f(res.height, res.width, (float*)src.data, (double*)dst.data);
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, 10 * sizeof(float));
+}
+BENCHMARK(integral_c10_64f_sse)->Apply(resolutions_and_simd);
+#endif
+
+// gradients
+
+static void gradient_32f(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	int ch = int(state.range(1));
+	cv::Mat src = random_mat(res, CV_32FC(ch), 0, 255);
+	cv::Mat angle, magnitude, dx, dy;
+	for (auto _: state)
+	{
+		imgproc::gradient(src, angle, magnitude, 3, dx, dy);
+		benchmark::DoNotOptimize(magnitude.data);
+	}
+	set_counters(state, res, ch * sizeof(float));
+}
+BENCHMARK(gradient_32f)->Apply(gradient_args);
+
+static void gradient_32f_opencv(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	cv::Mat src = random_mat(res, CV_32FC1, 0, 255);
+	cv::Mat angle, magnitude, dx, dy;
+	for (auto _: state)
+	{
+		cv::Sobel(src, dx, -1, 1, 0, 3);
+		cv::Sobel(src, dy, -1, 0, 1, 3);
+		cv::cartToPolar(dx, dy, magnitude, angle, true);
+		benchmark::DoNotOptimize(magnitude.data);
+	}
+	set_counters(state, res, sizeof(float));
+}
+BENCHMARK(gradient_32f_opencv)->Apply(all_resolutions);
+
+static void gradient2_8u(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	cv::Mat src = random_mat(res, CV_8UC1, 0, 256);
+	cv::Mat angle, magnitude;
+	for (auto _: state)
+	{
+		imgproc::gradient2(src, angle, magnitude);
+		benchmark::DoNotOptimize(magnitude.data);
+	}
+	set_counters(state, res, 1);
+}
+BENCHMARK(gradient2_8u)->Apply(all_resolutions);
+
+// magnitude and angle from precomputed derivatives
+static void polar_scalar(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	cv::Mat dx = random_mat(res, CV_32FC1, -255, 255);
+	cv::Mat dy = random_mat(res, CV_32FC1, -255, 255);
+	cv::Mat angle(dx.size(), CV_32FC1), magnitude(dx.size(), CV_32FC1);
+	const int len = res.width * res.height;
+	for (auto _: state)
+	{
+		const float *px = (const float*)dx.data;
+		const float *py = (const float*)dy.data;
+		float *pa = (float*)angle.data;
+		float *pm = (float*)magnitude.data;
+		for (int i = 0; i < len; ++i)
+		{
+			pm[i] = std::sqrt(px[i] * px[i] + py[i] * py[i]);
+			float a = std::atan2(py[i], px[i]) * float(180.0 / CV_PI);
+			pa[i] = a < 0 ? a + 180.0f : (a >= 180.0f ? a - 180.0f : a);
+		}
+		benchmark::DoNotOptimize(pm);
+	}
+	set_counters(state, res, 2 * sizeof(float));
+}
+BENCHMARK(polar_scalar)->Apply(all_resolutions);
+
+static void polar_opencv(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	cv::Mat dx = random_mat(res, CV_32FC1, -255, 255);
+	cv::Mat dy = random_mat(res, CV_32FC1, -255, 255);
+	cv::Mat angle, magnitude;
+	for (auto _: state)
+	{
+		cv::cartToPolar(dx, dy, magnitude, angle, true);
+		benchmark::DoNotOptimize(magnitude.data);
+	}
+	set_counters(state, res, 2 * sizeof(float));
+}
+BENCHMARK(polar_opencv)->Apply(all_resolutions);
+
+#ifdef AIFIL_BENCH_SSE
+static void polar_sse(benchmark::State &state)
+{
+	if (!set_simd_level(state))
+		return;
+	const Resolution &res = resolution(state);
+	cv::Mat dx = random_mat(res, CV_32FC1, -255, 255);
+	cv::Mat dy = random_mat(res, CV_32FC1, -255, 255);
+	cv::Mat angle(dx.size(), CV_32FC1), magnitude(dx.size(), CV_32FC1);
+	for (auto _: state)
+	{
+		sse_gradient_c1(res.height, res.width, (float*)dx.data, (float*)dy.data,
+			(float*)angle.data, (float*)magnitude.data);
+		benchmark::DoNotOptimize(magnitude.data);
+	}
+	set_counters(state, res, 2 * sizeof(float));
+}
+BENCHMARK(polar_sse)->Apply(resolutions_and_simd);
+
+static void magnitude_sse(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	cv::Mat dx = random_mat(res, CV_32FC1, -255, 255);
+	cv::Mat dy = random_mat(res, CV_32FC1, -255, 255);
+	cv::Mat magnitude(dx.size(), CV_32FC1);
+	for (auto _: state)
+	{
+		sse_sqrt_sum_of_squares((float*)dx.data, (float*)dy.data, (float*)magnitude.data,
+			uint32_t(res.width * res.height));
+		benchmark::DoNotOptimize(magnitude.data);
+	}
+	set_counters(state, res, 2 * sizeof(float));
+}
+BENCHMARK(magnitude_sse)->Apply(all_resolutions);
+#endif
+
+static void magnitude_opencv(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	cv::Mat dx = random_mat(res, CV_32FC1, -255, 255);
+	cv::Mat dy = random_mat(res, CV_32FC1, -255, 255);
+	cv::Mat magnitude;
+	for (auto _: state)
+	{
+		cv::magnitude(dx, dy, magnitude);
+		benchmark::DoNotOptimize(magnitude.data);
+	}
+	set_counters(state, res, 2 * sizeof(float));
+}
+BENCHMARK(magnitude_opencv)->Apply(all_resolutions);
+
+// histograms of oriented gradients
+
+static void hog_classic(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	const int nbins = 9;
+	const int cell = 8;
+	cv::Mat angle = random_mat(res, CV_32FC1, 0, 179.9);
+	cv::Mat magnitude = random_mat(res, CV_32FC1, 0, 255);
+	cv::Mat dst(res.height / cell, res.width / cell, CV_32FC(nbins * 3 + 4));
+	cv::Mat cn, ca;
+	for (auto _: state)
+	{
+		imgproc::hog_classic(angle, magnitude, dst, nbins, cell, cell, cn, ca);
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, 2 * sizeof(float));
+}
+BENCHMARK(hog_classic)->Apply(all_resolutions);
+
+static void hog_kernel(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	cv::Mat angle = random_mat(res, CV_32FC1, 0, 179.9);
+	cv::Mat magnitude = random_mat(res, CV_32FC1, 0, 255);
+	cv::Mat dst(res.height, res.width, CV_32FC(9));
+	for (auto _: state)
+	{
+		imgproc::hog_kernel(angle, magnitude, dst, 0);
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, 2 * sizeof(float));
+}
+BENCHMARK(hog_kernel)->Apply(small_resolutions);
+
+// quantization
+
+static void quantize_soft_32f(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	const int nbins = 6;
+	cv::Mat angle = random_mat(res, CV_32FC1, 0, 179.9);
+	cv::Mat magnitude = random_mat(res, CV_32FC1, 0, 255);
+	cv::Mat dst(res.height, res.width, CV_32FC(nbins + 1));
+	for (auto _: state)
+	{
+		imgproc::quantize_soft_32f(angle, magnitude, dst, nbins, 0, 0, 180);
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, 2 * sizeof(float));
+}
+BENCHMARK(quantize_soft_32f)->Apply(all_resolutions);
+
+static void quantize_soft_8u(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	const int nbins = 6;
+	cv::Mat angle = random_mat(res, CV_32FC1, 0, 179.9);
+	cv::Mat magnitude = random_mat(res, CV_32FC1, 0, 255);
+	cv::Mat dst(res.height, res.width, CV_8UC(nbins + 1));
+	for (auto _: state)
+	{
+		imgproc::quantize_soft_8u(angle, magnitude, dst, nbins, 0, 0, 180);
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, 2 * sizeof(float));
+}
+BENCHMARK(quantize_soft_8u)->Apply(all_resolutions);
+
+// colorspaces
+
+static void rgb_from_yuv(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	cv::Mat y = random_mat(res, CV_8UC1, 0, 256);
+	Resolution half = {res.name, res.width / 2, res.height / 2};
+	cv::Mat u = random_mat(half, CV_8UC1, 0, 256);
+	cv::Mat v = random_mat(half, CV_8UC1, 0, 256);
+	cv::Mat rgb;
+	for (auto _: state)
+	{
+		imgproc::rgb_from_yuv(y, u, v, rgb);
+		benchmark::DoNotOptimize(rgb.data);
+	}
+	set_counters(state, res, 3);
+}
+BENCHMARK(rgb_from_yuv)->Apply(all_resolutions);
+
+static void rgb_from_yuv_opencv(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	Resolution planes = {res.name, res.width, res.height * 3 / 2};
+	cv::Mat i420 = random_mat(planes, CV_8UC1, 0, 256);
+	cv::Mat rgb;
+	for (auto _: state)
+	{
+		cv::cvtColor(i420, rgb, cv::COLOR_YUV2RGB_I420);
+		benchmark::DoNotOptimize(rgb.data);
+	}
+	set_counters(state, res, 3);
+}
+BENCHMARK(rgb_from_yuv_opencv)->Apply(all_resolutions);
+
+// median filters, kernel size is the second argument
+
+static void median_args(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({"res", "ksize"});
+	for (int r = 0; r < resolutions_count - 1; ++r)
+	{
+		b->Args({r, 3});
+		b->Args({r, 5});
+	}
+}
+
+static void filter_median(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	int ksize = int(state.range(1));
+	cv::Mat src = random_mat(res, CV_8UC1, 0, 256);
+	for (auto _: state)
+	{
+		cv::Mat dst = imgproc::filter_median(src, cv::Size(ksize, ksize));
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, 1);
+}
+BENCHMARK(filter_median)->Apply(median_args)->Unit(benchmark::kMillisecond);
+
+static void filter_median_opencv(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	int ksize = int(state.range(1));
+	cv::Mat src = random_mat(res, CV_8UC1, 0, 256);
+	cv::Mat dst;
+	for (auto _: state)
+	{
+		cv::medianBlur(src, dst, ksize);
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, 1);
+}
+BENCHMARK(filter_median_opencv)->Apply(median_args)->Unit(benchmark::kMillisecond);
+
+// generic path: float image, windows medianBlur does not support
+static void filter_median_32f(benchmark::State &state)
+{
+	const Resolution &res = resolution(state);
+	int kw = int(state.range(1));
+	int kh = int(state.range(2));
+	cv::Mat src = random_mat(res, CV_32FC1, 0, 255);
+	for (auto _: state)
+	{
+		cv::Mat dst = imgproc::filter_median(src, cv::Size(kw, kh));
+		benchmark::DoNotOptimize(dst.data);
+	}
+	set_counters(state, res, sizeof(float));
+}
+BENCHMARK(filter_median_32f)->ArgNames({"res", "kw", "kh"})
+	->Args({0, 7, 7})->Args({0, 5, 3})->Args({1, 7, 7})->Args({1, 5, 3})
+	->Unit(benchmark::kMillisecond);
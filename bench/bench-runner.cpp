@@ -0,0 +1,254 @@
+//
+// Benchmark harness: runs registered cases with warmup and repetitions,
+// prints median and MAD (median absolute deviation) of per-call time.
+//
+#include "bench-runner.hpp"
+
+#include "common/errutils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace aifil {
+namespace bench {
+
+std::vector<BenchCase>& bench_registry()
+{
+	static std::vector<BenchCase> registry;
+	return registry;
+}
+
+static bool pin_current_thread(int cpu)
+{
+	int cpus = std::max(1u, std::thread::hardware_concurrency());
+	cpu %= cpus;
+#ifdef _WIN32
+	return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)cpu;
+	return false;
+#endif
+}
+
+// every worker takes exactly one task: tasks do not finish until all started
+static void pin_pool(ThreadPool &pool, int first_cpu)
+{
+	std::mutex mutex;
+	std::condition_variable cond;
+	int started = 0;
+	int finished = 0;
+	for (int i = 0; i < pool.size(); ++i)
+	{
+		pool.submit([&]() {
+			std::unique_lock<std::mutex> lock(mutex);
+			int index = started++;
+			if (!pin_current_thread(first_cpu + 1 + index))
+				log_warning("cannot pin worker thread to CPU %d", first_cpu + 1 + index);
+			cond.notify_all();
+			cond.wait(lock, [&]() { return started == pool.size(); });
+			++finished;
+			cond.notify_all();
+		});
+	}
+	std::unique_lock<std::mutex> lock(mutex);
+	cond.wait(lock, [&]() { return finished == pool.size(); });
+}
+
+struct Stats
+{
+	double median;
+	double mad;
+	double min;
+	double mean;
+};
+
+static double median_of(std::vector<double> values)
+{
+	size_t half = values.size() / 2;
+	std::nth_element(values.begin(), values.begin() + half, values.end());
+	double m = values[half];
+	if (values.size() % 2 == 0)
+		m = (m + *std::max_element(values.begin(), values.begin() + half)) / 2;
+	return m;
+}
+
+static Stats statistics(const std::vector<double> &samples)
+{
+	Stats st;
+	st.median = median_of(samples);
+	std::vector<double> deviations;
+	for (double s: samples)
+		deviations.push_back(std::fabs(s - st.median));
+	st.mad = median_of(deviations);
+	st.min = *std::min_element(samples.begin(), samples.end());
+	st.mean = 0;
+	for (double s: samples)
+		st.mean += s;
+	st.mean /= samples.size();
+	return st;
+}
+
+// human readable time, value in nanoseconds
+static std::string time_to_string(double ns)
+{
+	char buf[32];
+	if (ns < 1e3)
+		snprintf(buf, sizeof(buf), "%.1lf ns", ns);
+	else if (ns < 1e6)
+		snprintf(buf, sizeof(buf), "%.2lf us", ns * 1e-3);
+	else if (ns < 1e9)
+		snprintf(buf, sizeof(buf), "%.2lf ms", ns * 1e-6);
+	else
+		snprintf(buf, sizeof(buf), "%.2lf s", ns * 1e-9);
+	return buf;
+}
+
+static void usage(const char *app)
+{
+	printf("Usage: %s [options] [case-filter]\n"
+		"  --threads N      worker threads in pool (0 = all cores)\n"
+		"  --iterations N   measured calls per repetition\n"
+		"  --warmup N       not measured calls before repetitions\n"
+		"  --repetitions N  samples for median/MAD\n"
+		"  --size N         problem size for cases\n"
+		"  --pin CPU        pin main thread to CPU, workers to the following CPUs\n"
+		"  --list           list registered cases\n", app);
+}
+
+static int run(int argc, char *argv[])
+{
+	ArgParser args;
+	args.parse_args(argc, argv);
+	if (args.has_param("help") || args.has_param("h"))
+	{
+		usage(argv[0]);
+		return 0;
+	}
+
+	std::vector<BenchCase> &registry = bench_registry();
+	std::sort(registry.begin(), registry.end(),
+		[](const BenchCase &a, const BenchCase &b) { return a.name < b.name; });
+	if (args.get_bool("list"))
+	{
+		for (const auto &c: registry)
+			printf("%s\n", c.name.c_str());
+		return 0;
+	}
+
+	BenchOptions opt;
+	opt.threads = std::max(0, args.get_int("threads", opt.threads));
+	opt.iterations = std::max(1, args.get_int("iterations", opt.iterations));
+	opt.warmup = std::max(0, args.get_int("warmup", opt.warmup));
+	opt.repetitions = std::max(1, args.get_int("repetitions", opt.repetitions));
+	opt.size = std::max<int64_t>(1, int64_t(args.get_double("size", double(opt.size))));
+	opt.pin_cpu = args.get_int("pin", opt.pin_cpu);
+	opt.filter = args.get_string("filter", args.positional.empty() ? "" : args.positional[0]);
+
+	std::vector<const BenchCase*> cases;
+	for (const auto &c: registry)
+		if (c.name.find(opt.filter) != std::string::npos)
+			cases.push_back(&c);
+	if (cases.empty())
+	{
+		log_error("no benchmark cases match '%s'", opt.filter.c_str());
+		return 1;
+	}
+
+	ThreadPool pool(opt.threads);
+	if (opt.pin_cpu >= 0)
+	{
+		if (!pin_current_thread(opt.pin_cpu))
+			log_warning("cannot pin main thread to CPU %d", opt.pin_cpu);
+		pin_pool(pool, opt.pin_cpu);
+	}
+
+	printf("threads %d, size %lld, %d x %d iterations, warmup %d\n",
+		pool.size(), (long long)opt.size, opt.repetitions, opt.iterations, opt.warmup);
+
+	struct Result
+	{
+		std::string name;
+		Stats stats;
+		int64_t items;
+	};
+	std::vector<Result> results;
+	{
+		int64_t calls_per_case = opt.warmup + int64_t(opt.repetitions) * opt.iterations;
+		ProgressMeter progress(calls_per_case * int64_t(cases.size()), "benchmarks");
+		for (const BenchCase *c: cases)
+		{
+			BenchContext ctx(opt, pool);
+			BenchBody body = c->factory(ctx);
+			for (int i = 0; i < opt.warmup; ++i)
+			{
+				body();
+				progress.add();
+			}
+
+			std::vector<double> samples;
+			for (int r = 0; r < opt.repetitions; ++r)
+			{
+				auto start = std::chrono::steady_clock::now();
+				for (int i = 0; i < opt.iterations; ++i)
+					body();
+				auto stop = std::chrono::steady_clock::now();
+				samples.push_back(std::chrono::duration<double, std::nano>(stop - start).count()
+					/ opt.iterations);
+				progress.add(opt.iterations);
+			}
+			results.push_back(Result{c->name, statistics(samples), ctx.items_per_iteration});
+		}
+	}
+
+	printf("%-40s %12s %12s %12s %12s %14s\n",
+		"case", "median", "MAD", "min", "mean", "items/s");
+	for (const auto &r: results)
+	{
+		std::string rate = "-";
+		if (r.items > 0 && r.stats.median > 0)
+		{
+			double per_second = r.items * 1e9 / r.stats.median;
+			const char *suffix[] = {"", "k", "M", "G", "T"};
+			int k = 0;
+			while (per_second >= 1000 && k < 4)
+			{
+				per_second /= 1000;
+				++k;
+			}
+			char buf[32];
+			snprintf(buf, sizeof(buf), "%.2lf%s", per_second, suffix[k]);
+			rate = buf;
+		}
+		printf("%-40s %12s %12s %12s %12s %14s\n", r.name.c_str(),
+			time_to_string(r.stats.median).c_str(), time_to_string(r.stats.mad).c_str(),
+			time_to_string(r.stats.min).c_str(), time_to_string(r.stats.mean).c_str(),
+			rate.c_str());
+	}
+	return 0;
+}
+
+}  // namespace bench
+}  // namespace aifil
+
+int main(int argc, char *argv[])
+{
+	return aifil::bench::run(argc, argv);
+}
@@ -0,0 +1,98 @@
+#ifndef AIFIL_BENCH_RUNNER_H
+#define AIFIL_BENCH_RUNNER_H
+
+#include "common/console.hpp"
+#include "common/thread-pool.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace aifil {
+namespace bench {
+
+struct BenchOptions
+{
+	BenchOptions():
+		threads(0), iterations(10), warmup(2), repetitions(5),
+		size(1 << 20), pin_cpu(-1) {}
+
+	int threads;       // worker threads in pool, 0 = hardware concurrency
+	int iterations;    // measured calls per repetition
+	int warmup;        // not measured calls before repetitions
+	int repetitions;   // samples for median/MAD
+	int64_t size;      // problem size, meaning is defined by the case
+	int pin_cpu;       // first CPU to pin threads to, -1 = no pinning
+	std::string filter;
+};
+
+class BenchContext
+{
+public:
+	BenchContext(const BenchOptions &options, ThreadPool &pool):
+		options(options), items_per_iteration(0), thread_pool(pool) {}
+
+	ThreadPool& pool() { return thread_pool; }
+	int64_t size() const { return options.size; }
+
+	const BenchOptions &options;
+	// items processed by one call, enables items/s column
+	int64_t items_per_iteration;
+
+private:
+	ThreadPool &thread_pool;
+};
+
+typedef std::function<void()> BenchBody;
+// prepares data and returns the measured body
+typedef std::function<BenchBody(BenchContext&)> BenchFactory;
+
+struct BenchCase
+{
+	std::string name;
+	BenchFactory factory;
+};
+
+std::vector<BenchCase>& bench_registry();
+
+struct BenchRegistrar
+{
+	BenchRegistrar(const char *name, BenchFactory factory)
+	{
+		bench_registry().push_back(BenchCase{name, factory});
+	}
+};
+
+// keep result alive, so that compiler does not drop the computation
+template <typename T>
+inline void keep(const T &value)
+{
+#ifdef _MSC_VER
+	static volatile const void *sink;
+	sink = &value;
+#else
+	asm volatile("" : : "g"(&value) : "memory");
+#endif
+}
+
+}  // namespace bench
+}  // namespace aifil
+
+/**
+ * Register benchmark case:
+ * @code
+ * AIFIL_BENCH(line_count)(aifil::bench::BenchContext &ctx)
+ * {
+ *     std::shared_ptr<std::string> data = ...;  // setup, not measured
+ *     ctx.items_per_iteration = data->size();
+ *     return [data]() { aifil::bench::keep(aifil::line_count(data->data(), data->size())); };
+ * }
+ * @endcode
+ */
+#define AIFIL_BENCH(name) \
+	static aifil::bench::BenchBody bench_##name(aifil::bench::BenchContext&); \
+	static aifil::bench::BenchRegistrar bench_registrar_##name(#name, bench_##name); \
+	static aifil::bench::BenchBody bench_##name
+
+#endif  // AIFIL_BENCH_RUNNER_H
@@ -0,0 +1,238 @@
+//
+// Micro-benchmarks: allocating string helpers vs. slice-based counterparts.
+//
+#include "common/stringutils.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <codecvt>
+#include <cstdio>
+#include <locale>
+#include <string>
+#include <vector>
+
+static const std::string csv_line =
+		"2017-04-09 12:00:00,camera-01,person,0.981,120,64,48,96,"
+		"2017-04-09 12:00:01,camera-02,car,0.774,320,240,128,64";
+
+static const std::string http_request =
+		"POST /api/v1/events?camera=1&zone=3 HTTP/1.1\r\n"
+		"Host: localhost:8080\r\nContent-Length: 32\r\n\r\n"
+		"camera=1&zone=3&event=intrusion";
+
+static void split_char_vector(benchmark::State &state)
+{
+	for (auto _: state)
+	{
+		std::vector<std::string> tokens = aifil::split(csv_line, ',');
+		benchmark::DoNotOptimize(tokens.data());
+	}
+}
+BENCHMARK(split_char_vector);
+
+static void split_char_slices(benchmark::State &state)
+{
+	for (auto _: state)
+	{
+		size_t total = 0;
+		for (const auto &token: aifil::split_slices(csv_line, ','))
+			total += token.size();
+		benchmark::DoNotOptimize(total);
+	}
+}
+BENCHMARK(split_char_slices);
+
+static void split_any_of_vector(benchmark::State &state)
+{
+	for (auto _: state)
+	{
+		std::vector<std::string> tokens = aifil::split(csv_line, std::string(", :"));
+		benchmark::DoNotOptimize(tokens.data());
+	}
+}
+BENCHMARK(split_any_of_vector);
+
+static void split_any_of_slices(benchmark::State &state)
+{
+	std::vector<aifil::StringSlice> tokens;
+	for (auto _: state)
+	{
+		aifil::split_slices(csv_line, ", :").to_vector(tokens);
+		benchmark::DoNotOptimize(tokens.data());
+	}
+}
+BENCHMARK(split_any_of_slices);
+
+static void split_substr_vector(benchmark::State &state)
+{
+	for (auto _: state)
+	{
+		std::vector<std::string> tokens = aifil::split_by_substr(http_request, "\r\n");
+		benchmark::DoNotOptimize(tokens.data());
+	}
+}
+BENCHMARK(split_substr_vector);
+
+static void split_substr_slices(benchmark::State &state)
+{
+	for (auto _: state)
+	{
+		size_t total = 0;
+		for (const auto &token: aifil::split_slices_by_substr(http_request, "\r\n"))
+			total += token.size();
+		benchmark::DoNotOptimize(total);
+	}
+}
+BENCHMARK(split_substr_slices);
+
+static void stdprintf_return(benchmark::State &state)
+{
+	int counter = 0;
+	for (auto _: state)
+	{
+		std::string res = aifil::stdprintf("frame %d: %s %.2f", ++counter, "person", 0.981);
+		benchmark::DoNotOptimize(res.data());
+	}
+}
+BENCHMARK(stdprintf_return);
+
+static void stdprintf_reuse(benchmark::State &state)
+{
+	int counter = 0;
+	std::string res;
+	for (auto _: state)
+	{
+		aifil::stdprintf(res, "frame %d: %s %.2f", ++counter, "person", 0.981);
+		benchmark::DoNotOptimize(res.data());
+	}
+}
+BENCHMARK(stdprintf_reuse);
+
+static void format_buffer(benchmark::State &state)
+{
+	int counter = 0;
+	aifil::FormatBuffer buf;
+	for (auto _: state)
+	{
+		buf.printf("frame %d: %s %.2f", ++counter, "person", 0.981);
+		benchmark::DoNotOptimize(buf.c_str());
+	}
+}
+BENCHMARK(format_buffer);
+
+static void int_snprintf(benchmark::State &state)
+{
+	char buf[32];
+	int64_t v = 1234567890123LL;
+	for (auto _: state)
+	{
+		snprintf(buf, sizeof(buf), "%ld", long(++v));
+		benchmark::DoNotOptimize(buf);
+	}
+}
+BENCHMARK(int_snprintf);
+
+static void int_to_chars(benchmark::State &state)
+{
+	char buf[32];
+	int64_t v = 1234567890123LL;
+	for (auto _: state)
+	{
+		aifil::to_chars(buf, buf + sizeof(buf), ++v);
+		benchmark::DoNotOptimize(buf);
+	}
+}
+BENCHMARK(int_to_chars);
+
+static void float_snprintf(benchmark::State &state)
+{
+	char buf[32];
+	double v = 0.0;
+	for (auto _: state)
+	{
+		v += 0.37;
+		snprintf(buf, sizeof(buf), "%.2f", v);
+		benchmark::DoNotOptimize(buf);
+	}
+}
+BENCHMARK(float_snprintf);
+
+static void float_to_chars(benchmark::State &state)
+{
+	char buf[32];
+	double v = 0.0;
+	for (auto _: state)
+	{
+		v += 0.37;
+		aifil::to_chars(buf, buf + sizeof(buf), v, 2);
+		benchmark::DoNotOptimize(buf);
+	}
+}
+BENCHMARK(float_to_chars);
+
+static std::string osd_text()
+{
+	std::string res;
+	for (int i = 0; i < 64; ++i)
+		res += "Camera 01 / \xd0\x9a\xd0\xb0\xd0\xbc\xd0\xb5\xd1\x80\xd0\xb0 entrance, ";
+	return res;
+}
+
+static void utf8_decode_codecvt(benchmark::State &state)
+{
+	const std::string text = osd_text();
+	std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> convert;
+	for (auto _: state)
+	{
+		std::u16string res = convert.from_bytes(text);
+		benchmark::DoNotOptimize(res.data());
+	}
+	state.SetBytesProcessed(int64_t(state.iterations()) * text.size());
+}
+BENCHMARK(utf8_decode_codecvt);
+
+static void utf8_decode(benchmark::State &state)
+{
+	const std::string text = osd_text();
+	aifil::utf8::string res;
+	for (auto _: state)
+	{
+		aifil::utf8::decode(text, res);
+		benchmark::DoNotOptimize(res.data());
+	}
+	state.SetBytesProcessed(int64_t(state.iterations()) * text.size());
+}
+BENCHMARK(utf8_decode);
+
+static void utf8_encode_codecvt(benchmark::State &state)
+{
+	std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> convert;
+	const std::u16string text = convert.from_bytes(osd_text());
+	for (auto _: state)
+	{
+		std::string res = convert.to_bytes(text);
+		benchmark::DoNotOptimize(res.data());
+	}
+}
+BENCHMARK(utf8_encode_codecvt);
+
+static void utf8_encode(benchmark::State &state)
+{
+	const aifil::utf8::string text = aifil::utf8::decode(osd_text());
+	std::string res;
+	for (auto _: state)
+	{
+		aifil::utf8::encode(text, res);
+		benchmark::DoNotOptimize(res.data());
+	}
+}
+BENCHMARK(utf8_encode);
+
+static void utf8_validate(benchmark::State &state)
+{
+	const std::string text = osd_text();
+	for (auto _: state)
+		benchmark::DoNotOptimize(aifil::utf8::validate(text));
+	state.SetBytesProcessed(int64_t(state.iterations()) * text.size());
+}
+BENCHMARK(utf8_validate);
@@ -0,0 +1,168 @@
+//
+// Datetime parsing/formatting: boost and strftime based code vs. hand-written one.
+//
+#include "common/timeutils.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <boost/date_time.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// previous parse_datetime() implementation
+static bool parse_datetime_boost(const std::string &datetime, int64_t &utc)
+{
+	utc = 0;
+	try
+	{
+		std::stringstream ss(datetime);
+		ss.imbue(std::locale(ss.getloc(),
+			new boost::local_time::local_time_input_facet("%Y-%m-%d %H:%M:%S%F %ZP")));
+		boost::local_time::local_date_time ldt(boost::local_time::not_a_date_time);
+		if (!(ss >> ldt))
+			return false;
+		boost::posix_time::ptime const epoch(boost::gregorian::date(1970, 1, 1));
+		utc = (ldt.utc_time() - epoch).total_milliseconds();
+	}
+	catch (...)
+	{
+		return false;
+	}
+	return true;
+}
+
+// regular API events with some broken and irregular strings
+static std::vector<std::string> datetime_corpus(size_t count, bool damaged)
+{
+	static const char *zones[] = {
+		"", "Z", "+05", "-03:30", "+14", "-12", "+14:00", "-12:00", "+12:45",
+		"+00", "-00:00", "+14:01", "-13", "+130", "+0130", "+5", "+05:3", " +05"};
+	static const char *fractions[] = {
+		"", ".5", ".123", ".123456", ".1234567", ".123456789", ".0000005", "."};
+	const int zones_count = sizeof(zones) / sizeof(zones[0]);
+	const int fractions_count = sizeof(fractions) / sizeof(fractions[0]);
+
+	std::mt19937 rng(2017);
+	std::vector<std::string> res;
+	char buf[80];
+	for (size_t i = 0; i < count; ++i)
+	{
+		bool regular = !damaged || rng() % 3;
+		int year = regular ? 1970 + rng() % 80 : 1390 + rng() % 700;
+		int month = regular ? 1 + rng() % 12 : rng() % 14;
+		int day = regular ? 1 + rng() % 28 : rng() % 33;
+		int hour = regular ? rng() % 24 : rng() % 26;
+		int minute = regular ? rng() % 60 : rng() % 62;
+		int second = regular ? rng() % 60 : rng() % 62;
+		snprintf(buf, sizeof(buf), "%04d-%02d-%02d%c%02d:%02d:%02d%s%s",
+			year, month, day, rng() % 2 ? ' ' : 'T', hour, minute, second,
+			fractions[rng() % (damaged ? fractions_count : 4)],
+			zones[rng() % (damaged ? zones_count : 4)]);
+		std::string s = buf;
+		if (damaged && rng() % 10 == 0)
+			s[rng() % s.size()] = " 0123456789-:+T.Zx"[rng() % 18];
+		if (damaged && rng() % 20 == 0)
+			s.resize(rng() % s.size());
+		res.push_back(s);
+	}
+	return res;
+}
+
+// fails if any result differs from boost
+static void datetime_parse_equivalence(benchmark::State &state)
+{
+	const std::vector<std::string> corpus = datetime_corpus(200000, true);
+	int64_t mismatches = 0;
+	int64_t accepted = 0;
+	for (auto _: state)
+	{
+		mismatches = 0;
+		accepted = 0;
+		for (const auto &s: corpus)
+		{
+			int64_t expected, actual;
+			bool expected_ok = parse_datetime_boost(s, expected);
+			bool actual_ok = aifil::parse_datetime(s.data(), s.size(), actual);
+			if (expected_ok != actual_ok || expected != actual)
+				++mismatches;
+			accepted += actual_ok;
+		}
+	}
+	state.counters["strings"] = double(corpus.size());
+	state.counters["accepted"] = double(accepted);
+	state.counters["mismatches"] = double(mismatches);
+	if (mismatches)
+		state.SkipWithError("parse_datetime() differs from boost");
+}
+BENCHMARK(datetime_parse_equivalence)->Iterations(1)->Unit(benchmark::kMillisecond);
+
+static void datetime_parse_boost(benchmark::State &state)
+{
+	const std::vector<std::string> corpus = datetime_corpus(1024, false);
+	size_t i = 0;
+	for (auto _: state)
+	{
+		int64_t utc;
+		benchmark::DoNotOptimize(parse_datetime_boost(corpus[i++ & 1023], utc));
+		benchmark::DoNotOptimize(utc);
+	}
+}
+BENCHMARK(datetime_parse_boost);
+
+static void datetime_parse(benchmark::State &state)
+{
+	const std::vector<std::string> corpus = datetime_corpus(1024, false);
+	size_t i = 0;
+	for (auto _: state)
+	{
+		const std::string &s = corpus[i++ & 1023];
+		int64_t utc;
+		benchmark::DoNotOptimize(aifil::parse_datetime(s.data(), s.size(), utc));
+		benchmark::DoNotOptimize(utc);
+	}
+}
+BENCHMARK(datetime_parse);
+
+static void datetime_format_strftime(benchmark::State &state)
+{
+	int64_t ts = 1491739200000LL;
+	char buf[64];
+	for (auto _: state)
+	{
+		ts += 7;
+		time_t sec = time_t(ts / 1000);
+		size_t len = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&sec));
+		snprintf(buf + len, sizeof(buf) - len, ".%03d", int(ts % 1000));
+		benchmark::DoNotOptimize(buf);
+	}
+}
+BENCHMARK(datetime_format_strftime);
+
+static void datetime_format(benchmark::State &state)
+{
+	int64_t ts = 1491739200000LL;
+	char buf[64];
+	for (auto _: state)
+	{
+		ts += 7;
+		benchmark::DoNotOptimize(aifil::format_datetime(buf, buf + sizeof(buf), ts, 180));
+	}
+}
+BENCHMARK(datetime_format);
+
+static void datetime_format_cached(benchmark::State &state)
+{
+	int64_t ts = 1491739200000LL;
+	aifil::TimestampFormatter formatter;
+	for (auto _: state)
+	{
+		ts += 7;
+		benchmark::DoNotOptimize(formatter.format(ts));
+	}
+}
+BENCHMARK(datetime_format_cached);
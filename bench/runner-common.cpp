@@ -0,0 +1,102 @@
+//
+// bench-runner cases for common/ helpers, sizes are taken from --size.
+//
+#include "bench-runner.hpp"
+
+#include "common/adjacency-matrix.h"
+#include "common/fileutils.hpp"
+#include "common/stringutils.hpp"
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using aifil::bench::BenchBody;
+using aifil::bench::BenchContext;
+
+// text of short lines, about ctx.size() bytes
+static std::shared_ptr<std::string> make_text(int64_t size)
+{
+	std::shared_ptr<std::string> text(new std::string);
+	text->reserve(size_t(size) + 64);
+	std::mt19937 rng(2017);
+	while (int64_t(text->size()) < size)
+	{
+		int len = 8 + rng() % 72;
+		for (int i = 0; i < len; ++i)
+			*text += char(rng() % 4 ? 'a' + rng() % 26 : ',');
+		*text += '\n';
+	}
+	return text;
+}
+
+AIFIL_BENCH(line_count)(BenchContext &ctx)
+{
+	auto text = make_text(ctx.size());
+	ctx.items_per_iteration = text->size();
+	return [text]() {
+		aifil::bench::keep(aifil::line_count(text->data(), text->size()));
+	};
+}
+
+AIFIL_BENCH(line_count_parallel)(BenchContext &ctx)
+{
+	auto text = make_text(ctx.size());
+	ctx.items_per_iteration = text->size();
+	aifil::ThreadPool *pool = &ctx.pool();
+	return [text, pool]() {
+		std::atomic<size_t> lines(0);
+		aifil::parallel_for(0, int((text->size() + 65535) / 65536), [&](int begin, int end) {
+			size_t from = size_t(begin) * 65536;
+			size_t to = std::min(text->size(), size_t(end) * 65536);
+			lines += aifil::line_count(text->data() + from, to - from);
+		}, 1, *pool);
+		aifil::bench::keep(lines);
+	};
+}
+
+AIFIL_BENCH(split_slices)(BenchContext &ctx)
+{
+	auto text = make_text(ctx.size());
+	ctx.items_per_iteration = text->size();
+	return [text]() {
+		size_t tokens = 0;
+		for (const auto &token: aifil::split_slices(*text, ','))
+			tokens += !token.empty();
+		aifil::bench::keep(tokens);
+	};
+}
+
+AIFIL_BENCH(utf8_validate)(BenchContext &ctx)
+{
+	auto text = make_text(ctx.size());
+	ctx.items_per_iteration = text->size();
+	return [text]() {
+		aifil::bench::keep(aifil::utf8::validate(text->data(), text->size()));
+	};
+}
+
+// confusion matrix accumulation from all pool threads
+AIFIL_BENCH(adjacency_sharded)(BenchContext &ctx)
+{
+	std::vector<std::string> names;
+	for (int i = 0; i < 64; ++i)
+		names.push_back("class-" + std::to_string(i));
+	std::shared_ptr<std::vector<int> > ids(new std::vector<int>(size_t(ctx.size())));
+	std::mt19937 rng(2017);
+	for (auto &id: *ids)
+		id = rng() % (64 * 64);
+	ctx.items_per_iteration = ids->size();
+	aifil::ThreadPool *pool = &ctx.pool();
+	return [names, ids, pool]() {
+		ShardedAdjacencyMatrix acc(names);
+		aifil::parallel_for(0, int(ids->size()), [&](int begin, int end) {
+			AdjacencyMatrix &m = acc.local();
+			for (int i = begin; i < end; ++i)
+				m.at((*ids)[i] >> 6, (*ids)[i] & 63) += 1;
+		}, 4096, *pool);
+		AdjacencyMatrix res = acc.merge(*pool);
+		aifil::bench::keep(res);
+	};
+}
@@ -6,6 +6,68 @@
 #include "errutils.hpp"
 #include "stringutils.hpp"
 
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define AIFIL_MATRIX_SSE2
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// dst[i] += src[i]
+static void add_arrays(double *dst, const double *src, size_t n)
+{
+	size_t i = 0;
+#if defined(__AVX__)
+	for (; i + 8 <= n; i += 8)
+	{
+		_mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(dst + i), _mm256_loadu_pd(src + i)));
+		_mm256_storeu_pd(dst + i + 4,
+			_mm256_add_pd(_mm256_loadu_pd(dst + i + 4), _mm256_loadu_pd(src + i + 4)));
+	}
+#endif
+#ifdef AIFIL_MATRIX_SSE2
+	for (; i + 2 <= n; i += 2)
+		_mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(dst + i), _mm_loadu_pd(src + i)));
+#endif
+	for (; i < n; ++i)
+		dst[i] += src[i];
+}
+
+static double sum_array(const double *src, size_t n)
+{
+	size_t i = 0;
+	double sum = 0;
+#if defined(__AVX__)
+	__m256d acc0 = _mm256_setzero_pd();
+	__m256d acc1 = _mm256_setzero_pd();
+	for (; i + 8 <= n; i += 8)
+	{
+		acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(src + i));
+		acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(src + i + 4));
+	}
+	acc0 = _mm256_add_pd(acc0, acc1);
+	double lanes4[4];
+	_mm256_storeu_pd(lanes4, acc0);
+	sum += (lanes4[0] + lanes4[2]) + (lanes4[1] + lanes4[3]);
+#endif
+#ifdef AIFIL_MATRIX_SSE2
+	__m128d acc = _mm_setzero_pd();
+	for (; i + 2 <= n; i += 2)
+		acc = _mm_add_pd(acc, _mm_loadu_pd(src + i));
+	double lanes[2];
+	_mm_storeu_pd(lanes, acc);
+	sum += lanes[0] + lanes[1];
+#endif
+	for (; i < n; ++i)
+		sum += src[i];
+	return sum;
+}
+
 AdjacencyMatrix::AdjacencyMatrix(const std::vector<std::string> &_vertex_names)
 {
 	init(_vertex_names);
@@ -16,36 +78,52 @@ void  AdjacencyMatrix::init(const std::vector<std::string> &_vertex_names)
 	clear();
 	size = _vertex_names.size();
 	vertex_names = _vertex_names;
-	for (int i = 0; i < size; ++i)
-	{
-		std::vector<Vertex> temp;
-		matr.emplace_back(temp);
-		for (int j = 0; j < size; ++j)
-		{
-			Vertex a(vertex_names[i], vertex_names[j]);
-			matr[i].emplace_back(a);
-		}
-	}
+	y_names = vertex_names;
+	x_names = vertex_names;
+	weights.assign(size_t(size) * size, 0.0);
 	for (int j = 0; j < size; j++)
-		x_vertex_names[matr[0][j].x_vertex] = j;
+		x_vertex_names[x_names[j]] = j;
 	for (int i = 0; i < size; i++)
-		y_vertex_names[matr[i][0].y_vertex] = i;
+		y_vertex_names[y_names[i]] = i;
 	af_assert(x_vertex_names.size() == y_vertex_names.size());
 	af_assert(vertex_names.size() == x_vertex_names.size());
 }
 
+bool AdjacencyMatrix::same_layout(const AdjacencyMatrix &rhs) const
+{
+	return y_names == rhs.y_names && x_names == rhs.x_names;
+}
+
 AdjacencyMatrix& AdjacencyMatrix::operator+= (const AdjacencyMatrix &rhs)
 {
-	if (matr.size() == 0)
-		this->init(rhs.vertex_names);
-	if (matr.size() != rhs.matr.size())
+	if (size == 0)
+		*this = rhs;
+	else if (size != rhs.size)
 		af_exception("AdjacencyMatrix::AdjacencyMatrix::operator+= (const AdjacencyMatrix &rhs) " \
 								   "Different of rhs and *this.");
-	for (const auto &it:rhs.matr)
+	else if (same_layout(rhs))
+		add_arrays(weights.data(), rhs.weights.data(), weights.size());
+	else
 	{
-		for (const auto &jt:it)
+		// rows/columns are ordered differently, remap them once
+		std::vector<int> cols(size);
+		for (int j = 0; j < size; ++j)
 		{
-			find_element(jt.y_vertex, jt.x_vertex).edge_weight += jt.edge_weight;
+			cols[j] = find_x_index(rhs.x_names[j]);
+			if (cols[j] == -1)
+				af_exception("AdjacencyMatrix::operator+=: " \
+						 "Incorrect pattern-id strings in graph.");
+		}
+		for (int i = 0; i < size; ++i)
+		{
+			int y = find_y_index(rhs.y_names[i]);
+			if (y == -1)
+				af_exception("AdjacencyMatrix::operator+=: " \
+						 "Incorrect pattern-id strings in graph.");
+			double *dst = row(y);
+			const double *src = rhs.row(i);
+			for (int j = 0; j < size; ++j)
+				dst[cols[j]] += src[j];
 		}
 	}
 	return *this;
@@ -53,18 +131,28 @@ AdjacencyMatrix& AdjacencyMatrix::operator+= (const AdjacencyMatrix &rhs)
 
 bool AdjacencyMatrix::operator==(const AdjacencyMatrix &rhs) const
 {
-	if (matr.size() != rhs.matr.size())
+	if (size != rhs.size)
 		return false;
-	for (const auto &it:rhs.matr)
+	if (same_layout(rhs))
+	{
+		// not memcmp: 0.0 == -0.0
+		for (size_t k = 0; k < weights.size(); ++k)
+			if (weights[k] != rhs.weights[k])
+				return false;
+		return true;
+	}
+	for (int i = 0; i < size; ++i)
 	{
-		for (const auto &jt:it)
+		int y = find_y_index(rhs.y_names[i]);
+		if (y == -1)
+			return false;
+		for (int j = 0; j < size; ++j)
 		{
-			int i = find_y_index(jt.y_vertex);
-			int j = find_x_index(jt.x_vertex);
-			if (i == -1 || j == -1)
+			int x = find_x_index(rhs.x_names[j]);
+			if (x == -1)
 				return false;
 
-			if (matr[i][j].edge_weight != jt.edge_weight)
+			if (at(y, x) != rhs.at(i, j))
 				return false;
 		}
 	}
@@ -73,17 +161,17 @@ bool AdjacencyMatrix::operator==(const AdjacencyMatrix &rhs) const
 
 double& AdjacencyMatrix::operator()(const std::string &first_vertex, const std::string &second_vertex)
 {
-	return find_element(first_vertex, second_vertex).edge_weight;
+	return find_element(first_vertex, second_vertex);
 }
 
-Vertex& AdjacencyMatrix::find_element(const std::string &y_vertex, const std::string &x_vertex)
+double& AdjacencyMatrix::find_element(const std::string &y_vertex, const std::string &x_vertex)
 {
 	int i = find_y_index(y_vertex);
 	int j = find_x_index(x_vertex);
 	if (i == -1 || j == -1)
 		af_exception("AdjacencyMatrix::find_element(std::string y_vertex, std::string x_vertex): " \
 						 "Incorrect pattern-id strings in graph.");
-	return matr[i][j];
+	return at(i, j);
 }
 
 int AdjacencyMatrix::find_x_index(const std::string &x_vertex) const
@@ -113,15 +201,36 @@ void AdjacencyMatrix::cout_debug_print()
 		for (int j = 0; j < size; ++j)
 		{
 			std::cout << std::setw(5)
-					  << matr[i][j].y_vertex<< "-"
-					  << matr[i][j].x_vertex << " "
-					  << matr[i][j].edge_weight;
+					  << y_names[i] << "-"
+					  << x_names[j] << " "
+					  << at(i, j);
 		}
 		std::cout << std::endl;
 	}
 }
 
+// same as "%.2lf\t"
+static void append_weight(std::string &dst, double value)
+{
+	char buf[64];
+	char *end = aifil::to_chars(buf, buf + sizeof(buf), value, 2);
+	if (!end)
+	{
+		aifil::stdprintf_append(dst, "%.2lf\t", value);
+		return;
+	}
+	dst.append(buf, end);
+	dst += '\t';
+}
+
 std::string AdjacencyMatrix::result_to_string(bool norm, int width, int height)
+{
+	std::ostringstream out;
+	write_result(out, norm, width, height);
+	return out.str();
+}
+
+void AdjacencyMatrix::write_result(std::ostream &out, bool norm, int width, int height) const
 {
 	if (width < 0 || width > size || height < 0 || height > size)
 		aifil::log_state("AdjacencyMatrix::Incorrect arguments in result_to_string(int width, int height).");
@@ -130,27 +239,81 @@ std::string AdjacencyMatrix::result_to_string(bool norm, int width, int height)
 	if (height <= 0 || height > size)
 		height = size;
 
-	std::string result = "\n\n";
-	result = "\t";
+	// one line buffer reused for all rows
+	std::string line = "\t";
 
-	for (int i = 0; i < int(matr[0].size()); ++i)
-		result += matr[0][i].x_vertex + "\t";
-	result += "\n";
+	for (int i = 0; i < size; ++i)
+		line += x_names[i] + "\t";
+	line += "\n";
+	out << line;
 
 	for (int i = 0; i < height; ++i)
 	{
-		result += matr[i][0].y_vertex + "\t";
-		double sum = sum_x(matr[i][0].y_vertex);
+		line = y_names[i];
+		line += '\t';
+		double sum = sum_row(i);
+		const double *src = row(i);
 		for (int j = 0; j < width; ++j)
 		{
 			if (norm)
-				result += aifil::stdprintf("%.2lf\t", sum ? matr[i][j].edge_weight*100/sum : 0);
+				append_weight(line, sum ? src[j] * 100 / sum : 0);
 			else
-				result += aifil::stdprintf("%.2lf\t", matr[i][j].edge_weight);
+				append_weight(line, src[j]);
 		}
-		result += "\n";
+		line += "\n";
+		out << line;
+	}
+}
+
+// RFC 4180 quoting
+static void append_csv_field(std::string &dst, const std::string &field, char separator)
+{
+	if (field.find_first_of(std::string("\"\r\n") + separator) == std::string::npos)
+	{
+		dst += field;
+		return;
+	}
+	dst += '"';
+	for (char c: field)
+	{
+		if (c == '"')
+			dst += '"';
+		dst += c;
+	}
+	dst += '"';
+}
+
+void AdjacencyMatrix::write_csv(std::ostream &out, bool norm, int precision, char separator) const
+{
+	std::string line;
+	for (int j = 0; j < size; ++j)
+	{
+		line += separator;
+		append_csv_field(line, x_names[j], separator);
+	}
+	line += '\n';
+	out << line;
+
+	char buf[64];
+	for (int i = 0; i < size; ++i)
+	{
+		line.clear();
+		append_csv_field(line, y_names[i], separator);
+		double sum = norm ? sum_row(i) : 0;
+		const double *src = row(i);
+		for (int j = 0; j < size; ++j)
+		{
+			double value = norm ? (sum ? src[j] * 100 / sum : 0) : src[j];
+			line += separator;
+			char *end = aifil::to_chars(buf, buf + sizeof(buf), value, precision);
+			if (end)
+				line.append(buf, end);
+			else
+				aifil::stdprintf_append(line, "%.*f", precision, value);
+		}
+		line += '\n';
+		out << line;
 	}
-	return result;
 }
 
 std::string AdjacencyMatrix::get_row_as_string(const std::string &y_vertex)
@@ -160,17 +323,14 @@ std::string AdjacencyMatrix::get_row_as_string(const std::string &y_vertex)
 		af_exception("AdjacencyMatrix::get_row_as_string(std::string y_vertex): " \
 						 "Incorrect pattern-id string row in graph.");
 
-	std::string result = "\n\n";
-	result = "\t";
+	std::string result = "\t";
 
-	for (int j = 0; j < int(matr[0].size()); j++)
-		result += matr[0][j].x_vertex + "\t";
+	for (int j = 0; j < size; j++)
+		result += x_names[j] + "\t";
 	result += "\n";
-	result += matr[i][0].y_vertex + "\t";
+	result += y_names[i] + "\t";
 	for (int j = 0; j < size; ++j)
-	{
-		result += aifil::stdprintf("%.2lf\t", matr[i][j].edge_weight);
-	}
+		append_weight(result, at(i, j));
 	result += "\n";
 	return result;
 }
@@ -184,12 +344,12 @@ std::string AdjacencyMatrix::get_col_as_string(const std::string &x_vertex)
 
 	std::string result = "\n";
 	result += "\t";
-	result += matr[0][k].x_vertex + "\t";
+	result += x_names[k] + "\t";
 	result += "\n";
 	for (int j = 0; j < size; ++j)
 	{
-		result += matr[j][k].y_vertex + "\t";
-		result += aifil::stdprintf("%.2lf\t", matr[j][k].edge_weight);
+		result += y_names[j] + "\t";
+		append_weight(result, at(j, k));
 		result += "\n";
 	}
 	result += "\n";
@@ -198,54 +358,92 @@ std::string AdjacencyMatrix::get_col_as_string(const std::string &x_vertex)
 
 void AdjacencyMatrix::clear()
 {
-	matr.clear();
+	weights.clear();
 	size = 0;
 	vertex_names.clear();
+	y_names.clear();
+	x_names.clear();
+	x_vertex_names.clear();
+	y_vertex_names.clear();
 }
 
-double AdjacencyMatrix::sum_row(const std::vector<Vertex> &mat_row)
+double AdjacencyMatrix::sum_row(const int i) const
 {
-	double sum = 0;
-	for (const auto &it:mat_row)
-		sum += it.edge_weight;
-	return sum;
+	return sum_array(row(i), size);
 }
 
-double AdjacencyMatrix::sum_column(const int j)
+double AdjacencyMatrix::sum_column(const int j) const
 {
 	double sum = 0;
 	for (auto i = 0; i < size; i++)
-		sum += matr[i][j].edge_weight;
+		sum += at(i, j);
 	return sum;
 }
 
+void AdjacencyMatrix::row_sums(std::vector<double> &sums) const
+{
+	sums.resize(size);
+	for (int i = 0; i < size; ++i)
+		sums[i] = sum_row(i);
+}
+
+void AdjacencyMatrix::column_sums(std::vector<double> &sums) const
+{
+	// row by row accumulation, no strided reads
+	sums.assign(size, 0.0);
+	for (int i = 0; i < size; ++i)
+		add_arrays(sums.data(), row(i), size);
+}
+
 void AdjacencyMatrix::sort_rows()
 {
-	std::sort(matr.begin(), matr.end(), [this](const std::vector<Vertex>&a,
-    const std::vector<Vertex>&b) {return sum_row(a) > sum_row(b); });
+	std::vector<double> sums;
+	row_sums(sums);
+	std::vector<int> order(size);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(),
+		[&sums](int a, int b) { return sums[a] > sums[b]; });
+
+	std::vector<double> sorted(weights.size());
+	std::vector<std::string> names(size);
+	for (int i = 0; i < size; ++i)
+	{
+		std::copy(row(order[i]), row(order[i]) + size, sorted.begin() + size_t(i) * size);
+		names[i] = y_names[order[i]];
+	}
+	weights.swap(sorted);
+	y_names.swap(names);
+
 	y_vertex_names.clear();
 	for (int i = 0; i < size; i++)
-		y_vertex_names[matr[i][0].y_vertex] = i;
+		y_vertex_names[y_names[i]] = i;
 }
 
 void AdjacencyMatrix::sort_columns()
 {
-	bool sorted = false;
-	while (!sorted)
+	std::vector<double> sums;
+	column_sums(sums);
+	std::vector<int> order(size);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(),
+		[&sums](int a, int b) { return sums[a] > sums[b]; });
+
+	std::vector<double> src(size);
+	for (int i = 0; i < size; ++i)
 	{
-		sorted = true;
-		for (int i = 0; i < size-1; i++)
-		{
-			if (sum_column(i) < sum_column(i + 1))
-			{
-				swap_columns(i, i + 1);
-				sorted = false;
-			}
-		}
+		double *dst = row(i);
+		std::copy(dst, dst + size, src.begin());
+		for (int j = 0; j < size; ++j)
+			dst[j] = src[order[j]];
 	}
+	std::vector<std::string> names(size);
+	for (int j = 0; j < size; ++j)
+		names[j] = x_names[order[j]];
+	x_names.swap(names);
+
 	x_vertex_names.clear();
 	for (int j = 0; j < size; j++)
-		x_vertex_names[matr[0][j].x_vertex] = j;
+		x_vertex_names[x_names[j]] = j;
 }
 
 void AdjacencyMatrix::sort()
@@ -254,28 +452,259 @@ void AdjacencyMatrix::sort()
 	sort_columns();
 }
 
-double AdjacencyMatrix::sum()
+double AdjacencyMatrix::sum() const
 {
-	double sum = 0;
-	for (const auto &it:matr)
-		for (const auto &jt:it)
-			sum += jt.edge_weight;
-	return sum;
+	return sum_array(weights.data(), weights.size());
 }
 
-double AdjacencyMatrix::sum_x(std::string y_name)
+double AdjacencyMatrix::sum_x(std::string y_name) const
 {
 	int i = find_y_index(y_name);
-	double sum = 0;
-	for (const auto &jt:matr[i])
-		sum += jt.edge_weight;
-	return sum;
+	if (i == -1)
+		af_exception("AdjacencyMatrix::sum_x(std::string y_name): " \
+						 "Incorrect pattern-id string row in graph.");
+	return sum_row(i);
 }
 
 void AdjacencyMatrix::swap_columns(const int i, const int j)
 {
 	af_assert(i >=0 && i < size && j >=0 && j < size);
 	for (auto k = 0; k < size; k++)
-		std::swap(matr[k][i], matr[k][j]);
+		std::swap(at(k, i), at(k, j));
+	std::swap(x_names[i], x_names[j]);
+	x_vertex_names[x_names[i]] = i;
+	x_vertex_names[x_names[j]] = j;
+}
+
+
+ShardedAdjacencyMatrix::ShardedAdjacencyMatrix(const std::vector<std::string> &_vertex_names):
+	vertex_names(_vertex_names)
+{
+}
+
+AdjacencyMatrix& ShardedAdjacencyMatrix::local()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = owners.find(std::this_thread::get_id());
+	if (it != owners.end())
+		return *shards[it->second];
+	owners[std::this_thread::get_id()] = int(shards.size());
+	shards.emplace_back(new AdjacencyMatrix(vertex_names));
+	return *shards.back();
+}
+
+int ShardedAdjacencyMatrix::shards_count() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return int(shards.size());
+}
+
+AdjacencyMatrix ShardedAdjacencyMatrix::merge(aifil::ThreadPool &pool) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	AdjacencyMatrix res(vertex_names);
+	int size = res.vertex_count();
+	// rows are independent: every chunk sums its rows over all shards
+	aifil::parallel_for(0, size, [&](int begin, int end) {
+		for (const auto &shard: shards)
+			add_arrays(res.row(begin), shard->row(begin), size_t(end - begin) * size);
+	}, std::max(1, 4096 / std::max(1, size)), pool);
+	return res;
+}
+
+void ShardedAdjacencyMatrix::reset()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto &shard: shards)
+		std::fill(shard->weights.begin(), shard->weights.end(), 0.0);
+}
+
+
+SparseAdjacencyMatrix::SparseAdjacencyMatrix(const std::vector<std::string> &_vertex_names)
+{
+	init(_vertex_names);
+}
+
+void SparseAdjacencyMatrix::init(const std::vector<std::string> &_vertex_names)
+{
+	clear();
+	vertex_names = _vertex_names;
+	for (int i = 0; i < int(vertex_names.size()); ++i)
+		ids[vertex_names[i]] = i;
+	af_assert(ids.size() == vertex_names.size());
+}
+
+void SparseAdjacencyMatrix::clear()
+{
+	vertex_names.clear();
+	ids.clear();
+	cells.clear();
+	compressed = false;
+	csr_rows.clear();
+	csr_cols.clear();
+	csr_values.clear();
+}
+
+int SparseAdjacencyMatrix::find_index(const std::string &vertex) const
+{
+	auto it = ids.find(vertex);
+	if (it != ids.end())
+		return it->second;
+	else
+		return -1;
+}
+
+double& SparseAdjacencyMatrix::operator()(const std::string &first_vertex, const std::string &second_vertex)
+{
+	int i = find_index(first_vertex);
+	int j = find_index(second_vertex);
+	if (i == -1 || j == -1)
+		af_exception("SparseAdjacencyMatrix::operator(): " \
+						 "Incorrect pattern-id strings in graph.");
+	return at(i, j);
+}
+
+double& SparseAdjacencyMatrix::at(int y, int x)
+{
+	// returned reference may be modified, CSR copy becomes stale
+	compressed = false;
+	return cells[key(y, x)];
+}
+
+double SparseAdjacencyMatrix::get(int y, int x) const
+{
+	auto it = cells.find(key(y, x));
+	return it != cells.end() ? it->second : 0.0;
+}
+
+SparseAdjacencyMatrix& SparseAdjacencyMatrix::operator+= (const SparseAdjacencyMatrix &rhs)
+{
+	if (vertex_names.empty())
+	{
+		*this = rhs;
+		return *this;
+	}
+	if (vertex_names.size() != rhs.vertex_names.size())
+		af_exception("SparseAdjacencyMatrix::operator+= (const SparseAdjacencyMatrix &rhs) " \
+								   "Different of rhs and *this.");
+	compressed = false;
+	if (vertex_names == rhs.vertex_names)
+	{
+		for (const auto &it: rhs.cells)
+			cells[it.first] += it.second;
+		return *this;
+	}
+	std::vector<int> remap(rhs.vertex_names.size());
+	for (size_t i = 0; i < remap.size(); ++i)
+	{
+		remap[i] = find_index(rhs.vertex_names[i]);
+		if (remap[i] == -1)
+			af_exception("SparseAdjacencyMatrix::operator+=: " \
+					 "Incorrect pattern-id strings in graph.");
+	}
+	for (const auto &it: rhs.cells)
+		cells[key(remap[it.first >> 32], remap[it.first & 0xffffffffu])] += it.second;
+	return *this;
+}
+
+bool SparseAdjacencyMatrix::operator==(const SparseAdjacencyMatrix &rhs) const
+{
+	if (vertex_names.size() != rhs.vertex_names.size())
+		return false;
+	bool same = vertex_names == rhs.vertex_names;
+	std::vector<int> remap;
+	if (!same)
+	{
+		remap.resize(rhs.vertex_names.size());
+		for (size_t i = 0; i < remap.size(); ++i)
+			if ((remap[i] = find_index(rhs.vertex_names[i])) == -1)
+				return false;
+	}
+	// explicit zeros are equal to missing cells
+	for (const auto &it: rhs.cells)
+	{
+		int y = int(it.first >> 32);
+		int x = int(it.first & 0xffffffffu);
+		if (get(same ? y : remap[y], same ? x : remap[x]) != it.second)
+			return false;
+	}
+	size_t rhs_nonzero = 0;
+	for (const auto &it: rhs.cells)
+		rhs_nonzero += it.second != 0;
+	size_t nonzero = 0;
+	for (const auto &it: cells)
+		nonzero += it.second != 0;
+	return nonzero == rhs_nonzero;
+}
+
+void SparseAdjacencyMatrix::compress()
+{
+	if (compressed)
+		return;
+	int rows = vertex_names.size();
+	std::vector<uint64_t> keys;
+	keys.reserve(cells.size());
+	for (const auto &it: cells)
+		keys.push_back(it.first);
+	// (row, column) order
+	std::sort(keys.begin(), keys.end());
+
+	csr_rows.assign(rows + 1, 0);
+	csr_cols.resize(keys.size());
+	csr_values.resize(keys.size());
+	for (size_t k = 0; k < keys.size(); ++k)
+	{
+		++csr_rows[(keys[k] >> 32) + 1];
+		csr_cols[k] = int(keys[k] & 0xffffffffu);
+		csr_values[k] = cells.find(keys[k])->second;
+	}
+	for (int i = 0; i < rows; ++i)
+		csr_rows[i + 1] += csr_rows[i];
+	compressed = true;
+}
+
+double SparseAdjacencyMatrix::sum_row(int y) const
+{
+	if (compressed)
+	{
+		double sum = 0;
+		for (int k = csr_rows[y]; k < csr_rows[y + 1]; ++k)
+			sum += csr_values[k];
+		return sum;
+	}
+	double sum = 0;
+	for (const auto &it: cells)
+		if (int(it.first >> 32) == y)
+			sum += it.second;
+	return sum;
+}
+
+void SparseAdjacencyMatrix::row_sums(std::vector<double> &sums) const
+{
+	sums.assign(vertex_names.size(), 0.0);
+	for (const auto &it: cells)
+		sums[it.first >> 32] += it.second;
+}
+
+void SparseAdjacencyMatrix::column_sums(std::vector<double> &sums) const
+{
+	sums.assign(vertex_names.size(), 0.0);
+	for (const auto &it: cells)
+		sums[it.first & 0xffffffffu] += it.second;
+}
+
+double SparseAdjacencyMatrix::sum() const
+{
+	double sum = 0;
+	for (const auto &it: cells)
+		sum += it.second;
+	return sum;
 }
 
+AdjacencyMatrix SparseAdjacencyMatrix::to_dense() const
+{
+	AdjacencyMatrix res(vertex_names);
+	for (const auto &it: cells)
+		res.at(int(it.first >> 32), int(it.first & 0xffffffffu)) = it.second;
+	return res;
+}
@@ -13,8 +13,15 @@
 #include <unordered_map>
 #include <iostream>
 #include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
 
+#include "thread-pool.hpp"
 
+
+// cell of the former row-of-vertices layout, kept for users of the type
 struct Vertex
 {
 	Vertex(std::string _y_vertex = "", std::string _x_vertex = ""):
@@ -26,6 +33,15 @@ struct Vertex
 };
 
 
+/**
+ * @brief Dense square matrix of weights between named vertices
+ * (confusion matrix and so on).
+ * Weights are kept in one contiguous row-major array,
+ * vertex names are stored once for rows and once for columns.
+ * Rows and columns may be reordered independently (see sort()).
+ * For hot loops resolve indices once with find_y_index()/find_x_index()
+ * and use at() or row().
+ */
 class AdjacencyMatrix
 {
 
@@ -47,8 +63,24 @@ public:
 	AdjacencyMatrix& operator+= (const AdjacencyMatrix &rhs);
 	bool operator==(const AdjacencyMatrix &rhs) const;
 
+	// index-based access, no checks
+	double& at(int y, int x) { return weights[size_t(y) * size + x]; }
+	double at(int y, int x) const { return weights[size_t(y) * size + x]; }
+	double* row(int y) { return &weights[size_t(y) * size]; }
+	const double* row(int y) const { return &weights[size_t(y) * size]; }
+	const std::string& y_name(int y) const { return y_names[y]; }
+	const std::string& x_name(int x) const { return x_names[x]; }
+	int vertex_count() const { return size; }
+
+	// sums of all rows/columns at once (vectorized)
+	void row_sums(std::vector<double> &sums) const;
+	void column_sums(std::vector<double> &sums) const;
 
 	std::string result_to_string(bool norm=true, int width=0, int height=0);
+	// same table written row by row, without building the whole string
+	void write_result(std::ostream &out, bool norm=true, int width=0, int height=0) const;
+	// header row with column names, then one line per row; names are quoted when needed
+	void write_csv(std::ostream &out, bool norm=false, int precision=2, char separator=',') const;
 
 
 	void cout_debug_print();
@@ -56,23 +88,129 @@ public:
 #ifndef UNIT_TEST
 private:
 #endif
-	double sum_row(const std::vector<Vertex> &mat_row);
-	double sum_column(const int j);
-	double sum();
-	double sum_x(std::string);
+	double sum_row(const int i) const;
+	double sum_column(const int j) const;
+	double sum() const;
+	double sum_x(std::string) const;
 	int find_y_index(const std::string &y_vertex) const;
 	int find_x_index(const std::string &x_vertex) const;
 
 	int size;
-	std::vector<std::vector<Vertex>> matr;
+	// size * size weights, row-major
+	std::vector<double> weights;
 	std::vector<std::string> vertex_names;
-	Vertex& find_element(const std::string &y_vertex, const std::string &x_vertex);
+	// rows and columns labels in the current order
+	std::vector<std::string> y_names;
+	std::vector<std::string> x_names;
+	double& find_element(const std::string &y_vertex, const std::string &x_vertex);
+	// same labels order, element-wise operations are possible
+	bool same_layout(const AdjacencyMatrix &rhs) const;
 	std::unordered_map <std::string, int> x_vertex_names;
 	std::unordered_map <std::string, int> y_vertex_names;
 
 };
 
 
+/**
+ * @brief Accumulates AdjacencyMatrix from many threads without contention.
+ * Every thread gets its own dense shard with the same vertex set,
+ * merge() sums shards with parallel reduction over rows.
+ * Typical usage:
+ * @code
+ * ShardedAdjacencyMatrix acc(names);
+ * parallel_for(0, n, [&](int begin, int end) {
+ *     AdjacencyMatrix &m = acc.local();
+ *     for (int i = begin; i < end; ++i)
+ *         m.at(truth_id[i], detected_id[i]) += 1;
+ * });
+ * AdjacencyMatrix result = acc.merge();
+ * @endcode
+ */
+class ShardedAdjacencyMatrix
+{
+public:
+	ShardedAdjacencyMatrix(const std::vector<std::string> &_vertex_names);
+
+	/**
+	 * @brief Shard of the calling thread, created on first use.
+	 * Takes a lock: fetch it once per task, not per element.
+	 */
+	AdjacencyMatrix& local();
+
+	int shards_count() const;
+
+	/**
+	 * @brief Sum of all shards, shards are left untouched.
+	 * Must not be called concurrently with writes to shards.
+	 */
+	AdjacencyMatrix merge(aifil::ThreadPool &pool = aifil::ThreadPool::global()) const;
+
+	// zero all shards, keep them allocated
+	void reset();
+
+private:
+	std::vector<std::string> vertex_names;
+	mutable std::mutex mutex;
+	std::unordered_map<std::thread::id, int> owners;
+	std::vector<std::unique_ptr<AdjacencyMatrix> > shards;
+};
+
+
+/**
+ * @brief Sparse variant of AdjacencyMatrix for large mostly-empty matrices.
+ * Cells are accumulated in the hash table keyed by (row, column) ids,
+ * compress() builds CSR arrays (columns sorted) for fast traversal.
+ * CSR arrays are dropped on the next modification.
+ */
+class SparseAdjacencyMatrix
+{
+public:
+	SparseAdjacencyMatrix(const std::vector<std::string> &_vertex_names =
+	std::vector<std::string>());
+
+	void init(const std::vector<std::string> &_vertex_names);
+	void clear();
+
+	int vertex_count() const { return int(vertex_names.size()); }
+	size_t nonzeros() const { return cells.size(); }
+	int find_index(const std::string &vertex) const;
+	const std::string& name(int id) const { return vertex_names[id]; }
+
+	double& operator()(const std::string &first_vertex, const std::string &second_vertex);
+	// cell is created if it does not exist
+	double& at(int y, int x);
+	// 0 for missing cells
+	double get(int y, int x) const;
+
+	SparseAdjacencyMatrix& operator+= (const SparseAdjacencyMatrix &rhs);
+	bool operator==(const SparseAdjacencyMatrix &rhs) const;
+
+	void compress();
+	bool is_compressed() const { return compressed; }
+	// CSR arrays, valid after compress()
+	const std::vector<int>& row_offsets() const { return csr_rows; }
+	const std::vector<int>& col_indices() const { return csr_cols; }
+	const std::vector<double>& values() const { return csr_values; }
+
+	double sum_row(int y) const;
+	void row_sums(std::vector<double> &sums) const;
+	void column_sums(std::vector<double> &sums) const;
+	double sum() const;
+
+	AdjacencyMatrix to_dense() const;
+
+private:
+	static uint64_t key(int y, int x) { return (uint64_t(uint32_t(y)) << 32) | uint32_t(x); }
+
+	std::vector<std::string> vertex_names;
+	std::unordered_map<std::string, int> ids;
+	std::unordered_map<uint64_t, double> cells;
+
+	bool compressed;
+	std::vector<int> csr_rows;
+	std::vector<int> csr_cols;
+	std::vector<double> csr_values;
+};
 
 
 
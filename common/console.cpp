@@ -4,7 +4,11 @@
 #include "stringutils.hpp"
 
 #include <stdint.h>
+#include <cerrno>
+#include <chrono>
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <cstdarg>
 
@@ -22,6 +26,14 @@
 namespace aifil {
 
 CONSOLE_STATE console_state = CON_STATE_BEGIN;
+// console output and console_state
+static std::mutex console_mutex;
+
+static int64_t steady_time_us()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 int get_char()
 {
@@ -47,6 +59,7 @@ void print_progress(const char* fmt, ...)
 	vsnprintf(buf, sizeof(buf), fmt, ap);
 	va_end(ap);
 	buf[65535] = 0;
+	std::unique_lock<std::mutex> lock(console_mutex);
 	if (console_state == CON_STATE_END)
 	{
 		fprintf(stdout, "\n");
@@ -58,6 +71,7 @@ void print_progress(const char* fmt, ...)
 
 void print_progress(int part, int total, int skip)
 {
+	std::unique_lock<std::mutex> lock(console_mutex);
 	if (console_state == CON_STATE_END)
 	{
 		fprintf(stdout, "\n");
@@ -77,7 +91,7 @@ void pretty_printf(int level, FILE* fd, const char* buf)
 	if (!fd)
 		return;
 
-	//std::unique_lock lock(logging_mutex);
+	std::unique_lock<std::mutex> lock(console_mutex);
 #if defined(_WIN32) && !defined(CYGWIN)
 	HANDLE con = 0;
 	if (fd == stderr)
@@ -164,6 +178,80 @@ void pretty_printf(int level, FILE* fd, const char* buf)
 #endif
 }
 
+ProgressMeter::ProgressMeter(int64_t total, const std::string &title, int interval_ms):
+	total(total), title(title), interval_us(int64_t(interval_ms) * 1000),
+	start_us(steady_time_us()), current(0), next_print_us(0), finished(false), printed(-1)
+{
+}
+
+ProgressMeter::~ProgressMeter()
+{
+	finish();
+}
+
+void ProgressMeter::add(int64_t count)
+{
+	int64_t value = current.fetch_add(count, std::memory_order_relaxed) + count;
+	int64_t now = steady_time_us();
+	int64_t next = next_print_us.load(std::memory_order_relaxed);
+	if (now < next && value != total)
+		return;
+	// only one thread prints, the others go on working
+	if (!next_print_us.compare_exchange_strong(next, now + interval_us))
+		return;
+	std::unique_lock<std::mutex> lock(print_mutex, std::try_to_lock);
+	if (!lock.owns_lock() || finished.load())
+		return;
+	print(current.load(std::memory_order_relaxed), false);
+}
+
+void ProgressMeter::finish()
+{
+	std::unique_lock<std::mutex> lock(print_mutex);
+	if (finished.exchange(true))
+		return;
+	int64_t value = current.load();
+	if (value == printed)
+	{
+		// line is up to date, only move to the next one
+		std::unique_lock<std::mutex> console_lock(console_mutex);
+		fprintf(stdout, "\n");
+		fflush(stdout);
+		return;
+	}
+	print(value, true);
+}
+
+void ProgressMeter::print(int64_t value, bool final)
+{
+	double elapsed = (steady_time_us() - start_us) * 1e-6;
+	char buf[512];
+	int len = 0;
+	if (total > 0)
+	{
+		double eta = value > 0 && value < total ? elapsed * (total - value) / value : 0;
+		len = snprintf(buf, sizeof(buf), "%s%s%.2lf%% (%lld/%lld) %.1lfs, eta %.1lfs",
+			title.c_str(), title.empty() ? "" : ": ", value * 100.0 / total,
+			(long long)value, (long long)total, elapsed, eta);
+	}
+	else
+		len = snprintf(buf, sizeof(buf), "%s%s%lld %.1lfs",
+			title.c_str(), title.empty() ? "" : ": ", (long long)value, elapsed);
+	if (len < 0)
+		return;
+	printed = value;
+
+	std::unique_lock<std::mutex> lock(console_mutex);
+	if (console_state == CON_STATE_END)
+	{
+		fprintf(stdout, "\n");
+		console_state = CON_STATE_BEGIN;
+	}
+	// pad with spaces to wipe previous longer line
+	fprintf(stdout, "%-60s%s", buf, final ? "\n" : "\r");
+	fflush(stdout);
+}
+
 void ArgParser::parse_args(int argc, char *argv[])
 {
 	int opt_count = 1;
@@ -215,6 +303,62 @@ bool ArgParser::has_param(const std::string &param) const
 	return params.find(param) != params.end();
 }
 
+std::string ArgParser::get_string(const std::string &param, const std::string &default_value) const
+{
+	auto it = params.find(param);
+	return it != params.end() ? it->second : default_value;
+}
+
+int ArgParser::get_int(const std::string &param, int default_value) const
+{
+	auto it = params.find(param);
+	if (it == params.end() || it->second.empty())
+		return default_value;
+	char *end = 0;
+	errno = 0;
+	long value = strtol(it->second.c_str(), &end, 10);
+	if (*end)
+	{
+		log_warning("Parameter '%s': '%s' is not an integer", param.c_str(), it->second.c_str());
+		return default_value;
+	}
+	if (errno == ERANGE || value < INT_MIN || value > INT_MAX)
+	{
+		log_warning("Parameter '%s': '%s' is out of int range", param.c_str(), it->second.c_str());
+		return default_value;
+	}
+	return int(value);
+}
+
+double ArgParser::get_double(const std::string &param, double default_value) const
+{
+	auto it = params.find(param);
+	if (it == params.end() || it->second.empty())
+		return default_value;
+	char *end = 0;
+	double value = strtod(it->second.c_str(), &end);
+	if (*end)
+	{
+		log_warning("Parameter '%s': '%s' is not a number", param.c_str(), it->second.c_str());
+		return default_value;
+	}
+	return value;
+}
+
+bool ArgParser::get_bool(const std::string &param, bool default_value) const
+{
+	auto it = params.find(param);
+	if (it == params.end())
+		return default_value;
+	const std::string &v = it->second;
+	if (v.empty() || v == "1" || v == "true" || v == "yes" || v == "on")
+		return true;
+	if (v == "0" || v == "false" || v == "no" || v == "off")
+		return false;
+	log_warning("Parameter '%s': '%s' is not a boolean", param.c_str(), v.c_str());
+	return default_value;
+}
+
 bool ArgParser::has_leading_hyphen(const std::string &param)
 {
 	return !param.empty() && param[0] == '-';
@@ -1,9 +1,13 @@
 #ifndef AIFIL_UTILS_CONSOLE_H
 #define AIFIL_UTILS_CONSOLE_H
 
+#include <atomic>
+#include <cstdio>
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
+#include <stdint.h>
 
 namespace aifil {
 
@@ -29,6 +33,42 @@ void print_progress(const char* fmt, ...);
 void print_progress(int part, int total, int skip = 20);
 void pretty_printf(int level, FILE* fd, const char* buf);
 
+/**
+ * @brief Progress counter shared by many threads.
+ * add() is a single atomic increment; the line is redrawn by at most
+ * one thread at a time and not more often than once per interval_ms,
+ * other threads never wait for the console.
+ * Output goes through the same lock as pretty_printf(), so progress
+ * line and log messages do not interleave.
+ */
+class ProgressMeter
+{
+public:
+	ProgressMeter(int64_t total, const std::string &title = std::string(), int interval_ms = 100);
+	~ProgressMeter();
+
+	void add(int64_t count = 1);
+	int64_t done() const { return current.load(std::memory_order_relaxed); }
+	int64_t total_count() const { return total; }
+
+	// print final state and move to the next line, called by destructor
+	void finish();
+
+private:
+	void print(int64_t value, bool final);
+
+	const int64_t total;
+	const std::string title;
+	const int64_t interval_us;
+	const int64_t start_us;
+	std::atomic<int64_t> current;
+	std::atomic<int64_t> next_print_us;
+	std::atomic<bool> finished;
+	// last printed value, guarded by print_mutex
+	int64_t printed;
+	std::mutex print_mutex;
+};
+
 /**
  * @brief The simplest argument parser.
  *
@@ -45,6 +85,13 @@ struct ArgParser
 	void parse_args(int argc, char *argv[]);
 	bool has_param(const std::string &param) const;
 
+	// parameter value or default_value if absent or not convertible
+	std::string get_string(const std::string &param, const std::string &default_value = "") const;
+	int get_int(const std::string &param, int default_value) const;
+	double get_double(const std::string &param, double default_value) const;
+	// "--flag", "--flag=1/true/yes/on" are true
+	bool get_bool(const std::string &param, bool default_value = false) const;
+
 	bool has_leading_hyphen(const std::string &param);
 	std::string trim_hyphens(const char *param);
 	std::map<std::string, std::string> params;
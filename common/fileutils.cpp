@@ -1,6 +1,31 @@
 #include "fileutils.hpp"
 
 #include "errutils.hpp"
+#include "thread-pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define AIFIL_FILEUTILS_SSE2
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #ifdef HAVE_BOOST
 #define BOOST_NO_CXX11_SCOPED_ENUMS
@@ -53,73 +78,363 @@ std::string get_relative_path(const std::string &parent, const std::string &file
 	return rest;
 }
 
-// add path to result if it meets type and extension criteria
-static void add_proper_path_to_result(
-		const fs::path &p, PATH_TYPE path_types,
-		const std::set<std::string> &extensions,
-		std::list<std::string> &result)
+namespace {
+
+// extensions matching on native path without temporary strings
+class ExtensionFilter
 {
-	if (fs::is_directory(p) && !(path_types & PATH_FOLDER))
-		return;
-	if (fs::is_symlink(p) && !(path_types & PATH_SYMLINK))
-		return;
-	if (fs::is_regular_file(p) && !(path_types & PATH_FILE))
-		return;
-	if (fs::is_other(p) && !(path_types & PATH_OTHER))
+public:
+	explicit ExtensionFilter(const std::set<std::string> &extensions)
+	{
+		for (auto ext: extensions)
+		{
+			boost::algorithm::to_lower(ext);
+			// "jpg" is the same as ".jpg", empty one selects files without extension
+			if (!ext.empty() && ext[0] != '.')
+				ext.insert(0, 1, '.');
+			exts.push_back(ext);
+		}
+	}
+
+	bool empty() const { return exts.empty(); }
+
+	// the same extension as fs::path::extension() gives, case-insensitive
+	bool match(const fs::path::string_type &path) const
+	{
+		typedef fs::path::value_type char_type;
+		size_t name_pos = path.find_last_of(fs::path::separator);
+#ifdef _WIN32
+		size_t alt_pos = path.find_last_of(char_type('\\'));
+		if (alt_pos != path.npos && (name_pos == path.npos || alt_pos > name_pos))
+			name_pos = alt_pos;
+#endif
+		name_pos = name_pos == path.npos ? 0 : name_pos + 1;
+
+		size_t name_len = path.size() - name_pos;
+		const char_type *name = path.data() + name_pos;
+		bool dots = (name_len == 1 && name[0] == '.') ||
+			(name_len == 2 && name[0] == '.' && name[1] == '.');
+		size_t ext_pos = dots ? path.npos : path.find_last_of(char_type('.'));
+		size_t ext_len = ext_pos == path.npos || ext_pos < name_pos ? 0 : path.size() - ext_pos;
+		const char_type *ext = path.data() + path.size() - ext_len;
+
+		for (const auto &candidate: exts)
+		{
+			if (candidate.size() != ext_len)
+				continue;
+			size_t i = 0;
+			for (; i < ext_len; ++i)
+			{
+				char_type c = ext[i];
+				if (c >= 'A' && c <= 'Z')
+					c = c - 'A' + 'a';
+				if (c != char_type((unsigned char)candidate[i]))
+					break;
+			}
+			if (i == ext_len)
+				return true;
+		}
+		return false;
+	}
+
+private:
+	std::vector<std::string> exts;
+};
+
+// parallel walker, subdirectories are submitted as separate tasks
+class DirectoryWalker
+{
+public:
+	// receives found entries batch, returns false to stop walking
+	typedef std::function<bool(std::vector<std::string>&)> Sink;
+
+	DirectoryWalker(PATH_TYPE path_types, bool recursive,
+			const std::set<std::string> &extensions, const Sink &sink) :
+		path_types(path_types), recursive(recursive),
+		filter(extensions), sink(sink), stopped(false) {}
+
+	void walk(const fs::path &dir, TaskGroup &group);
+	void stop() { stopped = true; }
+
+private:
+	static const size_t batch_size = 256;
+
+	// path meets type and extension criteria
+	bool accept(const fs::path &p, const fs::file_status &st, bool is_link) const;
+	void flush(std::vector<std::string> &batch);
+
+	PATH_TYPE path_types;
+	bool recursive;
+	ExtensionFilter filter;
+	Sink sink;
+	std::atomic<bool> stopped;
+};
+
+bool DirectoryWalker::accept(
+		const fs::path &p, const fs::file_status &st, bool is_link) const
+{
+	if (fs::is_directory(st) && !(path_types & PATH_FOLDER))
+		return false;
+	if (is_link && !(path_types & PATH_SYMLINK))
+		return false;
+	if (fs::is_regular_file(st) && !(path_types & PATH_FILE))
+		return false;
+	if (fs::is_other(st) && !(path_types & PATH_OTHER))
+		return false;
+	if (!filter.empty() && !filter.match(p.native()))
+		return false;
+	return true;
+}
+
+void DirectoryWalker::flush(std::vector<std::string> &batch)
+{
+	if (!batch.empty() && !stopped && !sink(batch))
+		stopped = true;
+	batch.clear();
+}
+
+void DirectoryWalker::walk(const fs::path &dir, TaskGroup &group)
+{
+	boost::system::error_code ec;
+	fs::directory_iterator it(dir, ec);
+	if (ec)
+	{
+		aifil::log_warning("Can't list directory '%s': %s",
+				dir.string().c_str(), ec.message().c_str());
 		return;
-	if (!extensions.empty())
+	}
+
+	std::vector<std::string> batch;
+	for ( ; it != fs::directory_iterator() && !stopped; it.increment(ec))
 	{
-		std::string my_ext = p.extension().string();
-		boost::algorithm::to_lower(my_ext);
-		if (extensions.find(my_ext) == extensions.end())
-			return;
+		if (ec)
+		{
+			aifil::log_warning("Directory '%s' listing is interrupted: %s",
+					dir.string().c_str(), ec.message().c_str());
+			break;
+		}
+
+		// entry statuses are cached by iterator (d_type), stat() is made for symlinks only
+		const fs::directory_entry &entry = *it;
+		fs::file_status link_st = entry.symlink_status(ec);
+		if (ec)
+			continue;
+		bool is_link = fs::is_symlink(link_st);
+		fs::file_status st = is_link ? entry.status(ec) : link_st;
+
+		// symlinks to directories are not followed like in recursive_directory_iterator
+		if (recursive && !is_link && fs::is_directory(st))
+		{
+			fs::path sub = entry.path();
+			group.run([this, sub, &group] { walk(sub, group); });
+		}
+
+		if (accept(entry.path(), st, is_link))
+		{
+			batch.push_back(entry.path().generic_string());
+			if (batch.size() >= batch_size)
+				flush(batch);
+		}
 	}
-	std::string full_name = p.generic_string();
-	result.push_back(full_name);
+	flush(batch);
+}
+
+}  // namespace
+
+static bool check_directory(const std::string &my_dir)
+{
+	if (!path_exists(my_dir))
+	{
+		aifil::log_warning("Can't list directory '%s': does not exist", my_dir.c_str());
+		return false;
+	}
+
+	if (!fs::is_directory(my_dir))
+	{
+		aifil::log_warning("Can't list '%s': it is not directory", my_dir.c_str());
+		return false;
+	}
+	return true;
+}
+
+std::list<std::string> ls_directory(
+		const std::string &my_dir,
+		PATH_TYPE path_types,
+		bool recursive,
+		const std::set<std::string> &extensions,
+		bool sorted)
+{
+	if (!check_directory(my_dir))
+		return std::list<std::string>();
+
+	std::vector<std::string> found;
+	std::mutex found_mutex;
+	DirectoryWalker walker(path_types, recursive, extensions,
+		[&found, &found_mutex](std::vector<std::string> &batch) {
+			std::lock_guard<std::mutex> lock(found_mutex);
+			found.insert(found.end(),
+				std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+			return true;
+		});
+
+	TaskGroup group;
+	walker.walk(fs::path(my_dir), group);
+	group.wait();
+
+	if (sorted)
+		std::sort(found.begin(), found.end());
+	return std::list<std::string>(
+		std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
 }
 
 std::list<std::string> ls_directory(
 		const std::string &my_dir,
+		const std::set<std::string> &extensions,
+		bool recursive,
+		bool sorted)
+{
+	return ls_directory(my_dir, PATH_FILE, recursive, extensions, sorted);
+}
+
+void scan_directory(
+		const std::string &my_dir,
+		const std::function<bool(const std::string&)> &callback,
 		PATH_TYPE path_types,
 		bool recursive,
 		const std::set<std::string> &extensions)
 {
-	std::list<std::string> result;
+	if (!check_directory(my_dir))
+		return;
 
-	if (!path_exists(my_dir))
+	std::mutex callback_mutex;
+	DirectoryWalker walker(path_types, recursive, extensions,
+		[&callback, &callback_mutex](std::vector<std::string> &batch) {
+			std::lock_guard<std::mutex> lock(callback_mutex);
+			for (const auto &path: batch)
+				if (!callback(path))
+					return false;
+			return true;
+		});
+
+	TaskGroup group;
+	walker.walk(fs::path(my_dir), group);
+	group.wait();
+}
+
+struct DirectoryScanner::State
+{
+	State(PATH_TYPE path_types, bool recursive,
+			const std::set<std::string> &extensions,
+			size_t queue_limit, int threads) :
+		walker(path_types, recursive, extensions,
+			[this](std::vector<std::string> &batch) { return push(batch); }),
+		queue_limit(std::max<size_t>(queue_limit, 1)),
+		finished(false), stopped(false), pool(threads), driver(pool) {}
+
+	bool push(std::vector<std::string> &batch)
 	{
-		aifil::log_warning("Can't list directory '%s': does not exist", my_dir.c_str());
-		return result;
+		std::unique_lock<std::mutex> lock(mutex);
+		for (auto &path: batch)
+		{
+			not_full.wait(lock, [this] { return stopped || queue.size() < queue_limit; });
+			if (stopped)
+				return false;
+			queue.push_back(std::move(path));
+			not_empty.notify_one();
+		}
+		return true;
 	}
 
-	if (!fs::is_directory(my_dir))
+	void set_finished()
 	{
-		aifil::log_warning("Can't list '%s': it is not directory", my_dir.c_str());
-		return result;
+		std::lock_guard<std::mutex> lock(mutex);
+		finished = true;
+		not_empty.notify_all();
+	}
+
+	DirectoryWalker walker;
+	size_t queue_limit;
+
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	std::deque<std::string> queue;
+	bool finished;
+	bool stopped;
+
+	ThreadPool pool;
+	// runs the root walk and waits for subdirectories in the pool thread
+	TaskGroup driver;
+};
+
+DirectoryScanner::DirectoryScanner(
+		const std::string &my_dir,
+		PATH_TYPE path_types,
+		bool recursive,
+		const std::set<std::string> &extensions,
+		size_t queue_limit,
+		int threads) :
+	state(new State(path_types, recursive, extensions, queue_limit, threads))
+{
+	if (!check_directory(my_dir))
+	{
+		state->set_finished();
+		return;
 	}
 
-	if (recursive)
+	State *st = state.get();
+	fs::path root(my_dir);
+	st->driver.run([st, root] {
+		try
+		{
+			TaskGroup group(st->pool);
+			st->walker.walk(root, group);
+			group.wait();
+		}
+		catch (...)
+		{
+			st->set_finished();
+			throw;
+		}
+		st->set_finished();
+	});
+}
+
+DirectoryScanner::~DirectoryScanner()
+{
+	stop();
+	try
 	{
-		fs::recursive_directory_iterator it(my_dir);
-		for ( ; it != fs::recursive_directory_iterator(); ++it)
-			add_proper_path_to_result(it->path(), path_types, extensions, result);
+		state->driver.wait();
 	}
-	else
+	catch (const std::exception &e)
 	{
-		fs::directory_iterator it(my_dir);
-		for ( ; it != fs::directory_iterator(); ++it)
-			add_proper_path_to_result(it->path(), path_types, extensions, result);
+		aifil::log_warning("Directory scanning failed: %s", e.what());
 	}
+}
+
+bool DirectoryScanner::next(std::string &path)
+{
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->not_empty.wait(lock, [this] {
+		return state->stopped || state->finished || !state->queue.empty();
+	});
+	if (state->stopped || state->queue.empty())
+		return false;
 
-	return result;
+	path = std::move(state->queue.front());
+	state->queue.pop_front();
+	state->not_full.notify_one();
+	return true;
 }
 
-std::list<std::string> ls_directory(
-		const std::string &my_dir,
-		const std::set<std::string> &extensions,
-		bool recursive)
+void DirectoryScanner::stop()
 {
-	return ls_directory(my_dir, PATH_FILE, recursive, extensions);
+	state->walker.stop();
+	std::lock_guard<std::mutex> lock(state->mutex);
+	state->stopped = true;
+	state->not_full.notify_all();
+	state->not_empty.notify_all();
 }
 
 bool path_exists(const std::string &target_path)
@@ -264,16 +579,207 @@ bool file_exists(const std::string &filename)
 	return in_file.is_open();
 }
 
+size_t line_count(const char *data, size_t size)
+{
+	const unsigned char *s = (const unsigned char*)data;
+	size_t res = 0;
+	size_t i = 0;
+#if defined(__AVX2__)
+	{
+		const __m256i nl = _mm256_set1_epi8('\n');
+		const __m256i zero = _mm256_setzero_si256();
+		while (i + 32 <= size)
+		{
+			// per-byte counters overflow after 255 iterations
+			size_t block_end = std::min(size - (size - i) % 32, i + 255 * 32);
+			__m256i acc = zero;
+			for (; i < block_end; i += 32)
+			{
+				__m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+				acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+			}
+			__m256i sums = _mm256_sad_epu8(acc, zero);
+			res += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) +
+				_mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+		}
+	}
+#endif
+#ifdef AIFIL_FILEUTILS_SSE2
+	{
+		const __m128i nl = _mm_set1_epi8('\n');
+		const __m128i zero = _mm_setzero_si128();
+		while (i + 16 <= size)
+		{
+			// per-byte counters overflow after 255 iterations
+			size_t block_end = std::min(size - (size - i) % 16, i + 255 * 16);
+			__m128i acc = zero;
+			for (; i < block_end; i += 16)
+			{
+				__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+				acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+			}
+			__m128i sums = _mm_sad_epu8(acc, zero);
+			res += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+		}
+	}
+#endif
+	for (; i < size; ++i)
+		res += s[i] == '\n';
+
+	// the last line without newline
+	if (size && data[size - 1] != '\n')
+		++res;
+	return res;
+}
+
 int line_count_in_file(const std::string &file_name)
 {
-	std::ifstream f(file_name);
+	MappedFile f(file_name);
 	if (!f.is_open())
 		return 0;
-	std::string line;
-	int num = 0;
-	while (std::getline(f, line))
-		num++;
-	return num;
+	return int(line_count(f.data(), f.size()));
+}
+
+MappedFile::MappedFile(const std::string &file_name) :
+	ptr(0), len(0), handle(0), mapping(0)
+{
+	open(file_name);
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const std::string &file_name)
+{
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+	handle = intptr_t(file);
+	len = size_t(file_size.QuadPart);
+	if (!len)
+		return true;
+
+	HANDLE map = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	const void *view = map ? MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : 0;
+	if (!view)
+	{
+		if (map)
+			CloseHandle(map);
+		close();
+		return false;
+	}
+	mapping = intptr_t(map);
+	ptr = (const char*)view;
+#else
+	int fd = ::open(file_name.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+	{
+		::close(fd);
+		return false;
+	}
+	handle = fd + 1;
+	len = size_t(st.st_size);
+	if (!len)
+		return true;
+
+	void *addr = mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (addr == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+	madvise(addr, len, MADV_SEQUENTIAL);
+	ptr = (const char*)addr;
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (ptr)
+		UnmapViewOfFile(ptr);
+	if (mapping)
+		CloseHandle(HANDLE(mapping));
+	if (handle)
+		CloseHandle(HANDLE(handle));
+#else
+	if (ptr)
+		munmap((void*)ptr, len);
+	if (handle)
+		::close(int(handle - 1));
+#endif
+	ptr = 0;
+	len = 0;
+	handle = 0;
+	mapping = 0;
+}
+
+std::vector<StringSlice> split_at_lines(const StringSlice &text, int count)
+{
+	std::vector<StringSlice> res;
+	if (text.empty())
+		return res;
+	count = std::max(count, 1);
+
+	size_t approx = text.size() / count;
+	size_t begin = 0;
+	for (int i = 0; i < count - 1 && begin < text.size(); ++i)
+	{
+		size_t target = std::max(begin, size_t(i + 1) * approx);
+		size_t nl = text.find('\n', std::max(begin, target ? target - 1 : 0));
+		if (nl == StringSlice::npos)
+			break;
+		res.push_back(text.substr(begin, nl + 1 - begin));
+		begin = nl + 1;
+	}
+	if (begin < text.size())
+		res.push_back(text.substr(begin));
+	return res;
+}
+
+bool process_file_chunks(const std::string &file_name, int chunks,
+		const std::function<void(int, const StringSlice&)> &body)
+{
+	MappedFile f(file_name);
+	if (!f.is_open())
+		return false;
+
+	ThreadPool &pool = ThreadPool::global();
+	std::vector<StringSlice> parts = split_at_lines(
+			f.slice(), chunks > 0 ? chunks : pool.size());
+	TaskGroup group(pool);
+	for (size_t i = 0; i < parts.size(); ++i)
+	{
+		const StringSlice &part = parts[i];
+		group.run([&body, &part, i] { body(int(i), part); });
+	}
+	group.wait();
+	return true;
+}
+
+bool process_file_lines(const std::string &file_name, int chunks,
+		const std::function<void(int, const StringSlice&)> &body)
+{
+	return process_file_chunks(file_name, chunks,
+		[&body](int chunk, const StringSlice &text) {
+			for (const auto &line: split_slices(text, '\n'))
+				body(chunk, line);
+		});
 }
 
 
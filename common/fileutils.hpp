@@ -1,8 +1,12 @@
 #ifndef AIFIL_FILEUTILS_H
 #define AIFIL_FILEUTILS_H
 
+#include "stringutils.hpp"
+
 #include <fstream>
+#include <functional>
 #include <list>
+#include <memory>
 #include <set>
 #include <string>
 #include <tuple>
@@ -43,10 +47,14 @@ std::string get_relative_path(const std::string &parent, const std::string &file
 /**
  * @brief list files in the given directory
  * all paths will be relative to given directory
+ * Subdirectories are scanned in parallel (global thread pool),
+ * so entries order is unspecified unless 'sorted' is set.
  * @param my_dir [in] directory
  * @param path_type [in] path types: all, directories, files, symlinks
  * @param recursive [in] do it recursively or not
- * @param extensions [in] file extensions to add into the list
+ * @param extensions [in] file extensions to add into the list,
+ * case-insensitive, leading dot is optional
+ * @param sorted [in] sort result once after scanning
  * @return list of file paths
  * @sa PATH_TYPE
  */
@@ -54,7 +62,8 @@ std::list<std::string> ls_directory(
 		const std::string &my_dir,
 		PATH_TYPE path_types = PATH_ALL,
 		bool recursive = true,
-		const std::set<std::string> &extensions = std::set<std::string>());
+		const std::set<std::string> &extensions = std::set<std::string>(),
+		bool sorted = false);
 
 /**
  * @overload std::list<std::string> ls_directory(
@@ -64,7 +73,68 @@ std::list<std::string> ls_directory(
 std::list<std::string> ls_directory(
 		const std::string &my_dir,
 		const std::set<std::string> &extensions,
-		bool recursive = true);
+		bool recursive = true,
+		bool sorted = false);
+
+/**
+ * @brief Walk directory calling 'callback' for every matching entry
+ * as soon as it is found. Selection rules are the same as in ls_directory().
+ * Subdirectories are processed by the pool threads in parallel,
+ * callback calls are serialized but may come from different threads.
+ * Unreadable directories are skipped with a warning.
+ * @param callback [in] Receives entry path, returns false to stop the walk.
+ */
+void scan_directory(
+		const std::string &my_dir,
+		const std::function<bool(const std::string&)> &callback,
+		PATH_TYPE path_types = PATH_ALL,
+		bool recursive = true,
+		const std::set<std::string> &extensions = std::set<std::string>());
+
+/**
+ * @brief Streaming directory listing.
+ * Scanning starts right in the constructor, subdirectories are walked
+ * in parallel by the scanner's own work-stealing pool (its threads block
+ * when consumer is slow, so the shared pool is not used).
+ * Found entries are passed through the bounded queue,
+ * so memory does not depend on directory size.
+ * @code{.cpp}
+ * aifil::DirectoryScanner scanner("photos", aifil::PATH_FILE, true, {".jpg"});
+ * std::string path;
+ * while (scanner.next(path))
+ *     process(path);
+ * @endcode
+ */
+class DirectoryScanner
+{
+public:
+	/**
+	 * @param queue_limit [in] Maximum amount of found but not taken entries.
+	 * @param threads [in] Scanning threads, 0 means hardware concurrency.
+	 */
+	DirectoryScanner(
+			const std::string &my_dir,
+			PATH_TYPE path_types = PATH_ALL,
+			bool recursive = true,
+			const std::set<std::string> &extensions = std::set<std::string>(),
+			size_t queue_limit = 4096,
+			int threads = 0);
+	// stops scanning and waits for the scanning threads
+	~DirectoryScanner();
+
+	/**
+	 * @brief Take the next found entry, blocks until it is available.
+	 * @return false when scanning is over and all entries are taken.
+	 */
+	bool next(std::string &path);
+
+	// stop scanning, next() returns false afterwards
+	void stop();
+
+private:
+	struct State;
+	std::unique_ptr<State> state;
+};
 
 bool path_exists(const std::string &target_path);
 
@@ -209,11 +279,76 @@ bool file_write(const std::string &file_name, InputIterator first, InputIterator
 
 /**
 * @brief Amount of lines in file.
+* File is memory mapped and scanned for newlines with SIMD,
+* the last line without '\n' is counted too (like std::getline does).
 * @param file_name [in] Path to file.
 * @return Amount of lines (0 if file does not exist).
 */
 int line_count_in_file(const std::string &file_name);
 
+// lines amount in the memory block, counted like in line_count_in_file()
+size_t line_count(const char *data, size_t size);
+
+/**
+ * @brief Read-only memory mapped file.
+ * Empty file is opened successfully with zero size.
+ */
+class MappedFile
+{
+public:
+	MappedFile() : ptr(0), len(0), handle(0), mapping(0) {}
+	explicit MappedFile(const std::string &file_name);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string &file_name);
+	void close();
+
+	bool is_open() const { return handle != 0; }
+	const char* data() const { return ptr; }
+	size_t size() const { return len; }
+	StringSlice slice() const { return StringSlice(ptr ? ptr : "", len); }
+
+private:
+	const char *ptr;
+	size_t len;
+	// file descriptor + 1 or HANDLE, 0 if closed
+	intptr_t handle;
+	intptr_t mapping;
+};
+
+/**
+ * @brief Split text into at most 'count' parts of similar size.
+ * Every part ends right after '\n' (except the last one),
+ * so no line is broken between parts.
+ */
+std::vector<StringSlice> split_at_lines(const StringSlice &text, int count);
+
+/**
+ * @brief Chunked parallel processing of the text file without copying.
+ * File is memory mapped and split by split_at_lines(), each chunk is
+ * processed by a separate task of the global thread pool.
+ * Lines of the chunk are available as
+ * @code{.cpp}
+ * for (auto line: aifil::split_slices(chunk, '\n'))
+ * @endcode
+ * Slices are valid inside body() only.
+ * @param chunks [in] Chunks count, 0 means thread pool size.
+ * @param body [in] body(chunk_index, chunk), called concurrently.
+ * @return false if file can not be opened.
+ */
+bool process_file_chunks(const std::string &file_name, int chunks,
+		const std::function<void(int, const StringSlice&)> &body);
+
+/**
+ * @brief The same as process_file_chunks() but calls body(chunk_index, line)
+ * for every line (without '\n') in the file.
+ */
+bool process_file_lines(const std::string &file_name, int chunks,
+		const std::function<void(int, const StringSlice&)> &body);
+
 } //namespace aifil
 
 #endif //AIFIL_FILEUTILS_H
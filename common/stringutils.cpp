@@ -8,15 +8,21 @@
 #include <sstream>
 
 #include <cstdarg>
+#include <cmath>
 #include <cstring>
 #include <cstdio>
 #include <ctime>
 #include <cctype>
+#include <cfloat>
 
-#define GNUC_4_8 __GNUC__ == 4 && __GNUC_MINOR__ == 8
-#if GNUC_4_8
-#else
-#include <codecvt>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define AIFIL_UTF8_SSE2
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
 #endif
 
 #if defined(_MSC_VER) && _MSC_VER <= 1310
@@ -25,15 +31,104 @@
 
 namespace aifil {
 
+// format into dst starting from offset, dst is resized to the exact length
+static size_t vformat_to(std::string &dst, size_t offset, const char *fmt, va_list ap)
+{
+	// small strings are formatted on stack, large ones directly into destination
+	char buf[256];
+	va_list ap_copy;
+	va_copy(ap_copy, ap);
+	int res = vsnprintf(buf, sizeof(buf), fmt, ap);
+	if (res < 0)
+		res = 0;
+	dst.resize(offset);
+	if (size_t(res) < sizeof(buf))
+		dst.append(buf, res);
+	else
+	{
+		dst.resize(offset + res);
+		vsnprintf(&dst[offset], res + 1, fmt, ap_copy);
+	}
+	va_end(ap_copy);
+	return res;
+}
+
 std::string stdprintf(const char* fmt, ...)
 {
-	char buf[32768];
+	std::string result;
 	va_list ap;
 	va_start(ap, fmt);
-	vsnprintf(buf, sizeof(buf), fmt, ap);
+	vformat_to(result, 0, fmt, ap);
 	va_end(ap);
-	buf[32768-1] = 0;
-	return buf;
+	return result;
+}
+
+size_t stdprintf(std::string &dst, const char* fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	size_t res = vformat_to(dst, 0, fmt, ap);
+	va_end(ap);
+	return res;
+}
+
+size_t stdprintf_append(std::string &dst, const char* fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	size_t res = vformat_to(dst, dst.size(), fmt, ap);
+	va_end(ap);
+	return res;
+}
+
+const char* FormatBuffer::printf(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	const char *res = vformat(false, fmt, ap);
+	va_end(ap);
+	return res;
+}
+
+const char* FormatBuffer::append(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	const char *res = vformat(true, fmt, ap);
+	va_end(ap);
+	return res;
+}
+
+const char* FormatBuffer::vformat(bool append, const char *fmt, va_list ap)
+{
+	if (!append)
+		len = 0;
+
+	if (!on_heap)
+	{
+		va_list ap_copy;
+		va_copy(ap_copy, ap);
+		int res = vsnprintf(local + len, sizeof(local) - len, fmt, ap_copy);
+		va_end(ap_copy);
+		if (res < 0)
+		{
+			local[len] = 0;
+			return local;
+		}
+		if (len + res < sizeof(local))
+		{
+			len += res;
+			return local;
+		}
+		// does not fit: move to heap and format again
+		heap.assign(local, len);
+		on_heap = true;
+	}
+	else if (!append)
+		heap.clear();
+
+	len = len + vformat_to(heap, len, fmt, ap);
+	return heap.c_str();
 }
 
 bool endswith(const std::string& str, const std::string& with)
@@ -132,6 +227,289 @@ std::vector<std::string> split_by_substr(
 	return elems;
 }
 
+StringSlice StringSlice::substr(size_t pos, size_t count) const
+{
+	if (pos > len)
+		pos = len;
+	if (count > len - pos)
+		count = len - pos;
+	return StringSlice(ptr + pos, count);
+}
+
+size_t StringSlice::find(char ch, size_t pos) const
+{
+	if (pos >= len)
+		return npos;
+	const void *found = memchr(ptr + pos, ch, len - pos);
+	return found ? static_cast<const char*>(found) - ptr : npos;
+}
+
+size_t StringSlice::find(const StringSlice &sub, size_t pos) const
+{
+	if (sub.len == 0)
+		return pos <= len ? pos : npos;
+	if (sub.len == 1)
+		return find(sub.ptr[0], pos);
+
+	// memchr for the first symbol is much faster than naive comparison
+	while (pos + sub.len <= len)
+	{
+		const void *found = memchr(ptr + pos, sub.ptr[0], len - pos - sub.len + 1);
+		if (!found)
+			return npos;
+		pos = static_cast<const char*>(found) - ptr;
+		if (!memcmp(ptr + pos + 1, sub.ptr + 1, sub.len - 1))
+			return pos;
+		++pos;
+	}
+	return npos;
+}
+
+size_t StringSlice::find_first_of(const StringSlice &chars, size_t pos) const
+{
+	if (chars.len == 1)
+		return find(chars.ptr[0], pos);
+
+	bool table[256] = { false };
+	for (size_t i = 0; i < chars.len; ++i)
+		table[static_cast<unsigned char>(chars.ptr[i])] = true;
+	for ( ; pos < len; ++pos)
+	{
+		if (table[static_cast<unsigned char>(ptr[pos])])
+			return pos;
+	}
+	return npos;
+}
+
+bool StringSlice::starts_with(const StringSlice &prefix) const
+{
+	return len >= prefix.len && !memcmp(ptr, prefix.ptr, prefix.len);
+}
+
+bool StringSlice::operator<(const StringSlice &other) const
+{
+	int res = memcmp(ptr, other.ptr, std::min(len, other.len));
+	return res < 0 || (res == 0 && len < other.len);
+}
+
+void SplitRange::iterator::advance()
+{
+	if (!owner || pos == StringSlice::npos)
+	{
+		pos = StringSlice::npos;
+		return;
+	}
+	const StringSlice &in = owner->input;
+
+	switch (owner->mode)
+	{
+	case SPLIT_CHAR:
+	{
+		// std::getline semantics: empty tokens are kept, except trailing one
+		if (pos >= in.size())
+		{
+			pos = StringSlice::npos;
+			return;
+		}
+		size_t next = in.find(owner->delim_char, pos);
+		if (next == StringSlice::npos)
+			next = in.size();
+		token = StringSlice(in.data() + pos, next - pos);
+		pos = next + 1;
+		return;
+	}
+	case SPLIT_ANY_OF:
+	{
+		// skip delimiters sequence
+		const StringSlice &delim = owner->delim;
+		while (pos < in.size() && delim.find(in[pos]) != StringSlice::npos)
+			++pos;
+		if (pos >= in.size())
+		{
+			pos = StringSlice::npos;
+			return;
+		}
+		size_t next = in.find_first_of(delim, pos);
+		if (next == StringSlice::npos)
+			next = in.size();
+		token = StringSlice(in.data() + pos, next - pos);
+		pos = next;
+		return;
+	}
+	case SPLIT_SUBSTR:
+	{
+		const StringSlice &delim = owner->delim;
+		if (delim.empty())
+		{
+			// nothing to split by: the whole input is the only token
+			if (pos || in.empty())
+				pos = StringSlice::npos;
+			else
+			{
+				token = in;
+				pos = in.size();
+			}
+			return;
+		}
+		while (pos < in.size() && in.find(delim, pos) == pos)
+			pos += delim.size();
+		if (pos >= in.size())
+		{
+			pos = StringSlice::npos;
+			return;
+		}
+		size_t next = in.find(delim, pos);
+		if (next == StringSlice::npos)
+			next = in.size();
+		token = StringSlice(in.data() + pos, next - pos);
+		pos = next;
+		return;
+	}
+	}
+}
+
+size_t SplitRange::count() const
+{
+	size_t res = 0;
+	for (iterator it = begin(); it != end(); ++it)
+		++res;
+	return res;
+}
+
+void SplitRange::to_vector(std::vector<StringSlice> &dst) const
+{
+	dst.clear();
+	for (iterator it = begin(); it != end(); ++it)
+		dst.push_back(*it);
+}
+
+SplitRange split_slices(const StringSlice &s, const StringSlice &delimiters)
+{
+	return SplitRange(s, delimiters, SplitRange::SPLIT_ANY_OF);
+}
+
+SplitRange split_slices_by_substr(const StringSlice &s, const StringSlice &delim_substr)
+{
+	return SplitRange(s, delim_substr, SplitRange::SPLIT_SUBSTR);
+}
+
+// two digits lookup table for integer formatting
+static const char digits_lut[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static int decimal_length(uint64_t v)
+{
+	int len = 1;
+	for (;;)
+	{
+		if (v < 10) return len;
+		if (v < 100) return len + 1;
+		if (v < 1000) return len + 2;
+		if (v < 10000) return len + 3;
+		v /= 10000u;
+		len += 4;
+	}
+}
+
+char* to_chars(char *first, char *last, uint64_t value)
+{
+	int len = decimal_length(value);
+	if (last - first < len)
+		return 0;
+	char *p = first + len;
+	while (value >= 100)
+	{
+		unsigned idx = unsigned(value % 100) * 2;
+		value /= 100;
+		*--p = digits_lut[idx + 1];
+		*--p = digits_lut[idx];
+	}
+	if (value >= 10)
+	{
+		unsigned idx = unsigned(value) * 2;
+		*--p = digits_lut[idx + 1];
+		*--p = digits_lut[idx];
+	}
+	else
+		*--p = char('0' + value);
+	return first + len;
+}
+
+char* to_chars(char *first, char *last, int64_t value)
+{
+	if (value >= 0)
+		return to_chars(first, last, uint64_t(value));
+	if (last - first < 2)
+		return 0;
+	*first = '-';
+	// negate in unsigned domain to support INT64_MIN
+	return to_chars(first + 1, last, uint64_t(0) - uint64_t(value));
+}
+
+static char* to_chars_fallback(char *first, char *last, double value, int precision)
+{
+	char buf[512];
+	int res = snprintf(buf, sizeof(buf), "%.*f", precision, value);
+	if (res < 0 || size_t(res) >= sizeof(buf) || last - first < res)
+		return 0;
+	memcpy(first, buf, res);
+	return first + res;
+}
+
+char* to_chars(char *first, char *last, double value, int precision)
+{
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+
+	if (precision < 0 || precision > 9)
+		return to_chars_fallback(first, last, value, precision);
+
+	// product is rounded once, its error is below one ulp of scaled;
+	// digits are exact while scaled fits 2^50 and the fraction is farther
+	// than the error from the tie, floor and the subtraction are exact
+	double scaled = std::fabs(value) * pow10[precision];
+	if (!(scaled < 1125899906842624.0))
+		return to_chars_fallback(first, last, value, precision);
+	double whole = std::floor(scaled);
+	double frac = scaled - whole;
+	if (std::fabs(frac - 0.5) <= 2 * DBL_EPSILON * scaled)
+		return to_chars_fallback(first, last, value, precision);
+
+	uint64_t digits = uint64_t(whole) + (frac > 0.5 ? 1 : 0);
+	uint64_t int_part = digits / uint64_t(pow10[precision]);
+	uint64_t frac_part = digits % uint64_t(pow10[precision]);
+
+	char buf[32];
+	char *p = buf;
+	// printf keeps sign for negative values rounded to zero ("-0.00")
+	if (std::signbit(value))
+		*p++ = '-';
+	p = to_chars(p, buf + sizeof(buf), int_part);
+	if (precision)
+	{
+		*p++ = '.';
+		char *frac_end = p + precision;
+		for (char *q = frac_end; q != p; frac_part /= 10)
+			*--q = char('0' + frac_part % 10);
+		p = frac_end;
+	}
+
+	size_t len = p - buf;
+	if (size_t(last - first) < len)
+		return 0;
+	memcpy(first, buf, len);
+	return first + len;
+}
+
 std::string& ltrim(std::string &s)
 {
 	s.erase(s.begin(), std::find_if(
@@ -274,29 +652,266 @@ void base64_decode(const std::string & src, std::vector<char> &dst)
 }
 
 namespace utf8 {
-#if GNUC_4_8
-#else
-		static std::wstring_convert<std::codecvt_utf8<char_t>, char_t> convert;
+
+// length of the leading ASCII run, checked by 32/16 bytes when possible
+static inline size_t ascii_prefix(const unsigned char *s, size_t size)
+{
+	size_t i = 0;
+#if defined(__AVX2__)
+	for (; i + 32 <= size; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+		if (_mm256_movemask_epi8(v))
+			break;
+	}
 #endif
+#ifdef AIFIL_UTF8_SSE2
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+		if (_mm_movemask_epi8(v))
+			break;
+	}
+#endif
+	while (i < size && s[i] < 0x80)
+		++i;
+	return i;
+}
 
-std::string encode(const string &str)
+// decode one non-ASCII sequence, return its length or 0 if it is invalid
+static inline int next_code_point(const unsigned char *s, size_t avail, uint32_t &cp)
+{
+	unsigned c = s[0];
+	if (c < 0xC2)  // continuation byte or overlong 2-byte sequence
+		return 0;
+	if (c < 0xE0)
+	{
+		if (avail < 2 || (s[1] & 0xC0) != 0x80)
+			return 0;
+		cp = ((c & 0x1F) << 6) | (s[1] & 0x3F);
+		return 2;
+	}
+	if (c < 0xF0)
+	{
+		if (avail < 3 || (s[1] & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80)
+			return 0;
+		cp = ((c & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+		if (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF))
+			return 0;
+		return 3;
+	}
+	if (c < 0xF5)
+	{
+		if (avail < 4 || (s[1] & 0xC0) != 0x80 ||
+			(s[2] & 0xC0) != 0x80 || (s[3] & 0xC0) != 0x80)
+			return 0;
+		cp = ((c & 0x07) << 18) | ((s[1] & 0x3F) << 12) |
+			((s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+		if (cp < 0x10000 || cp > 0x10FFFF)
+			return 0;
+		return 4;
+	}
+	return 0;
+}
+
+static inline int popcount(unsigned v)
+{
+	int res = 0;
+	for (; v; v &= v - 1)
+		++res;
+	return res;
+}
+
+bool validate(const char *data, size_t size, size_t *error_pos)
+{
+	const unsigned char *s = (const unsigned char*)data;
+	size_t i = 0;
+	for (;;)
+	{
+		i += ascii_prefix(s + i, size - i);
+		if (i == size)
+			return true;
+		uint32_t cp;
+		int n = next_code_point(s + i, size - i, cp);
+		if (!n)
+		{
+			if (error_pos)
+				*error_pos = i;
+			return false;
+		}
+		i += n;
+	}
+}
+
+size_t decoded_length(const char *data, size_t size)
+{
+	// one unit per non-continuation byte plus one more per 4-byte sequence
+	const unsigned char *s = (const unsigned char*)data;
+	size_t res = 0;
+	size_t i = 0;
+#ifdef AIFIL_UTF8_SSE2
+	const __m128i cont_bound = _mm_set1_epi8(char(0xC0));
+	const __m128i lead4_bound = _mm_set1_epi8(char(0xF0));
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+		int cont = _mm_movemask_epi8(_mm_cmplt_epi8(v, cont_bound));
+		int lead4 = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, lead4_bound), v));
+		res += 16 - popcount(cont) + popcount(lead4);
+	}
+#endif
+	for (; i < size; ++i)
+		res += ((s[i] & 0xC0) != 0x80) + (s[i] >= 0xF0);
+	return res;
+}
+
+size_t encoded_length(const char_t *data, size_t size)
 {
-#if GNUC_4_8
-#else
-	return convert.to_bytes(str);
+	// surrogate units give 2 bytes each, 4 bytes per pair
+	size_t res = 0;
+	size_t i = 0;
+#ifdef AIFIL_UTF8_SSE2
+	const __m128i sign = _mm_set1_epi16(short(0x8000));
+	const __m128i bound_80 = _mm_set1_epi16(short(0x007F ^ 0x8000));
+	const __m128i bound_800 = _mm_set1_epi16(short(0x07FF ^ 0x8000));
+	const __m128i surr_mask = _mm_set1_epi16(short(0xF800));
+	const __m128i surr_val = _mm_set1_epi16(short(0xD800));
+	for (; i + 8 <= size; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+		__m128i vs = _mm_xor_si128(v, sign);
+		__m128i ge80 = _mm_cmpgt_epi16(vs, bound_80);
+		__m128i ge800 = _mm_cmpgt_epi16(vs, bound_800);
+		__m128i surr = _mm_cmpeq_epi16(_mm_and_si128(v, surr_mask), surr_val);
+		// movemask yields two bits per 16-bit lane
+		res += 8 + (popcount(_mm_movemask_epi8(ge80)) +
+			popcount(_mm_movemask_epi8(_mm_andnot_si128(surr, ge800)))) / 2;
+	}
 #endif
-	af_assert(true); //not implemented
+	for (; i < size; ++i)
+	{
+		char_t c = data[i];
+		res += 1 + (c >= 0x80) + (c >= 0x800 && (c & 0xF800) != 0xD800);
+	}
+	return res;
 }
 
-utf8::string decode(const std::string &str)
+size_t decode(const char *src, size_t size, char_t *dst)
 {
-#if GNUC_4_8
-#else
-	return convert.from_bytes(str);
+	const unsigned char *s = (const unsigned char*)src;
+	char_t *out = dst;
+	size_t i = 0;
+	while (i < size)
+	{
+#ifdef AIFIL_UTF8_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 16 <= size; i += 16, out += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+			if (_mm_movemask_epi8(v))
+				break;
+			_mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi8(v, zero));
+			_mm_storeu_si128((__m128i*)(out + 8), _mm_unpackhi_epi8(v, zero));
+		}
 #endif
-	af_assert(true); //not implemented
+		for (; i < size && s[i] < 0x80; ++i)
+			*out++ = s[i];
+		if (i == size)
+			break;
+
+		uint32_t cp;
+		int n = next_code_point(s + i, size - i, cp);
+		if (!n)
+			throw std::range_error(stdprintf("utf8: invalid sequence at byte %zu", i));
+		i += n;
+		if (cp < 0x10000)
+			*out++ = char_t(cp);
+		else
+		{
+			cp -= 0x10000;
+			*out++ = char_t(0xD800 | (cp >> 10));
+			*out++ = char_t(0xDC00 | (cp & 0x3FF));
+		}
+	}
+	return out - dst;
+}
+
+size_t encode(const char_t *src, size_t size, char *dst)
+{
+	char *out = dst;
+	size_t i = 0;
+	while (i < size)
+	{
+#ifdef AIFIL_UTF8_SSE2
+		const __m128i non_ascii = _mm_set1_epi16(short(0xFF80));
+		for (; i + 16 <= size; i += 16, out += 16)
+		{
+			__m128i lo = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i hi = _mm_loadu_si128((const __m128i*)(src + i + 8));
+			__m128i test = _mm_and_si128(_mm_or_si128(lo, hi), non_ascii);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(test, _mm_setzero_si128())) != 0xFFFF)
+				break;
+			_mm_storeu_si128((__m128i*)out, _mm_packus_epi16(lo, hi));
+		}
+#endif
+		for (; i < size && src[i] < 0x80; ++i)
+			*out++ = char(src[i]);
+		if (i == size)
+			break;
+
+		uint32_t cp = src[i];
+		if (cp < 0x800)
+		{
+			*out++ = char(0xC0 | (cp >> 6));
+			*out++ = char(0x80 | (cp & 0x3F));
+			++i;
+			continue;
+		}
+		if ((cp & 0xF800) != 0xD800)
+		{
+			*out++ = char(0xE0 | (cp >> 12));
+			*out++ = char(0x80 | ((cp >> 6) & 0x3F));
+			*out++ = char(0x80 | (cp & 0x3F));
+			++i;
+			continue;
+		}
+		if (cp >= 0xDC00 || i + 1 == size || (src[i + 1] & 0xFC00) != 0xDC00)
+			throw std::range_error(stdprintf("utf8: unpaired surrogate at unit %zu", i));
+		cp = 0x10000 + (((cp & 0x3FF) << 10) | (src[i + 1] & 0x3FF));
+		*out++ = char(0xF0 | (cp >> 18));
+		*out++ = char(0x80 | ((cp >> 12) & 0x3F));
+		*out++ = char(0x80 | ((cp >> 6) & 0x3F));
+		*out++ = char(0x80 | (cp & 0x3F));
+		i += 2;
+	}
+	return out - dst;
+}
+
+void decode(const StringSlice &src, string &dst)
+{
+	dst.resize(decoded_length(src.data(), src.size()));
+	dst.resize(decode(src.data(), src.size(), &dst[0]));
+}
+
+void encode(const string &src, std::string &dst)
+{
+	dst.resize(encoded_length(src.data(), src.size()));
+	dst.resize(encode(src.data(), src.size(), &dst[0]));
+}
+
+std::string encode(const string &str)
+{
+	std::string res;
+	encode(str, res);
+	return res;
+}
+
+string decode(const std::string &str)
+{
+	string res;
+	decode(str, res);
+	return res;
 }
-		
 
 }
 
@@ -3,6 +3,10 @@
 
 #include "c_attribs.hpp"
 
+#include <cstdarg>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
 #include <list>
 #include <stdint.h>
 #include <string>
@@ -38,6 +42,186 @@ std::vector<std::string> split(const std::string &s, const std::string &delimite
 std::vector<std::string> split_by_substr(
 		const std::string &s, const std::string &delim_substr, const bool only_first = false);
 
+/**
+ * @brief Non-owning view of a character range (C++11 replacement of string_view).
+ * Referenced memory must outlive the slice.
+ */
+class StringSlice
+{
+public:
+	static const size_t npos = size_t(-1);
+
+	StringSlice() : ptr(""), len(0) {}
+	StringSlice(const char *data, size_t size) : ptr(data), len(size) {}
+	StringSlice(const char *cstr) : ptr(cstr), len(strlen(cstr)) {}
+	StringSlice(const std::string &str) : ptr(str.data()), len(str.size()) {}
+
+	const char* data() const { return ptr; }
+	size_t size() const { return len; }
+	bool empty() const { return !len; }
+	const char* begin() const { return ptr; }
+	const char* end() const { return ptr + len; }
+	char operator[](size_t i) const { return ptr[i]; }
+
+	std::string str() const { return std::string(ptr, len); }
+
+	StringSlice substr(size_t pos, size_t count = npos) const;
+	size_t find(char ch, size_t pos = 0) const;
+	size_t find(const StringSlice &sub, size_t pos = 0) const;
+	size_t find_first_of(const StringSlice &chars, size_t pos = 0) const;
+	bool starts_with(const StringSlice &prefix) const;
+
+	bool operator==(const StringSlice &other) const
+	{
+		return len == other.len && !memcmp(ptr, other.ptr, len);
+	}
+	bool operator!=(const StringSlice &other) const { return !(*this == other); }
+	bool operator<(const StringSlice &other) const;
+
+private:
+	const char *ptr;
+	size_t len;
+};
+
+/**
+ * @brief Lazy splitter yielding StringSlice tokens without allocations.
+ * Tokenization rules are the same as in corresponding split() functions:
+ * SPLIT_CHAR keeps empty tokens (except trailing one) like std::getline,
+ * SPLIT_ANY_OF and SPLIT_SUBSTR skip empty tokens.
+ * @code{.cpp}
+ * for (auto token: aifil::split_slices(line, ','))
+ *     process(token.data(), token.size());
+ * @endcode
+ */
+class SplitRange
+{
+public:
+	enum MODE {
+		SPLIT_CHAR,
+		SPLIT_ANY_OF,
+		SPLIT_SUBSTR
+	};
+
+	class iterator
+	{
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef StringSlice value_type;
+		typedef ptrdiff_t difference_type;
+		typedef const StringSlice* pointer;
+		typedef const StringSlice& reference;
+
+		iterator() : owner(0), pos(StringSlice::npos) {}
+
+		const StringSlice& operator*() const { return token; }
+		const StringSlice* operator->() const { return &token; }
+		iterator& operator++() { advance(); return *this; }
+		iterator operator++(int) { iterator tmp = *this; advance(); return tmp; }
+		bool operator==(const iterator &other) const { return pos == other.pos; }
+		bool operator!=(const iterator &other) const { return pos != other.pos; }
+
+	private:
+		friend class SplitRange;
+		iterator(const SplitRange *range) : owner(range), pos(0) { advance(); }
+		void advance();
+
+		const SplitRange *owner;
+		size_t pos;  // position of the next token search, npos at the end
+		StringSlice token;
+	};
+
+	SplitRange(const StringSlice &input, char delimiter) :
+		input(input), delim_char(delimiter), mode(SPLIT_CHAR) {}
+	SplitRange(const StringSlice &input, const StringSlice &delimiter, MODE mode) :
+		input(input), delim(delimiter), delim_char(0), mode(mode) {}
+
+	iterator begin() const { return iterator(this); }
+	iterator end() const { return iterator(); }
+
+	// tokens count (walks the whole input)
+	size_t count() const;
+	// store tokens into the vector reusing its capacity
+	void to_vector(std::vector<StringSlice> &dst) const;
+
+private:
+	StringSlice input;
+	StringSlice delim;
+	char delim_char;
+	MODE mode;
+};
+
+// lazy versions of split() and split_by_substr()
+inline SplitRange split_slices(const StringSlice &s, char delim)
+{
+	return SplitRange(s, delim);
+}
+SplitRange split_slices(const StringSlice &s, const StringSlice &delimiters);
+SplitRange split_slices_by_substr(const StringSlice &s, const StringSlice &delim_substr);
+
+/**
+ * @brief printf-like formatting into existing string reusing its capacity.
+ * Arguments must not point into dst (like stdprintf(dst, "%s", dst.c_str())):
+ * dst is resized before long results are formatted.
+ * @param dst [out] Destination, previous content is replaced.
+ * @return Formatted string length.
+ */
+size_t stdprintf(std::string &dst, const char* fmt, ...) AF_FORMAT(printf, 2, 3);
+// the same as above but appends to dst
+size_t stdprintf_append(std::string &dst, const char* fmt, ...) AF_FORMAT(printf, 2, 3);
+
+/**
+ * @brief printf-like formatter with small inplace buffer.
+ * Heap is used only if result does not fit into the inplace storage,
+ * heap storage is kept for the next calls.
+ * Arguments must not point into the buffer itself (see stdprintf()).
+ */
+class FormatBuffer
+{
+public:
+	FormatBuffer() : len(0), on_heap(false) { local[0] = 0; }
+
+	const char* printf(const char *fmt, ...) AF_FORMAT(printf, 2, 3);
+	const char* append(const char *fmt, ...) AF_FORMAT(printf, 2, 3);
+	void clear() { len = 0; on_heap = false; local[0] = 0; }
+
+	const char* c_str() const { return on_heap ? heap.c_str() : local; }
+	size_t size() const { return len; }
+	StringSlice slice() const { return StringSlice(c_str(), len); }
+	std::string str() const { return std::string(c_str(), len); }
+
+private:
+	const char* vformat(bool append, const char *fmt, va_list ap);
+
+	char local[256];
+	std::string heap;
+	size_t len;
+	bool on_heap;
+};
+
+/**
+ * @brief Fast integer to decimal string conversion (std::to_chars analogue).
+ * Nothing is written if [first, last) is too small.
+ * @return Pointer past the last written character or 0 on overflow.
+ */
+char* to_chars(char *first, char *last, int64_t value);
+char* to_chars(char *first, char *last, uint64_t value);
+inline char* to_chars(char *first, char *last, int value)
+{
+	return to_chars(first, last, int64_t(value));
+}
+inline char* to_chars(char *first, char *last, unsigned value)
+{
+	return to_chars(first, last, uint64_t(value));
+}
+
+/**
+ * @brief Fixed-point float formatting, output is identical to "%.<precision>f".
+ * Uses integer arithmetic while value * 10^precision is below 2^50
+ * and falls back to snprintf for larger values and near-ties.
+ * @return Pointer past the last written character or 0 on overflow.
+ */
+char* to_chars(char *first, char *last, double value, int precision);
+
 std::string& ltrim(std::string &s);  // trim from begin
 std::string& rtrim(std::string &s);  // trim from end
 std::string& strip(std::string &s);
@@ -72,8 +256,36 @@ namespace utf8
 typedef char16_t char_t;
 typedef std::u16string string;
 
+// UTF-16 <-> UTF-8, std::range_error is thrown on invalid input
 std::string encode(const string &str);
 string decode(const std::string &str);
+// the same as above but reusing dst capacity
+void encode(const string &src, std::string &dst);
+void decode(const StringSlice &src, string &dst);
+
+/**
+ * @brief Strict UTF-8 check: overlong forms, surrogates,
+ * code points above U+10FFFF and truncated sequences are rejected.
+ * @param error_pos [out] Offset of the first invalid sequence (optional).
+ */
+bool validate(const char *data, size_t size, size_t *error_pos = 0);
+inline bool validate(const StringSlice &str, size_t *error_pos = 0)
+{
+	return validate(str.data(), str.size(), error_pos);
+}
+
+// UTF-16 units count for valid UTF-8 input (input is not validated)
+size_t decoded_length(const char *data, size_t size);
+// UTF-8 bytes count for UTF-16 input (input is not validated)
+size_t encoded_length(const char_t *data, size_t size);
+
+/**
+ * @brief Transcoding into preallocated buffers of
+ * decoded_length()/encoded_length() size; never writes more than that.
+ * @return Written units count.
+ */
+size_t decode(const char *src, size_t size, char_t *dst);
+size_t encode(const char_t *src, size_t size, char *dst);
 }
 
 //typedef std::list<std::string> csv_list;
@@ -0,0 +1,230 @@
+#include "thread-pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace aifil {
+
+// pool and worker index of the current thread
+static thread_local const ThreadPool *current_pool = 0;
+static thread_local int current_worker = -1;
+
+ThreadPool::ThreadPool(int threads) : queued(0), next_victim(0), stopping(false)
+{
+	if (threads <= 0)
+		threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+	for (int i = 0; i < threads; ++i)
+		workers.emplace_back(new Worker);
+	for (int i = 0; i < threads; ++i)
+		workers[i]->thread = std::thread(&ThreadPool::worker_loop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	sleep_cond.notify_all();
+	for (auto &worker: workers)
+		worker->thread.join();
+}
+
+int ThreadPool::worker_index() const
+{
+	return current_pool == this ? current_worker : -1;
+}
+
+void ThreadPool::submit(Task task)
+{
+	int self = worker_index();
+	int target = self >= 0 ? self : int(next_victim++ % workers.size());
+	{
+		std::lock_guard<std::mutex> lock(workers[target]->mutex);
+		workers[target]->tasks.push_back(std::move(task));
+	}
+	{
+		// under the lock to not lose wake-up of the worker going to sleep
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		++queued;
+	}
+	sleep_cond.notify_one();
+}
+
+bool ThreadPool::pop_task(int self, Task &task)
+{
+	if (!queued.load())
+		return false;
+
+	int count = int(workers.size());
+	if (self >= 0)
+	{
+		Worker &own = *workers[self];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty())
+		{
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			--queued;
+			return true;
+		}
+	}
+
+	int start = self >= 0 ? self + 1 : 0;
+	for (int i = 0; i < count; ++i)
+	{
+		Worker &victim = *workers[(start + i) % count];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			--queued;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ThreadPool::run_pending()
+{
+	Task task;
+	if (!pop_task(worker_index(), task))
+		return false;
+	task();
+	return true;
+}
+
+void ThreadPool::worker_loop(int index)
+{
+	current_pool = this;
+	current_worker = index;
+
+	for (;;)
+	{
+		Task task;
+		if (pop_task(index, task))
+		{
+			task();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		sleep_cond.wait(lock, [this] { return stopping || queued.load() > 0; });
+		if (stopping && !queued.load())
+			return;
+	}
+}
+
+ThreadPool& ThreadPool::global()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+TaskGroup::TaskGroup(ThreadPool &pool) : pool(pool), pending(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+	try
+	{
+		wait();
+	}
+	catch (...)
+	{
+		// exception is lost if nobody called wait() explicitly
+	}
+}
+
+void TaskGroup::run(ThreadPool::Task task)
+{
+	++pending;
+	pool.submit([this, task] {
+		try
+		{
+			task();
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!error)
+				error = std::current_exception();
+		}
+		finish_task();
+	});
+}
+
+void TaskGroup::finish_task()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (--pending == 0)
+		done_cond.notify_all();
+}
+
+void TaskGroup::wait()
+{
+	while (pending.load())
+	{
+		if (pool.run_pending())
+			continue;
+		// nothing to help with: tasks of this group are running elsewhere
+		std::unique_lock<std::mutex> lock(mutex);
+		done_cond.wait_for(lock, std::chrono::milliseconds(1),
+				[this] { return !pending.load(); });
+	}
+
+	std::exception_ptr to_throw;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::swap(to_throw, error);
+	}
+	if (to_throw)
+		std::rethrow_exception(to_throw);
+}
+
+void parallel_for(int begin, int end, const std::function<void(int, int)> &body,
+		int grain, ThreadPool &pool)
+{
+	if (end <= begin)
+		return;
+	grain = std::max(grain, 1);
+	int total = end - begin;
+	// several chunks per thread to balance uneven work
+	int chunks = std::min((total + grain - 1) / grain, pool.size() * 4);
+	if (chunks <= 1)
+	{
+		body(begin, end);
+		return;
+	}
+
+	TaskGroup group(pool);
+	int step = total / chunks;
+	int rest = total % chunks;
+	int chunk_begin = begin;
+	for (int i = 0; i < chunks; ++i)
+	{
+		int chunk_end = chunk_begin + step + (i < rest ? 1 : 0);
+		if (i == chunks - 1)
+		{
+			// the last chunk is processed by the calling thread
+			try
+			{
+				body(chunk_begin, chunk_end);
+			}
+			catch (...)
+			{
+				group.wait();
+				throw;
+			}
+			break;
+		}
+		group.run([&body, chunk_begin, chunk_end] { body(chunk_begin, chunk_end); });
+		chunk_begin = chunk_end;
+	}
+	group.wait();
+}
+
+}  // namespace aifil
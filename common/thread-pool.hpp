@@ -0,0 +1,107 @@
+#ifndef AIFIL_THREAD_POOL_H
+#define AIFIL_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace aifil {
+
+/**
+ * @brief Work-stealing thread pool.
+ * Every worker has its own task deque: the owner takes the newest task,
+ * idle workers steal the oldest ones from the others.
+ * Tasks submitted from a worker go to its own deque, so recursive
+ * algorithms (tree walks, divide and conquer) keep locality.
+ */
+class ThreadPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	// threads == 0 means std::thread::hardware_concurrency()
+	explicit ThreadPool(int threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int size() const { return int(workers.size()); }
+
+	void submit(Task task);
+
+	/**
+	 * @brief Run one queued task in the calling thread.
+	 * Used by waiting threads to help instead of blocking.
+	 * @return false if there was nothing to run.
+	 */
+	bool run_pending();
+
+	// index of current worker in this pool or -1 for foreign threads
+	int worker_index() const;
+
+	// process-wide pool with hardware_concurrency() threads
+	static ThreadPool& global();
+
+private:
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		std::thread thread;
+	};
+
+	bool pop_task(int self, Task &task);
+	void worker_loop(int index);
+
+	std::vector<std::unique_ptr<Worker> > workers;
+	std::atomic<int> queued;
+	std::atomic<unsigned> next_victim;
+	std::mutex sleep_mutex;
+	std::condition_variable sleep_cond;
+	bool stopping;
+};
+
+/**
+ * @brief Set of tasks which can be waited for.
+ * wait() executes queued tasks while waiting, so it is safe
+ * to wait from the pool threads (nested parallelism).
+ * The first exception thrown by a task is rethrown from wait().
+ */
+class TaskGroup
+{
+public:
+	explicit TaskGroup(ThreadPool &pool = ThreadPool::global());
+	~TaskGroup();
+
+	void run(ThreadPool::Task task);
+	void wait();
+
+private:
+	void finish_task();
+
+	ThreadPool &pool;
+	std::atomic<int> pending;
+	std::mutex mutex;
+	std::condition_variable done_cond;
+	std::exception_ptr error;
+};
+
+/**
+ * @brief Parallel loop over [begin, end).
+ * Range is split into chunks of at least 'grain' iterations,
+ * body(chunk_begin, chunk_end) is called for each chunk.
+ * Calling thread takes part in the work.
+ */
+void parallel_for(int begin, int end, const std::function<void(int, int)> &body,
+		int grain = 1, ThreadPool &pool = ThreadPool::global());
+
+}  // namespace aifil
+
+#endif  // AIFIL_THREAD_POOL_H
@@ -3,6 +3,7 @@
 #include "stringutils.hpp"
 
 #include <chrono>
+#include <limits>
 
 #ifdef HAVE_BOOST
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -52,25 +53,265 @@ std::time_t get_system_time_ms()
 
 std::string get_current_date_and_time()
 {
-	auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-	char time_buf[30];
-	strftime(time_buf, 30, "%F-%T", std::localtime(&now));
-
-	return std::string(time_buf);
+	static thread_local TimestampFormatter formatter(true, DATETIME_DASH);
+	return formatter.now();
 }
 	
 std::string date_time_from_ts(std::chrono::milliseconds ts)
 {
-	static const int DATE_TIME_BUFFER_SIZE = 256;
-	static const std::string IMAGE_NAME_TIME_FORMAT = "%Y-%m-%d-%H:%M:%S";
-	
-	time_t readable_time = ts.count() / 1000;
-	char date_time[DATE_TIME_BUFFER_SIZE];
-	strftime(date_time, sizeof(date_time), IMAGE_NAME_TIME_FORMAT.c_str(), localtime(&readable_time));
-	
-	return date_time;
+	static thread_local TimestampFormatter formatter(true, DATETIME_DASH);
+	// whole seconds are rounded toward zero like in time_t conversion
+	return formatter.format(ts.count() / 1000 * 1000);
 }
-	
+
+// days since 1970-01-01 for proleptic Gregorian calendar date
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+	y -= m <= 2;
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = unsigned(y - era * 400);
+	unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + int64_t(doe) - 719468;
+}
+
+static void civil_from_days(int64_t z, int64_t &y, unsigned &m, unsigned &d)
+{
+	z += 719468;
+	int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+	unsigned doe = unsigned(z - era * 146097);
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+	d = doy - (153 * mp + 2) / 5 + 1;
+	m = mp < 10 ? mp + 3 : mp - 9;
+	y = int64_t(yoe) + era * 400 + (m <= 2);
+}
+
+static int days_in_month(int year, int month)
+{
+	static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+	return month == 2 && leap ? 29 : days[month - 1];
+}
+
+static inline int64_t floor_div(int64_t a, int64_t b)
+{
+	return a / b - (a % b < 0);
+}
+
+static inline char* put_digits(char *p, unsigned value, int count)
+{
+	for (int i = count - 1; i >= 0; --i, value /= 10)
+		p[i] = char('0' + value % 10);
+	return p + count;
+}
+
+// local time zone offset in seconds for the given moment
+static int local_tz_offset(int64_t sec)
+{
+	time_t t = time_t(sec);
+	std::tm tm_local;
+#ifdef _WIN32
+	if (localtime_s(&tm_local, &t))
+		return 0;
+#else
+	if (!localtime_r(&t, &tm_local))
+		return 0;
+#endif
+	int64_t local_sec = days_from_civil(tm_local.tm_year + 1900, tm_local.tm_mon + 1,
+			tm_local.tm_mday) * 86400 + tm_local.tm_hour * 3600 +
+			tm_local.tm_min * 60 + tm_local.tm_sec;
+	return int(local_sec - sec);
+}
+
+// "YYYY-MM-DD hh:mm:ss" for the local seconds, returns 0 on overflow
+static char* format_seconds(char *first, char *last, int64_t local_sec, int flags)
+{
+	int64_t days = floor_div(local_sec, 86400);
+	int64_t day_sec = local_sec - days * 86400;
+	int64_t year;
+	unsigned month, day;
+	civil_from_days(days, year, month, day);
+	if (year < 0 || year > 9999 || last - first < 19)
+		return 0;
+
+	char *p = put_digits(first, unsigned(year), 4);
+	*p++ = '-';
+	p = put_digits(p, month, 2);
+	*p++ = '-';
+	p = put_digits(p, day, 2);
+	*p++ = flags & DATETIME_T ? 'T' : (flags & DATETIME_DASH ? '-' : ' ');
+	p = put_digits(p, unsigned(day_sec / 3600), 2);
+	*p++ = ':';
+	p = put_digits(p, unsigned(day_sec / 60 % 60), 2);
+	*p++ = ':';
+	return put_digits(p, unsigned(day_sec % 60), 2);
+}
+
+// offset_sec is applied, tz_offset (minutes) is printed only
+static char* format_datetime_impl(char *first, char *last, int64_t utc,
+		int64_t offset_sec, int tz_offset, int flags)
+{
+	int64_t local_ms = utc + offset_sec * 1000;
+	int64_t sec = floor_div(local_ms, 1000);
+	char *p = format_seconds(first, last, sec, flags);
+	if (!p)
+		return 0;
+	if (flags & DATETIME_MS)
+	{
+		if (last - p < 4)
+			return 0;
+		*p++ = '.';
+		p = put_digits(p, unsigned(local_ms - sec * 1000), 3);
+	}
+	if (flags & DATETIME_TZ)
+	{
+		if (last - p < 6)
+			return 0;
+		*p++ = tz_offset < 0 ? '-' : '+';
+		unsigned abs_offset = unsigned(tz_offset < 0 ? -tz_offset : tz_offset);
+		p = put_digits(p, abs_offset / 60, 2);
+		*p++ = ':';
+		p = put_digits(p, abs_offset % 60, 2);
+	}
+	return p;
+}
+
+char* format_datetime(char *first, char *last, int64_t utc, int tz_offset, int flags)
+{
+	return format_datetime_impl(first, last, utc, int64_t(tz_offset) * 60, tz_offset, flags);
+}
+
+std::string format_datetime(int64_t utc, int tz_offset, int flags)
+{
+	char buf[40];
+	char *end = format_datetime(buf, buf + sizeof(buf), utc, tz_offset, flags);
+	return end ? std::string(buf, end) : std::string();
+}
+
+TimestampFormatter::TimestampFormatter(bool local_time, int flags) :
+	cached_second(std::numeric_limits<int64_t>::min()), flags(flags), local_time(local_time), len(0), ms_pos(0)
+{
+	buf[0] = 0;
+}
+
+const char* TimestampFormatter::format(int64_t utc)
+{
+	int64_t sec = floor_div(utc, 1000);
+	if (sec != cached_second)
+	{
+		// historical zones may have offsets with seconds
+		int offset_sec = local_time ? local_tz_offset(sec) : 0;
+		char *end = format_datetime_impl(buf, buf + sizeof(buf) - 1,
+				sec * 1000, offset_sec, offset_sec / 60, flags);
+		if (!end)
+		{
+			cached_second = std::numeric_limits<int64_t>::min();
+			len = 0;
+			buf[0] = 0;
+			return buf;
+		}
+		*end = 0;
+		len = end - buf;
+		ms_pos = 20;  // "YYYY-MM-DD hh:mm:ss."
+		cached_second = sec;
+	}
+	if (flags & DATETIME_MS)
+		put_digits(buf + ms_pos, unsigned(utc - sec * 1000), 3);
+	return buf;
+}
+
+const char* TimestampFormatter::now()
+{
+	return format(std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+static inline bool parse_digits(const char *s, int count, int &value)
+{
+	value = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		unsigned digit = unsigned(s[i] - '0');
+		if (digit > 9)
+			return false;
+		value = value * 10 + int(digit);
+	}
+	return true;
+}
+
+/*
+ * Strict form of the default format. Every input accepted here
+ * is parsed by boost in the same way; boost also accepts a lot of
+ * irregular inputs (trailing garbage, 24:00:00, +5:3 offsets...),
+ * those are left for the fallback.
+ */
+static bool parse_datetime_strict(const char *s, size_t size, int64_t &utc)
+{
+	int year, month, day, hour, minute, second;
+	if (size < 19 ||
+		!parse_digits(s, 4, year) || s[4] != '-' ||
+		!parse_digits(s + 5, 2, month) || s[7] != '-' ||
+		!parse_digits(s + 8, 2, day) || (s[10] != ' ' && s[10] != 'T') ||
+		!parse_digits(s + 11, 2, hour) || s[13] != ':' ||
+		!parse_digits(s + 14, 2, minute) || s[16] != ':' ||
+		!parse_digits(s + 17, 2, second))
+		return false;
+	if (year < 1400 || month < 1 || month > 12 || day < 1 ||
+		day > days_in_month(year, month) || hour > 23 || minute > 59 || second > 59)
+		return false;
+
+	size_t pos = 19;
+	int64_t micro = 0;
+	if (pos < size && s[pos] == '.')
+	{
+		// microseconds resolution, the rest digits are truncated
+		size_t start = ++pos;
+		int scale = 100000;
+		for ( ; pos < size && unsigned(s[pos] - '0') <= 9; ++pos, scale /= 10)
+			micro += (s[pos] - '0') * scale;
+		if (pos == start || pos - start > 9)
+			return false;
+	}
+
+	int offset = 0;
+	if (pos < size)
+	{
+		char sign = s[pos];
+		size_t rest = size - pos;
+		if (sign == 'Z' && rest == 1)
+			offset = 0;
+		else if ((sign == '+' || sign == '-') && (rest == 3 || rest == 6))
+		{
+			int tz_hours, tz_minutes = 0;
+			if (!parse_digits(s + pos + 1, 2, tz_hours))
+				return false;
+			if (rest == 6 && (s[pos + 3] != ':' ||
+				!parse_digits(s + pos + 4, 2, tz_minutes) || tz_minutes > 59))
+				return false;
+			offset = tz_hours * 60 + tz_minutes;
+			if (offset > (sign == '+' ? 14 * 60 : 12 * 60))
+				return false;
+			if (sign == '-')
+				offset = -offset;
+		}
+		else
+			return false;
+	}
+
+	int64_t sec = days_from_civil(year, month, day) * 86400 +
+			hour * 3600 + minute * 60 + second - offset * 60;
+	// boost supports years 1400..9999 after conversion to UTC too
+	static const int64_t min_sec = days_from_civil(1400, 1, 1) * 86400;
+	static const int64_t max_sec = days_from_civil(10000, 1, 1) * 86400;
+	if (sec < min_sec || sec >= max_sec)
+		return false;
+	// total_milliseconds() of boost duration rounds toward zero
+	utc = (sec * 1000000 + micro) / 1000;
+	return true;
+}
+
 #ifdef HAVE_BOOST
 int64_t iso_to_unix_time(const std::string & iso_time)
 {
@@ -112,7 +353,8 @@ int64_t get_current_local_unix_time_ms()
 	return (microsec_clock::local_time() - epoch).total_milliseconds();
 }
 
-bool parse_datetime(const std::string &datetime, int64_t &utc, const std::string &format)
+static bool parse_datetime_boost(
+		const std::string &datetime, int64_t &utc, const std::string &format)
 {
 	utc = 0;
 	try
@@ -141,7 +383,25 @@ bool parse_datetime(const std::string &datetime, int64_t &utc, const std::string
 	return true;
 }
 
+bool parse_datetime(const std::string &datetime, int64_t &utc, const std::string &format)
+{
+	if (format == "%Y-%m-%d %H:%M:%S%F %ZP")
+		return parse_datetime(datetime.data(), datetime.size(), utc);
+	return parse_datetime_boost(datetime, utc, format);
+}
+
 #endif  // HAVE_BOOST
 
+bool parse_datetime(const char *data, size_t size, int64_t &utc)
+{
+	if (parse_datetime_strict(data, size, utc))
+		return true;
+#ifdef HAVE_BOOST
+	return parse_datetime_boost(std::string(data, size), utc, "%Y-%m-%d %H:%M:%S%F %ZP");
+#else
+	utc = 0;
+	return false;
+#endif
+}
 	
 } //namespace aifil
@@ -4,6 +4,7 @@
 #include <string>
 #include <ctime>
 #include <chrono>
+#include <stdint.h>
 
 
 namespace aifil
@@ -24,6 +25,58 @@ std::string get_current_date_and_time();
 * @return Форматированная строка с датой и временем YYYY-MM-DD-hh:mm:ss.
 */
 std::string date_time_from_ts(std::chrono::milliseconds ts);
+
+enum DATETIME_FORMAT {
+	DATETIME_MS = 0x1,    // ".mmm" after seconds
+	DATETIME_TZ = 0x2,    // "+hh:mm" offset suffix
+	DATETIME_T = 0x4,     // 'T' between date and time (' ' by default)
+	DATETIME_DASH = 0x8   // '-' between date and time
+};
+
+/**
+ * @brief Format timestamp as YYYY-MM-DD hh:mm:ss[.mmm][+hh:mm] without allocations.
+ * @param utc [in] UTC time in milliseconds.
+ * @param tz_offset [in] Time zone offset of the output in minutes (+05:00 is 300).
+ * @param flags [in] DATETIME_FORMAT combination.
+ * @return Pointer past the last written character or 0 if buffer is too small.
+ */
+char* format_datetime(char *first, char *last, int64_t utc, int tz_offset = 0,
+		int flags = DATETIME_MS);
+std::string format_datetime(int64_t utc, int tz_offset = 0, int flags = DATETIME_MS);
+
+/**
+ * @brief Timestamps formatter for logs: date and time are reformatted
+ * once per second, only milliseconds are updated for other calls.
+ * Not thread-safe, use one instance per thread.
+ */
+class TimestampFormatter
+{
+public:
+	// local_time: use system time zone, UTC otherwise
+	explicit TimestampFormatter(bool local_time = true, int flags = DATETIME_MS);
+
+	// zero terminated result is valid until the next call
+	const char* format(int64_t utc);
+	const char* now();
+	size_t size() const { return len; }
+
+private:
+	int64_t cached_second;
+	int flags;
+	bool local_time;
+	size_t len;
+	size_t ms_pos;  // position of milliseconds digits
+	char buf[40];
+};
+
+/**
+ * @brief Strict ISO-8601 parser for the default parse_datetime() format
+ * working on the char span: YYYY-MM-DD[ T]hh:mm:ss[.f][Z|+hh|+hh:mm].
+ * Input not matching this strict form is passed to the boost parser
+ * (if available), so results are always the same as from
+ * parse_datetime(std::string(data, size), utc).
+ */
+bool parse_datetime(const char *data, size_t size, int64_t &utc);
 	
 #ifdef HAVE_BOOST
 int64_t iso_to_unix_time(const std::string & iso_time);
@@ -48,6 +101,7 @@ int64_t get_current_local_unix_time_ms();
  * @param format [in] пользовательский формат даты-времени (опционально)
  * по умолчанию -- 2000-01-01 12:00:00+00
  * см. подробнее в boost::local_time::local_time_input_facet
+ * Формат по умолчанию разбирается без boost (см. parse_datetime(const char*, size_t, int64_t&)).
  *
  * @return true -- если парсинг прошёл успешно, false -- если нет
  */
@@ -0,0 +1,426 @@
+/** @file components.cpp
+ *
+ *  @brief Connected components labeling and functions built on it.
+ *
+ *  Two-pass union-find over pixel indices: a pixel is linked to its already
+ *  visited neighbours, every tree is rooted at its smallest index (the first
+ *  pixel of component in raster order). Stripes of rows are linked in
+ *  parallel, then pixels near stripe borders are linked to the stripe above.
+ *  Roots are numbered per stripe with offsets of preceding stripes, area and
+ *  bounding box are gathered while labels are written. Components rooted in
+ *  stripes above enter a stripe through its top gap rows, so they are
+ *  collected there into a small sorted table instead of a hash map.
+ */
+#include "imgproc.hpp"
+#include "parallel.hpp"
+#include "scratch.hpp"
+
+#include <common/errutils.hpp>
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace aifil {
+namespace imgproc {
+
+namespace {
+
+//path halving: every visited pixel is linked to its grandparent
+inline int find_root(int *parent, int i)
+{
+	while (parent[i] != i)
+	{
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+inline void unite(int *parent, int a, int b)
+{
+	a = find_root(parent, a);
+	b = find_root(parent, b);
+	if (a < b)
+		parent[b] = a;
+	else if (b < a)
+		parent[a] = b;
+}
+
+//inclusive bounds and pixels count
+struct Box
+{
+	int x0, y0, x1, y1;
+	int area;
+
+	Box(): x0(INT_MAX), y0(INT_MAX), x1(-1), y1(-1), area(0) {}
+
+	void add(int x, int y)
+	{
+		x0 = std::min(x0, x);
+		y0 = std::min(y0, y);
+		x1 = std::max(x1, x);
+		y1 = std::max(y1, y);
+		++area;
+	}
+
+	void add(const Box &o)
+	{
+		x0 = std::min(x0, o.x0);
+		y0 = std::min(y0, o.y0);
+		x1 = std::max(x1, o.x1);
+		y1 = std::max(y1, o.y1);
+		area += o.area;
+	}
+
+	cv::Rect rect() const { return cv::Rect(x0, y0, x1 - x0 + 1, y1 - y0 + 1); }
+};
+
+struct Stripe
+{
+	int begin, end;
+	int first_label;  // labels of roots in stripe start here
+	int roots;
+	//components coming from stripes above pass through the top gap rows
+	//(or the whole stripe if it is lower): sorted labels and boxes in stripe
+	int *above_labels;
+	Box *above;
+	int above_count;
+};
+
+//connected_components() with boxes[i] of component with label i + 1,
+//all memory is taken from scratch of the caller
+int label_components(const cv::Mat &src, cv::Mat &labels, ScratchFrame &scratch,
+		Box *&boxes, int connectivity, int gap, uint8_t min_val, uint8_t max_val)
+{
+	const int w = src.cols;
+	const int h = src.rows;
+	labels.create(h, w, CV_32S);
+	boxes = 0;
+	if (src.empty())
+		return 0;
+
+	//already visited neighbours: rows above and pixels on the left
+	cv::Point *offsets = scratch.alloc<cv::Point>(size_t(gap + 1) * (2 * gap + 1));
+	int offsets_count = 0;
+	for (int dy = -gap; dy <= 0; ++dy)
+		for (int dx = -gap; dx <= gap; ++dx)
+		{
+			if (dy == 0 && dx >= 0)
+				break;
+			if (connectivity == 4 && std::abs(dx) - dy > gap)
+				continue;
+			offsets[offsets_count++] = cv::Point(dx, dy);
+		}
+
+	auto inside = [&](uint8_t v) { return v >= min_val && v <= max_val; };
+	int *par = scratch.alloc<int>(size_t(w) * h);
+
+	auto link = [&](int x, int y, int top) {
+		const int i = y * w + x;
+		for (int k = 0; k < offsets_count; ++k)
+		{
+			const int nx = x + offsets[k].x;
+			const int ny = y + offsets[k].y;
+			if (nx < 0 || nx >= w || ny < top)
+				continue;
+			if (inside(src.ptr(ny)[nx]))
+				unite(par, i, ny * w + nx);
+		}
+	};
+
+	int stripes_count = std::max(1, std::min(threads() * 4, h / 16));
+	Stripe *stripes = scratch.alloc<Stripe>(stripes_count);
+	for (int s = 0; s < stripes_count; ++s)
+	{
+		stripes[s].begin = int(int64_t(h) * s / stripes_count);
+		stripes[s].end = int(int64_t(h) * (s + 1) / stripes_count);
+	}
+
+	//first pass: links inside stripes
+	parallel_rows(stripes_count, [&](int begin, int end) {
+		for (int s = begin; s < end; ++s)
+		{
+			Stripe &st = stripes[s];
+			for (int y = st.begin; y < st.end; ++y)
+			{
+				const uint8_t *ps = src.ptr(y);
+				for (int x = 0; x < w; ++x)
+				{
+					if (!inside(ps[x]))
+						continue;
+					par[y * w + x] = y * w + x;
+					link(x, y, st.begin);
+				}
+			}
+		}
+	}, 1);
+
+	//links across stripe borders
+	for (int s = 1; s < stripes_count; ++s)
+	{
+		const int top = stripes[s].begin;
+		for (int y = top; y < std::min(top + gap, stripes[s].end); ++y)
+		{
+			const uint8_t *ps = src.ptr(y);
+			for (int x = 0; x < w; ++x)
+				if (inside(ps[x]))
+					link(x, y, 0);
+		}
+	}
+
+	//roots are numbered in raster order
+	parallel_rows(stripes_count, [&](int begin, int end) {
+		for (int s = begin; s < end; ++s)
+		{
+			Stripe &st = stripes[s];
+			st.roots = 0;
+			for (int y = st.begin; y < st.end; ++y)
+			{
+				const uint8_t *ps = src.ptr(y);
+				for (int x = 0; x < w; ++x)
+					st.roots += inside(ps[x]) && par[y * w + x] == y * w + x;
+			}
+		}
+	}, 1);
+	int count = 0;
+	for (int s = 0; s < stripes_count; ++s)
+	{
+		Stripe &st = stripes[s];
+		st.first_label = count + 1;
+		count += st.roots;
+		const size_t top_pixels = size_t(w) * (std::min(st.end, st.begin + gap) - st.begin);
+		st.above_labels = scratch.alloc<int>(top_pixels);
+		st.above = scratch.alloc<Box>(top_pixels);
+	}
+	boxes = scratch.alloc<Box>(count);
+	std::fill_n(boxes, count, Box());
+
+	parallel_rows(stripes_count, [&](int begin, int end) {
+		for (int s = begin; s < end; ++s)
+		{
+			Stripe &st = stripes[s];
+			int label = st.first_label;
+			for (int y = st.begin; y < st.end; ++y)
+			{
+				const uint8_t *ps = src.ptr(y);
+				int *pl = labels.ptr<int>(y);
+				for (int x = 0; x < w; ++x)
+					pl[x] = inside(ps[x]) && par[y * w + x] == y * w + x ? label++ : 0;
+			}
+		}
+	}, 1);
+
+	//labels of other pixels are taken from roots; parents precede pixels in
+	//raster order, so a parent in the same stripe is labeled already, trees
+	//of stripes above are walked without writes as other stripes read them
+	auto resolve = [&](int x, int y, int stripe_begin) {
+		int &label = labels.ptr<int>(y)[x];
+		if (!label)
+		{
+			int root = par[y * w + x];
+			if (root < stripe_begin * w)
+				while (par[root] != root)
+					root = par[root];
+			label = labels.ptr<int>(root / w)[root % w];
+		}
+		return label;
+	};
+
+	//statistics per stripe, own components are written to boxes directly
+	parallel_rows(stripes_count, [&](int begin, int end) {
+		for (int s = begin; s < end; ++s)
+		{
+			Stripe &st = stripes[s];
+			int *above_end = st.above_labels;
+			for (int y = st.begin; y < std::min(st.end, st.begin + gap); ++y)
+			{
+				const uint8_t *ps = src.ptr(y);
+				for (int x = 0; x < w; ++x)
+				{
+					if (!inside(ps[x]))
+						continue;
+					const int label = resolve(x, y, st.begin);
+					if (label < st.first_label)
+						*above_end++ = label;
+				}
+			}
+			std::sort(st.above_labels, above_end);
+			above_end = std::unique(st.above_labels, above_end);
+			st.above_count = int(above_end - st.above_labels);
+			std::fill_n(st.above, st.above_count, Box());
+
+			for (int y = st.begin; y < st.end; ++y)
+			{
+				const uint8_t *ps = src.ptr(y);
+				for (int x = 0; x < w; ++x)
+				{
+					if (!inside(ps[x]))
+						continue;
+					const int label = resolve(x, y, st.begin);
+					if (label >= st.first_label)
+						boxes[label - 1].add(x, y);
+					else
+						st.above[std::lower_bound(st.above_labels, above_end, label) -
+							st.above_labels].add(x, y);
+				}
+			}
+		}
+	}, 1);
+
+	for (int s = 0; s < stripes_count; ++s)
+		for (int i = 0; i < stripes[s].above_count; ++i)
+			boxes[stripes[s].above_labels[i] - 1].add(stripes[s].above[i]);
+	return count;
+}
+
+//component of (x, y) filled with color, bounds are returned
+Box fill_component(uint8_t *data, int w, int h, int x, int y,
+	uint8_t min_val, uint8_t max_val, int gap, uint8_t color)
+{
+	cv::Mat img(h, w, CV_8UC1, data);
+	ScratchFrame scratch;
+	cv::Mat labels = scratch.mat(h, w, CV_32S);
+	Box *boxes;
+	uint8_t &seed = data[y * w + x];
+	if (seed < min_val || seed > max_val)
+		seed = min_val;
+	label_components(img, labels, scratch, boxes, 8, gap, min_val, max_val);
+
+	const int label = labels.at<int>(y, x);
+	const cv::Rect rect = boxes[label - 1].rect();
+	for (int i = rect.y; i < rect.y + rect.height; ++i)
+	{
+		const int *pl = labels.ptr<int>(i);
+		uint8_t *pd = img.ptr(i);
+		for (int j = rect.x; j < rect.x + rect.width; ++j)
+			if (pl[j] == label)
+				pd[j] = color;
+	}
+	return boxes[label - 1];
+}
+
+}  // namespace
+
+int connected_components(const cv::Mat &src, cv::Mat &labels,
+		std::vector<Component> &components, int connectivity, int gap,
+		uint8_t min_val, uint8_t max_val)
+{
+	af_assert(src.type() == CV_8UC1);
+	af_assert((connectivity == 4 || connectivity == 8) && gap >= 0);
+
+	ScratchFrame scratch;
+	Box *boxes;
+	const int count = label_components(src, labels, scratch, boxes,
+		connectivity, gap, min_val, max_val);
+	components.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		components[i].rect = boxes[i].rect();
+		components[i].area = boxes[i].area;
+	}
+	return count;
+}
+
+void floodfill(cv::Mat &mat, uint8_t background,
+		uint8_t fill_with, int min_cont_size)
+{
+	af_assert(background != fill_with && "trying to floodfill with the same color");
+
+	ScratchFrame scratch;
+	cv::Mat labels = scratch.mat(mat.size(), CV_32S);
+	Box *boxes;
+	int count = label_components(mat, labels, scratch, boxes, 8, 1, background, background);
+
+	uint8_t *colors = scratch.zeros<uint8_t>(count + 1);
+	for (int i = 0; i < count; ++i)
+		colors[i + 1] = boxes[i].area < min_cont_size ? 0 : fill_with;
+
+	parallel_rows(mat.rows, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y)
+		{
+			const int *pl = labels.ptr<int>(y);
+			uint8_t *pd = mat.ptr(y);
+			for (int x = 0; x < mat.cols; ++x)
+				if (pl[x])
+					pd[x] = colors[pl[x]];
+		}
+	});
+}
+
+int floodfill_pixel(uint8_t* data, int w, int h,
+					uint8_t background, uint8_t fill_with,
+					int start_x, int start_y)
+{
+	return fill_component(data, w, h, start_x, start_y,
+		background, background, 1, fill_with).area;
+}
+
+int find_rects(cv::Mat &img, uint8_t start_color,
+		uint8_t min_color, uint8_t result_color,
+		std::vector<cv::Rect> &rects,
+		int min_obj_size, int allowed_gap)
+{
+	af_assert(start_color != result_color && "trying to floodfill with the same color");
+	af_assert(!rects.size() && "rectangles vector is not empty");
+	af_assert(start_color >= min_color && min_color > result_color);
+
+	const int w = img.cols;
+	const int h = img.rows;
+	ScratchFrame scratch;
+	cv::Mat labels = scratch.mat(h, w, CV_32S);
+	Box *boxes;
+	int count = label_components(img, labels, scratch, boxes, 8, allowed_gap, min_color, 255);
+
+	//components with start_color pixel, in order of the first such pixel
+	uint8_t *found = scratch.zeros<uint8_t>(count + 1);
+	int max_rect_square = 0;
+	for (int y = 0; y < h; ++y)
+	{
+		const uint8_t *ps = img.ptr(y);
+		const int *pl = labels.ptr<int>(y);
+		for (int x = 0; x < w; ++x)
+		{
+			if (ps[x] < start_color || found[pl[x]])
+				continue;
+			found[pl[x]] = 1;
+
+			// width and height are (max - min)
+			cv::Rect rect = boxes[pl[x] - 1].rect();
+			rect.width -= 1;
+			rect.height -= 1;
+			if (double(rect.width) > min_obj_size * 0.01 * w ||
+					double(rect.height) > min_obj_size * 0.01 * h)
+				rects.push_back(rect);
+			max_rect_square = std::max(max_rect_square, rect.area());
+		}
+	}
+
+	parallel_rows(h, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y)
+		{
+			const int *pl = labels.ptr<int>(y);
+			uint8_t *pd = img.ptr(y);
+			for (int x = 0; x < w; ++x)
+				if (found[pl[x]])
+					pd[x] = result_color;
+		}
+	});
+
+	return max_rect_square;
+}
+
+cv::Rect find_bounding_rect(uint8_t* data, int w, int h,
+		uint8_t start_color, uint8_t result_color,
+		int start_x, int start_y, int allowed_gap)
+{
+	Box box = fill_component(data, w, h, start_x, start_y,
+		start_color, 255, allowed_gap, result_color);
+	return cv::Rect(box.x0, box.y0, box.x1 - box.x0, box.y1 - box.y0);
+}
+
+}  // namespace imgproc
+}  // namespace aifil
@@ -0,0 +1,235 @@
+/** @file corners.cpp
+ *
+ *  @brief Harris and Shi-Tomasi feature points.
+ *
+ *  dx^2, dy^2 and dx*dy are computed once per source row and box-filtered
+ *  with running sums: column sums slide down by adding the entering row and
+ *  subtracting the leaving one, then every row of them is turned into prefix
+ *  sums, so the cost per pixel does not depend on block size. Responses of
+ *  row bands are computed in parallel, non-maximum suppression runs over
+ *  bands of grid cells.
+ */
+#include "imgproc.hpp"
+#include "parallel.hpp"
+#include "scratch.hpp"
+
+#include <common/errutils.hpp>
+
+#include <float.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace aifil {
+namespace imgproc {
+
+namespace {
+
+template<typename T>
+void add_products(const cv::Mat &dx, const cv::Mat &dy, int y, double sign,
+	double *xx, double *yy, double *xy)
+{
+	const T *px = dx.ptr<T>(y);
+	const T *py = dy.ptr<T>(y);
+	for (int x = 0; x < dx.cols; ++x)
+	{
+		double gx = px[x];
+		double gy = py[x];
+		xx[x] += sign * gx * gx;
+		yy[x] += sign * gy * gy;
+		xy[x] += sign * gx * gy;
+	}
+}
+
+void add_products(const cv::Mat &dx, const cv::Mat &dy, int y, double sign,
+	double *xx, double *yy, double *xy)
+{
+	switch (dx.depth())
+	{
+	case CV_8U: add_products<uint8_t>(dx, dy, y, sign, xx, yy, xy); break;
+	case CV_16S: add_products<int16_t>(dx, dy, y, sign, xx, yy, xy); break;
+	default: add_products<float>(dx, dy, y, sign, xx, yy, xy); break;
+	}
+}
+
+//metrics of mean structure tensor [a b; b c] of n pixels,
+//plain loops over row, vectorized by compiler
+void harris_row(const double *a, const double *b, const double *c, const double *n,
+	double k, float *dst, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		double inv = 1.0 / n[i];
+		double sa = a[i] * inv;
+		double sb = b[i] * inv;
+		double sc = c[i] * inv;
+		dst[i] = float((sa * sc - sb * sb) - k * (sa + sc) * (sa + sc));
+	}
+}
+
+void shi_tomasi_row(const double *a, const double *b, const double *c, const double *n,
+	double, float *dst, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		double inv = 1.0 / n[i];
+		double sa = a[i] * inv;
+		double sb = b[i] * inv;
+		double sc = c[i] * inv;
+		dst[i] = float((sa + sc) * 0.5 - sqrt(sb * sb + (sa - sc) * (sa - sc) * 0.25));
+	}
+}
+
+void corner_response(const cv::Mat &dx, const cv::Mat &dy, cv::Mat &response,
+	int block_size, CORNER_METRIC metric, double coeff, int begin, int end)
+{
+	const int rows = dx.rows;
+	const int cols = dx.cols;
+	//window rows (cols) around the pixel, even block_size has one less after it
+	const int before = block_size / 2;
+	const int after = block_size - 1 - before;
+
+	//column sums of window rows, prefix sums of them, window sums and pixel counts
+	ScratchFrame scratch;
+	double *buf = scratch.zeros<double>(3 * cols + 3 * (cols + 1) + 4 * cols);
+	double *col_sum[3] = { &buf[0], &buf[cols], &buf[2 * cols] };
+	double *prefix[3] = { &buf[3 * cols], &buf[4 * cols + 1], &buf[5 * cols + 2] };
+	double *sum[3] = { &buf[6 * cols + 3], &buf[7 * cols + 3], &buf[8 * cols + 3] };
+	double *count = &buf[9 * cols + 3];
+
+	for (int y = std::max(0, begin - before); y < std::min(rows, begin + after); ++y)
+		add_products(dx, dy, y, 1.0, col_sum[0], col_sum[1], col_sum[2]);
+
+	for (int y = begin; y < end; ++y)
+	{
+		if (y + after < rows)
+			add_products(dx, dy, y + after, 1.0, col_sum[0], col_sum[1], col_sum[2]);
+		if (y > begin && y - before - 1 >= 0)
+			add_products(dx, dy, y - before - 1, -1.0, col_sum[0], col_sum[1], col_sum[2]);
+		const int window_rows = std::min(rows, y + after + 1) - std::max(0, y - before);
+
+		for (int p = 0; p < 3; ++p)
+		{
+			double *pre = prefix[p];
+			const double *col = col_sum[p];
+			pre[0] = 0;
+			for (int x = 0; x < cols; ++x)
+				pre[x + 1] = pre[x] + col[x];
+			double *s = sum[p];
+			for (int x = 0; x < cols; ++x)
+			{
+				int lo = std::max(0, x - before);
+				int hi = std::min(cols, x + after + 1);
+				s[x] = pre[hi] - pre[lo];
+			}
+		}
+		for (int x = 0; x < cols; ++x)
+			count[x] = double(window_rows * (std::min(cols, x + after + 1) - std::max(0, x - before)));
+
+		float *dst = response.ptr<float>(y);
+		if (metric == CORNER_HARRIS)
+			harris_row(sum[0], sum[2], sum[1], count, coeff, dst, cols);
+		else
+			shi_tomasi_row(sum[0], sum[2], sum[1], count, coeff, dst, cols);
+	}
+}
+
+//response(y, x) is not less than 8 neighbours, and greater than ones
+//before it in raster order (plateaus give a single maximum)
+inline bool local_max(const cv::Mat &response, int y, int x)
+{
+	const float v = response.ptr<float>(y)[x];
+	for (int j = std::max(0, y - 1); j <= std::min(response.rows - 1, y + 1); ++j)
+	{
+		const float *row = response.ptr<float>(j);
+		for (int i = std::max(0, x - 1); i <= std::min(response.cols - 1, x + 1); ++i)
+		{
+			if (j == y && i == x)
+				continue;
+			bool before = j < y || (j == y && i < x);
+			if (row[i] > v || (before && row[i] == v))
+				return false;
+		}
+	}
+	return true;
+}
+
+bool stronger(const Corner &a, const Corner &b)
+{
+	if (a.response != b.response)
+		return a.response > b.response;
+	return a.pt.y < b.pt.y || (a.pt.y == b.pt.y && a.pt.x < b.pt.x);
+}
+
+}  // namespace
+
+void corners(const cv::Mat &dx, const cv::Mat &dy, std::vector<Corner> &dst,
+	int block_size, int max_corners, double threshold, CORNER_METRIC metric,
+	double coeff, int nms_cell)
+{
+	af_assert(dx.rows == dy.rows && dx.cols == dy.cols && dx.type() == dy.type());
+	af_assert(dx.type() == CV_8UC1 || dx.type() == CV_16SC1 || dx.type() == CV_32FC1);
+	af_assert(block_size > 0 && nms_cell > 0);
+
+	dst.clear();
+	if (dx.empty())
+		return;
+
+	ScratchFrame scratch;
+	cv::Mat response = scratch.mat(dx.rows, dx.cols, CV_32FC1);
+	parallel_rows(dx.rows, [&](int begin, int end) {
+		corner_response(dx, dy, response, block_size, metric, coeff, begin, end);
+	});
+
+	//the strongest local maximum of every grid cell
+	const int grid_rows = (dx.rows + nms_cell - 1) / nms_cell;
+	const int grid_cols = (dx.cols + nms_cell - 1) / nms_cell;
+	Corner none;
+	none.response = -FLT_MAX;
+	const int cells = grid_rows * grid_cols;
+	Corner *best = scratch.alloc<Corner>(cells);
+	std::fill_n(best, cells, none);
+	parallel_rows(grid_rows, [&](int begin, int end) {
+		for (int y = begin * nms_cell; y < std::min(dx.rows, end * nms_cell); ++y)
+		{
+			const float *row = response.ptr<float>(y);
+			Corner *cell = &best[(y / nms_cell) * grid_cols];
+			for (int x = 0; x < dx.cols; ++x)
+			{
+				if (row[x] <= threshold || row[x] <= cell[x / nms_cell].response)
+					continue;
+				if (!local_max(response, y, x))
+					continue;
+				cell[x / nms_cell].pt = cv::Point(x, y);
+				cell[x / nms_cell].response = row[x];
+			}
+		}
+	}, 1);
+
+	for (int i = 0; i < cells; ++i)
+		if (best[i].response != -FLT_MAX)
+			dst.push_back(best[i]);
+	if (max_corners > 0 && int(dst.size()) > max_corners)
+	{
+		std::partial_sort(dst.begin(), dst.begin() + max_corners, dst.end(), stronger);
+		dst.resize(max_corners);
+	}
+	else
+		std::sort(dst.begin(), dst.end(), stronger);
+}
+
+void corners_harris(const cv::Mat &dx, const cv::Mat &dy, std::vector<Corner> &dst,
+	double K, int block_size, int max_corners, double threshold)
+{
+	corners(dx, dy, dst, block_size, max_corners, threshold, CORNER_HARRIS, K);
+}
+
+void corners_shi_tomasi(const cv::Mat &dx, const cv::Mat &dy, std::vector<Corner> &dst,
+	int block_size, int max_corners, double eigenval_th)
+{
+	corners(dx, dy, dst, block_size, max_corners, eigenval_th, CORNER_SHI_TOMASI);
+}
+
+}  // namespace imgproc
+}  // namespace aifil
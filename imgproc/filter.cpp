@@ -1,13 +1,33 @@
+#include "histogram.hpp"
 #include "imgproc.hpp"
+#include "parallel.hpp"
+#include "scratch.hpp"
 
 #include <common/stringutils.hpp>
 #include <common/errutils.hpp>
 #include <common/logging.hpp>
 #include <common/profiler.hpp>
 
+#include <float.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
 namespace aifil {
 namespace imgproc {
 
+#ifdef HAVE_SSE
+// extern SSE code, see sse/simd-dispatch.hpp
+extern "C" void sse_gradient_c1(int height, int width, float *pdx, float *pdy,
+	float *pangle, float *pmag);
+extern "C" void sse_gradient_c3(int height, int width, float *pdx, float *pdy,
+	float *pangle, float *pmag, float *buf);
+extern "C" void sse_gradient2_8u(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+	uint8_t *angle, uint8_t *magnitude, int count, int threshold);
+#endif
+
 // helpers
 int log_function(int color, float A, float B)
 {
@@ -36,36 +56,54 @@ cv::Vec2f lin_transform(const cv::Vec2i &minmax, int min_val, int max_val)
 	return cv::Vec2f(A, B);
 }
 
-template<typename outtype>
-cv::Mat_<outtype> convolution(const cv::Mat &src,
-	const cv::Size &window, const std::function<outtype(const cv::Mat &)> &func,
-	cv::BorderTypes border_type)
+void convolution_tiles(const cv::Mat &src, const cv::Size &window, int type,
+	cv::BorderTypes border_type,
+	const std::function<void(const cv::Mat &, const cv::Rect &)> &body)
 {
-	if (src.empty())
-		return cv::Mat_<outtype>();
-
 	if (window.width <= 0 || window.height <= 0)
 		af_exception("convolution: window dimensions should be positive");
 	if (window.width % 2 == 0 || window.height % 2 == 0)
 		af_exception("convolution: window dimensions should be even");
+	af_assert(src.type() == type);
 
-	cv::Mat expsrc;
+	ScratchFrame scratch;
+	cv::Mat expsrc = scratch.mat(src.rows + window.height - 1, src.cols + window.width - 1, type);
 	cv::copyMakeBorder(
 			src, expsrc,
 			window.height / 2, window.height / 2,
 			window.width / 2, window.width / 2, border_type);
 
+	parallel_tiles(src.size(), cv::Size(256, 64), 0, [&](const Tile &t) {
+		body(expsrc, t.rect);
+	});
+}
+
+template<typename outtype>
+cv::Mat_<outtype> convolution(const cv::Mat &src,
+	const cv::Size &window, const std::function<outtype(const cv::Mat &)> &func,
+	cv::BorderTypes border_type)
+{
+	if (src.empty())
+		return cv::Mat_<outtype>();
+
+	const int type = src.type();
+	const size_t esize = src.elemSize();
 	cv::Mat_<outtype> dst = cv::Mat_<outtype>(src.size());
-	for (int i = 0; i < dst.rows; ++i)
-	{
-		cv::Mat roiy = expsrc.rowRange(i, i + window.height);
-		auto pdst = dst[i];
-		for (int j = 0; j < dst.cols; ++j)
-		{
-			cv::Mat roi = roiy.colRange(j, j + window.width);
-			pdst[j] = func(roi);
-		}
-	}
+	convolution_tiles(src, window, type, border_type,
+		[&](const cv::Mat &expsrc, const cv::Rect &rect) {
+			for (int i = rect.y; i < rect.y + rect.height; ++i)
+			{
+				uint8_t *ps = const_cast<uint8_t*>(expsrc.ptr(i));
+				auto pdst = dst[i];
+				for (int j = rect.x; j < rect.x + rect.width; ++j)
+				{
+					// header over window data, no reference counting
+					const cv::Mat roi(window.height, window.width, type,
+						ps + j * esize, expsrc.step);
+					pdst[j] = func(roi);
+				}
+			}
+		});
 	return dst;
 }
 template
@@ -88,30 +126,6 @@ void blur(const cv::Mat& src, cv::Mat& dst, int type, int size, cv::Mat &tmp)
 	if (tmp.rows != src.rows || tmp.cols != src.cols || tmp.type() != src.type())
 		tmp = cv::Mat(src.rows, src.cols, src.type());
 
-	bool processed = false;
-#ifdef HAVE_SSE
-	int w = src.cols;
-	int h = src.rows;
-
-	if (type == 1 && (size == 3 || size == 5) && !(w % 16) && !(h % 8))
-	{
-		src.copyTo(tmp);
-		if (size == 3)
-		{
-			::blur_1u8_3x3_sse((uint8_t *)dst.data, (uint8_t *)tmp.data, w, h, w);
-			processed = true;
-		}
-		if (size == 5)
-		{
-			::blur_1u8_5x5_sse((uint8_t *)dst.data, (uint8_t *)tmp.data, w, h, w);
-			processed = true;
-		}
-	}
-#endif
-
-	if (processed)
-		return;
-
 	cv::Size blur_size_cv(size, size);
 	switch (type)
 	{
@@ -179,6 +193,128 @@ void sobel_v2(const cv::Mat &src, cv::Mat &dx, cv::Mat &dy)
 	}
 }
 
+namespace {
+
+//cv::fastAtan2() polynomial, result folded to [0, 180) like gradient() does,
+//written without branches so that loops over pixels are vectorized
+inline float atan2_0_180(float dy, float dx)
+{
+	const float p1 = 0.9997878412794807f * 57.29577951308232f;
+	const float p3 = -0.3258083974640975f * 57.29577951308232f;
+	const float p5 = 0.1555786518463281f * 57.29577951308232f;
+	const float p7 = -0.04432655554792128f * 57.29577951308232f;
+
+	float ax = std::abs(dx);
+	float ay = std::abs(dy);
+	float c = std::min(ax, ay) / (std::max(ax, ay) + float(DBL_EPSILON));
+	float c2 = c * c;
+	float a = (((p7 * c2 + p5) * c2 + p3) * c2 + p1) * c;
+	a = ax >= ay ? a : 90.0f - a;
+	a = (dx < 0) != (dy < 0) ? 180.0f - a : a;
+	return a >= 180.0f ? a - 180.0f : a;
+}
+
+inline int reflect_101(int i, int len)
+{
+	if (len == 1)
+		return 0;
+	return i < 0 ? -i : (i >= len ? 2 * len - 2 - i : i);
+}
+
+//source row with one reflected pixel on both sides, as float
+template<typename T>
+void load_row_101(const cv::Mat &src, int y, float *dst)
+{
+	const int ch = src.channels();
+	const int len = src.cols * ch;
+	const T *row = src.ptr<T>(reflect_101(y, src.rows));
+	for (int i = 0; i < len; ++i)
+		dst[ch + i] = float(row[i]);
+	const int left = reflect_101(-1, src.cols) * ch;
+	const int right = reflect_101(src.cols, src.cols) * ch;
+	for (int c = 0; c < ch; ++c)
+	{
+		dst[c] = dst[ch + left + c];
+		dst[ch + len + c] = dst[ch + right + c];
+	}
+}
+
+//3x3 Sobel derivatives and polar form of rows [begin, end)
+template<typename T>
+void gradient_rows(const cv::Mat &src, cv::Mat &angle, cv::Mat &magnitude,
+	cv::Mat *dx, cv::Mat *dy, int begin, int end)
+{
+	const int ch = src.channels();
+	const int len = src.cols * ch;
+	const int ext = len + 2 * ch;
+
+	//ring of 3 source rows, then vertical smooth/difference, then dx and dy
+	ScratchFrame scratch;
+	float *buf = scratch.alloc<float>(5 * ext + 2 * len);
+	float *ring[3] = { &buf[0], &buf[ext], &buf[2 * ext] };
+	float *smooth = &buf[3 * ext];
+	float *diff = &buf[4 * ext];
+	float *gx_buf = &buf[5 * ext];
+	float *gy_buf = gx_buf + len;
+
+	load_row_101<T>(src, begin - 1, ring[(begin + 2) % 3]);
+	load_row_101<T>(src, begin, ring[begin % 3]);
+	for (int y = begin; y < end; ++y)
+	{
+		load_row_101<T>(src, y + 1, ring[(y + 1) % 3]);
+		const float *r0 = ring[(y + 2) % 3];
+		const float *r1 = ring[y % 3];
+		const float *r2 = ring[(y + 1) % 3];
+		for (int i = 0; i < ext; ++i)
+		{
+			smooth[i] = r0[i] + 2.0f * r1[i] + r2[i];
+			diff[i] = r2[i] - r0[i];
+		}
+
+		float *gx = dx ? dx->ptr<float>(y) : gx_buf;
+		float *gy = dy ? dy->ptr<float>(y) : gy_buf;
+		for (int i = 0; i < len; ++i)
+		{
+			gx[i] = smooth[i + 2 * ch] - smooth[i];
+			gy[i] = diff[i] + 2.0f * diff[i + ch] + diff[i + 2 * ch];
+		}
+
+		float *pangle = angle.ptr<float>(y);
+		float *pmag = magnitude.ptr<float>(y);
+		if (angle.channels() == ch)
+		{
+			for (int i = 0; i < len; ++i)
+			{
+				pmag[i] = sqrtf(gx[i] * gx[i] + gy[i] * gy[i]);
+				pangle[i] = atan2_0_180(gy[i], gx[i]);
+			}
+			continue;
+		}
+
+		//channel with the largest magnitude
+		for (int x = 0; x < src.cols; ++x)
+		{
+			const float *px = gx + x * ch;
+			const float *py = gy + x * ch;
+			float max_mv = px[0] * px[0] + py[0] * py[0];
+			int max_ind = 0;
+			for (int c = 1; c < ch; ++c)
+			{
+				float mv = px[c] * px[c] + py[c] * py[c];
+				if (mv > max_mv)
+				{
+					max_ind = c;
+					max_mv = mv;
+				}
+			}
+			pmag[x] = sqrtf(max_mv);
+			pangle[x] = atan2_0_180(py[max_ind], px[max_ind]);
+		}
+	}
+}
+
+}  // namespace
+
 void gradient(const cv::Mat &src, cv::Mat &angle, cv::Mat &magnitude,
 		int ksize, cv::Mat &dx, cv::Mat &dy)
 {
@@ -197,6 +333,11 @@ void gradient(const cv::Mat &src, cv::Mat &angle, cv::Mat &magnitude,
 		magnitude.depth() == CV_32F && dx.depth() == CV_32F && dy.depth() == CV_32F);
 
 	int sch = src.channels();
+	if (ksize == 3)
+	{
+		gradient_fused(src, angle, magnitude, &dx, &dy);
+		return;
+	}
 
 	sobel(src, dx, 1, 0, ksize);
 	sobel(src, dy, 0, 1, ksize);
@@ -220,8 +361,9 @@ void gradient(const cv::Mat &src, cv::Mat &angle, cv::Mat &magnitude,
 #ifdef HAVE_SSE
 	if (sch == 3 && src.isContinuous())
 	{
+		ScratchFrame scratch;
 		sse_gradient_c3(src.rows, src.cols, (float*)dx.data, (float*)dy.data,
-			(float*)angle.data, (float*)magnitude.data);
+			(float*)angle.data, (float*)magnitude.data, scratch.alloc<float>(5 * src.total()));
 		return;
 	}
 	else if (sch == 1 && src.isContinuous())
@@ -278,59 +420,130 @@ void gradient(const cv::Mat &src, cv::Mat &angle, cv::Mat &magnitude,
 		af_assert(!"incorrect dst matrixes");
 }
 
-void gradient2(const cv::Mat &src, cv::Mat &angle, cv::Mat &magnitude,
-	int threshold, int /* ksize */)
+void gradient_fused(const cv::Mat &src, cv::Mat &angle, cv::Mat &magnitude,
+	cv::Mat *dx, cv::Mat *dy)
 {
-	if (angle.rows != src.rows || angle.cols != src.cols ||
-		angle.type() != src.type())
-		angle = cv::Mat(src.rows, src.cols,  CV_8UC1);
+	af_assert(src.depth() == CV_32F || src.depth() == CV_8U);
+	const int sch = src.channels();
+	int ach = angle.channels() == sch ? sch : 1;
+	if (angle.rows != src.rows || angle.cols != src.cols || angle.type() != CV_32FC(ach))
+		angle = cv::Mat(src.rows, src.cols, CV_32FC(ach));
 	if (magnitude.rows != src.rows || magnitude.cols != src.cols ||
-		magnitude.type() != src.type())
-		magnitude = cv::Mat(src.rows, src.cols,  CV_8UC1);
+		magnitude.type() != CV_32FC(ach))
+		magnitude = cv::Mat(src.rows, src.cols, CV_32FC(ach));
+	cv::Mat *derivatives[2] = { dx, dy };
+	for (cv::Mat *d: derivatives)
+		if (d && (d->rows != src.rows || d->cols != src.cols || d->type() != CV_32FC(sch)))
+			*d = cv::Mat(src.rows, src.cols, CV_32FC(sch));
+	if (src.empty())
+		return;
+
+	PROFILE("gradient fused");
+	parallel_rows(src.rows, [&](int begin, int end) {
+		if (src.depth() == CV_8U)
+			gradient_rows<uint8_t>(src, angle, magnitude, dx, dy, begin, end);
+		else
+			gradient_rows<float>(src, angle, magnitude, dx, dy, begin, end);
+	});
+}
+
+namespace {
 
-	int ch = 1;
-	int shift = 1; //ksize / 2
-	af_assert(src.type() == CV_8UC1 && "other is not implemented now");
-	af_assert(magnitude.type() == CV_8UC1 && "other is not implemented now");
-	af_assert(angle.type() == CV_8UC1 && "gradient2 is quantized gradient version");
+inline uint8_t absdiff_8u(uint8_t a, uint8_t b)
+{
+	return uint8_t(std::max(a, b) - std::min(a, b));
+}
 
-	angle.setTo(0);
-	magnitude.setTo(0);
+//largest channel difference between opposite neighbours
+template<int CH>
+inline uint8_t direction_diff(const uint8_t *a, const uint8_t *b)
+{
+	uint8_t d = absdiff_8u(a[0], b[0]);
+	for (int c = 1; c < CH; ++c)
+		d = std::max(d, absdiff_8u(a[c], b[c]));
+	return d;
+}
 
-	int stride = static_cast<int>(src.step1());
-	int addr[8] = { shift, stride * shift + shift, stride * shift,
-					stride * shift - shift, -shift, -stride * shift - shift,
-					-stride * shift, -stride * shift + shift };
+//scalar version, 1-channel rows go to SIMD kernel if available
+template<int CH>
+void gradient2_rows(const cv::Mat &src, cv::Mat &angle, cv::Mat &magnitude,
+	int threshold, int begin, int end)
+{
+	const int cols = src.cols;
+	const bool keep_first = threshold < 0;
+	const uint8_t thr = uint8_t(std::min(std::max(threshold, 0), 255));
 
-	uint8_t *pang = angle.data + stride * shift + shift;
-	uint8_t *pmag = magnitude.data + stride * shift + shift;
-	for (int col = shift; col < src.cols - shift; ++col)
+	for (int y = begin; y < end; ++y)
 	{
-		pang = angle.data;
-		pmag = magnitude.data;
-		for (int row = shift; row < src.rows - shift; ++row)
+		uint8_t *pang = angle.ptr<uint8_t>(y);
+		uint8_t *pmag = magnitude.ptr<uint8_t>(y);
+		if (y == 0 || y == src.rows - 1 || cols < 3)
 		{
-			int pixel_index = src.cols * row + col;
-			int diff = 0;
-			int max_diff = threshold;
-			for (int i = 0; i < 8; ++i)
-			{
-				diff = abs(src.data[pixel_index + addr[i]] - src.data[pixel_index - addr[i]]);
-				if (diff > max_diff)
-				{
-					max_diff = diff;
-					*pang = i + 1;
-					*pmag = diff;
-				}
-			}
-			++pang;
-			++pmag;
+			memset(pang, 0, cols);
+			memset(pmag, 0, cols);
+			continue;
+		}
+		pang[0] = pmag[0] = 0;
+		pang[cols - 1] = pmag[cols - 1] = 0;
+
+		const uint8_t *up = src.ptr<uint8_t>(y - 1);
+		const uint8_t *mid = src.ptr<uint8_t>(y);
+		const uint8_t *down = src.ptr<uint8_t>(y + 1);
+#ifdef HAVE_SSE
+		if (CH == 1)
+		{
+			sse_gradient2_8u(up + 1, mid + 1, down + 1, pang + 1, pmag + 1, cols - 2, threshold);
+			continue;
+		}
+#endif
+		for (int x = 1; x < cols - 1; ++x)
+		{
+			const int l = (x - 1) * CH;
+			const int c = x * CH;
+			const int r = (x + 1) * CH;
+			//1: horizontal, 2: main diagonal, 3: vertical, 4: anti-diagonal
+			uint8_t d1 = direction_diff<CH>(mid + r, mid + l);
+			uint8_t d2 = direction_diff<CH>(down + r, up + l);
+			uint8_t d3 = direction_diff<CH>(down + c, up + c);
+			uint8_t d4 = direction_diff<CH>(down + l, up + r);
+
+			//the first of equal maximums wins
+			uint8_t m = keep_first ? d1 : thr;
+			uint8_t a = keep_first ? 1 : 0;
+			a = d1 > m ? 1 : a;
+			m = d1 > m ? d1 : m;
+			a = d2 > m ? 2 : a;
+			m = d2 > m ? d2 : m;
+			a = d3 > m ? 3 : a;
+			m = d3 > m ? d3 : m;
+			a = d4 > m ? 4 : a;
+			m = d4 > m ? d4 : m;
+			pang[x] = a;
+			pmag[x] = a ? m : 0;
 		}
-		pang += shift * 2 * ch;
-		pmag += shift * 2 * ch;
 	}
 }
 
+}  // namespace
+
+void gradient2(const cv::Mat &src, cv::Mat &angle, cv::Mat &magnitude,
+	int threshold, int /* ksize */)
+{
+	af_assert(src.type() == CV_8UC1 || src.type() == CV_8UC3);
+	if (angle.rows != src.rows || angle.cols != src.cols || angle.type() != CV_8UC1)
+		angle = cv::Mat(src.rows, src.cols,  CV_8UC1);
+	if (magnitude.rows != src.rows || magnitude.cols != src.cols ||
+		magnitude.type() != CV_8UC1)
+		magnitude = cv::Mat(src.rows, src.cols,  CV_8UC1);
+
+	parallel_rows(src.rows, [&](int begin, int end) {
+		if (src.channels() == 1)
+			gradient2_rows<1>(src, angle, magnitude, threshold, begin, end);
+		else
+			gradient2_rows<3>(src, angle, magnitude, threshold, begin, end);
+	}, 32);
+}
+
 float f32_bilinear_1u8(IplImage *img, float x, float y)
 {
 	int x2 = (int)ceil(x);
@@ -351,42 +564,201 @@ float f32_bilinear_1u8(IplImage *img, float x, float y)
 	return col;
 }
 
-template<typename T>
-cv::Mat_<T> filter_median(
-		const cv::Mat_<T> &src, const cv::Size &size,
-		cv::BorderTypes border_type);
+namespace {
 
-// float specialization
-template<>
-cv::Mat_<float> filter_median(
-		const cv::Mat_<float> &src, const cv::Size &size,
-		cv::BorderTypes border_type)
+//two-level histogram of BITS-bit keys, coarse bins hold 2^(BITS/2) keys
+template<int BITS>
+struct MedianHistogram
+{
+	enum { FINE = 1 << BITS, SHIFT = BITS / 2, COARSE = FINE >> SHIFT };
+
+	int *fine;
+	int *coarse;
+
+	explicit MedianHistogram(ScratchFrame &scratch):
+		fine(scratch.zeros<int>(FINE)), coarse(scratch.zeros<int>(COARSE)) {}
+
+	void add(int key, int delta)
+	{
+		fine[key] += delta;
+		coarse[key >> SHIFT] += delta;
+	}
+
+	//key of k-th (from 0) smallest value
+	int kth(int k) const
+	{
+		int c = 0;
+		for (; k >= coarse[c]; ++c)
+			k -= coarse[c];
+		int key = c << SHIFT;
+		for (; k >= fine[key]; ++key)
+			k -= fine[key];
+		return key;
+	}
+};
+
+//three-level histogram of keys below size, for float ranks beyond 16 bits;
+//every level bin holds 2^shift bins of the level below
+struct RankHistogram
+{
+	int shift;
+	int *level[3];  // fine, middle, coarse
+
+	RankHistogram(int size, ScratchFrame &scratch): shift(1)
+	{
+		while ((size_t(1) << (3 * shift)) < size_t(size))
+			++shift;
+		for (int l = 0; l < 3; ++l)
+			level[l] = scratch.zeros<int>(((size - 1) >> (l * shift)) + 1);
+	}
+
+	void add(int key, int delta)
+	{
+		level[0][key] += delta;
+		level[1][key >> shift] += delta;
+		level[2][key >> (2 * shift)] += delta;
+	}
+
+	int kth(int k) const
+	{
+		int key = 0;
+		for (int l = 2; l >= 0; --l)
+		{
+			const int *h = level[l];
+			key <<= l < 2 ? shift : 0;
+			for (; k >= h[key]; ++key)
+				k -= h[key];
+		}
+		return key;
+	}
+};
+
+//Huang sliding median: window goes along the row by one column,
+//src is dst grown by window - 1; histogram is empty on entry and on exit
+template<typename K, typename Histogram>
+void median_keys(const cv::Mat &src, cv::Mat &dst, cv::Size window, Histogram &hist)
+{
+	const int k = window.area() / 2;
+	const size_t step = src.step1();
+	for (int y = 0; y < dst.rows; ++y)
+	{
+		const K *ps = src.ptr<K>(y);
+		auto column = [&](int x, int delta) {
+			const K *p = ps + x;
+			for (int i = 0; i < window.height; ++i, p += step)
+				hist.add(*p, delta);
+		};
+
+		for (int x = 0; x < window.width; ++x)
+			column(x, 1);
+		K *pd = dst.ptr<K>(y);
+		for (int x = 0; x < dst.cols; ++x)
+		{
+			if (x > 0)
+			{
+				column(x - 1, -1);
+				column(x + window.width - 1, 1);
+			}
+			pd[x] = K(hist.kth(k));
+		}
+		for (int x = dst.cols - 1; x < dst.cols - 1 + window.width; ++x)
+			column(x, -1);
+	}
+}
+
+//float values are replaced by their ranks among all values of expanded
+//image, sorted once; stripes run the integer sliding median on ranks
+void median_32f(const cv::Mat &expsrc, cv::Mat &dst, cv::Size window, cv::Size tile,
+		ScratchFrame &scratch)
+{
+	float *values = scratch.alloc<float>(expsrc.total());
+	for (int y = 0; y < expsrc.rows; ++y)
+		std::copy(expsrc.ptr<float>(y), expsrc.ptr<float>(y) + expsrc.cols,
+			values + y * expsrc.cols);
+	std::sort(values, values + expsrc.total());
+	float *values_end = std::unique(values, values + expsrc.total());
+	const int size = int(values_end - values);
+
+	const bool wide = size > 65536;
+	cv::Mat keys = scratch.mat(expsrc.size(), wide ? CV_32S : CV_16U);
+	parallel_rows(expsrc.rows, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y)
+		{
+			const float *ps = expsrc.ptr<float>(y);
+			for (int x = 0; x < expsrc.cols; ++x)
+			{
+				const int key = int(std::lower_bound(values, values_end, ps[x]) - values);
+				if (wide)
+					keys.ptr<int>(y)[x] = key;
+				else
+					keys.ptr<uint16_t>(y)[x] = uint16_t(key);
+			}
+		}
+	});
+
+	parallel_tiles(dst.size(), tile, 0, [&](const Tile &t) {
+		cv::Mat in = keys(cv::Rect(t.rect.x, t.rect.y,
+			t.rect.width + window.width - 1, t.rect.height + window.height - 1));
+		ScratchFrame tile_scratch;
+		cv::Mat out = tile_scratch.mat(t.rect.size(), keys.type());
+		if (wide)
+		{
+			RankHistogram hist(size, tile_scratch);
+			median_keys<int>(in, out, window, hist);
+		}
+		else
+		{
+			MedianHistogram<16> hist(tile_scratch);
+			median_keys<uint16_t>(in, out, window, hist);
+		}
+		for (int y = 0; y < out.rows; ++y)
+		{
+			float *pd = dst.ptr<float>(t.rect.y + y) + t.rect.x;
+			for (int x = 0; x < out.cols; ++x)
+				pd[x] = values[wide ? out.ptr<int>(y)[x] : out.ptr<uint16_t>(y)[x]];
+		}
+	});
+}
+
+void median_channel(const cv::Mat &src, cv::Mat &dst, const cv::Size &size, int border_type)
 {
-	cv::Mat_<float> dst(src.size());
-	cv::Mat_<float> expsrc;
+	ScratchFrame scratch;
+	cv::Mat expsrc = scratch.mat(
+		src.rows + size.height - 1, src.cols + size.width - 1, src.type());
 	cv::copyMakeBorder(
 			src, expsrc,
 			size.height / 2, size.height / 2,
-			size.width / 2, size.width/2, border_type);
+			size.width / 2, size.width / 2, border_type);
 
-	std::vector<float> array(size.width * size.height);
-	for (int i = 0; i < dst.rows; ++i)
+	//tiles are row stripes
+	const cv::Size tile(src.cols, 32);
+	const int depth = src.depth();
+	if (depth == CV_32F)
 	{
-		cv::Mat_<float> roiy = expsrc.rowRange(i, i + size.height);
-		auto dst_data = dst[i];
-		for (int j = 0; j < dst.cols; ++j)
-		{
-			cv::Mat_<float> roi = roiy.colRange(j, j + size.width);
+		median_32f(expsrc, dst, size, tile, scratch);
+		return;
+	}
 
-			for (int y = 0; y < roi.rows; ++y)
-				std::copy(roi[y], roi[y] + roi.cols, array.begin() + y * roi.cols);
-			std::nth_element(array.begin(), array.begin() + array.size() / 2, array.end());
-			dst_data[j] = array[array.size()/2];
+	parallel_tiles(src.size(), tile, 0, [&](const Tile &t) {
+		cv::Mat in = expsrc(cv::Rect(t.rect.x, t.rect.y,
+			t.rect.width + size.width - 1, t.rect.height + size.height - 1));
+		cv::Mat out = dst(t.rect);
+		ScratchFrame tile_scratch;
+		if (depth == CV_8U)
+		{
+			MedianHistogram<8> hist(tile_scratch);
+			median_keys<uint8_t>(in, out, size, hist);
 		}
-	}
-	return dst;
+		else
+		{
+			MedianHistogram<16> hist(tile_scratch);
+			median_keys<uint16_t>(in, out, size, hist);
+		}
+	});
 }
 
+}  // namespace
+
 cv::Mat filter_median(
 		const cv::Mat &src, const cv::Size &size,
 		cv::BorderTypes border_type)
@@ -399,20 +771,30 @@ cv::Mat filter_median(
 	if (size.width % 2 == 0 || size.height % 2 == 0)
 		af_exception("median filter: window dimensions should be even");
 
-	if (size.width == size.height &&
-		(src.type() == CV_8U || size.width <= 5))
+	const int depth = src.depth();
+	if (depth != CV_8U && depth != CV_16U && depth != CV_32F)
+		af_exception("median filter: only 8U, 16U and 32F images are supported");
+
+	cv::Mat dst(src.size(), src.type());
+	if (src.channels() == 1)
 	{
-		cv::Mat dst;
-		cv::medianBlur(src, dst, size.width);
+		median_channel(src, dst, size, border_type);
 		return dst;
 	}
 
-	if (src.type() != CV_32FC1)
-		af_exception(
-				"median filter: for non-rectangular kernel with size > 5 only"
-				"float images are supported");
-
-	return filter_median<float>(src, size, border_type);
+	ScratchFrame scratch;
+	std::vector<cv::Mat> channels(src.channels());
+	std::vector<cv::Mat> filtered(src.channels());
+	for (int c = 0; c < src.channels(); ++c)
+	{
+		channels[c] = scratch.mat(src.size(), src.depth());
+		filtered[c] = scratch.mat(src.size(), src.depth());
+	}
+	cv::split(src, channels);
+	for (int c = 0; c < src.channels(); ++c)
+		median_channel(channels[c], filtered[c], size, border_type);
+	cv::merge(filtered, dst);
+	return dst;
 }
 
 cv::Mat_<float> filter_adaptive_median(
@@ -427,16 +809,23 @@ cv::Mat_<float> filter_adaptive_median(
 	if (window.width % 2 == 0 || window.height % 2 == 0)
 		af_exception("adaptive median filter: window dimensions should be even");
 
-	cv::Mat tmp = to32f(src);
-	std::function<float(const cv::Mat &)> op_func =
-	[](const cv::Mat &img)->float
-	{
-		float m = float(median(img));
-		float v = img.at<float>(img.rows / 2, img.cols / 2);
-		return v - m;
-	};
+	af_assert(src.channels() == 1);
 
-	return convolution(tmp, window, op_func);
+	// integer images are filtered in their own type, histograms are smaller
+	cv::Mat_<float> dst = to32f(src);
+	cv::Mat med = src.depth() == CV_8U || src.depth() == CV_16U ?
+		filter_median(src, window, borderType) : filter_median(dst, window, borderType);
+	cv::Mat_<float> med32 = med.depth() == CV_32F ? med : to32f(med);
+	parallel_rows(dst.rows, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+		{
+			float *pd = dst[i];
+			const float *pm = med32[i];
+			for (int j = 0; j < dst.cols; ++j)
+				pd[j] -= pm[j];
+		}
+	});
+	return dst;
 }
 
 // cv::Mat img = ...;
@@ -504,64 +893,44 @@ void filter_homomorphic(
 		filter_homomorphic_uc3(img, output, lower, upper, threshold);
 }
 
-void histogram_local(const cv::Mat &src, std::vector<std::vector<int> > &hists,
-		const cv::Rect &rect)
-{
-	int channels = src.channels();
-
-	hists.clear();
-	hists.resize(channels);
-
-	int cols = src.cols;
-	int rows = src.rows;
-
-	int xl = std::max<int>(rect.x, 0);
-	int yl = std::max<int>(rect.y, 0);
-	int xr = std::min<int>(rect.x + rect.width - 1, cols - 1);
-	int yr = std::min<int>(rect.y + rect.height - 1, rows - 1);
+namespace {
 
-	for (int c = 0; c < channels; ++c)
+//window [pos, pos + len) as ranges of [0, size), outside parts are mirrored
+int mirrored_ranges(int pos, int len, int size, int ranges[3][2])
+{
+	int count = 0;
+	int parts[3][2] = {
+		{ std::max(pos, 0), std::min(pos + len, size) },
+		{ 0, std::min(-pos, size) },
+		{ std::max(2 * size - (pos + len), 0), size }
+	};
+	for (int i = 0; i < 3; ++i)
 	{
-		hists[c].resize(256, 0);
-		for (int y = yl; y <= yr; ++y)
-		{
-			const uint8_t* Mi = src.ptr(y);
-			for (int x = xl; x <= xr; ++x)
-				++hists[c][ Mi[x*channels + c] ];
-			//if rect.x < 0
-			for (int x = xl; x < -rect.x; ++x)
-				++hists[c][ Mi[x*channels + c] ];
-			//if (rect.x + rect.width) > cols
-			for (int x = cols - 1; x >= (cols - 1) + cols - (rect.x + rect.width); --x)
-				++hists[c][ Mi[x*channels + c] ];
-		}
-		//if rect.y < 0
-		for (int y = 0; y < -rect.y; ++y)
-		{
-			const uint8_t* Mi = src.ptr(y);
-			for (int x = xl; x <= xr; ++x)
-				++hists[c][ Mi[x*channels + c] ];
-			//if rect.x < 0
-			for (int x = xl; x < -rect.x; ++x)
-				++hists[c][ Mi[x*channels + c] ];
-			//if (rect.x + rect.width) > cols
-			for (int x = cols - 1; x >= (cols - 1) + cols - (rect.x + rect.width); --x)
-				++hists[c][ Mi[x*channels + c] ];
-		}
-		//if (rect.y + rect.height) > rows
-		for (int y = rows - 1; y >= (rows - 1) + rows - (rect.y + rect.height); --y)
-		{
-			const uint8_t* Mi = src.ptr(y);
-			for (int x = xl; x <= xr; ++x)
-				++hists[c][ Mi[x*channels + c] ];
-			//if rect.x < 0
-			for (int x = xl; x < -rect.x; ++x)
-				++hists[c][ Mi[x*channels + c] ];
-			//if (rect.x + rect.width) > cols
-			for (int x = cols - 1; x >= (cols - 1) + cols - (rect.x + rect.width); --x)
-				++hists[c][ Mi[x*channels + c] ];
-		}
+		if (parts[i][0] >= parts[i][1])
+			continue;
+		ranges[count][0] = parts[i][0];
+		ranges[count][1] = parts[i][1];
+		++count;
 	}
+	return count;
+}
+
+}  // namespace
+
+void histogram_local(const cv::Mat &src, std::vector<std::vector<int> > &hists,
+		const cv::Rect &rect)
+{
+	af_assert(src.depth() == CV_8U);
+	int rows[3][2];
+	int cols[3][2];
+	int rows_count = mirrored_ranges(rect.y, rect.height, src.rows, rows);
+	int cols_count = mirrored_ranges(rect.x, rect.width, src.cols, cols);
+
+	hists.assign(src.channels(), std::vector<int>(256, 0));
+	for (int r = 0; r < rows_count; ++r)
+		for (int c = 0; c < cols_count; ++c)
+			histograms_add(src(cv::Rect(cols[c][0], rows[r][0],
+				cols[c][1] - cols[c][0], rows[r][1] - rows[r][0])), hists, 256, 0, 256);
 }
 
 void histogram_save_debug(const std::vector<int> &hists, int scale)
@@ -761,9 +1130,13 @@ cv::Vec2i histogram_bounds_from_peak_square(
 }
 
 void histogram_truncate(std::vector<float> &fhist, int maxval)
+{
+	histogram_truncate(fhist.data(), int(fhist.size()), maxval);
+}
+
+void histogram_truncate(float *fhist, int N, int maxval)
 {
 	float sum = 0;
-	int N = int(fhist.size());
 	for (int k = 0; k < N; ++k)
 	{
 		if (fhist[k] > maxval)
@@ -836,27 +1209,22 @@ void contrast_stretch_around_mean(const cv::Mat &src, cv::Mat &dst, float factor
 void contrast_shift_128(const cv::Mat &src, cv::Mat &dst, float contrast)
 {
 	int channels = src.channels();
-	dst = src.clone();
-
-	channel_linear_stretch(dst, dst);
+	channel_linear_stretch(src, dst);
 
 	float factor = (259 * (contrast + 255)) / (255 * (259 - contrast));
-	int cols = dst.cols;
-	int rows = dst.rows;
-	if (dst.isContinuous())
-	{
-		cols *= rows;
-		rows = 1;
-	}
-	for (int i = 0; i < rows; ++i)
-	{
-		uint8_t* Mi = dst.ptr(i);
-		for (int j = 0; j < cols; ++j)
+	uint8_t lut[256];
+	for (int v = 0; v < 256; ++v)
+		lut[v] = to_uint8_t(factor * (v - 128) + 128);
+
+	int len = dst.cols * channels;
+	parallel_rows(dst.rows, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
 		{
-			for (int c = 0; c < channels; ++c)
-				Mi[j*channels + c] = to_uint8_t(factor * (Mi[j * channels + c] - 128) + 128);
+			uint8_t* Mi = dst.ptr(i);
+			for (int j = 0; j < len; ++j)
+				Mi[j] = lut[Mi[j]];
 		}
-	}
+	});
 }
 
 void contrast_histogram_shift_stretch(
@@ -1036,30 +1404,24 @@ void channel_linear_stretch(const cv::Mat &src, cv::Mat &dst, int min_val, int m
 	}
 
 	cv::Vec2f lin_params = lin_transform(minmax_vec, min_val, max_val);
-
-	int cols = src.cols;
-	int rows = src.rows;
-	dst = src.clone();
-
-	if (src.isContinuous())
-	{
-		cols *= rows;
-		rows = 1;
-	}
-	for (int c = 0; c < channels; ++c)
-	{
-		for (int i = 0; i < rows; ++i)
+	uint8_t lut[256];
+	for (int v = 0; v < 256; ++v)
+		lut[v] = to_uint8_t(trunc_val<float>(lin_params[0] * v + lin_params[1],
+			min_val, max_val));
+
+	//src may be dst
+	cv::Mat in = src;
+	dst = cv::Mat(in.rows, in.cols, in.type());
+	int len = in.cols * channels;
+	parallel_rows(in.rows, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
 		{
-			const uint8_t* ps = src.ptr(i);
+			const uint8_t* ps = in.ptr(i);
 			uint8_t* pd = dst.ptr(i);
-			for (int j = 0; j < cols; ++j)
-			{
-				pd[j * channels + c] = to_uint8_t(trunc_val<float>(
-						lin_params[0] * ps[j*channels + c] + lin_params[1],
-						min_val, max_val));
-			}
+			for (int j = 0; j < len; ++j)
+				pd[j] = lut[ps[j]];
 		}
-	}
+	});
 }
 
 void channel_linear_stretch(const cv::Mat &src, cv::Mat &dst)
@@ -1126,82 +1488,266 @@ void contrast_histogram_equalize(const cv::Mat &src, cv::Mat &dst)
 	}
 }
 
-void contrast_adaptive_equalization(const cv::Mat &src, cv::Mat &dst, int window)
+namespace {
+
+//BORDER_REFLECT index, also for windows larger than image
+inline int reflect(int i, int len)
 {
-	contrast_limit_adaptive_equalization(src, dst, window, -1);
+	while (i < 0 || i >= len)
+		i = i < 0 ? -i - 1 : 2 * len - 1 - i;
+	return i;
 }
 
-void contrast_limit_adaptive_equalization(const cv::Mat &src, cv::Mat &dst,
-		int window, int maxval)
+//gray image the equalization mapping is computed from
+cv::Mat equalization_base(const cv::Mat &src, ScratchFrame &scratch)
 {
-	int channels = src.channels();
-	int count_bins = 256;
-	size_t count_pixels = window * window;
-	int resize_factor = 16;
-	/*
-	resize_factor = std::min(src.cols, src.rows) / (2 * window);
-	resize_factor = std::min(16, resize_factor);
-	resize_factor = std::max(1, resize_factor);
-	*/
+	af_assert(src.type() == CV_8UC1 || src.type() == CV_8UC3);
+	if (src.channels() == 1)
+		return src;
+	cv::Mat gray = scratch.mat(src.size(), CV_8UC1);
+	cv::cvtColor(src, gray, CV_BGR2GRAY);
+	return gray;
+}
 
-	std::vector<std::vector<int> > hists;
-	std::vector<float> fhist(count_bins);
+//Perreault sliding histogram: 256 fine and 16 coarse bins per column of
+//window height, updated by one row in and one out. Coarse window histogram
+//moves by one column per pixel; fine bins of a coarse bin are refreshed
+//lazily, only when a pixel value falls into it, by the columns passed since
+//its last refresh (or summed anew if the whole window was passed).
+void adaptive_equalization_rows(const cv::Mat &src, const cv::Mat &gray, cv::Mat &dst,
+		int window, int begin, int end)
+{
+	const int rows = gray.rows;
+	const int cols = gray.cols;
+	const int channels = src.channels();
+	const int lo = -(window / 2);
+	const int hi = lo + window - 1;
+	const float scale = 255.0f / (float(window) * window);
+
+	ScratchFrame scratch;
+	uint16_t *col_fine = scratch.zeros<uint16_t>(size_t(cols) * 256);
+	uint16_t *col_coarse = scratch.zeros<uint16_t>(size_t(cols) * 16);
+	int fine[256];
+	int coarse[16];
+	int fine_x[16];  // window position fine bins of coarse bin are valid for
+
+	auto update_column = [&](const uint8_t *row, int delta) {
+		for (int x = 0; x < cols; ++x)
+		{
+			col_fine[x * 256 + row[x]] += delta;
+			col_coarse[x * 16 + (row[x] >> 4)] += delta;
+		}
+	};
 
-	cv::Mat tmp;
-	cv::resize(src, tmp, cv::Size(src.cols / resize_factor + 1, src.rows / resize_factor + 1));
-	int cols = tmp.cols;
-	int rows = tmp.rows;
-	cv::Mat gray;
-	if (src.channels() == 3)
-		cv::cvtColor(tmp, gray, CV_BGR2GRAY);
-	else
-		tmp.copyTo(gray);
-	std::vector<cv::Mat> nrm;
-	nrm.resize(count_bins);
-	for (int k = 0; k < count_bins; ++k)
-		nrm[k] = cv::Mat::zeros(cv::Size(cols, rows), CV_32F);
+	auto refresh_fine = [&](int b, int x) {
+		int *f = fine + b * 16;
+		if (fine_x[b] < 0 || x - fine_x[b] >= window)
+		{
+			memset(f, 0, 16 * sizeof(int));
+			for (int k = lo; k <= hi; ++k)
+			{
+				const uint16_t *cf = &col_fine[reflect(x + k, cols) * 256 + b * 16];
+				for (int i = 0; i < 16; ++i)
+					f[i] += cf[i];
+			}
+		}
+		else
+		{
+			for (int t = fine_x[b] + 1; t <= x; ++t)
+			{
+				const uint16_t *fin = &col_fine[reflect(t + hi, cols) * 256 + b * 16];
+				const uint16_t *fout = &col_fine[reflect(t + lo - 1, cols) * 256 + b * 16];
+				for (int i = 0; i < 16; ++i)
+					f[i] += int(fin[i]) - int(fout[i]);
+			}
+		}
+		fine_x[b] = x;
+	};
+
+	for (int k = lo; k <= hi; ++k)
+		update_column(gray.ptr(reflect(begin + k, rows)), 1);
 
-	for (int y = 0; y < rows; ++y)
+	for (int y = begin; y < end; ++y)
 	{
+		if (y > begin)
+		{
+			update_column(gray.ptr(reflect(y + lo - 1, rows)), -1);
+			update_column(gray.ptr(reflect(y + hi, rows)), 1);
+		}
+
+		memset(coarse, 0, sizeof(coarse));
+		for (int k = lo; k <= hi; ++k)
+		{
+			const uint16_t *cc = &col_coarse[reflect(k, cols) * 16];
+			for (int b = 0; b < 16; ++b)
+				coarse[b] += cc[b];
+		}
+		std::fill(fine_x, fine_x + 16, -1);
+
+		const uint8_t *ps = src.ptr(y);
+		uint8_t *pd = dst.ptr(y);
 		for (int x = 0; x < cols; ++x)
 		{
-			histogram_local(gray, hists, cv::Rect(x - window / 2, y - window / 2, window, window));
-			if (maxval != -1) // CLAHE
+			if (x > 0)
 			{
-				fhist.assign(hists[0].begin(), hists[0].end());
-				histogram_truncate(fhist, maxval);
-				nrm[0].at<float>(y, x) = fhist[0] / count_pixels;
-				for (int k = 1; k < count_bins; ++k)
-					nrm[k].at<float>(y, x) = fhist[k] /
-							count_pixels + nrm[k - 1].at<float>(y, x);
+				const uint16_t *cin = &col_coarse[reflect(x + hi, cols) * 16];
+				const uint16_t *cout = &col_coarse[reflect(x + lo - 1, cols) * 16];
+				for (int b = 0; b < 16; ++b)
+					coarse[b] += int(cin[b]) - int(cout[b]);
 			}
-			else // AHE
+			for (int c = 0; c < channels; ++c)
 			{
-				nrm[0].at<float>(y, x) = (float)hists[0][0] / count_pixels;
-				for (int k = 1; k < count_bins; ++k)
-					nrm[k].at<float>(y, x) = (float)hists[0][k] / count_pixels +
-							nrm[k - 1].at<float>(y, x);
+				const int v = ps[x * channels + c];
+				const int cb = v >> 4;
+				if (fine_x[cb] != x)
+					refresh_fine(cb, x);
+				int rank = 0;
+				for (int b = 0; b < cb; ++b)
+					rank += coarse[b];
+				for (int b = v & ~15; b <= v; ++b)
+					rank += fine[b];
+				pd[x * channels + c] = to_uint8_t(scale * rank);
 			}
 		}
 	}
+}
+
+//tile index pair and weight of the second tile for every position,
+//tile LUTs are anchored at tile centers
+void clahe_interpolation(const int *bounds, int count, int len,
+		int *first, float *weight, ScratchFrame &scratch)
+{
+	float *centers = scratch.alloc<float>(count);
+	for (int t = 0; t < count; ++t)
+		centers[t] = 0.5f * (bounds[t] + bounds[t + 1] - 1);
+
+	int t = 0;
+	for (int i = 0; i < len; ++i)
+	{
+		while (t + 1 < count && centers[t + 1] <= i)
+			++t;
+		first[i] = t;
+		if (t + 1 >= count || i <= centers[t])
+			weight[i] = 0;
+		else
+			weight[i] = (i - centers[t]) / (centers[t + 1] - centers[t]);
+	}
+}
 
-	cols = src.cols;
-	rows = src.rows;
-	dst = cv::Mat::zeros(rows, cols, src.type());
-	for (int c = 0; c < channels; ++c)
+}  // namespace
+
+void contrast_adaptive_equalization(const cv::Mat &src, cv::Mat &dst, int window)
+{
+	contrast_limit_adaptive_equalization(src, dst, window, -1);
+}
+
+void contrast_limit_adaptive_equalization(const cv::Mat &src, cv::Mat &dst,
+		int window, int maxval)
+{
+	af_assert(window > 0);
+	// src may be dst, windows read neighbour rows
+	ScratchFrame scratch;
+	cv::Mat in = src;
+	if (src.data == dst.data)
 	{
-		for (int i = 0; i < rows; ++i)
+		in = scratch.mat(src.size(), src.type());
+		src.copyTo(in);
+	}
+	cv::Mat gray = equalization_base(in, scratch);
+	dst.create(in.rows, in.cols, in.type());
+	const int rows = in.rows;
+	const int cols = in.cols;
+	const int channels = in.channels();
+
+	if (maxval == -1) // AHE
+	{
+		// column histograms of the sliding window count in 16 bits
+		af_assert(window <= 65535);
+		parallel_rows(rows, [&](int begin, int end) {
+			adaptive_equalization_rows(in, gray, dst, window, begin, end);
+		}, std::max(16, window));
+		return;
+	}
+
+	// CLAHE: histograms of window x window tiles, clipped,
+	// tile LUTs are bilinearly interpolated between tile centers
+	const int tiles_x = std::max(1, (cols + window / 2) / window);
+	const int tiles_y = std::max(1, (rows + window / 2) / window);
+	int *bounds_x = scratch.alloc<int>(tiles_x + 1);
+	int *bounds_y = scratch.alloc<int>(tiles_y + 1);
+	for (int t = 0; t <= tiles_x; ++t)
+		bounds_x[t] = int(int64_t(cols) * t / tiles_x);
+	for (int t = 0; t <= tiles_y; ++t)
+		bounds_y[t] = int(int64_t(rows) * t / tiles_y);
+	int *tile_x = scratch.alloc<int>(cols);
+	for (int t = 0; t < tiles_x; ++t)
+		std::fill(tile_x + bounds_x[t], tile_x + bounds_x[t + 1], t);
+
+	float *luts = scratch.alloc<float>(size_t(tiles_x) * tiles_y * 256);
+	parallel_rows(tiles_y, [&](int begin, int end) {
+		ScratchFrame rows_scratch;
+		int *hists = rows_scratch.alloc<int>(size_t(tiles_x) * 256);
+		float fhist[256];
+		for (int ty = begin; ty < end; ++ty)
 		{
-			const uint8_t* ps = src.ptr(i);
-			uint8_t* pd = dst.ptr(i);
-			for (int j = 0; j < cols; ++j)
-				pd[j * channels + c] = to_uint8_t(
-						255.0f * nrm[ ps[j*channels + c] ].at<float>(
-							(int)(i * tmp.rows / (float)src.rows),
-							(int)(j * tmp.cols / (float)src.cols))
-						);
+			std::fill(hists, hists + size_t(tiles_x) * 256, 0);
+			for (int y = bounds_y[ty]; y < bounds_y[ty + 1]; ++y)
+			{
+				const uint8_t *pg = gray.ptr(y);
+				for (int x = 0; x < cols; ++x)
+					++hists[tile_x[x] * 256 + pg[x]];
+			}
+			const int height = bounds_y[ty + 1] - bounds_y[ty];
+			for (int tx = 0; tx < tiles_x; ++tx)
+			{
+				const int area = height * (bounds_x[tx + 1] - bounds_x[tx]);
+				std::copy(hists + tx * 256, hists + (tx + 1) * 256, fhist);
+				// maxval is given for window x window histogram
+				histogram_truncate(fhist, 256,
+					std::max(1, int(int64_t(maxval) * area / (window * window))));
+				float *lut = &luts[(size_t(ty) * tiles_x + tx) * 256];
+				float sum = 0;
+				for (int v = 0; v < 256; ++v)
+				{
+					sum += fhist[v];
+					lut[v] = 255.0f * sum / area;
+				}
+			}
 		}
-	}
+	}, 1);
+
+	int *first_x = scratch.alloc<int>(cols);
+	int *first_y = scratch.alloc<int>(rows);
+	float *weight_x = scratch.alloc<float>(cols);
+	float *weight_y = scratch.alloc<float>(rows);
+	clahe_interpolation(bounds_x, tiles_x, cols, first_x, weight_x, scratch);
+	clahe_interpolation(bounds_y, tiles_y, rows, first_y, weight_y, scratch);
+
+	parallel_rows(rows, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y)
+		{
+			const int ty0 = first_y[y];
+			const int ty1 = std::min(ty0 + 1, tiles_y - 1);
+			const float wy = weight_y[y];
+			const float *lut0 = &luts[size_t(ty0) * tiles_x * 256];
+			const float *lut1 = &luts[size_t(ty1) * tiles_x * 256];
+			const uint8_t *ps = in.ptr(y);
+			uint8_t *pd = dst.ptr(y);
+			for (int x = 0; x < cols; ++x)
+			{
+				const int t0 = first_x[x] * 256;
+				const int t1 = std::min(first_x[x] + 1, tiles_x - 1) * 256;
+				const float wx = weight_x[x];
+				for (int c = 0; c < channels; ++c)
+				{
+					const int v = ps[x * channels + c];
+					float a = lut0[t0 + v] + wx * (lut0[t1 + v] - lut0[t0 + v]);
+					float b = lut1[t0 + v] + wx * (lut1[t1 + v] - lut1[t0 + v]);
+					pd[x * channels + c] = to_uint8_t(a + wy * (b - a));
+				}
+			}
+		}
+	});
 }
 
 void contrast_mask_equalize(const cv::Mat &src, cv::Mat &dst, float blur_value, float reduce_value)
@@ -7,6 +7,8 @@
 #include <opencv2/video/video.hpp>
 #include <opencv2/imgproc/types_c.h>
 
+#include "scratch.hpp"
+
 #include <functional>
 #include <vector>
 
@@ -33,6 +35,8 @@ cv::Vec2f lin_transform(const cv::Vec2i &minmax, int min_val, int max_val);
 
 /**
  * @brief Convolutional with custom filter.
+ * Thin wrapper over convolution_tiles(), func gets window as cv::Mat header
+ * and may be called from several threads.
  * @param src [in] input matrix.
  * @param window [in] Convolution window size.
  * @param func [in] Convolution kernel function.
@@ -46,21 +50,160 @@ cv::Mat_<outtype> convolution(
 	const cv::Size &window, const std::function<outtype(const cv::Mat &)> &func,
 	cv::BorderTypes border_type = cv::BORDER_REFLECT_101);
 
+/**
+ * @brief Engine of convolutions: src is extended by border of half window,
+ * output is split into tiles processed in parallel (see parallel.hpp).
+ * @param type [in] required src type.
+ * @param body [in] called for every tile with extended src and tile rect,
+ * window of output pixel (x, y) has top-left corner (x, y) in extended src.
+ */
+void convolution_tiles(const cv::Mat &src, const cv::Size &window, int type,
+	cv::BorderTypes border_type,
+	const std::function<void(const cv::Mat &, const cv::Rect &)> &body);
+
+/**
+ * @brief Window passed to kernels of convolution_kernel(): raw pointer and
+ * row step, WIDTH and HEIGHT are compile-time size or 0 if known at run time.
+ */
+template<typename T, int WIDTH = 0, int HEIGHT = 0>
+struct ConvolutionWindow
+{
+	const T *data;  // top-left pixel
+	size_t step;  // row step in elements
+	cv::Size size;
+
+	int width() const { return WIDTH ? WIDTH : size.width; }
+	int height() const { return HEIGHT ? HEIGHT : size.height; }
+	const T *operator[](int y) const { return data + y * step; }
+	const T &center() const { return data[(height() / 2) * step + width() / 2]; }
+};
+
+/**
+ * @brief Convolution with kernel inlined: outtype kernel(const ConvolutionWindow<intype, WIDTH, HEIGHT>&).
+ * @param src [in] matrix of cv::DataType<intype>::type.
+ * @param window [in] window size, ignored for non-zero WIDTH / HEIGHT.
+ */
+template<typename outtype, typename intype, int WIDTH = 0, int HEIGHT = 0, typename Kernel>
+cv::Mat_<outtype> convolution_kernel(
+	const cv::Mat &src, const cv::Size &window, Kernel kernel,
+	cv::BorderTypes border_type = cv::BORDER_REFLECT_101)
+{
+	if (src.empty())
+		return cv::Mat_<outtype>();
+
+	const cv::Size size(WIDTH ? WIDTH : window.width, HEIGHT ? HEIGHT : window.height);
+	cv::Mat_<outtype> dst(src.size());
+	convolution_tiles(src, size, cv::DataType<intype>::type, border_type,
+		[&](const cv::Mat &expsrc, const cv::Rect &rect) {
+			ConvolutionWindow<intype, WIDTH, HEIGHT> w;
+			w.step = expsrc.step / sizeof(intype);
+			w.size = size;
+			for (int y = rect.y; y < rect.y + rect.height; ++y)
+			{
+				const intype *ps = expsrc.ptr<intype>(y);
+				outtype *pd = dst[y];
+				for (int x = rect.x; x < rect.x + rect.width; ++x)
+				{
+					w.data = ps + x;
+					pd[x] = kernel(w);
+				}
+			}
+		});
+	return dst;
+}
+
+/**
+ * @brief Separable convolution: midtype row_kernel(const ConvolutionWindow<intype, WIDTH, 1>&)
+ * over rows of tile (with vertical halo), then
+ * outtype column_kernel(const ConvolutionWindow<midtype, 1, HEIGHT>&) over its results.
+ */
+template<typename outtype, typename intype, typename midtype = float,
+	int WIDTH = 0, int HEIGHT = 0, typename RowKernel, typename ColumnKernel>
+cv::Mat_<outtype> convolution_separable(
+	const cv::Mat &src, const cv::Size &window,
+	RowKernel row_kernel, ColumnKernel column_kernel,
+	cv::BorderTypes border_type = cv::BORDER_REFLECT_101)
+{
+	if (src.empty())
+		return cv::Mat_<outtype>();
+
+	const cv::Size size(WIDTH ? WIDTH : window.width, HEIGHT ? HEIGHT : window.height);
+	cv::Mat_<outtype> dst(src.size());
+	convolution_tiles(src, size, cv::DataType<intype>::type, border_type,
+		[&](const cv::Mat &expsrc, const cv::Rect &rect) {
+			const int rows = rect.height + size.height - 1;
+			ScratchFrame scratch;
+			midtype *tmp = scratch.alloc<midtype>(size_t(rows) * rect.width);
+
+			ConvolutionWindow<intype, WIDTH, 1> rw;
+			rw.step = expsrc.step / sizeof(intype);
+			rw.size = cv::Size(size.width, 1);
+			for (int i = 0; i < rows; ++i)
+			{
+				const intype *ps = expsrc.ptr<intype>(rect.y + i) + rect.x;
+				midtype *pt = &tmp[size_t(i) * rect.width];
+				for (int x = 0; x < rect.width; ++x)
+				{
+					rw.data = ps + x;
+					pt[x] = row_kernel(rw);
+				}
+			}
+
+			ConvolutionWindow<midtype, 1, HEIGHT> cw;
+			cw.step = rect.width;
+			cw.size = cv::Size(1, size.height);
+			for (int y = 0; y < rect.height; ++y)
+			{
+				const midtype *pt = &tmp[size_t(y) * rect.width];
+				outtype *pd = dst[rect.y + y] + rect.x;
+				for (int x = 0; x < rect.width; ++x)
+				{
+					cw.data = pt + x;
+					pd[x] = column_kernel(cw);
+				}
+			}
+		});
+	return dst;
+}
+
 void blur(const cv::Mat& src, cv::Mat& dst, int type, int size, cv::Mat &tmp);
 void erode_dilate(cv::Mat &img);
 void sobel(const cv::Mat &src, cv::Mat &dst, int dx, int dy, int ksize = 3);
 void sobel_v2(const cv::Mat &src, cv::Mat &dst, cv::Mat &dx, cv::Mat &dy);
 void gradient(const cv::Mat &src, cv::Mat &angle, cv::Mat &magnitude,
 	int ksize, cv::Mat &dx, cv::Mat &dy);
-//quantized version, all output is uint8_t
+/**
+ * @brief 3x3 Sobel and gradient() in a single pass over src.
+ * Source rows are read once into a 3-row ring, derivatives are kept in row
+ * buffers and only angle and magnitude are written (and dx/dy if given).
+ * Row stripes are processed in parallel, see parallel.hpp.
+ * @param src [in] CV_32F or CV_8U image, any channels count.
+ * @param angle, magnitude [out] CV_32F, [0, 180) degrees; one value per channel
+ * if angle has src channels, otherwise one for the strongest channel.
+ * @param dx, dy [out] optional Sobel derivatives.
+ */
+void gradient_fused(const cv::Mat &src, cv::Mat &angle, cv::Mat &magnitude,
+	cv::Mat *dx = nullptr, cv::Mat *dy = nullptr);
+/**
+ * @brief Quantized gradient: the largest absolute difference between opposite
+ * neighbours of every pixel among 4 directions.
+ * @param src [in] CV_8UC1 or CV_8UC3 (differences are maximized over channels).
+ * @param angle [out] CV_8UC1 direction: 1 - horizontal, 2 - main diagonal,
+ * 3 - vertical, 4 - anti-diagonal, 0 if no difference exceeds threshold.
+ * @param magnitude [out] CV_8UC1 difference, 0 if angle is 0. Borders are 0.
+ */
 void gradient2(const cv::Mat &src, cv::Mat &angle, cv::Mat &magnitude,
 	int threshold = 0, int ksize = 3);
 float f32_bilinear_1u8(IplImage *img, float x, float y);
 
 /**
  * Median filter.
- * @param src [in] Input image.
- * @param size [in] Filter window size.
+ * Sliding two-level histograms, O(window height) per pixel; float images are
+ * filtered by ranks of values in the whole image (three-level histogram when
+ * there are more than 65536 distinct values). Row stripes are processed in
+ * parallel.
+ * @param src [in] Input image, CV_8U, CV_16U or CV_32F, any channels count.
+ * @param size [in] Filter window size, odd width and height.
  * @return filtered image.
  */
 cv::Mat filter_median(
@@ -68,8 +211,8 @@ cv::Mat filter_median(
 		cv::BorderTypes borderType = cv::BORDER_WRAP);
 
 /**
- * Adaptive median filter.
- * @param src [in] input image.
+ * Adaptive median filter: src - filter_median(src).
+ * @param src [in] input single channel image.
  * @param size [in] Filter window size.
  * @return filtered image.
  */
@@ -99,6 +242,7 @@ void channel_linear_stretch(const cv::Mat &src, cv::Mat &dst,
 void channel_linear_stretch(const cv::Mat &src, cv::Mat &dst);
 
 // histogram manipulations
+// 256-bin histograms of CV_8U window, parts outside of image are mirrored
 void histogram_local(const cv::Mat &src, std::vector<std::vector<int> > &hists,
 		const cv::Rect &rect);
 void histogram_save_debug(const std::vector<int> &hists, int scale);
@@ -117,6 +261,7 @@ cv::Vec2i histogram_bounds_from_peak_square(
 		int peak, int min_square,
 		int min_left = 0, int max_right = 255);
 void histogram_truncate(std::vector<float> &fhist, int maxval);
+void histogram_truncate(float *fhist, int bins, int maxval);
 
 // contrast adjustment
 // dst = (src - mean) / (sqrt(bias + var))
@@ -137,7 +282,18 @@ void contrast_histogram_shift_stretch(
 void contrast_nonlinear_equalize(const cv::Mat &src, cv::Mat &dst,
 		float P, float G, int (*function)(int, float, float));
 void contrast_histogram_equalize(const cv::Mat &src, cv::Mat &dst);
+/**
+ * @brief Adaptive histogram equalization of CV_8UC1 or CV_8UC3 image
+ * (mapping is computed from gray and applied to every channel).
+ * Every pixel is mapped by CDF of its window x window neighbourhood (mirrored
+ * at borders), window histogram slides over per-column histograms.
+ */
 void contrast_adaptive_equalization(const cv::Mat &src, cv::Mat &dst, int window);
+/**
+ * @brief CLAHE: histograms of window x window tiles are clipped at maxval
+ * (excess is spread over all bins), tile mappings are bilinearly interpolated.
+ * maxval == -1 is contrast_adaptive_equalization().
+ */
 void contrast_limit_adaptive_equalization(
 		const cv::Mat &src, cv::Mat &dst, int window, int maxval);
 void contrast_mask_equalize(
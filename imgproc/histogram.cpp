@@ -0,0 +1,171 @@
+/** @file histogram.cpp
+ *
+ *  @brief One-pass multi-channel histograms.
+ *
+ *  Every row channel is first converted to bin indices (by table for 8-bit
+ *  images), then counted into 4 interleaved sub-histograms, so runs of equal
+ *  values do not wait on one counter. Row stripes count into their own
+ *  buffers and are summed into the result under a mutex.
+ */
+#include "histogram.hpp"
+#include "parallel.hpp"
+#include "scratch.hpp"
+
+#include <common/errutils.hpp>
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <mutex>
+
+namespace aifil {
+namespace imgproc {
+
+namespace {
+
+//independent counters per channel: pixel x goes to sub-histogram x % sub_hists
+const int sub_hists = 4;
+
+//bin of every pixel of row channel, out of range values go to trash bin nbins
+template<typename T>
+struct RowBinner
+{
+	double min_val;
+	double scale;
+	int nbins;
+
+	RowBinner(int nbins, double min_val, double max_val) :
+		min_val(min_val), scale(nbins / (max_val - min_val)), nbins(nbins) {}
+
+	void operator()(const T *src, int step, int count, int *bins) const
+	{
+		const double top = nbins;
+		for (int x = 0; x < count; ++x)
+		{
+			double v = (src[x * step] - min_val) * scale;
+			//NaN fails comparisons too
+			bins[x] = (v >= 0.0 && v < top) ? int(v) : nbins;
+		}
+	}
+};
+
+//8-bit values are binned by table
+template<>
+struct RowBinner<uint8_t>
+{
+	int lut[256];
+
+	RowBinner(int nbins, double min_val, double max_val)
+	{
+		const double scale = nbins / (max_val - min_val);
+		for (int v = 0; v < 256; ++v)
+		{
+			double bin = (v - min_val) * scale;
+			lut[v] = (bin >= 0 && bin < nbins) ? int(bin) : nbins;
+		}
+	}
+
+	void operator()(const uint8_t *src, int step, int count, int *bins) const
+	{
+		for (int x = 0; x < count; ++x)
+			bins[x] = lut[src[x * step]];
+	}
+};
+
+template<typename T>
+void histograms_typed(const cv::Mat &src, std::vector<std::vector<int> > &hists,
+	int nbins, double min_val, double max_val, int first_ch, int count_ch)
+{
+	const RowBinner<T> binner(nbins, min_val, max_val);
+	const int ch = src.channels();
+	//sub-histograms of a channel are interleaved bin by bin, plus trash bin
+	const int hist_size = (nbins + 1) * sub_hists;
+	std::mutex merge_mutex;
+
+	parallel_rows(src.rows, [&](int begin, int end) {
+		ScratchFrame scratch;
+		int *counts = scratch.zeros<int>(count_ch * hist_size);
+		int *bins = scratch.alloc<int>(src.cols);
+		for (int y = begin; y < end; ++y)
+		{
+			const T *row = src.ptr<T>(y) + first_ch;
+			for (int c = 0; c < count_ch; ++c)
+			{
+				binner(row + c, ch, src.cols, bins);
+				int *cnt = &counts[c * hist_size];
+				int x = 0;
+				for ( ; x + sub_hists <= src.cols; x += sub_hists)
+				{
+					++cnt[bins[x] * sub_hists];
+					++cnt[bins[x + 1] * sub_hists + 1];
+					++cnt[bins[x + 2] * sub_hists + 2];
+					++cnt[bins[x + 3] * sub_hists + 3];
+				}
+				for ( ; x < src.cols; ++x)
+					++cnt[bins[x] * sub_hists];
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(merge_mutex);
+		for (int c = 0; c < count_ch; ++c)
+		{
+			const int *cnt = &counts[c * hist_size];
+			std::vector<int> &hist = hists[c];
+			for (int b = 0; b < nbins; ++b)
+				hist[b] += cnt[b * sub_hists] + cnt[b * sub_hists + 1] +
+					cnt[b * sub_hists + 2] + cnt[b * sub_hists + 3];
+		}
+	}, 64);
+}
+
+}  // namespace
+
+void histograms_add(const cv::Mat &src, std::vector<std::vector<int> > &hists,
+	int nbins, double min_val, double max_val, int channel)
+{
+	af_assert(nbins > 0 && max_val > min_val);
+	af_assert(channel >= -1 && channel < src.channels() && "illegal channel requested");
+	const int first_ch = channel < 0 ? 0 : channel;
+	const int count_ch = channel < 0 ? src.channels() : 1;
+	af_assert(int(hists.size()) == count_ch);
+	for (auto &h: hists)
+		af_assert(int(h.size()) == nbins);
+	if (src.empty())
+		return;
+
+	switch (src.depth())
+	{
+	case CV_8U:
+		histograms_typed<uint8_t>(src, hists, nbins, min_val, max_val, first_ch, count_ch);
+		break;
+	case CV_16U:
+		histograms_typed<uint16_t>(src, hists, nbins, min_val, max_val, first_ch, count_ch);
+		break;
+	case CV_32F:
+		histograms_typed<float>(src, hists, nbins, min_val, max_val, first_ch, count_ch);
+		break;
+	default:
+		af_assert(!"histograms(): unsupported depth");
+	}
+}
+
+void histograms(const cv::Mat &src, std::vector<std::vector<int> > &hists,
+	int nbins, double min_val, double max_val, int channel)
+{
+	//capacity of hists is reused by repeated calls
+	hists.resize(channel < 0 ? src.channels() : 1);
+	for (auto &h: hists)
+		h.assign(nbins, 0);
+	histograms_add(src, hists, nbins, min_val, max_val, channel);
+}
+
+void histogram_channel(const cv::Mat &src, std::vector<int> &hist,
+	int nbins, double min_val, double max_val, int channel)
+{
+	std::vector<std::vector<int> > hists(1, std::vector<int>(nbins, 0));
+	histograms_add(src, hists, nbins, min_val, max_val, channel);
+	hist.swap(hists[0]);
+}
+
+}  // namespace imgproc
+}  // namespace aifil
@@ -0,0 +1,44 @@
+/** @file histogram.hpp
+ *
+ *  @brief Histograms of all image channels in one pass.
+ *
+ *  Bins are uniform over [min_val, max_val), values outside are skipped
+ *  (like cv::calcHist). Counting goes to several interleaved sub-histograms,
+ *  so repeated values (flat areas) do not serialize on one counter,
+ *  and stripes of image are counted in parallel and merged.
+ */
+
+#ifndef AIFIL_IMGPROC_HISTOGRAM_H
+#define AIFIL_IMGPROC_HISTOGRAM_H
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+
+namespace aifil {
+namespace imgproc {
+
+/**
+ * @brief Histograms of CV_8U, CV_16U or CV_32F image.
+ * @param hists [out] one histogram of nbins values per channel,
+ * or only the requested channel.
+ * @param channel [in] -1 for all channels.
+ */
+void histograms(const cv::Mat &src, std::vector<std::vector<int> > &hists,
+	int nbins, double min_val, double max_val, int channel = -1);
+
+// histogram of single channel
+void histogram_channel(const cv::Mat &src, std::vector<int> &hist,
+	int nbins, double min_val, double max_val, int channel = 0);
+
+/**
+ * @brief Histograms are added to hists instead of replacing them.
+ * hists must have the right size already (channels x nbins).
+ */
+void histograms_add(const cv::Mat &src, std::vector<std::vector<int> > &hists,
+	int nbins, double min_val, double max_val, int channel = -1);
+
+}  // namespace imgproc
+}  // namespace aifil
+
+#endif  // AIFIL_IMGPROC_HISTOGRAM_H
@@ -0,0 +1,383 @@
+/** @file hog.cpp
+ *
+ *  @brief Histograms of oriented gradients.
+ *
+ *  hog_classic() is the Felzenszwalb HOG: 2 * nbins contrast sensitive
+ *  bins, nbins contrast insensitive ones and 4 texture features per cell,
+ *  normalized by the 4 blocks of 2x2 cells around it.
+ *
+ *  Bilinear spatial weight of a pixel is wx(col) * wy(row), so cells are
+ *  accumulated in two passes: every pixel row is binned into a row of cells
+ *  with horizontal weights, then the row is added to the two nearest cell
+ *  rows with vertical weights (vectorized axpy). Pixels which fall half a
+ *  cell outside the grid go to padding cells, so the inner loops do not
+ *  branch on borders.
+ *
+ *  hog_kernel() is a dense HOG: 9-bin histogram of every 5x5 window weighted
+ *  by Gaussian. The kernel is separable, so magnitudes are split into per-bin
+ *  planes and every plane is blurred by rows and then by columns.
+ */
+#include "imgproc.hpp"
+#include "parallel.hpp"
+#include "scratch.hpp"
+
+#include <common/errutils.hpp>
+
+#include <algorithm>
+#include <math.h>
+
+namespace aifil {
+namespace imgproc {
+
+namespace {
+
+//pixel coordinate interpolated between centers of cells `cell` and `cell + 1`,
+//cells are counted from -1 (left or top padding)
+struct CellWeight
+{
+	int cell;
+	float w0;
+	float w1;
+};
+
+void cell_weights(int pixels, int cell_size, CellWeight *weights)
+{
+	for (int p = 0; p < pixels; ++p)
+	{
+		float pos = (p + 0.5f) / cell_size - 0.5f;
+		int cell = int(floorf(pos));
+		weights[p].cell = cell;
+		weights[p].w1 = pos - cell;
+		weights[p].w0 = 1.0f - weights[p].w1;
+	}
+}
+
+//cell histograms for cell rows [row_begin, row_end),
+//xw and yw are weights of width and height pixels
+void hog_cells(const cv::Mat &grangle, const cv::Mat &grmag, cv::Mat &cn,
+	int nbins, const CellWeight *xw, int width, const CellWeight *yw, int height,
+	int row_begin, int row_end)
+{
+	const int cnbins = nbins * 2;
+	const int dcols = cn.cols;
+	const float agmult = cnbins / 360.0f;
+	const float mgmult = 1.0f / 255.0f;
+
+	for (int row = row_begin; row < row_end; ++row)
+		std::fill_n(cn.ptr<float>(row), dcols * cnbins, 0.0f);
+
+	ScratchFrame scratch;
+	//orientation bins and weighted magnitudes of one pixel row
+	int *b0 = scratch.alloc<int>(width);
+	int *b1 = scratch.alloc<int>(width);
+	float *m0 = scratch.alloc<float>(width);
+	float *m1 = scratch.alloc<float>(width);
+	//cells -1 .. dcols of one pixel row
+	const int row_hist_size = (dcols + 2) * cnbins;
+	float *row_hist = scratch.alloc<float>(row_hist_size);
+
+	//pixel rows reaching cell rows of the band
+	int y_begin = std::max(0, (row_begin - 1) * height / cn.rows);
+	int y_end = std::min(height, (row_end + 1) * height / cn.rows);
+	for (int y = y_begin; y < y_end; ++y)
+	{
+		const CellWeight &wy = yw[y];
+		const bool use0 = wy.cell >= row_begin && wy.cell < row_end;
+		const bool use1 = wy.cell + 1 >= row_begin && wy.cell + 1 < row_end;
+		if (!use0 && !use1)
+			continue;
+
+		const float *pangle = grangle.ptr<float>(y);
+		const float *pmag = grmag.ptr<float>(y);
+		for (int x = 0; x < width; ++x)
+		{
+			float agv = pangle[x] * agmult;
+			int ag = int(agv);
+			float r = agv - ag;
+			float mgv = pmag[x] * mgmult;
+			ag = ag < cnbins ? ag : ag - cnbins;
+			b0[x] = ag;
+			b1[x] = ag + 1 < cnbins ? ag + 1 : 0;
+			m0[x] = mgv * (1.0f - r);
+			m1[x] = mgv * r;
+		}
+
+		std::fill_n(row_hist, row_hist_size, 0.0f);
+		float *hist = row_hist + cnbins;
+		for (int x = 0; x < width; ++x)
+		{
+			const CellWeight &wx = xw[x];
+			float *h0 = hist + wx.cell * cnbins;
+			float *h1 = h0 + cnbins;
+			h0[b0[x]] += wx.w0 * m0[x];
+			h0[b1[x]] += wx.w0 * m1[x];
+			h1[b0[x]] += wx.w1 * m0[x];
+			h1[b1[x]] += wx.w1 * m1[x];
+		}
+
+		const int len = dcols * cnbins;
+		if (use0)
+		{
+			float *dst = cn.ptr<float>(wy.cell);
+			for (int i = 0; i < len; ++i)
+				dst[i] += wy.w0 * hist[i];
+		}
+		if (use1)
+		{
+			float *dst = cn.ptr<float>(wy.cell + 1);
+			for (int i = 0; i < len; ++i)
+				dst[i] += wy.w1 * hist[i];
+		}
+	}
+}
+
+//squared contrast insensitive histogram of every cell
+void hog_energy(const cv::Mat &cn, cv::Mat &ca, int nbins, int row_begin, int row_end)
+{
+	const int cnbins = nbins * 2;
+	for (int row = row_begin; row < row_end; ++row)
+	{
+		const float *cnp = cn.ptr<float>(row);
+		float *cap = ca.ptr<float>(row);
+		for (int col = 0; col < cn.cols; ++col, cnp += cnbins)
+		{
+			float e = 0;
+			for (int k = 0; k < nbins; ++k)
+				e += (cnp[k] + cnp[k + nbins]) * (cnp[k] + cnp[k + nbins]);
+			cap[col] = e;
+		}
+	}
+}
+
+void hog_normalize(const cv::Mat &cn, const cv::Mat &ca, cv::Mat &dst, int nbins,
+	int row_begin, int row_end)
+{
+	const int cnbins = nbins * 2;
+	const int drows = cn.rows;
+	const int dcols = cn.cols;
+	const int dst_ch = dst.channels();
+
+	for (int row = row_begin; row < row_end; ++row)
+	{
+		//neighbour cells outside of the grid are replaced by the nearest ones
+		const float *ca_up = ca.ptr<float>(std::max(row - 1, 0));
+		const float *ca_mid = ca.ptr<float>(row);
+		const float *ca_down = ca.ptr<float>(std::min(row + 1, drows - 1));
+		const float *cnp = cn.ptr<float>(row);
+		float *dbp = dst.ptr<float>(row);
+		for (int col = 0; col < dcols; ++col, cnp += cnbins, dbp += dst_ch)
+		{
+			const int left = std::max(col - 1, 0);
+			const int right = std::min(col + 1, dcols - 1);
+			const float c = ca_mid[col];
+			//blocks: down-right, up-right, down-left, up-left
+			float norm[4] = {
+				c + ca_mid[right] + ca_down[col] + ca_down[right],
+				c + ca_mid[right] + ca_up[col] + ca_up[right],
+				c + ca_mid[left] + ca_down[col] + ca_down[left],
+				c + ca_mid[left] + ca_up[col] + ca_up[left]
+			};
+			for (int idx = 0; idx < 4; ++idx)
+				norm[idx] = 1.0f / sqrtf(0.0001f + norm[idx]);
+
+			float *texture = dbp;
+			float *insensitive = dbp + 4;
+			float *sensitive = dbp + 4 + nbins;
+			for (int idx = 0; idx < 4; ++idx)
+				texture[idx] = 0;
+			for (int k = 0; k < cnbins; ++k)
+			{
+				float sum = 0;
+				for (int idx = 0; idx < 4; ++idx)
+				{
+					float v = 0.5f * std::min(cnp[k] * norm[idx], 0.2f);
+					texture[idx] += v;
+					sum += v;
+				}
+				sensitive[k] = sum;
+			}
+			for (int idx = 0; idx < 4; ++idx)
+				texture[idx] *= 0.2357f;
+			for (int k = 0; k < nbins; ++k)
+			{
+				float h = cnp[k] + cnp[k + nbins];
+				float sum = 0;
+				for (int idx = 0; idx < 4; ++idx)
+					sum += 0.5f * std::min(h * norm[idx], 0.2f);
+				insensitive[k] = sum;
+			}
+		}
+	}
+}
+
+const int hog_kernel_bins = 9;
+const int hog_kernel_size = 5;
+
+//normalized 1D Gaussian, 2D kernel is outer product of it
+struct HogKernel
+{
+	float k[hog_kernel_size];
+
+	HogKernel()
+	{
+		const float shift = -(hog_kernel_size - 1) / 2.0f;
+		const float sigma = 0.5f * hog_kernel_size;
+		const float sigma2 = 2.0f * sigma * sigma;
+		double sum = 0;
+		for (int i = 0; i < hog_kernel_size; ++i)
+		{
+			k[i] = expf(-(i + shift) * (i + shift) / sigma2);
+			sum += k[i];
+		}
+		for (int i = 0; i < hog_kernel_size; ++i)
+			k[i] = float(k[i] / sum);
+	}
+};
+
+const HogKernel& hog_kernel_weights()
+{
+	static const HogKernel kernel;
+	return kernel;
+}
+
+//per-bin planes of source row y blurred horizontally, plane b at dst + b * width
+void hog_kernel_row(const cv::Mat &grangle, const cv::Mat &grmag, int y,
+	const float *k, float *bin_weights, int *bins, float *plane, float *dst, int width)
+{
+	const int nbins = hog_kernel_bins;
+	const int src_width = grangle.cols;
+	const float mult = nbins / 180.0f;
+	const float *pangle = grangle.ptr<float>(y);
+	const float *pmag = grmag.ptr<float>(y);
+
+	float *w1 = bin_weights;
+	float *w0 = bin_weights + src_width;
+	for (int x = 0; x < src_width; ++x)
+	{
+		float binf = pangle[x] * mult;
+		int bin = int(binf);
+		binf -= bin;
+		bins[x] = bin < nbins ? bin : bin - nbins;
+		w1[x] = pmag[x] * binf;
+		w0[x] = pmag[x] - w1[x];
+	}
+
+	for (int b = 0; b < nbins; ++b)
+	{
+		//pixel goes to bins[x] and the next one (cyclic)
+		const int prev = b > 0 ? b - 1 : nbins - 1;
+		for (int x = 0; x < src_width; ++x)
+			plane[x] = (bins[x] == b ? w0[x] : 0.0f) + (bins[x] == prev ? w1[x] : 0.0f);
+
+		float *out = dst + b * width;
+		for (int x = 0; x < width; ++x)
+		{
+			float sum = 0;
+			for (int i = 0; i < hog_kernel_size; ++i)
+				sum += k[i] * plane[x + i];
+			out[x] = sum;
+		}
+	}
+}
+
+}  // namespace
+
+void hog_classic(const cv::Mat &grangle, const cv::Mat &grmag, cv::Mat &dst,
+	int nbins, int cell_w, int cell_h, cv::Mat &cn, cv::Mat &ca)
+{
+	af_assert(cell_w > 0 && cell_h > 0 && nbins > 0);
+	af_assert(grangle.channels() == 1 && "1-ch gradient must be computed");
+	af_assert(grangle.depth() == CV_32F && grmag.depth() == CV_32F);
+	af_assert(grmag.channels() == 1 && grangle.size() == grmag.size());
+
+	af_assert(nbins * 3 + 4 <= dst.channels() && dst.depth() == CV_32F);
+
+	int drows = grangle.rows / cell_h;
+	int dcols = grangle.cols / cell_w;
+	af_assert(dst.rows == drows && dst.cols == dcols);
+	if (drows == 0 || dcols == 0)
+		return;
+
+	if (cn.rows != drows || cn.cols != dcols || cn.type() != CV_32FC(nbins * 2))
+		cn = cv::Mat(drows, dcols, CV_32FC(nbins * 2));
+	if (ca.rows != drows || ca.cols != dcols || ca.type() != CV_32FC1)
+		ca = cv::Mat(drows, dcols, CV_32FC1);
+
+	//pixels after the last whole cell are skipped
+	ScratchFrame scratch;
+	const int width = dcols * cell_w;
+	const int height = drows * cell_h;
+	CellWeight *xw = scratch.alloc<CellWeight>(width);
+	CellWeight *yw = scratch.alloc<CellWeight>(height);
+	cell_weights(width, cell_w, xw);
+	cell_weights(height, cell_h, yw);
+
+	//bands of cell rows, a band reads pixel rows half a cell around it
+	parallel_rows(drows, [&](int begin, int end) {
+		hog_cells(grangle, grmag, cn, nbins, xw, width, yw, height, begin, end);
+		hog_energy(cn, ca, nbins, begin, end);
+	}, 4);
+	parallel_rows(drows, [&](int begin, int end) {
+		hog_normalize(cn, ca, dst, nbins, begin, end);
+	}, 4);
+}
+
+void hog_kernel(const cv::Mat &grangle, const cv::Mat &grmag, cv::Mat &dst, int start_ch)
+{
+	const int nbins = hog_kernel_bins;
+	const int ksize = hog_kernel_size;
+
+	af_assert(grangle.channels() == 1 && grmag.channels() == 1);
+	af_assert(grangle.depth() == CV_32F && grmag.depth() == CV_32F);
+	af_assert(grangle.cols == grmag.cols && grangle.rows == grmag.rows);
+	af_assert(dst.rows >= grangle.rows - ksize && dst.cols >= grangle.cols - ksize);
+	af_assert(nbins + start_ch <= dst.channels() && dst.depth() == CV_32F);
+
+	//dst(row, col) is histogram of ksize x ksize window at (row, col)
+	const int rows = grangle.rows - ksize;
+	const int width = grangle.cols - ksize;
+	if (rows <= 0 || width <= 0)
+		return;
+	const float *k = hog_kernel_weights().k;
+	const int dst_ch = dst.channels();
+	const int plane_size = nbins * width;
+
+	parallel_rows(rows, [&](int begin, int end) {
+		ScratchFrame scratch;
+		float *bin_weights = scratch.alloc<float>(2 * grangle.cols);
+		int *bins = scratch.alloc<int>(grangle.cols);
+		float *plane = scratch.alloc<float>(grangle.cols);
+		//horizontally blurred planes of the last ksize source rows
+		float *ring = scratch.alloc<float>(ksize * plane_size);
+		float *s = scratch.alloc<float>(plane_size);
+
+		for (int y = begin; y < begin + ksize - 1; ++y)
+			hog_kernel_row(grangle, grmag, y, k, bin_weights, bins,
+				plane, &ring[(y % ksize) * plane_size], width);
+
+		for (int row = begin; row < end; ++row)
+		{
+			const int last = row + ksize - 1;
+			hog_kernel_row(grangle, grmag, last, k, bin_weights, bins,
+				plane, &ring[(last % ksize) * plane_size], width);
+
+			const float *r = &ring[(row % ksize) * plane_size];
+			for (int i = 0; i < plane_size; ++i)
+				s[i] = k[0] * r[i];
+			for (int j = 1; j < ksize; ++j)
+			{
+				r = &ring[((row + j) % ksize) * plane_size];
+				for (int i = 0; i < plane_size; ++i)
+					s[i] += k[j] * r[i];
+			}
+
+			float *res = dst.ptr<float>(row) + start_ch;
+			for (int col = 0; col < width; ++col, res += dst_ch)
+				for (int b = 0; b < nbins; ++b)
+					res[b] = s[b * width + col];
+		}
+	}, 8);
+}
+
+}  // namespace imgproc
+}  // namespace aifil
@@ -9,6 +9,9 @@
  *
  */
 #include "imgproc.hpp"
+#include "histogram.hpp"
+#include "integral.hpp"
+#include "parallel.hpp"
 
 //#include "sse/sse.h"
 
@@ -30,6 +33,8 @@ extern "C" {
 #include <opencv2/video/video.hpp>
 #include <opencv2/imgproc/types_c.h>
 
+#include <atomic>
+
 namespace aifil {
 
 #ifdef HAVE_SSE
@@ -37,11 +42,7 @@ namespace aifil {
 extern "C" void sse_gradient_c1(int height, int width, float *pdx, float *pdy,
 	float *pangle, float *pmag);
 extern "C" void sse_gradient_c3(int height, int width, float *pdx, float *pdy,
-	float *pangle, float *pmag);
-
-extern "C" void sse_integral_c10_32f(int height, int width, float *src, float *dst);
-extern "C" void sse_integral_c10_64f(int height, int width, float *src, double *dst);
-extern "C" void sse_integral_c10_32s(int height, int width, uint8_t *src, int *dst);
+	float *pangle, float *pmag, float *buf);
 
 extern "C" void sse_quantize_soft_6_10(int height, int width,
 	float *psrc, float *pweight, float *pdst);
@@ -118,26 +119,16 @@ int difference(const cv::Mat &src_0, const cv::Mat &src_1,
 	if (tmp.rows != src_0.rows || tmp.cols != src_0.cols || tmp.type() != src_0.type())
 		tmp = cv::Mat(src_0.rows, src_0.cols, src_0.type());
 
-#ifdef HAVE_SSE
-	int w = src_0.cols;
-	int h = src_0.rows;
-	::subtract_abs_1u8_sse((uint8_t *)tmp.data, (uint8_t *)src_0.data,
-				(uint8_t *)src_1.data, h, w);
-#else
-	cv::absdiff(src_0, src_1, tmp);
-#endif
-
-	if (thresh == -1)
-		return 0;
-
-	int mask_square = 0;
-#ifdef HAVE_SSE
-	mask_square = ::binarize_1u8_sse((uint8_t *)dst.data, (uint8_t *)tmp.data,
-				h, w, thresh);
-#else
-	cv::threshold(tmp, dst, thresh, 255, CV_THRESH_BINARY);
-	mask_square = cv::countNonZero(dst);
-#endif
+	std::atomic<int> mask_square(0);
+	parallel_rows(src_0.rows, [&](int begin, int end) {
+		cv::Mat tmp_rows = tmp.rowRange(begin, end);
+		cv::absdiff(src_0.rowRange(begin, end), src_1.rowRange(begin, end), tmp_rows);
+		if (thresh == -1)
+			return;
+		cv::Mat dst_rows = dst.rowRange(begin, end);
+		cv::threshold(tmp_rows, dst_rows, thresh, 255, CV_THRESH_BINARY);
+		mask_square += cv::countNonZero(dst_rows);
+	}, 64);
 
 	return mask_square;
 }
@@ -155,17 +146,16 @@ int difference(const cv::Mat &src_0, const cv::Mat &src_1,
 	if (tmp.rows != src_0.rows || tmp.cols != src_0.cols || tmp.type() != src_0.type())
 		tmp = cv::Mat(src_0.rows, src_0.cols, src_0.type());
 
-#ifdef HAVE_SSE
-	int w = src_0.cols;
-	int h = src_0.rows;
-	::subtract_abs_1u8_sse((uint8_t *)tmp.data, (uint8_t *)src_0.data,
-			(uint8_t *)src_1.data, h, w);
-#else
-	cv::absdiff(src_0, src_1, tmp);
-#endif
+	std::atomic<int> mask_square(0);
+	parallel_rows(src_0.rows, [&](int begin, int end) {
+		cv::Mat tmp_rows = tmp.rowRange(begin, end);
+		cv::Mat dst_rows = dst.rowRange(begin, end);
+		cv::absdiff(src_0.rowRange(begin, end), src_1.rowRange(begin, end), tmp_rows);
+		cv::subtract(tmp_rows, thresh.rowRange(begin, end), dst_rows);
+		mask_square += cv::countNonZero(dst_rows);
+	}, 64);
 
-	dst = tmp - thresh;
-	return cv::countNonZero(dst);
+	return mask_square;
 }
 
 cv::Mat rotate(const cv::Mat &src, double angle, double scale, cv::Rect roi, cv::Point2d center)
@@ -217,20 +207,20 @@ void flatten(const cv::Mat &src, cv::Mat &dst)
 		dst = cv::Mat(src.rows, src.cols, src.type());
 
 	int ch = src.channels();
-	float* sp = (float*)src.data;
-	float* dp = (float*)dst.data;
-	for (int i = 0; i < src.rows; ++i)
-	{
-		for (int j = 0; j < dst.cols; ++j)
+	parallel_rows(src.rows, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
 		{
-			float sum = 0;
-			for (int k = 0; k < ch; ++k)
-				sum += sp[j * ch + k];
-			dp[j] = sum;
+			const float* sp = src.ptr<float>(i);
+			float* dp = dst.ptr<float>(i);
+			for (int j = 0; j < dst.cols; ++j)
+			{
+				float sum = 0;
+				for (int k = 0; k < ch; ++k)
+					sum += sp[j * ch + k];
+				dp[j] = sum;
+			}
 		}
-		sp += src.cols * ch;
-		dp += dst.cols;
-	}
+	});
 }
 
 cv::Point2f perspective_transform_apply(cv::Point2f point, cv::Size size,
@@ -286,154 +276,48 @@ void perspective_transform(const cv::Mat &src, cv::Mat &dst,
 	int ch = src.channels();
 //	float* a_ptr = (float*)src.data;
 //	float *b_ptr = (float*)dst.data;
-	uint8_t* a_ptr = (uint8_t*)src.data;
-	uint8_t *b_ptr = (uint8_t*)dst.data;
-	for (int i = 0; i < dst.rows; ++i)
-	{
-		float cy = i - dst.rows * 0.5f;
-		float crx = cy * m01 + m02; \
-		float cry = cy * m11 + m12; \
-		float crz = cy * m21 + m22; \
-		for (int j = 0; j < dst.cols; ++j)
-		{
-			float cx = j - dst.cols * 0.5f;
-			float wz = 1.0f / (cx * m20 + crz);
-			float wx = src.cols * 0.5f + (cx * m00 + crx) * wz;
-			float wy = src.rows * 0.5f + (cx * m10 + cry) * wz;
-			int iwx = (int)wx;
-			int iwy = (int)wy;
-			wx = wx - iwx;
-			wy = wy - iwy;
-			int iwx1 = std::min(iwx + 1, src.cols - 1);
-			int iwy1 = std::min(iwy + 1, src.rows - 1);
-			if (iwx >= 0 && iwx <= src.cols && iwy >= 0 && iwy < src.rows)
-				for (int k = 0; k < ch; k++)
-					b_ptr[j * ch + k] = to_uint8_t(
-						a_ptr[iwy * src.step1() + iwx * ch + k] * (1 - wx) * (1 - wy) +
-						a_ptr[iwy * src.step1() + iwx1 * ch + k] * wx * (1 - wy) +
-						a_ptr[iwy1 * src.step1() + iwx * ch + k] * (1 - wx) * wy +
-						a_ptr[iwy1 * src.step1() + iwx1 * ch + k] * wx * wy);
-			else
-				for (int k = 0; k < ch; ++k)
-					b_ptr[j * ch + k] = 0;
-		}
-		b_ptr += dst.step1();
-	}
-}
-
-inline double corner_harris_metric(
-	double dx2, double dy2, double dxdy, double K)
-{
-	// original Harris and Stephens operator: det(A) - K * trace(A)
-	return (dx2 * dy2 - dxdy * dxdy) - K * (dx2 + dy2) * (dx2 + dy2);
-}
-
-inline double corner_shi_tomasi_metric(
-	double dx2, double dy2, double dxdy, double)
-{
-	// Shi-Tomasi (or Kanade-Tomasi) corner detector
-	// (use direct minimal eigenvalue)
-	double sqrt_part = sqrt(dxdy * dxdy + (dx2 - dy2) * (dx2 - dy2) * 0.25);
-	//double lambda0 = (dx2 + dy2) * 0.5 + sqrt_part;
-	return (dx2 + dy2) * 0.5 - sqrt_part;
-}
-
-void corners(const cv::Mat &dx, const cv::Mat &dy,
-	int block_size, int max_corners, int threshold, corners_metric_t metric,
-	double coeff)
-{
-	af_assert(dx.rows == dy.rows && dx.cols == dy.cols);
-	af_assert(dx.type() == CV_8UC1 && dy.type() == CV_8UC1);
-
-	bool stop = false;
-	int count = 0;
-	std::vector<cv::Point> corners;
-	for (int y = 0; y < dx.rows && !stop; ++y)
-	{
-		for (int x = 0; x < dx.cols; ++x)
+	const uint8_t* a_ptr = (const uint8_t*)src.data;
+	parallel_rows(dst.rows, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
 		{
-			// compute covariance matrix
-			double dx2 = 0;
-			double dy2 = 0;
-			double dxdy = 0;
-
-			// apply block filter
-			int half = block_size / 2;
-			int cnt = 0;
-			for (int i = -half; i <= half; ++i)
-			{
-				for (int j = -half; j <= half; ++j)
-				{
-					if (y + i < 0 || y + i >= dx.rows ||
-						x + j < 0 || x + j >= dx.cols)
-						continue;
-
-					double dx_cur = dx.at<uint8_t>(y + i, x + j);
-					double dy_cur = dy.at<uint8_t>(y + i, x + j);
-					dx2 += dx_cur * dx_cur;
-					dy2 += dy_cur * dy_cur;
-					dxdy += dx_cur * dy_cur;
-					++cnt;
-				}
-			}
-			if (cnt)
-			{
-				dx2 /= cnt;
-				dy2 /= cnt;
-				dxdy /= cnt;
-			}
-
-			double metric_val = metric(dx2, dy2, dxdy, coeff);
-			if (metric_val > threshold)
-			{
-				corners[count].x = x;
-				corners[count].y = y;
-				++count;
-			}
-
-			if (count >= max_corners)
+			uint8_t *b_ptr = dst.ptr(i);
+			float cy = i - dst.rows * 0.5f;
+			float crx = cy * m01 + m02;
+			float cry = cy * m11 + m12;
+			float crz = cy * m21 + m22;
+			for (int j = 0; j < dst.cols; ++j)
 			{
-				stop = true;
-				break;
+				float cx = j - dst.cols * 0.5f;
+				float wz = 1.0f / (cx * m20 + crz);
+				float wx = src.cols * 0.5f + (cx * m00 + crx) * wz;
+				float wy = src.rows * 0.5f + (cx * m10 + cry) * wz;
+				int iwx = (int)wx;
+				int iwy = (int)wy;
+				wx = wx - iwx;
+				wy = wy - iwy;
+				int iwx1 = std::min(iwx + 1, src.cols - 1);
+				int iwy1 = std::min(iwy + 1, src.rows - 1);
+				if (iwx >= 0 && iwx <= src.cols && iwy >= 0 && iwy < src.rows)
+					for (int k = 0; k < ch; k++)
+						b_ptr[j * ch + k] = to_uint8_t(
+							a_ptr[iwy * src.step1() + iwx * ch + k] * (1 - wx) * (1 - wy) +
+							a_ptr[iwy * src.step1() + iwx1 * ch + k] * wx * (1 - wy) +
+							a_ptr[iwy1 * src.step1() + iwx * ch + k] * (1 - wx) * wy +
+							a_ptr[iwy1 * src.step1() + iwx1 * ch + k] * wx * wy);
+				else
+					for (int k = 0; k < ch; ++k)
+						b_ptr[j * ch + k] = 0;
 			}
-		}  // for each column
-	}  // for each row
-}
-
-void corners_harris(const cv::Mat &dx, const cv::Mat &dy, double K,
-	int block_size, int max_corners, int threshold)
-{
-	corners(dx, dy, block_size, max_corners, threshold, &corner_harris_metric, K);
-}
-
-void corners_shi_tomasi(const cv::Mat &dx, const cv::Mat &dy,
-	int block_size, int max_corners, int eigenval_th)
-{
-	corners(dx, dy, block_size, max_corners, eigenval_th, &corner_shi_tomasi_metric);
+		}
+	});
 }
 
 template<typename T>
 void histogram(const cv::Mat &src, std::vector<int> &dst,
 			   int nbins, int channel, int min_val, int max_val)
 {
-	int ch_num = src.channels();
-	int bin_size = (max_val - min_val + 1) / nbins;
-	af_assert(nbins && !((max_val - min_val) % bin_size) && "want uniform binning");
-	af_assert(channel >= 0 && channel < ch_num && "illegal channel requested");
-
-	if (nbins != (int)dst.size())
-		dst.resize(nbins);
-	dst.assign(dst.size(), 0);
-	for (int row = 0; row < src.rows; ++row)
-	{
-		T *psrc = (T*)src.ptr(row);
-		for (int col = 0; col < src.cols; ++col)
-		{
-			int bin = psrc[channel] / bin_size;
-			dst[bin] += 1;
-			psrc += ch_num;
-		}
-	}
+	af_assert(src.elemSize1() == sizeof(T));
+	histogram_channel(src, dst, nbins, min_val, max_val + 1, channel);
 }
 
 template<typename T>
@@ -451,12 +335,8 @@ void histogram_normalized(const cv::Mat &src, std::vector<double> &dst,
 template<typename T>
 void histogram_all_channels(const cv::Mat &src, std::vector<std::vector<int> > &hists)
 {
-	int channels = src.channels();
-	hists.clear();
-	hists.resize(channels);
-
-	for (int ch = 0; ch < channels; ++ch)
-		histogram<T>(src, hists[ch], 256, ch);
+	af_assert(src.elemSize1() == sizeof(T));
+	histograms(src, hists, 256, 0, 256);
 }
 
 // explicit instantiation
@@ -488,18 +368,23 @@ void quantize(const cv::Mat &src, const cv::Mat &weights, cv::Mat &dst,
 	af_assert(nbins + 1 + start_ch <= dst.channels());
 	af_assert(src.channels() == 1);
 
-	float *psrc = (float*)src.data;
-	float *pweight = (float*)weights.data;
-	float *res = (float*)dst.data + start_ch;
 	int res_step = dst.channels();
 	float mult = nbins / (max - min);
-	for (int i = 0; i < src.rows * src.cols; ++i, ++psrc, ++pweight, res += res_step)
-	{
-		memset(res, 0, (nbins + 1) * sizeof(float));
-		res[0] = *pweight;
-		int bin = int((*psrc) * mult);
-		res[bin + 1] = *pweight;
-	}
+	parallel_rows(src.rows, [&](int begin, int end) {
+		for (int row = begin; row < end; ++row)
+		{
+			const float *psrc = src.ptr<float>(row);
+			const float *pweight = weights.ptr<float>(row);
+			float *res = dst.ptr<float>(row) + start_ch;
+			for (int i = 0; i < src.cols; ++i, ++psrc, ++pweight, res += res_step)
+			{
+				memset(res, 0, (nbins + 1) * sizeof(float));
+				res[0] = *pweight;
+				int bin = int((*psrc) * mult);
+				res[bin + 1] = *pweight;
+			}
+		}
+	});
 }
 
 void quantize_soft_32f(const cv::Mat &src, const cv::Mat &weights, cv::Mat &dst,
@@ -513,22 +398,27 @@ void quantize_soft_32f(const cv::Mat &src, const cv::Mat &weights, cv::Mat &dst,
 	af_assert(dst.depth() == CV_32F);
 	af_assert(src.channels() == 1);
 
-	float *psrc = (float*)src.data;
-	float *pweight = (float*)weights.data;
-	float *res = (float*)dst.data + start_ch;
 	int res_step = dst.channels();
 	float mult = nbins / (max - min);
-	for (int i = 0; i < src.rows * src.cols; ++i, ++psrc, ++pweight, res += res_step)
-	{
-		memset(res, 0, (nbins + 1) * sizeof(float));
-		res[0] = *pweight;
-		float binf = (*psrc) * mult;
-		int bin0 = int(binf);
-		int bin1 = bin0 < (nbins - 1) ? bin0 + 1 : 0;
-		binf = binf - bin0;
-		res[bin0 + 1] = (*pweight) * (1.0f - binf);
-		res[bin1 + 1] = (*pweight) * binf;
-	}
+	parallel_rows(src.rows, [&](int begin, int end) {
+		for (int row = begin; row < end; ++row)
+		{
+			const float *psrc = src.ptr<float>(row);
+			const float *pweight = weights.ptr<float>(row);
+			float *res = dst.ptr<float>(row) + start_ch;
+			for (int i = 0; i < src.cols; ++i, ++psrc, ++pweight, res += res_step)
+			{
+				memset(res, 0, (nbins + 1) * sizeof(float));
+				res[0] = *pweight;
+				float binf = (*psrc) * mult;
+				int bin0 = int(binf);
+				int bin1 = bin0 < (nbins - 1) ? bin0 + 1 : 0;
+				binf = binf - bin0;
+				res[bin0 + 1] = (*pweight) * (1.0f - binf);
+				res[bin1 + 1] = (*pweight) * binf;
+			}
+		}
+	});
 }
 
 void quantize_soft_8u(const cv::Mat &src, const cv::Mat &weights, cv::Mat &dst,
@@ -542,429 +432,41 @@ void quantize_soft_8u(const cv::Mat &src, const cv::Mat &weights, cv::Mat &dst,
 	af_assert(dst.depth() == CV_8U);
 	af_assert(src.channels() == 1 && "must be only 1ch after gradient");
 
-	float *psrc = (float*)src.data;
-	float *pweight = (float*)weights.data;
-	uint8_t *res = dst.data + start_ch;
 	int res_step = dst.channels();
 	const float mult = nbins / (max - min);
 	const float mag_mult = 0.2f;
-	for (int i = 0; i < src.rows * src.cols; ++i, ++psrc, ++pweight, res += res_step)
-	{
-		memset(res, 0, nbins + 1);
-		float mag = (*pweight) * mag_mult;
-		res[0] = std::min(int(mag), 255);
-		float binf = (*psrc) * mult;
-		int bin0 = int(binf);
-		int bin1 = bin0 < (nbins - 1) ? bin0 + 1 : 0;
-		binf = binf - bin0;
-		res[bin0 + 1] = std::min(int(mag * (1.0f - binf)), 255);
-		res[bin1 + 1] = std::min(int(mag * binf), 255);
-	}
+	parallel_rows(src.rows, [&](int begin, int end) {
+		for (int row = begin; row < end; ++row)
+		{
+			const float *psrc = src.ptr<float>(row);
+			const float *pweight = weights.ptr<float>(row);
+			uint8_t *res = dst.ptr(row) + start_ch;
+			for (int i = 0; i < src.cols; ++i, ++psrc, ++pweight, res += res_step)
+			{
+				memset(res, 0, nbins + 1);
+				float mag = (*pweight) * mag_mult;
+				res[0] = std::min(int(mag), 255);
+				float binf = (*psrc) * mult;
+				int bin0 = int(binf);
+				int bin1 = bin0 < (nbins - 1) ? bin0 + 1 : 0;
+				binf = binf - bin0;
+				res[bin0 + 1] = std::min(int(mag * (1.0f - binf)), 255);
+				res[bin1 + 1] = std::min(int(mag * binf), 255);
+			}
+		}
+	});
 }
 
 void integrate(const cv::Mat &src, cv::Mat &dst)
 {
 	if (src.depth() == CV_8U)
-	{
-		if (dst.rows != src.rows + 1 || dst.cols != src.cols + 1 ||
-				dst.type() != CV_32SC(src.channels()))
-			dst = cv::Mat(src.rows + 1, src.cols + 1, CV_32SC(src.channels()));
-#ifdef HAVE_SSE
-		if (src.isContinuous() && src.channels() == 10)
-		{
-			sse_integral_c10_32s(src.rows, src.cols, src.data, (int*)dst.data);
-			return;
-		}
-#endif
-		cv::integral(src, dst, CV_32S);
-	}
+		imgproc::integral(src, dst, CV_32S);
 	else if (src.depth() == CV_32F)
-	{
-		if (dst.rows != src.rows + 1 || dst.cols != src.cols + 1 ||
-			dst.type() != CV_64FC(src.channels()))
-			dst = cv::Mat(src.rows + 1, src.cols + 1, CV_64FC(src.channels()));
-#ifdef HAVE_SSE
-		if (src.isContinuous() && src.channels() == 10)
-		{
-			sse_integral_c10_64f(src.rows, src.cols, (float*)src.data, (double*)dst.data);
-			return;
-		}
-#endif
-		cv::integral(src, dst, CV_64F);
-	}
+		imgproc::integral(src, dst, CV_64F);
 	else
 		af_assert(!"integrate(): incorrect input image");
 }
 
-void hog_classic(const cv::Mat &grangle, const cv::Mat &grmag, cv::Mat &dst,
-	int nbins, int cell_w, int cell_h, cv::Mat &cn, cv::Mat &ca)
-{
-	af_assert(cell_w == cell_h && "zzzzz X(");
-	af_assert(grangle.channels() == 1 && "1-ch gradient must be computed");
-	af_assert(grangle.depth() == CV_32F && grmag.depth() == CV_32F);
-
-	af_assert(nbins * 3 + 4 <= dst.channels());
-
-	int drows = grangle.rows / (cell_h);
-	int dcols = grangle.cols / (cell_w);
-	af_assert(dst.rows == drows && dst.cols == dcols);
-
-	if (cn.rows != drows || cn.cols != dcols || cn.type() != CV_32FC(nbins * 2))
-		cn = cv::Mat(drows, dcols, CV_32FC(nbins * 2));
-	if (ca.rows != drows || ca.cols != dcols || ca.type() != CV_32FC(nbins * 2))
-		ca = cv::Mat(drows, dcols, CV_32FC1);
-
-	//calculate histograms for cell_w * cell_h cells
-	float *cnp = (float*)cn.data;
-	float *agp = (float*)grangle.data;
-	float *mgp = (float*)grmag.data;
-	int cnbins = nbins * 2;
-	float agmult = cnbins / 360.0f;
-	float mgmult = 1.0f / 255.0f;
-	for (int row = 0; row < drows * cell_h; ++row)
-	{
-		for (int col = 0; col < dcols * cell_w; ++col)
-		{
-			float agv = agp[col] * agmult;
-			float mgv = mgp[col] * mgmult;
-
-			int ag0 = (int)agv;
-			int ag1 = (ag0 + 1 < cnbins) ? ag0 + 1 : 0;
-			float agr0 = agv - ag0;
-			float agr1 = 1.0f - agr0;
-
-			float yp = (row + 0.5f) / cell_h - 0.5f;
-			float xp = (col + 0.5f) / cell_w - 0.5f;
-			int iyp = (int)yp;
-			int ixp = (int)xp;
-			float vy0 = yp - iyp;
-			float vx0 = xp - ixp;
-			float vy1 = 1.0f - vy0;
-			float vx1 = 1.0f - vx0;
-			if (ixp >= 0 && iyp >= 0)
-			{
-				int ind = iyp * dcols * cnbins + ixp * cnbins;
-				cnp[ind + ag0] += agr1 * vx1 * vy1 * mgv;
-				cnp[ind + ag1] += agr0 * vx1 * vy1 * mgv;
-			}
-			if (ixp + 1 < dcols && iyp >= 0)
-			{
-				int ind = iyp * dcols * cnbins + (ixp + 1) * cnbins;
-				cnp[ind + ag0] += agr1 * vx0 * vy1 * mgv;
-				cnp[ind + ag1] += agr0 * vx0 * vy1 * mgv;
-			}
-			if (ixp >= 0 && iyp + 1 < drows)
-			{
-				int ind = (iyp + 1) * dcols * cnbins + ixp * cnbins;
-				cnp[ind + ag0] += agr1 * vx1 * vy0 * mgv;
-				cnp[ind + ag1] += agr0 * vx1 * vy0 * mgv;
-			}
-			if (ixp + 1 < dcols && iyp + 1 < drows)
-			{
-				int ind = (iyp + 1) * dcols * cnbins + (ixp + 1) * cnbins;
-				cnp[ind + ag0] += agr1 * vx0 * vy0 * mgv;
-				cnp[ind + ag1] += agr0 * vx0 * vy0 * mgv;
-			}
-		}
-		agp += grangle.cols;
-		mgp += grmag.cols;
-	}
-
-	//calculate local normalizer
-	cnp = (float*)cn.data;
-	float *cap = (float*)ca.data;
-	for (int row = 0; row < drows; ++row)
-	{
-		for (int col = 0; col < dcols; ++col, ++cap, cnp += cnbins)
-		{
-			*cap = 0;
-			for (int k = 0; k < nbins; k++)
-				*cap += (cnp[k] + cnp[k + nbins]) * (cnp[k] + cnp[k + nbins]);
-		}
-	}
-
-	//normalize and put in destination
-	cnp = (float*)cn.data;
-	cap = (float*)ca.data;
-	float *dbp = (float*)dst.data;
-	int dnbins = 3 * nbins + 4;
-
-	int indexes[4][4] = {
-		{ 0, 1, dcols, dcols + 1 },
-		{ 0, 1, -dcols, -dcols + 1 },
-		{ 0, -1, dcols, dcols - 1 },
-		{ 0, -1, -dcols, -dcols - 1 }
-	};
-
-	//compute up border
-	cnp = (float*)cn.data + dcols * cnbins;
-	cap = (float*)cn.data + dcols;
-	dbp = (float*)dst.data + dcols * dnbins;
-	for (int row = 1; row < drows - 1; ++row)
-	{
-		//compule left border
-		cnp += cnbins;
-		dbp += dnbins;
-		++cap;
-		for (int col = 1; col < dcols - 1; ++col)
-		{
-			for (int idx = 0; idx < 4; ++idx)
-			{
-				float norm = 1.0f / sqrtf(0.0001f +
-					cap[indexes[idx][0]] + cap[indexes[idx][1]] +
-					cap[indexes[idx][2]] + cap[indexes[idx][3]]);
-				for (int k = 0; k < cnbins; k++)
-				{
-					float v = 0.5f * std::min(cnp[k] * norm, 0.2f); \
-					dbp[4 + nbins + k] += v;
-					dbp[idx] += v;
-				}
-				dbp[idx] *= 0.2357f;
-				for (int k = 0; k < nbins; k++)
-				{
-					float v = 0.5f * std::min((cnp[k] + cnp[k + nbins]) * norm, 0.2f);
-					dbp[4 + k] += v;
-				}
-			}
-			cnp += cnbins;
-			dbp += dnbins;
-			++cap;
-		}
-		//compute right border
-		cnp += cnbins;
-		dbp += dnbins;
-		++cap;
-	}
-	//TODO: compute down border
-
-}
-
-void hog_kernel(const cv::Mat &grangle, const cv::Mat &grmag, cv::Mat &dst, int start_ch)
-{
-	const int nbins = 9;
-	const int ksize = 5;
-
-	af_assert(grangle.channels() == 1 && grmag.channels() == 1);
-	af_assert(grangle.depth() == CV_32F && grmag.depth() == CV_32F);
-	af_assert(grangle.cols == grmag.cols && grangle.rows == grmag.rows);
-
-	static const float kshift = -(ksize - 1) / 2.0f;
-	static const float sigma = (0.5f * ksize);
-	//static const float sigma = 0.3f * ((ksize - 1) * 0.5f - 1.0f) + 0.8f;
-	static const float sigma2 = 2.0f * sigma * sigma;
-	static float kernel[ksize * ksize];
-
-	double ksum = 0;
-	for (int y = 0; y < ksize; ++y)
-	{
-		for (int x = 0; x < ksize; ++x)
-		{
-			float val =  expf(
-				-((x + kshift) * (x + kshift) + (y + kshift) * (y + kshift)) / sigma2);
-			kernel[y * ksize + x] = val;
-			ksum += val;
-		}
-	}
-	for (int i = 0; i < ksize * ksize; ++i)
-		kernel[i] = float(kernel[i] / ksum);
-
-	float *pangle = (float*)grangle.data;
-	float *pmag = (float*)grmag.data;
-	float *res = (float*)dst.data + start_ch;
-	int step = static_cast<int>(grangle.step1());
-	int res_step = dst.channels();
-	float mult = nbins / 180.0f;
-	for (int row = 0; row < grangle.rows - ksize; ++row)
-	{
-		for (int col = 0; col < grangle.cols - ksize; ++col, ++pangle, ++pmag, res += res_step)
-		{
-			memset(res, 0, nbins * sizeof(float));
-
-			float *ppmag = pmag;
-			float *ppangle = pangle;
-			int kind = 0;
-			for (int y = 0; y < ksize; ++y, ppangle += step, ppmag += step)
-			{
-				for (int x = 0; x < ksize; ++x, ++kind)
-				{
-					float binf = ppangle[x] * mult;
-					int bin0 = int(binf);
-					int bin1 = bin0 < (nbins - 1) ? bin0 + 1 : 0;
-					binf = binf - bin0;
-					res[bin0] += ppmag[x] * kernel[kind] * (1.0f - binf);
-					res[bin1] += ppmag[x] * kernel[kind] * binf;
-				}
-			} //for kernel
-		} //for each col
-	} //for each row
-}
-
-void floodfill(cv::Mat &mat, uint8_t background,
-		uint8_t fill_with, int min_cont_size)
-{
-	af_assert(background != fill_with && "trying to floodfill with the same color");
-
-	uint8_t *data = mat.data;
-	int w = mat.size().width;
-	int h = mat.size().height;
-
-	for (int y = 0; y < h; y++)
-	{
-		for (int x = 0; x < w; x++)
-		{
-			uint8_t b = data[y * w + x];
-			if (b == 0 || b == fill_with)
-				continue;
-			int size = floodfill_pixel(
-					data, w, h,
-					background, fill_with,
-					x, y);
-			if (size < min_cont_size) // erase
-				floodfill_pixel(data, w, h, fill_with, 0, x, y);
-//			else
-//				floodfill_pixel(data, w, h, fill_with, 0, x, y);
-		}
-	}
-}
-
-int floodfill_pixel(uint8_t* data, int w, int h,
-					uint8_t background, uint8_t fill_with,
-					int start_x, int start_y)
-{
-	static int dx[] = { -1, -1, 0, 1, 1, 1, 0, -1 };
-	static int dy[] = { 0, -1, -1, -1, 0, 1, 1, 1 };
-
-	std::vector<int> stack_x(w * h);
-	std::vector<int> stack_y(w * h);
-	stack_x[0] = start_x;
-	stack_y[0] = start_y;
-	data[start_y * w + start_x] = fill_with;
-	int pixel_counter = 1;
-	int sp = 1;
-	while (sp)
-	{
-		sp--;
-		int x = stack_x[sp];
-		int y = stack_y[sp];
-		for (int c = 0; c < 8; c++)
-		{
-			int rx = x + dx[c];
-			int ry = y + dy[c];
-			if (rx < 0 || rx > w - 1 || ry < 0 || ry > h - 1)
-				continue;
-			if (data[ry * w + rx] == background)
-			{
-				stack_x[sp] = rx;
-				stack_y[sp] = ry;
-				data[ry * w + rx] = fill_with;
-				pixel_counter++;
-				sp++;
-			}
-		}
-	}
-
-	return pixel_counter;
-}
-
-int find_rects(cv::Mat &img, uint8_t start_color,
-		uint8_t min_color, uint8_t result_color,
-		std::vector<cv::Rect> &rects,
-		int min_obj_size, int allowed_gap)
-{
-	af_assert(start_color != result_color && "trying to floodfill with the same color");
-	af_assert(!rects.size() && "rectangles vector is not empty");
-	af_assert(start_color >= min_color && min_color > result_color);
-
-	uint8_t *data = img.data;
-	int w = img.size().width;
-	int h = img.size().height;
-
-	int max_rect_square = 0;
-	for (int y = 0; y < h; y++)
-	{
-		for (int x = 0; x < w; x++)
-		{
-			uint8_t b = data[y * w + x];
-			if (b < start_color)
-				continue;
-			cv::Rect rect = find_bounding_rect(
-					data, w, h,
-					min_color, result_color,
-					x, y, allowed_gap);
-
-			int area = rect.area();
-			if (double(rect.width) > min_obj_size * 0.01 * w ||
-					double(rect.height) > min_obj_size * 0.01 * h)
-				rects.push_back(rect);
-
-			if (area > max_rect_square)
-				max_rect_square = area;
-		}
-	}
-
-	return max_rect_square;
-}
-
-cv::Rect find_bounding_rect(uint8_t* data, int w, int h,
-		uint8_t start_color, uint8_t result_color,
-		int start_x, int start_y, int allowed_gap)
-{
-	std::vector<int> stack_x(w * h);
-	std::vector<int> stack_y(w * h);
-
-	stack_x[0] = start_x;
-	stack_y[0] = start_y;
-	data[start_y * w + start_x] = result_color;
-	int up_left_x = start_x;
-	int up_left_y = start_y;
-	int down_right_x = start_x;
-	int down_right_y = start_y;
-	int pixel_counter = 1;
-	int sp = 1;
-	while (sp)
-	{
-		sp--;
-		int x = stack_x[sp];
-		int y = stack_y[sp];
-		for (int dx = -allowed_gap; dx <= allowed_gap; dx++)
-		{
-			for (int dy = -allowed_gap; dy <= allowed_gap; dy++)
-			{
-				int rx = x + dx;
-				int ry = y + dy;
-				if (rx < 0 || rx > w - 1 || ry < 0 || ry > h - 1)
-					continue;
-				if (data[ry * w + rx] >= start_color)
-				{
-					if (rx < up_left_x)
-						up_left_x = rx;
-					if (ry < up_left_y)
-						up_left_y = ry;
-					if (rx > down_right_x)
-						down_right_x = rx;
-					if (ry > down_right_y)
-						down_right_y = ry;
-					stack_x[sp] = rx;
-					stack_y[sp] = ry;
-					data[ry * w + rx] = result_color;
-					pixel_counter++;
-					sp++;
-				}
-			}
-		}
-	}
-
-	cv::Rect rect;
-
-	rect.x = up_left_x;
-	rect.y = up_left_y;
-	rect.width = down_right_x - up_left_x;
-	rect.height = down_right_y - up_left_y;
-//	rect.density = ((float)pixel_counter) / rect.rect.area();
-
-	return rect;
-}
-
 class LuvHelperTable
 {
 public:
@@ -81,17 +81,39 @@ void rgb_to_luv_pix(const float r, const float g, const float b,
 
 
 // feature points
-typedef double (*corners_metric_t)(double, double, double, double);
-void corners(const cv::Mat &dx, const cv::Mat &dy,
-	int block_size, int max_corners, int th, corners_metric_t metric,
-	double coeff = 0);
-void corners_harris(const cv::Mat &dx, const cv::Mat &dy, double K = 0.04,
-	int block_size = 3, int max_corners = 1000, int threshold = 1e9);
-void corners_shi_tomasi(const cv::Mat &dx, const cv::Mat &dy,
-	int block_size = 3, int max_corners = 1000, int eigenval_th = 32000);
+enum CORNER_METRIC
+{
+	CORNER_HARRIS,  // det(A) - coeff * trace(A)^2
+	CORNER_SHI_TOMASI  // minimal eigenvalue of A
+};
+
+struct Corner
+{
+	cv::Point pt;
+	float response;
+};
+
+/**
+ * @brief Corners by structure tensor A of block_size x block_size window
+ * (mean of dx^2, dy^2, dx*dy; window is clipped by image borders), see corners.cpp.
+ * Window starts block_size / 2 pixels before the center, as OpenCV anchors
+ * box filters, so even block_size has one pixel less after it.
+ * @param dx, dy [in] 1-channel CV_8U, CV_16S or CV_32F derivatives.
+ * @param dst [out] at most max_corners (all if <= 0) corners sorted by response,
+ * strongest first. Corner is a 3x3 local maximum above threshold,
+ * only the strongest one is kept in every nms_cell x nms_cell cell.
+ */
+void corners(const cv::Mat &dx, const cv::Mat &dy, std::vector<Corner> &dst,
+	int block_size, int max_corners, double threshold, CORNER_METRIC metric,
+	double coeff = 0, int nms_cell = 8);
+void corners_harris(const cv::Mat &dx, const cv::Mat &dy, std::vector<Corner> &dst,
+	double K = 0.04, int block_size = 3, int max_corners = 1000, double threshold = 1e9);
+void corners_shi_tomasi(const cv::Mat &dx, const cv::Mat &dy, std::vector<Corner> &dst,
+	int block_size = 3, int max_corners = 1000, double eigenval_th = 32000);
 
 // quantizations
-// simple histogram with weight 1 of each value
+// simple histogram with weight 1 of each value in [min, max],
+// see histogram.hpp for all channels at once and float ranges
 template<typename T>
 void histogram(const cv::Mat &src, std::vector<int> &dst,
 	int nbins, int channel = 0, int min = 0, int max = 255);
@@ -121,24 +143,57 @@ void perspective_transform(const cv::Mat & a, cv::Mat &b,
 	float m00, float m01, float m02, float m10, float m11, float m12,
 	float m20, float m21, float m22);
 
+// CV_8U -> CV_32S, CV_32F -> CV_64F; integral.hpp has other depths and parallel version
 void integrate(const cv::Mat &src, cv::Mat &dst);
 
 
-// classic historgam of oriented gradient
+/**
+ * @brief Classic (Felzenszwalb) histogram of oriented gradients, see hog.cpp.
+ * @param grangle [in] CV_32FC1 gradient angle in degrees, [0, 360).
+ * @param grmag [in] CV_32FC1 gradient magnitude.
+ * @param dst [out] (rows / cell_h) x (cols / cell_w) CV_32F matrix with at least
+ * 3 * nbins + 4 channels: 4 texture features, nbins contrast insensitive bins,
+ * 2 * nbins contrast sensitive bins.
+ * @param cn, ca [out] buffers for cell histograms and energies, reused between calls.
+ * Cell rows are computed in parallel bands, see parallel.hpp.
+ */
 void hog_classic(const cv::Mat &grangle, const cv::Mat &grmag, cv::Mat &dst,
 	int nbins, int cell_w, int cell_h, cv::Mat &cn, cv::Mat &ca);
 void hog_kernel(const cv::Mat &grangle, const cv::Mat &grmag, cv::Mat &dst, int start_ch);
 
 
-// image structural analysis
+// image structural analysis, see components.cpp
+
+struct Component
+{
+	cv::Rect rect;  // bounding rect
+	int area;  // pixels count
+};
 
 /**
- * @brief Fill connected areas of size less than min_cont_size
- * with background color
+ * @brief Connected components labeling.
+ * Pixels are connected if their distance is at most gap: chessboard distance
+ * for connectivity 8, city block one for connectivity 4.
+ *
+ * @param src [in] CV_8UC1 image, pixels of [min_val, max_val] are foreground
+ * @param labels [out] CV_32S, 0 for background, components are numbered from 1
+ * in raster order of their first pixels
+ * @param components [out] area and bounding rect of component with label i + 1
+ * @param connectivity [in] 4 or 8
+ * @param gap [in] 1 is usual 4- or 8-connectivity, larger values bridge gaps
+ * @return components count
+ */
+int connected_components(const cv::Mat &src, cv::Mat &labels,
+		std::vector<Component> &components, int connectivity = 8, int gap = 1,
+		uint8_t min_val = 1, uint8_t max_val = 255);
+
+/**
+ * @brief Fill 8-connected areas of background color with 0 if they are
+ * smaller than min_cont_size, otherwise with fill_with.
  *
  * @param image [in, out] input image (will be modified by function)
- * @param background [in] background color
- * @param fill_with [in] color for filling large areas (unused for now)
+ * @param background [in] color of areas
+ * @param fill_with [in] color for filling large areas
  * @param min_cont_size [in] minimal area square for making decision about bg/fg
  */
 void floodfill(cv::Mat &image, uint8_t background,
@@ -0,0 +1,337 @@
+#include "integral.hpp"
+
+#include <common/errutils.hpp>
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+namespace aifil {
+
+#ifdef HAVE_SSE
+// extern SSE code, see sse/simd-dispatch.hpp
+extern "C" void sse_integral_c10_32f(int height, int width, float *src, float *dst);
+extern "C" void sse_integral_c10_64f(int height, int width, float *src, double *dst);
+extern "C" void sse_integral_c10_32s(int height, int width, uint8_t *src, int *dst);
+
+extern "C" void sse_box_sums_32s(const int *sum, const int *offsets, int count, int base, int *dst);
+extern "C" void sse_box_sums_32f(const float *sum, const int *offsets, int count, int base, float *dst);
+extern "C" void sse_box_sums_64f(const double *sum, const int *offsets, int count, int base, double *dst);
+#endif
+
+namespace imgproc {
+
+namespace {
+
+//stripe is not worth a task if it has less rows
+const int min_stripe_rows = 32;
+
+int default_sum_depth(const cv::Mat &src, int sdepth)
+{
+	if (sdepth < 0)
+		sdepth = src.depth() == CV_8U ? CV_32S : CV_64F;
+	af_assert((sdepth == CV_32S || sdepth == CV_32F || sdepth == CV_64F) &&
+		"integral(): unsupported sum depth");
+	return sdepth;
+}
+
+template<typename D>
+void add_row(const D *src, D *dst, int len)
+{
+	for (int i = 0; i < len; ++i)
+		dst[i] += src[i];
+}
+
+//SIMD kernels for 10-channel images (ICF channels)
+bool integral_c10_simd(const cv::Mat &src, cv::Mat &dst)
+{
+#ifdef HAVE_SSE
+	if (src.channels() != 10 || !src.isContinuous() || !dst.isContinuous())
+		return false;
+	if (src.depth() == CV_8U && dst.depth() == CV_32S)
+	{
+		sse_integral_c10_32s(src.rows, src.cols, src.data, (int*)dst.data);
+		return true;
+	}
+	if (src.depth() == CV_32F && dst.depth() == CV_64F)
+	{
+		sse_integral_c10_64f(src.rows, src.cols, (float*)src.data, (double*)dst.data);
+		return true;
+	}
+	if (src.depth() == CV_32F && dst.depth() == CV_32F)
+	{
+		sse_integral_c10_32f(src.rows, src.cols, (float*)src.data, (float*)dst.data);
+		return true;
+	}
+#else
+	(void)src;
+	(void)dst;
+#endif
+	return false;
+}
+
+template<typename S, typename D>
+void integral_serial(const cv::Mat &src, cv::Mat &dst)
+{
+	const int channels = src.channels();
+	D *zero_row = dst.ptr<D>(0);
+	std::fill(zero_row, zero_row + dst.cols * channels, D(0));
+	integral_rows(src.ptr<S>(0), src.step1(), (const D*)zero_row, dst.ptr<D>(1), dst.step1(),
+		src.cols, channels, src.rows);
+}
+
+template<typename S, typename D>
+void integral_stripes(const cv::Mat &src, cv::Mat &dst, ThreadPool &pool)
+{
+	const int rows = src.rows;
+	const int channels = src.channels();
+	const int len = dst.cols * channels;
+	const int stripes = std::min(pool.size() + 1, rows / min_stripe_rows);
+	if (stripes < 2)
+	{
+		integral_serial<S, D>(src, dst);
+		return;
+	}
+
+	D *zero_row = dst.ptr<D>(0);
+	std::fill(zero_row, zero_row + len, D(0));
+
+	//every stripe starts from zero row as if it was a separate image
+	parallel_for(0, stripes, [&](int begin, int end) {
+		for (int s = begin; s < end; ++s)
+		{
+			int r0 = rows * s / stripes;
+			int r1 = rows * (s + 1) / stripes;
+			integral_rows(src.ptr<S>(r0), src.step1(), (const D*)zero_row,
+				dst.ptr<D>(r0 + 1), dst.step1(), src.cols, channels, r1 - r0);
+		}
+	}, 1, pool);
+
+	//last rows of stripes get the sums of all rows above, one by one
+	for (int s = 1; s < stripes; ++s)
+		add_row(dst.ptr<D>(rows * s / stripes), dst.ptr<D>(rows * (s + 1) / stripes), len);
+
+	//and the rest rows of stripes get the last row of the previous stripe
+	parallel_for(1, stripes, [&](int begin, int end) {
+		for (int s = begin; s < end; ++s)
+		{
+			int r0 = rows * s / stripes;
+			int r1 = rows * (s + 1) / stripes;
+			const D *carry = dst.ptr<D>(r0);
+			for (int r = r0 + 1; r < r1; ++r)
+				add_row(carry, dst.ptr<D>(r), len);
+		}
+	}, 1, pool);
+}
+
+template<typename S, typename D>
+void integral_typed(const cv::Mat &src, cv::Mat &dst, ThreadPool *pool)
+{
+	if (pool)
+		integral_stripes<S, D>(src, dst, *pool);
+	else if (!integral_c10_simd(src, dst))
+		integral_serial<S, D>(src, dst);
+}
+
+template<typename S>
+void integral_src(const cv::Mat &src, cv::Mat &dst, ThreadPool *pool)
+{
+	switch (dst.depth())
+	{
+	case CV_32S: integral_typed<S, int>(src, dst, pool); break;
+	case CV_32F: integral_typed<S, float>(src, dst, pool); break;
+	case CV_64F: integral_typed<S, double>(src, dst, pool); break;
+	default: af_assert(!"integral(): unsupported sum depth");
+	}
+}
+
+void integral_dispatch(const cv::Mat &src, cv::Mat &dst, int sdepth, ThreadPool *pool)
+{
+	sdepth = default_sum_depth(src, sdepth);
+	dst.create(src.rows + 1, src.cols + 1, CV_MAKETYPE(sdepth, src.channels()));
+
+	switch (src.depth())
+	{
+	case CV_8U: integral_src<uint8_t>(src, dst, pool); break;
+	case CV_16U: integral_src<uint16_t>(src, dst, pool); break;
+	case CV_32F: integral_src<float>(src, dst, pool); break;
+	default: af_assert(!"integral(): unsupported image depth");
+	}
+}
+
+//rows [row, row + rows) of src band, sum row 'row' must be ready
+template<typename S, typename D>
+void integral_band_typed(const cv::Mat &src, const cv::Rect &band, int row, int rows, cv::Mat &sum)
+{
+	const int channels = src.channels();
+	integral_rows(src.ptr<S>(band.y + row) + band.x * channels, src.step1(),
+		(const D*)sum.ptr<D>(row), sum.ptr<D>(row + 1), sum.step1(),
+		band.width, channels, rows);
+}
+
+template<typename S>
+void integral_band_src(const cv::Mat &src, const cv::Rect &band, int row, int rows, cv::Mat &sum)
+{
+	switch (sum.depth())
+	{
+	case CV_32S: integral_band_typed<S, int>(src, band, row, rows, sum); break;
+	case CV_32F: integral_band_typed<S, float>(src, band, row, rows, sum); break;
+	case CV_64F: integral_band_typed<S, double>(src, band, row, rows, sum); break;
+	default: af_assert(!"integral(): unsupported sum depth");
+	}
+}
+
+void integral_band(const cv::Mat &src, const cv::Rect &band, int row, int rows, cv::Mat &sum)
+{
+	switch (src.depth())
+	{
+	case CV_8U: integral_band_src<uint8_t>(src, band, row, rows, sum); break;
+	case CV_16U: integral_band_src<uint16_t>(src, band, row, rows, sum); break;
+	case CV_32F: integral_band_src<float>(src, band, row, rows, sum); break;
+	default: af_assert(!"integral(): unsupported image depth");
+	}
+}
+
+template<typename T>
+void box_sums_typed(const T *sum, const int *offsets, int count, int base, T *dst)
+{
+	for (int i = 0; i < count; ++i, offsets += 4)
+		dst[i] = sum[base + offsets[3]] - sum[base + offsets[1]] -
+			sum[base + offsets[2]] + sum[base + offsets[0]];
+}
+
+}  // namespace
+
+void integral(const cv::Mat &src, cv::Mat &dst, int sdepth)
+{
+	integral_dispatch(src, dst, sdepth, 0);
+}
+
+void integral_parallel(const cv::Mat &src, cv::Mat &dst, int sdepth, ThreadPool &pool)
+{
+	integral_dispatch(src, dst, sdepth, &pool);
+}
+
+IntegralImage::IntegralImage() : computed_rows(0)
+{
+}
+
+void IntegralImage::reset(const cv::Mat &src, const cv::Rect &roi, int sdepth)
+{
+	band = roi.area() > 0 ? roi : cv::Rect(0, 0, src.cols, src.rows);
+	af_assert(band.x >= 0 && band.y >= 0 && band.x + band.width <= src.cols &&
+		band.y + band.height <= src.rows && "IntegralImage: roi out of image");
+	src_mat = src;
+	computed_rows = 0;
+
+	int type = CV_MAKETYPE(default_sum_depth(src, sdepth), src.channels());
+	if (storage.type() != type || storage.rows < band.height + 1 || storage.cols < band.width + 1)
+		storage.create(std::max(storage.rows, band.height + 1),
+			std::max(storage.cols, band.width + 1), type);
+	sum_mat = storage(cv::Rect(0, 0, band.width + 1, band.height + 1));
+
+	//zero row, zero column is written by integral_rows()
+	uint8_t *zero_row = sum_mat.ptr(0);
+	memset(zero_row, 0, sum_mat.cols * sum_mat.elemSize());
+}
+
+void IntegralImage::update(int y_end)
+{
+	int rows = std::min(y_end, band.y + band.height) - band.y - computed_rows;
+	if (rows <= 0)
+		return;
+	integral_band(src_mat, band, computed_rows, rows, sum_mat);
+	computed_rows += rows;
+}
+
+void IntegralImage::compute(const cv::Mat &src, const cv::Rect &roi, int sdepth)
+{
+	reset(src, roi, sdepth);
+	update(band.y + band.height);
+}
+
+int IntegralImage::offset(int x, int y, int channel) const
+{
+	return (y - band.y) * step() + (x - band.x) * sum_mat.channels() + channel;
+}
+
+void IntegralImage::box_offsets(const cv::Rect *rects, int count, int channel, int *offsets) const
+{
+	const int channels = sum_mat.channels();
+	const int row_step = step();
+	for (int i = 0; i < count; ++i, offsets += 4)
+	{
+		const cv::Rect &r = rects[i];
+		offsets[0] = r.y * row_step + r.x * channels + channel;
+		offsets[1] = offsets[0] + r.width * channels;
+		offsets[2] = offsets[0] + r.height * row_step;
+		offsets[3] = offsets[2] + r.width * channels;
+	}
+}
+
+void IntegralImage::box_sums(const int *offsets, int count, int base, int *dst) const
+{
+	af_assert(sum_mat.depth() == CV_32S);
+#ifdef HAVE_SSE
+	sse_box_sums_32s(sum_mat.ptr<int>(0), offsets, count, base, dst);
+#else
+	box_sums_typed(sum_mat.ptr<int>(0), offsets, count, base, dst);
+#endif
+}
+
+void IntegralImage::box_sums(const int *offsets, int count, int base, float *dst) const
+{
+	af_assert(sum_mat.depth() == CV_32F);
+#ifdef HAVE_SSE
+	sse_box_sums_32f(sum_mat.ptr<float>(0), offsets, count, base, dst);
+#else
+	box_sums_typed(sum_mat.ptr<float>(0), offsets, count, base, dst);
+#endif
+}
+
+void IntegralImage::box_sums(const int *offsets, int count, int base, double *dst) const
+{
+	af_assert(sum_mat.depth() == CV_64F);
+#ifdef HAVE_SSE
+	sse_box_sums_64f(sum_mat.ptr<double>(0), offsets, count, base, dst);
+#else
+	box_sums_typed(sum_mat.ptr<double>(0), offsets, count, base, dst);
+#endif
+}
+
+double IntegralImage::box_sum(const cv::Rect &rect, int channel) const
+{
+	af_assert(rect.x >= band.x && rect.y >= band.y && rect.width >= 0 && rect.height >= 0 &&
+		rect.x + rect.width <= band.x + band.width &&
+		rect.y + rect.height <= band.y + computed_rows && "IntegralImage: box is not ready");
+	af_assert(channel >= 0 && channel < sum_mat.channels());
+
+	int offsets[4];
+	cv::Rect box(0, 0, rect.width, rect.height);
+	box_offsets(&box, 1, channel, offsets);
+	const int base = offset(rect.x, rect.y);
+	switch (sum_mat.depth())
+	{
+	case CV_32S:
+	{
+		int res;
+		box_sums_typed(sum_mat.ptr<int>(0), offsets, 1, base, &res);
+		return res;
+	}
+	case CV_32F:
+	{
+		float res;
+		box_sums_typed(sum_mat.ptr<float>(0), offsets, 1, base, &res);
+		return res;
+	}
+	default:
+	{
+		double res;
+		box_sums_typed(sum_mat.ptr<double>(0), offsets, 1, base, &res);
+		return res;
+	}
+	}
+}
+
+}  // namespace imgproc
+}  // namespace aifil
@@ -0,0 +1,179 @@
+/** @file integral.hpp
+ *
+ *  @brief Integral images (summed area tables) for any channels count.
+ *
+ *  dst(y, x) is the sum of src(j, i) over j < y, i < x for every channel,
+ *  dst is (rows + 1) x (cols + 1), the first row and column are zero.
+ *  Same layout and values as cv::integral().
+ */
+
+#ifndef AIFIL_IMGPROC_INTEGRAL_H
+#define AIFIL_IMGPROC_INTEGRAL_H
+
+#include <common/thread-pool.hpp>
+
+#include <opencv2/core/core.hpp>
+
+#include <stddef.h>
+
+namespace aifil {
+namespace imgproc {
+
+/**
+ * @brief One row of integral image: dst = prev + horizontal prefix sum of src.
+ * Pointers are at the first pixel (after the zero column), rows are
+ * width * CH elements long. Channels count is known at compile time,
+ * so the loop over channels is unrolled and vectorized by the compiler.
+ */
+template<int CH, typename S, typename D>
+inline void integral_row(const S *src, const D *prev, D *dst, int width)
+{
+	D sum[CH];
+	for (int c = 0; c < CH; ++c)
+		sum[c] = 0;
+	for (int x = 0; x < width; ++x, src += CH, prev += CH, dst += CH)
+	{
+		for (int c = 0; c < CH; ++c)
+		{
+			sum[c] += D(src[c]);
+			dst[c] = prev[c] + sum[c];
+		}
+	}
+}
+
+// the same for channels count known only at runtime
+template<typename S, typename D>
+inline void integral_row(const S *src, const D *prev, D *dst, int width, int channels)
+{
+	switch (channels)
+	{
+	case 1: integral_row<1>(src, prev, dst, width); return;
+	case 2: integral_row<2>(src, prev, dst, width); return;
+	case 3: integral_row<3>(src, prev, dst, width); return;
+	case 4: integral_row<4>(src, prev, dst, width); return;
+	case 10: integral_row<10>(src, prev, dst, width); return;
+	default: break;
+	}
+
+	//prefix sums with step of channels count, then vertical addition
+	const int len = width * channels;
+	for (int i = 0; i < channels && i < len; ++i)
+		dst[i] = D(src[i]);
+	for (int i = channels; i < len; ++i)
+		dst[i] = dst[i - channels] + D(src[i]);
+	for (int i = 0; i < len; ++i)
+		dst[i] += prev[i];
+}
+
+/**
+ * @brief Integral image rows for raw buffers.
+ * @param src [in] first source row, src_step elements between rows.
+ * @param prev [in] integral row above the first computed one (zero column included).
+ * @param dst [out] first computed integral row (zero column included).
+ * @param rows [in] amount of source rows to process.
+ */
+template<typename S, typename D>
+void integral_rows(const S *src, size_t src_step, const D *prev, D *dst, size_t dst_step,
+	int width, int channels, int rows)
+{
+	for (int y = 0; y < rows; ++y, src += src_step, dst += dst_step)
+	{
+		for (int c = 0; c < channels; ++c)
+			dst[c] = 0;
+		integral_row(src, prev + channels, dst + channels, width, channels);
+		prev = dst;
+	}
+}
+
+/**
+ * @brief Integral image of any channels count.
+ * @param src [in] CV_8U, CV_16U or CV_32F image.
+ * @param dst [out] (rows + 1) x (cols + 1) integral image, reallocated if needed.
+ * @param sdepth [in] CV_32S, CV_32F or CV_64F; -1 means CV_32S for CV_8U
+ * and CV_64F otherwise (like cv::integral).
+ */
+void integral(const cv::Mat &src, cv::Mat &dst, int sdepth = -1);
+
+/**
+ * @brief Multi-threaded integral(), same result.
+ * Horizontal stripes are integrated independently in parallel,
+ * then every stripe gets the last row of the previous ones added.
+ * Small images are processed in the calling thread.
+ */
+void integral_parallel(const cv::Mat &src, cv::Mat &dst, int sdepth = -1,
+	ThreadPool &pool = ThreadPool::global());
+
+/**
+ * @brief Integral image of a band of source, computed on demand and reused
+ * between frames, with box sums queries.
+ *
+ * Detectors over video stream usually need only some rows of image
+ * (region of interest, or rows already reached by sliding window),
+ * and sample the same set of boxes at thousands of window positions:
+ * box_offsets() is computed once, box_sums() takes window position as base.
+ * Queries use source image coordinates.
+ */
+class IntegralImage
+{
+public:
+	IntegralImage();
+
+	/**
+	 * @brief Bind source image, no rows are computed yet.
+	 * Buffer is reused if the new band fits into the allocated one.
+	 * @param roi [in] band of src to integrate, the whole image if empty.
+	 * @param sdepth [in] sum depth, see integral().
+	 */
+	void reset(const cv::Mat &src, const cv::Rect &roi = cv::Rect(), int sdepth = -1);
+
+	// integrate source rows up to y_end (exclusive), already computed rows are kept
+	void update(int y_end);
+
+	// reset() and update() of the whole band
+	void compute(const cv::Mat &src, const cv::Rect &roi = cv::Rect(), int sdepth = -1);
+
+	// (roi.height + 1) x (roi.width + 1) view into buffer, valid until next reset()
+	const cv::Mat& sum() const { return sum_mat; }
+	const cv::Rect& roi() const { return band; }
+	// source rows [roi().y, roi().y + rows_ready()) are integrated
+	int rows_ready() const { return computed_rows; }
+
+	/**
+	 * @brief Element offset of integral point above and left of source pixel (x, y).
+	 * Offsets depend on the buffer step and are invalidated by reset()
+	 * if it had to reallocate buffer (step() changes).
+	 */
+	int offset(int x, int y, int channel = 0) const;
+	int step() const { return int(sum_mat.step1()); }
+
+	/**
+	 * @brief Offsets of box corners relative to window origin:
+	 * 4 values per box (top-left, top-right, bottom-left, bottom-right).
+	 * @param rects [in] boxes in window coordinates.
+	 */
+	void box_offsets(const cv::Rect *rects, int count, int channel, int *offsets) const;
+
+	/**
+	 * @brief Sums of boxes for window at base = offset(window_x, window_y).
+	 * Boxes are not checked against computed rows, dst type must match sum depth.
+	 * AVX2 gathers are used for 32s, 32f and 64f sums if available.
+	 */
+	void box_sums(const int *offsets, int count, int base, int *dst) const;
+	void box_sums(const int *offsets, int count, int base, float *dst) const;
+	void box_sums(const int *offsets, int count, int base, double *dst) const;
+
+	// single box in source coordinates, checked
+	double box_sum(const cv::Rect &rect, int channel = 0) const;
+
+private:
+	cv::Mat src_mat;
+	cv::Mat storage;
+	cv::Mat sum_mat;
+	cv::Rect band;
+	int computed_rows;
+};
+
+}  // namespace imgproc
+}  // namespace aifil
+
+#endif  // AIFIL_IMGPROC_INTEGRAL_H
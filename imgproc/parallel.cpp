@@ -0,0 +1,138 @@
+#include "parallel.hpp"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace aifil {
+namespace imgproc {
+
+namespace {
+
+//pool is replaced by set_threads(), running calls keep the old one alive
+struct PoolHolder
+{
+	std::mutex mutex;
+	std::shared_ptr<ThreadPool> own;
+	ThreadPool *external;
+	int threads;
+
+	PoolHolder() : external(0), threads(1) {}
+};
+
+PoolHolder& holder()
+{
+	static PoolHolder h;
+	return h;
+}
+
+// null if single-threaded
+std::shared_ptr<ThreadPool> current_pool(int &threads_count)
+{
+	PoolHolder &h = holder();
+	std::lock_guard<std::mutex> lock(h.mutex);
+	threads_count = h.threads;
+	if (h.external)
+		return std::shared_ptr<ThreadPool>(h.external, [](ThreadPool*) {});
+	return h.own;
+}
+
+}  // namespace
+
+void set_threads(int threads)
+{
+	if (threads <= 0)
+		threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+	std::shared_ptr<ThreadPool> pool;
+	if (threads > 1)
+		pool = std::make_shared<ThreadPool>(threads - 1);
+
+	PoolHolder &h = holder();
+	std::lock_guard<std::mutex> lock(h.mutex);
+	h.own = pool;
+	h.external = 0;
+	h.threads = threads;
+}
+
+int threads()
+{
+	PoolHolder &h = holder();
+	std::lock_guard<std::mutex> lock(h.mutex);
+	return h.threads;
+}
+
+void set_thread_pool(ThreadPool *pool)
+{
+	if (!pool)
+	{
+		set_threads(1);
+		return;
+	}
+	PoolHolder &h = holder();
+	std::lock_guard<std::mutex> lock(h.mutex);
+	h.own.reset();
+	h.external = pool;
+	h.threads = pool->size() + 1;
+}
+
+void parallel_rows(int rows, const std::function<void(int, int)> &body, int min_rows)
+{
+	if (rows <= 0)
+		return;
+	int threads_count = 1;
+	std::shared_ptr<ThreadPool> pool = current_pool(threads_count);
+	min_rows = std::max(min_rows, 1);
+	if (!pool || rows < 2 * min_rows)
+	{
+		body(0, rows);
+		return;
+	}
+
+	//a few stripes per thread for load balancing, but not thinner than min_rows
+	int stripes = std::min(threads_count * 4, rows / min_rows);
+	parallel_for(0, stripes, [&](int begin, int end) {
+		for (int s = begin; s < end; ++s)
+			body(int(int64_t(rows) * s / stripes), int(int64_t(rows) * (s + 1) / stripes));
+	}, 1, *pool);
+}
+
+void parallel_tiles(cv::Size size, cv::Size tile, int halo,
+	const std::function<void(const Tile&)> &body)
+{
+	if (size.width <= 0 || size.height <= 0)
+		return;
+	tile.width = std::max(1, std::min(tile.width, size.width));
+	tile.height = std::max(1, std::min(tile.height, size.height));
+	const int tiles_x = (size.width + tile.width - 1) / tile.width;
+	const int tiles_y = (size.height + tile.height - 1) / tile.height;
+
+	auto run = [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+		{
+			Tile t;
+			t.rect.x = (i % tiles_x) * tile.width;
+			t.rect.y = (i / tiles_x) * tile.height;
+			t.rect.width = std::min(tile.width, size.width - t.rect.x);
+			t.rect.height = std::min(tile.height, size.height - t.rect.y);
+			t.halo.x = std::max(0, t.rect.x - halo);
+			t.halo.y = std::max(0, t.rect.y - halo);
+			t.halo.width = std::min(size.width, t.rect.x + t.rect.width + halo) - t.halo.x;
+			t.halo.height = std::min(size.height, t.rect.y + t.rect.height + halo) - t.halo.y;
+			body(t);
+		}
+	};
+
+	int threads_count = 1;
+	std::shared_ptr<ThreadPool> pool = current_pool(threads_count);
+	if (!pool)
+		run(0, tiles_x * tiles_y);
+	else
+		parallel_for(0, tiles_x * tiles_y, run, 1, *pool);
+}
+
+}  // namespace imgproc
+}  // namespace aifil
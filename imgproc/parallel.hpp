@@ -0,0 +1,64 @@
+/** @file parallel.hpp
+ *
+ *  @brief Multi-threaded execution of imgproc per-pixel functions.
+ *
+ *  Image is split into horizontal stripes (or tiles) processed on a thread
+ *  pool shared by all imgproc calls. By default imgproc is single-threaded,
+ *  as callers usually process several streams in parallel already;
+ *  set_threads() lets a single frame use all cores when latency matters.
+ */
+
+#ifndef AIFIL_IMGPROC_PARALLEL_H
+#define AIFIL_IMGPROC_PARALLEL_H
+
+#include <common/thread-pool.hpp>
+
+#include <opencv2/core/core.hpp>
+
+#include <functional>
+
+namespace aifil {
+namespace imgproc {
+
+/**
+ * @brief Threads used by imgproc functions, including the calling one.
+ * @param threads [in] 1 - calling thread only (default),
+ * 0 - std::thread::hardware_concurrency().
+ * Own pool with (threads - 1) workers is created.
+ */
+void set_threads(int threads);
+int threads();
+
+/**
+ * @brief Use external pool instead of own one (e.g. ThreadPool::global()),
+ * the calling thread takes part in the work too. Pool must outlive its use,
+ * nullptr returns to set_threads(1).
+ */
+void set_thread_pool(ThreadPool *pool);
+
+/**
+ * @brief Parallel loop over rows [0, rows).
+ * body(row_begin, row_end) is called for stripes of at least min_rows rows,
+ * in the calling thread only if imgproc is single-threaded.
+ */
+void parallel_rows(int rows, const std::function<void(int, int)> &body, int min_rows = 16);
+
+struct Tile
+{
+	cv::Rect rect;  // output area
+	cv::Rect halo;  // rect grown by halo, clipped to image
+};
+
+/**
+ * @brief Parallel loop over tiles of image.
+ * @param size [in] image size.
+ * @param tile [in] tile size, tiles on the right and bottom borders are smaller.
+ * @param halo [in] neighborhood radius needed to compute tile.rect.
+ */
+void parallel_tiles(cv::Size size, cv::Size tile, int halo,
+	const std::function<void(const Tile&)> &body);
+
+}  // namespace imgproc
+}  // namespace aifil
+
+#endif  // AIFIL_IMGPROC_PARALLEL_H
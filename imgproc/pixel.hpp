@@ -2,6 +2,10 @@
  *
  *  @brief color pixel simple operations
  *
+ *  pixel_val_ is a value on stack, pixel_ref_ points to pixel in matrix;
+ *  both are plain arrays of compile-time size, so arithmetic over them
+ *  is inlined to the same code as hand-written loops over channels.
+ *
  *  @author Victor Pogrebnyak <vp@aifil.ru>
  *
  *  $Id$
@@ -11,9 +15,15 @@
 #ifndef AIFIL_PIXEL_H
 #define AIFIL_PIXEL_H
 
+#include "parallel.hpp"
+
+#include <common/errutils.hpp>
+
 #include <stdint.h>
 #include <opencv2/core/core.hpp>
 
+#include <type_traits>
+
 namespace aifil {
 
 template<typename T> T* mat_ptr(const cv::Mat &mat, int row, int col)
@@ -21,183 +31,217 @@ template<typename T> T* mat_ptr(const cv::Mat &mat, int row, int col)
 	return (T*)(mat.data) + row * mat.step1() + col * mat.channels();
 }
 
-template<int ch, typename T> class pixel_t_;
-
-template<int ch, typename T>
-pixel_t_<ch, T> operator+(const pixel_t_<ch, T> &l, const pixel_t_<ch, T> &r);
-template<int ch, typename T>
-pixel_t_<ch, T> operator-(const pixel_t_<ch, T> &l, const pixel_t_<ch, T> &r);
-template<int ch, typename T>
-pixel_t_<ch, T> operator*(const pixel_t_<ch, T> &l, const pixel_t_<ch, T> &r);
 template<int ch, typename T>
-pixel_t_<ch, T> operator/(const pixel_t_<ch, T> &l, const pixel_t_<ch, T> &r);
-
-template<int ch, typename pix_t>
-pixel_t_<ch, pix_t> operator+(const pixel_t_<ch, pix_t> &pix, float val);
-template<int ch, typename pix_t>
-pixel_t_<ch, pix_t> operator-(const pixel_t_<ch, pix_t> &pix, float val);
-template<int ch, typename pix_t>
-pixel_t_<ch, pix_t> operator*(const pixel_t_<ch, pix_t> &pix, float val);
-template<int ch, typename pix_t>
-pixel_t_<ch, pix_t> operator/(const pixel_t_<ch, pix_t> &pix, float val);
-
-template<int ch, typename T>
-class pixel_t_
+struct pixel_val_
 {
-public:
-	pixel_t_() { ptr = new T[ch]; need_free = true; }
-	pixel_t_(T *p) : ptr(p) { need_free = false; }
-	~pixel_t_() { if (need_free) delete ptr; }
+	enum { channels = ch };
+	typedef T value_type;
 
-	//for assignment operators with pixels of another value type
-	const T* get_data() const { return ptr; }
+	T val[ch];
 
-	//replace default assignment operator
-	pixel_t_& operator=(const pixel_t_ &o)
+	//uninitialized, like built-in types
+	pixel_val_() = default;
+	explicit pixel_val_(T v)
 	{
 		for (int i = 0; i < ch; ++i)
-			ptr[i] = T(o.ptr[i]);
-		return *this;
+			val[i] = v;
 	}
-
-	//copy from pixel of other type
+	//load from pointer
 	template<typename oT>
-	pixel_t_& operator=(const pixel_t_<ch, oT> &o)
+	explicit pixel_val_(const oT *p)
 	{
-		const oT *p = o.get_data();
 		for (int i = 0; i < ch; ++i)
-			ptr[i] = static_cast<T>(p[i]);
-		return *this;
+			val[i] = static_cast<T>(p[i]);
 	}
+	//copy from pixel of other type
+	template<typename oT>
+	explicit pixel_val_(const pixel_val_<ch, oT> &o) : pixel_val_(o.val) {}
+
+	T &operator[](int i) { return val[i]; }
+	const T &operator[](int i) const { return val[i]; }
 
-	//copy from pointer
 	template<typename oT>
-	pixel_t_& operator=(const oT *o)
+	void store(oT *p) const
 	{
 		for (int i = 0; i < ch; ++i)
-			ptr[i] = static_cast<T>(o[i]);
-		return *this;
+			p[i] = static_cast<oT>(val[i]);
 	}
 
 	//for !obj checking
-	operator bool() const
+	explicit operator bool() const
 	{
-		if (!ptr)
-			return false;
 		for (int i = 0; i < ch; ++i)
-			if (ptr[i])
+			if (val[i])
 				return true;
 		return false;
 	}
 
-	friend bool operator==(const pixel_t_ &l, const pixel_t_ &r);
-	friend bool operator==(const pixel_t_ &me, T val);
-	friend bool operator!=(const pixel_t_ &l, const pixel_t_ &r) { return !(l == r); }
-
-	friend pixel_t_<ch, T> operator+ <>(const pixel_t_<ch, T> &l, const pixel_t_<ch, T> &r);
-	friend pixel_t_<ch, T> operator- <>(const pixel_t_<ch, T> &l, const pixel_t_<ch, T> &r);
-	friend pixel_t_<ch, T> operator* <>(const pixel_t_<ch, T> &l, const pixel_t_<ch, T> &r);
-	friend pixel_t_<ch, T> operator/ <>(const pixel_t_<ch, T> &l, const pixel_t_<ch, T> &r);
-
-	friend pixel_t_<ch, T> operator+ <>(const pixel_t_<ch, T> &pix, float val);
-	friend pixel_t_<ch, T> operator- <>(const pixel_t_<ch, T> &pix, float val);
-	friend pixel_t_<ch, T> operator* <>(const pixel_t_<ch, T> &pix, float val);
-	friend pixel_t_<ch, T> operator/ <>(const pixel_t_<ch, T> &pix, float val);
+	bool operator==(const pixel_val_ &o) const
+	{
+		for (int i = 0; i < ch; ++i)
+			if (val[i] != o.val[i])
+				return false;
+		return true;
+	}
+	bool operator!=(const pixel_val_ &o) const { return !(*this == o); }
+
+#define AIFIL_PIXEL_ASSIGN_OP(op) \
+	pixel_val_ &operator op(const pixel_val_ &o) \
+	{ \
+		for (int i = 0; i < ch; ++i) \
+			val[i] op o.val[i]; \
+		return *this; \
+	} \
+	pixel_val_ &operator op(float v) \
+	{ \
+		for (int i = 0; i < ch; ++i) \
+		{ \
+			float tmp = val[i]; \
+			tmp op v; \
+			val[i] = T(tmp); \
+		} \
+		return *this; \
+	}
 
-private:
-	pixel_t_(const pixel_t_ &) {}
-	T *ptr;
-	bool need_free;
+	AIFIL_PIXEL_ASSIGN_OP(+=)
+	AIFIL_PIXEL_ASSIGN_OP(-=)
+	AIFIL_PIXEL_ASSIGN_OP(*=)
+	AIFIL_PIXEL_ASSIGN_OP(/=)
+#undef AIFIL_PIXEL_ASSIGN_OP
 };
 
+//non-owning pixel, assignment writes to matrix
 template<int ch, typename T>
-bool operator==(const pixel_t_<ch, T> &l, const pixel_t_<ch, T> &r)
+class pixel_ref_
 {
-	for (int i = 0; i < ch; ++i)
-		if (r.ptr[i] != r.ptr[i])
-			return false;
-	return true;
-}
+public:
+	typedef pixel_val_<ch, typename std::remove_const<T>::type> value_t;
 
-template<int ch, typename T>
-bool operator==(const pixel_t_<ch, T> pix, T val)
-{
-	for (int i = 0; i < ch; ++i)
-		if (pix.ptr[i] != val)
-			return false;
-	return true;
-}
+	explicit pixel_ref_(T *p) : ptr(p) {}
 
-template<int ch, typename T>
-pixel_t_<ch, T> operator+(const pixel_t_<ch, T> &l, const pixel_t_<ch, T> &r)
-{
-	pixel_t_<ch, T> res;
-	for (int i = 0; i < ch; ++i)
-		res.ptr[i] = l.ptr[i] + r.ptr[i];
-	return res;
-}
+	T *data() const { return ptr; }
+	T &operator[](int i) const { return ptr[i]; }
 
-template<int ch, typename T>
-pixel_t_<ch, T> operator-(const pixel_t_<ch, T> &l, const pixel_t_<ch, T> &r)
-{
-	pixel_t_<ch, T> res;
-	for (int i = 0; i < ch; ++i)
-		res.ptr[i] = l.ptr[i] - r.ptr[i];
-	return res;
-}
+	value_t val() const { return value_t(ptr); }
+	operator value_t() const { return val(); }
+
+	//assignment copies values, reference is not rebound
+	pixel_ref_ &operator=(const pixel_ref_ &o)
+	{
+		o.val().store(ptr);
+		return *this;
+	}
+	template<typename oT>
+	pixel_ref_ &operator=(const pixel_val_<ch, oT> &o)
+	{
+		o.store(ptr);
+		return *this;
+	}
+
+	pixel_ref_ &operator+=(const value_t &o) { return *this = val() += o; }
+	pixel_ref_ &operator-=(const value_t &o) { return *this = val() -= o; }
+	pixel_ref_ &operator*=(const value_t &o) { return *this = val() *= o; }
+	pixel_ref_ &operator/=(const value_t &o) { return *this = val() /= o; }
+
+private:
+	T *ptr;
+};
 
 template<int ch, typename T>
-pixel_t_<ch, T> operator*(const pixel_t_<ch, T> &l, const pixel_t_<ch, T> &r)
+pixel_ref_<ch, T> pixel_at(cv::Mat &mat, int row, int col)
 {
-	pixel_t_<ch, T> res;
-	for (int i = 0; i < ch; ++i)
-		res.ptr[i] = l.ptr[i] * r.ptr[i];
-	return res;
+	return pixel_ref_<ch, T>(mat.ptr<T>(row) + col * ch);
 }
 
 template<int ch, typename T>
-pixel_t_<ch, T> operator/(const pixel_t_<ch, T> &l, const pixel_t_<ch, T> &r)
+pixel_ref_<ch, const T> pixel_at(const cv::Mat &mat, int row, int col)
 {
-	pixel_t_<ch, T> res;
-	for (int i = 0; i < ch; ++i)
-		res.ptr[i] = l.ptr[i] / r.ptr[i];
-	return res;
+	return pixel_ref_<ch, const T>(mat.ptr<T>(row) + col * ch);
 }
 
-template<int ch, typename pix_t>
-pixel_t_<ch, pix_t> operator+(const pixel_t_<ch, pix_t> &pix, float val)
+//value type of pixel_val_ or pixel_ref_, none for other types
+template<typename P> struct pixel_traits {};
+template<int ch, typename T> struct pixel_traits<pixel_val_<ch, T> >
 {
-	pixel_t_<ch, pix_t> res;
-	for (int i = 0; i < ch; ++i)
-		res.ptr[i] = pix_t(pix.ptr[i] + val);
-	return res;
-}
-
-template<int ch, typename pix_t>
-pixel_t_<ch, pix_t> operator-(const pixel_t_<ch, pix_t> &pix, float val)
+	typedef pixel_val_<ch, T> value_t;
+};
+template<int ch, typename T> struct pixel_traits<pixel_ref_<ch, T> >
 {
-	pixel_t_<ch, pix_t> res;
-	for (int i = 0; i < ch; ++i)
-		res.ptr[i] = pix_t(pix.ptr[i] - val);
-	return res;
+	typedef typename pixel_ref_<ch, T>::value_t value_t;
+};
+
+//pixel op pixel and pixel op float for values and references
+#define AIFIL_PIXEL_OP(op) \
+template<typename L, typename R> \
+typename std::enable_if< \
+	std::is_same<typename pixel_traits<L>::value_t, typename pixel_traits<R>::value_t>::value, \
+	typename pixel_traits<L>::value_t>::type \
+operator op(const L &l, const R &r) \
+{ \
+	typename pixel_traits<L>::value_t res(l); \
+	return res op##= typename pixel_traits<R>::value_t(r); \
+} \
+template<typename L> \
+typename pixel_traits<L>::value_t operator op(const L &l, float v) \
+{ \
+	typename pixel_traits<L>::value_t res(l); \
+	return res op##= v; \
 }
 
-template<int ch, typename pix_t>
-pixel_t_<ch, pix_t> operator*(const pixel_t_<ch, pix_t> &pix, float val)
+AIFIL_PIXEL_OP(+)
+AIFIL_PIXEL_OP(-)
+AIFIL_PIXEL_OP(*)
+AIFIL_PIXEL_OP(/)
+#undef AIFIL_PIXEL_OP
+
+/**
+ * @brief dst(y, x) = f(src(y, x)) over rows, see imgproc::parallel_rows().
+ * f gets pixel_val_<ch, T> and returns pixel_val_ of dst type, dst is created.
+ * f is inlined into loop over row, so simple f is vectorized by compiler.
+ */
+template<int ch, typename T, typename F>
+void pixels_transform(const cv::Mat &src, cv::Mat &dst, F f)
 {
-	pixel_t_<ch, pix_t> res;
-	for (int i = 0; i < ch; ++i)
-		res.ptr[i] = pix_t(pix.ptr[i] * val);
-	return res;
+	typedef typename std::result_of<F(pixel_val_<ch, T>)>::type out_t;
+	typedef typename out_t::value_type dT;
+	af_assert(src.type() == CV_MAKETYPE(CV_MAT_DEPTH(cv::DataType<T>::type), ch));
+
+	cv::Mat in = src;  // src may be dst
+	dst.create(in.rows, in.cols, CV_MAKETYPE(CV_MAT_DEPTH(cv::DataType<dT>::type), out_t::channels));
+	imgproc::parallel_rows(in.rows, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+		{
+			const T *ps = in.ptr<T>(i);
+			dT *pd = dst.ptr<dT>(i);
+			for (int j = 0; j < in.cols; ++j)
+				f(pixel_val_<ch, T>(ps + j * ch)).store(pd + j * out_t::channels);
+		}
+	});
 }
 
-template<int ch, typename pix_t>
-pixel_t_<ch, pix_t> operator/(const pixel_t_<ch, pix_t> &pix, float val)
+//dst(y, x) = f(src1(y, x), src2(y, x))
+template<int ch, typename T, typename F>
+void pixels_transform(const cv::Mat &src1, const cv::Mat &src2, cv::Mat &dst, F f)
 {
-	pixel_t_<ch, pix_t> res;
-	for (int i = 0; i < ch; ++i)
-		res.ptr[i] = pix_t(pix.ptr[i] / val);
-	return res;
+	typedef typename std::result_of<F(pixel_val_<ch, T>, pixel_val_<ch, T>)>::type out_t;
+	typedef typename out_t::value_type dT;
+	const int type = CV_MAKETYPE(CV_MAT_DEPTH(cv::DataType<T>::type), ch);
+	af_assert(src1.type() == type && src2.type() == type && src1.size() == src2.size());
+
+	cv::Mat in1 = src1;
+	cv::Mat in2 = src2;
+	dst.create(in1.rows, in1.cols, CV_MAKETYPE(CV_MAT_DEPTH(cv::DataType<dT>::type), out_t::channels));
+	imgproc::parallel_rows(in1.rows, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+		{
+			const T *ps1 = in1.ptr<T>(i);
+			const T *ps2 = in2.ptr<T>(i);
+			dT *pd = dst.ptr<dT>(i);
+			for (int j = 0; j < in1.cols; ++j)
+				f(pixel_val_<ch, T>(ps1 + j * ch), pixel_val_<ch, T>(ps2 + j * ch)).store(
+					pd + j * out_t::channels);
+		}
+	});
 }
 
 }  // namespace aifil
@@ -0,0 +1,150 @@
+#include "scratch.hpp"
+
+#include <common/errutils.hpp>
+
+#include <algorithm>
+#include <atomic>
+
+namespace aifil {
+namespace imgproc {
+
+namespace {
+
+const size_t MIN_BLOCK = 64 * 1024;
+
+std::atomic<uint64_t> total_heap_allocations(0);
+
+inline size_t align_up(size_t v, size_t align)
+{
+	return (v + align - 1) & ~(align - 1);
+}
+
+}  // namespace
+
+ScratchArena &ScratchArena::local()
+{
+	static thread_local ScratchArena arena;
+	return arena;
+}
+
+ScratchArena::ScratchArena() :
+	block(0), offset(0), used(0), peak(0), heap_allocations(0), frames(0)
+{
+}
+
+ScratchArena::~ScratchArena()
+{
+	for (const Block &b: blocks)
+		delete[] b.data;
+}
+
+void *ScratchArena::alloc(size_t bytes, size_t align)
+{
+	af_assert(frames > 0 && "scratch allocation outside of ScratchFrame");
+	af_assert(align && !(align & (align - 1)));
+
+	for (;;)
+	{
+		for (; block < blocks.size(); ++block, offset = 0)
+		{
+			const Block &b = blocks[block];
+			const size_t start = align_up(size_t(b.data) + offset, align) - size_t(b.data);
+			if (start + bytes > b.size)
+				continue;
+			offset = start + bytes;
+			// upper bound of padding, so one block of peak size fits any frame
+			used += bytes + align - 1;
+			peak = std::max(peak, used);
+			return b.data + start;
+		}
+
+		size_t capacity = 0;
+		for (const Block &b: blocks)
+			capacity += b.size;
+		add_block(std::max(std::max(bytes + align, capacity), MIN_BLOCK));
+		block = blocks.size() - 1;
+		offset = 0;
+	}
+}
+
+ScratchArena::Stats ScratchArena::stats() const
+{
+	Stats s;
+	s.heap_allocations = heap_allocations;
+	s.capacity = 0;
+	for (const Block &b: blocks)
+		s.capacity += b.size;
+	s.used = used;
+	s.peak = peak;
+	return s;
+}
+
+void ScratchArena::release()
+{
+	af_assert(!frames && "scratch arena is released inside of frame");
+	for (const Block &b: blocks)
+		delete[] b.data;
+	blocks.clear();
+	block = 0;
+	offset = 0;
+}
+
+ScratchArena::Mark ScratchArena::open()
+{
+	++frames;
+	Mark mark;
+	mark.block = block;
+	mark.offset = offset;
+	mark.used = used;
+	return mark;
+}
+
+void ScratchArena::close(const Mark &mark)
+{
+	block = mark.block;
+	offset = mark.offset;
+	used = mark.used;
+	if (--frames || blocks.size() < 2)
+		return;
+
+	// nothing is allocated now, blocks are replaced by one large enough
+	size_t capacity = 0;
+	for (const Block &b: blocks)
+		capacity += b.size;
+	release();
+	add_block(std::max(capacity, peak));
+}
+
+void ScratchArena::add_block(size_t size)
+{
+	Block b;
+	b.data = new char[size];
+	b.size = size;
+	blocks.push_back(b);
+	++heap_allocations;
+	++total_heap_allocations;
+}
+
+ScratchFrame::ScratchFrame() :
+	arena(ScratchArena::local()), mark(arena.open())
+{
+}
+
+ScratchFrame::~ScratchFrame()
+{
+	arena.close(mark);
+}
+
+cv::Mat ScratchFrame::mat(int rows, int cols, int type)
+{
+	const size_t step = size_t(cols) * CV_ELEM_SIZE(type);
+	return cv::Mat(rows, cols, type, alloc(step * rows), step);
+}
+
+uint64_t scratch_heap_allocations()
+{
+	return total_heap_allocations.load();
+}
+
+}  // namespace imgproc
+}  // namespace aifil
@@ -0,0 +1,137 @@
+/** @file scratch.hpp
+ *
+ *  @brief Per-thread scratch memory for imgproc temporaries.
+ *
+ *  Every thread owns a bump allocator; ScratchFrame marks its position and
+ *  rolls it back on destruction, so nested imgproc calls stack their
+ *  temporaries. When the outermost frame of a thread ends, blocks added
+ *  during it are merged into one block of the peak size: after the first
+ *  call with given image sizes further calls do not touch the heap.
+ *  scratch_heap_allocations() is a counter for checking that.
+ */
+
+#ifndef AIFIL_IMGPROC_SCRATCH_H
+#define AIFIL_IMGPROC_SCRATCH_H
+
+#include <opencv2/core/core.hpp>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+namespace aifil {
+namespace imgproc {
+
+class ScratchArena
+{
+public:
+	enum { ALIGN = 64 };  // cache line, enough for AVX-512 loads
+
+	struct Stats
+	{
+		uint64_t heap_allocations;  // blocks allocated by this arena
+		size_t capacity;  // bytes in blocks
+		size_t used;  // bytes given out in open frames
+		size_t peak;  // max used
+	};
+
+	// arena of calling thread
+	static ScratchArena &local();
+
+	~ScratchArena();
+
+	// memory is valid until the innermost open frame ends
+	void *alloc(size_t bytes, size_t align = ALIGN);
+	template<typename T>
+	T *alloc(size_t count)
+	{
+		return static_cast<T*>(alloc(count * sizeof(T)));
+	}
+
+	Stats stats() const;
+	// frees blocks, no frame may be open
+	void release();
+
+private:
+	friend class ScratchFrame;
+
+	struct Block
+	{
+		char *data;
+		size_t size;
+	};
+
+	struct Mark
+	{
+		size_t block;
+		size_t offset;
+		size_t used;
+	};
+
+	ScratchArena();
+	ScratchArena(const ScratchArena&) = delete;
+	ScratchArena &operator=(const ScratchArena&) = delete;
+
+	Mark open();
+	void close(const Mark &mark);
+	void add_block(size_t size);
+
+	std::vector<Block> blocks;
+	size_t block;  // current block
+	size_t offset;  // in current block
+	size_t used;
+	size_t peak;
+	uint64_t heap_allocations;
+	int frames;
+};
+
+/**
+ * @brief Scope of scratch allocations in arena of calling thread.
+ * Frames are nested in stack order; memory of parallel_rows() workers
+ * is allocated from frames opened inside the body.
+ */
+class ScratchFrame
+{
+public:
+	ScratchFrame();
+	~ScratchFrame();
+
+	void *alloc(size_t bytes, size_t align = ScratchArena::ALIGN)
+	{
+		return arena.alloc(bytes, align);
+	}
+	template<typename T>
+	T *alloc(size_t count)
+	{
+		return arena.alloc<T>(count);
+	}
+	// zero-filled array
+	template<typename T>
+	T *zeros(size_t count)
+	{
+		T *p = alloc<T>(count);
+		memset(p, 0, count * sizeof(T));
+		return p;
+	}
+	// continuous matrix over aligned arena memory, no reference counting;
+	// cv functions with it as output write there if size and type match
+	cv::Mat mat(int rows, int cols, int type);
+	cv::Mat mat(cv::Size size, int type) { return mat(size.height, size.width, type); }
+
+private:
+	ScratchFrame(const ScratchFrame&) = delete;
+	ScratchFrame &operator=(const ScratchFrame&) = delete;
+
+	ScratchArena &arena;
+	ScratchArena::Mark mark;
+};
+
+// blocks allocated by arenas of all threads since start
+uint64_t scratch_heap_allocations();
+
+}  // namespace imgproc
+}  // namespace aifil
+
+#endif  // AIFIL_IMGPROC_SCRATCH_H
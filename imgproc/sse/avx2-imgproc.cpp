@@ -0,0 +1,263 @@
+//AVX2 versions of sse-imgproc.cpp kernels
+//compile with -mavx2 (/arch:AVX2), called only if cpu supports AVX2
+
+#include "simd-dispatch.hpp"
+
+#include <immintrin.h>
+#include <math.h>
+#include <string.h> //memset, memcpy
+
+void avx2_sqrt_sum_of_squares(const float *src_x, const float *src_y, float *dst, int count)
+{
+	int i = 0;
+	for ( ; i + 8 <= count; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(src_x + i);
+		__m256 y = _mm256_loadu_ps(src_y + i);
+		x = _mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y));
+		_mm256_storeu_ps(dst + i, _mm256_sqrt_ps(x));
+	}
+	for ( ; i < count; ++i)
+		dst[i] = sqrtf(src_x[i] * src_x[i] + src_y[i] * src_y[i]);
+}
+
+void avx2_atan2_0_180(const float *src_x, const float *src_y, float *angle, int count)
+{
+	//see sse_atan2_0_180()
+	static const float to_degrees = 180.0f / 3.141592653589793238462643f;
+	const __m256 p1 = _mm256_set1_ps(0.9997878412794807f * to_degrees);
+	const __m256 p3 = _mm256_set1_ps(-0.3258083974640975f * to_degrees);
+	const __m256 p5 = _mm256_set1_ps(0.1555786518463281f * to_degrees);
+	const __m256 p7 = _mm256_set1_ps(-0.04432655554792128f * to_degrees);
+	const __m256 eps = _mm256_set1_ps(1e-6f);
+	const __m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const __m256 _90 = _mm256_set1_ps(90.0f);
+	const __m256 _180 = _mm256_set1_ps(180.0f);
+	const __m256 _360 = _mm256_set1_ps(360.0f);
+	const __m256 zero = _mm256_setzero_ps();
+
+	int i = 0;
+	for ( ; i + 8 <= count; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(src_x + i);
+		__m256 y = _mm256_loadu_ps(src_y + i);
+		__m256 ax = _mm256_and_ps(x, absmask);
+		__m256 ay = _mm256_and_ps(y, absmask);
+		__m256 c = _mm256_div_ps(_mm256_min_ps(ax, ay),
+			_mm256_add_ps(_mm256_max_ps(ax, ay), eps));
+		__m256 c2 = _mm256_mul_ps(c, c);
+		__m256 a = _mm256_mul_ps(c2, p7);
+		a = _mm256_mul_ps(_mm256_add_ps(a, p5), c2);
+		a = _mm256_mul_ps(_mm256_add_ps(a, p3), c2);
+		a = _mm256_mul_ps(_mm256_add_ps(a, p1), c);
+
+		a = _mm256_blendv_ps(a, _mm256_sub_ps(_90, a), _mm256_cmp_ps(ax, ay, _CMP_LT_OQ));
+		a = _mm256_blendv_ps(a, _mm256_sub_ps(_180, a), _mm256_cmp_ps(x, zero, _CMP_LT_OQ));
+		a = _mm256_blendv_ps(a, _mm256_sub_ps(_360, a), _mm256_cmp_ps(y, zero, _CMP_LT_OQ));
+		a = _mm256_sub_ps(a, _mm256_and_ps(_180, _mm256_cmp_ps(a, _180, _CMP_GE_OQ)));
+
+		_mm256_storeu_ps(angle + i, a);
+	}
+	for ( ; i < count; ++i)
+		angle[i] = atan2_0_180_pix(src_x[i], src_y[i]);
+}
+
+//10-channel integrals: channels 0..7 in ymm register, 8..9 in low half of xmm.
+//Unlike SSE versions nothing is read or written outside of images,
+//so there is no special processing of the last row.
+
+void avx2_integral_c10_32f(int height, int width, const float *src, float *dst)
+{
+	static const int channels = 10;
+	const int sum_step = (width + 1) * channels;
+	memset(dst, 0, sum_step * sizeof(float));
+
+	for (int y = 0; y < height; ++y, src += width * channels)
+	{
+		const float *prev = dst + y * sum_step + channels;
+		float *cur = dst + (y + 1) * sum_step;
+		memset(cur, 0, channels * sizeof(float));
+		cur += channels;
+
+		__m256 sum0 = _mm256_setzero_ps();
+		__m128 sum1 = _mm_setzero_ps();
+		for (int x = 0; x < width * channels; x += channels)
+		{
+			sum0 = _mm256_add_ps(sum0, _mm256_loadu_ps(src + x));
+			sum1 = _mm_add_ps(sum1,
+				_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(src + x + 8))));
+
+			_mm256_storeu_ps(cur + x, _mm256_add_ps(_mm256_loadu_ps(prev + x), sum0));
+			__m128 tail = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(prev + x + 8)));
+			_mm_storel_epi64((__m128i*)(cur + x + 8), _mm_castps_si128(_mm_add_ps(tail, sum1)));
+		}
+	}
+}
+
+void avx2_integral_c10_64f(int height, int width, const float *src, double *dst)
+{
+	//row sums are accumulated in double like cv::integral does
+	static const int channels = 10;
+	const int sum_step = (width + 1) * channels;
+	memset(dst, 0, sum_step * sizeof(double));
+
+	for (int y = 0; y < height; ++y, src += width * channels)
+	{
+		const double *prev = dst + y * sum_step + channels;
+		double *cur = dst + (y + 1) * sum_step;
+		memset(cur, 0, channels * sizeof(double));
+		cur += channels;
+
+		__m256d sum0 = _mm256_setzero_pd();
+		__m256d sum1 = _mm256_setzero_pd();
+		__m128d sum2 = _mm_setzero_pd();
+		for (int x = 0; x < width * channels; x += channels)
+		{
+			__m256 v = _mm256_loadu_ps(src + x);
+			sum0 = _mm256_add_pd(sum0, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+			sum1 = _mm256_add_pd(sum1, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+			sum2 = _mm_add_pd(sum2, _mm_cvtps_pd(
+				_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(src + x + 8)))));
+
+			_mm256_storeu_pd(cur + x, _mm256_add_pd(_mm256_loadu_pd(prev + x), sum0));
+			_mm256_storeu_pd(cur + x + 4, _mm256_add_pd(_mm256_loadu_pd(prev + x + 4), sum1));
+			_mm_storeu_pd(cur + x + 8, _mm_add_pd(_mm_loadu_pd(prev + x + 8), sum2));
+		}
+	}
+}
+
+void avx2_integral_c10_32s(int height, int width, const uint8_t *src, int *dst)
+{
+	static const int channels = 10;
+	const int sum_step = (width + 1) * channels;
+	memset(dst, 0, sum_step * sizeof(int));
+
+	for (int y = 0; y < height; ++y, src += width * channels)
+	{
+		const int *prev = dst + y * sum_step + channels;
+		int *cur = dst + (y + 1) * sum_step;
+		memset(cur, 0, channels * sizeof(int));
+		cur += channels;
+
+		__m256i sum0 = _mm256_setzero_si256();
+		__m128i sum1 = _mm_setzero_si128();
+		for (int x = 0; x < width * channels; x += channels)
+		{
+			uint16_t last2;
+			memcpy(&last2, src + x + 8, sizeof(last2));
+			sum0 = _mm256_add_epi32(sum0,
+				_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + x))));
+			sum1 = _mm_add_epi32(sum1, _mm_cvtepu8_epi32(_mm_cvtsi32_si128(last2)));
+
+			_mm256_storeu_si256((__m256i*)(cur + x), _mm256_add_epi32(
+				_mm256_loadu_si256((const __m256i*)(prev + x)), sum0));
+			_mm_storel_epi64((__m128i*)(cur + x + 8), _mm_add_epi32(
+				_mm_loadl_epi64((const __m128i*)(prev + x + 8)), sum1));
+		}
+	}
+}
+
+//box corners are gathered for 8 (4 for doubles) boxes at once:
+//offsets are interleaved, so corner k of box i is offsets[i * 4 + k]
+
+void avx2_box_sums_32s(const int *sum, const int *offsets, int count, int base, int *dst)
+{
+	const __m256i stride = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+	const __m256i vbase = _mm256_set1_epi32(base);
+	int i = 0;
+	for ( ; i + 8 <= count; i += 8, offsets += 32)
+	{
+		__m256i tl = _mm256_add_epi32(vbase, _mm256_i32gather_epi32(offsets + 0, stride, 4));
+		__m256i tr = _mm256_add_epi32(vbase, _mm256_i32gather_epi32(offsets + 1, stride, 4));
+		__m256i bl = _mm256_add_epi32(vbase, _mm256_i32gather_epi32(offsets + 2, stride, 4));
+		__m256i br = _mm256_add_epi32(vbase, _mm256_i32gather_epi32(offsets + 3, stride, 4));
+		__m256i res = _mm256_sub_epi32(_mm256_i32gather_epi32(sum, br, 4),
+			_mm256_i32gather_epi32(sum, tr, 4));
+		res = _mm256_sub_epi32(res, _mm256_i32gather_epi32(sum, bl, 4));
+		res = _mm256_add_epi32(res, _mm256_i32gather_epi32(sum, tl, 4));
+		_mm256_storeu_si256((__m256i*)(dst + i), res);
+	}
+	for ( ; i < count; ++i, offsets += 4)
+		dst[i] = sum[base + offsets[3]] - sum[base + offsets[1]] -
+			sum[base + offsets[2]] + sum[base + offsets[0]];
+}
+
+void avx2_box_sums_32f(const float *sum, const int *offsets, int count, int base, float *dst)
+{
+	const __m256i stride = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+	const __m256i vbase = _mm256_set1_epi32(base);
+	int i = 0;
+	for ( ; i + 8 <= count; i += 8, offsets += 32)
+	{
+		__m256i tl = _mm256_add_epi32(vbase, _mm256_i32gather_epi32(offsets + 0, stride, 4));
+		__m256i tr = _mm256_add_epi32(vbase, _mm256_i32gather_epi32(offsets + 1, stride, 4));
+		__m256i bl = _mm256_add_epi32(vbase, _mm256_i32gather_epi32(offsets + 2, stride, 4));
+		__m256i br = _mm256_add_epi32(vbase, _mm256_i32gather_epi32(offsets + 3, stride, 4));
+		__m256 res = _mm256_sub_ps(_mm256_i32gather_ps(sum, br, 4),
+			_mm256_i32gather_ps(sum, tr, 4));
+		res = _mm256_sub_ps(res, _mm256_i32gather_ps(sum, bl, 4));
+		res = _mm256_add_ps(res, _mm256_i32gather_ps(sum, tl, 4));
+		_mm256_storeu_ps(dst + i, res);
+	}
+	for ( ; i < count; ++i, offsets += 4)
+		dst[i] = sum[base + offsets[3]] - sum[base + offsets[1]] -
+			sum[base + offsets[2]] + sum[base + offsets[0]];
+}
+
+void avx2_box_sums_64f(const double *sum, const int *offsets, int count, int base, double *dst)
+{
+	const __m128i stride = _mm_setr_epi32(0, 4, 8, 12);
+	const __m128i vbase = _mm_set1_epi32(base);
+	int i = 0;
+	for ( ; i + 4 <= count; i += 4, offsets += 16)
+	{
+		__m128i tl = _mm_add_epi32(vbase, _mm_i32gather_epi32(offsets + 0, stride, 4));
+		__m128i tr = _mm_add_epi32(vbase, _mm_i32gather_epi32(offsets + 1, stride, 4));
+		__m128i bl = _mm_add_epi32(vbase, _mm_i32gather_epi32(offsets + 2, stride, 4));
+		__m128i br = _mm_add_epi32(vbase, _mm_i32gather_epi32(offsets + 3, stride, 4));
+		__m256d res = _mm256_sub_pd(_mm256_i32gather_pd(sum, br, 8),
+			_mm256_i32gather_pd(sum, tr, 8));
+		res = _mm256_sub_pd(res, _mm256_i32gather_pd(sum, bl, 8));
+		res = _mm256_add_pd(res, _mm256_i32gather_pd(sum, tl, 8));
+		_mm256_storeu_pd(dst + i, res);
+	}
+	for ( ; i < count; ++i, offsets += 4)
+		dst[i] = sum[base + offsets[3]] - sum[base + offsets[1]] -
+			sum[base + offsets[2]] + sum[base + offsets[0]];
+}
+
+//see sse2_gradient2_8u(), 32 pixels at once
+void avx2_gradient2_8u(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+	uint8_t *angle, uint8_t *magnitude, int count, int threshold)
+{
+	const bool keep_first = threshold < 0;
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i thr = _mm256_set1_epi8(char(threshold < 0 ? 0 : (threshold > 255 ? 255 : threshold)));
+	int x = 0;
+	for ( ; x + 32 <= count; x += 32)
+	{
+		__m256i d[4];
+		const uint8_t *a_rows[4] = { mid + x + 1, down + x + 1, down + x, down + x - 1 };
+		const uint8_t *b_rows[4] = { mid + x - 1, up + x - 1, up + x, up + x + 1 };
+		for (int k = 0; k < 4; ++k)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i*)a_rows[k]);
+			__m256i b = _mm256_loadu_si256((const __m256i*)b_rows[k]);
+			d[k] = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+		}
+		__m256i m = keep_first ? d[0] : thr;
+		__m256i a = keep_first ? _mm256_set1_epi8(1) : zero;
+		for (int k = keep_first ? 1 : 0; k < 4; ++k)
+		{
+			//d > m if max(d, m) != m
+			__m256i le = _mm256_cmpeq_epi8(_mm256_max_epu8(d[k], m), m);
+			a = _mm256_blendv_epi8(_mm256_set1_epi8(char(k + 1)), a, le);
+			m = _mm256_max_epu8(d[k], m);
+		}
+		m = _mm256_andnot_si256(_mm256_cmpeq_epi8(a, zero), m);
+		_mm256_storeu_si256((__m256i*)(angle + x), a);
+		_mm256_storeu_si256((__m256i*)(magnitude + x), m);
+	}
+	for ( ; x < count; ++x)
+		gradient2_pix(up + x, mid + x, down + x, angle + x, magnitude + x, threshold);
+}
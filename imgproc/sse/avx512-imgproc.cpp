@@ -0,0 +1,58 @@
+//AVX-512 versions of element-wise sse-imgproc.cpp kernels
+//compile with -mavx512f (/arch:AVX512), called only if cpu supports AVX-512F
+
+#include "simd-dispatch.hpp"
+
+#include <immintrin.h>
+
+//tails are processed with masked loads and stores
+
+void avx512_sqrt_sum_of_squares(const float *src_x, const float *src_y, float *dst, int count)
+{
+	for (int i = 0; i < count; i += 16)
+	{
+		__mmask16 mask = count - i >= 16 ? __mmask16(0xffff) : __mmask16((1u << (count - i)) - 1);
+		__m512 x = _mm512_maskz_loadu_ps(mask, src_x + i);
+		__m512 y = _mm512_maskz_loadu_ps(mask, src_y + i);
+		x = _mm512_add_ps(_mm512_mul_ps(x, x), _mm512_mul_ps(y, y));
+		_mm512_mask_storeu_ps(dst + i, mask, _mm512_sqrt_ps(x));
+	}
+}
+
+void avx512_atan2_0_180(const float *src_x, const float *src_y, float *angle, int count)
+{
+	//see sse_atan2_0_180()
+	static const float to_degrees = 180.0f / 3.141592653589793238462643f;
+	const __m512 p1 = _mm512_set1_ps(0.9997878412794807f * to_degrees);
+	const __m512 p3 = _mm512_set1_ps(-0.3258083974640975f * to_degrees);
+	const __m512 p5 = _mm512_set1_ps(0.1555786518463281f * to_degrees);
+	const __m512 p7 = _mm512_set1_ps(-0.04432655554792128f * to_degrees);
+	const __m512 eps = _mm512_set1_ps(1e-6f);
+	const __m512 _90 = _mm512_set1_ps(90.0f);
+	const __m512 _180 = _mm512_set1_ps(180.0f);
+	const __m512 _360 = _mm512_set1_ps(360.0f);
+	const __m512 zero = _mm512_setzero_ps();
+
+	for (int i = 0; i < count; i += 16)
+	{
+		__mmask16 mask = count - i >= 16 ? __mmask16(0xffff) : __mmask16((1u << (count - i)) - 1);
+		__m512 x = _mm512_maskz_loadu_ps(mask, src_x + i);
+		__m512 y = _mm512_maskz_loadu_ps(mask, src_y + i);
+		__m512 ax = _mm512_abs_ps(x);
+		__m512 ay = _mm512_abs_ps(y);
+		__m512 c = _mm512_div_ps(_mm512_min_ps(ax, ay),
+			_mm512_add_ps(_mm512_max_ps(ax, ay), eps));
+		__m512 c2 = _mm512_mul_ps(c, c);
+		__m512 a = _mm512_mul_ps(c2, p7);
+		a = _mm512_mul_ps(_mm512_add_ps(a, p5), c2);
+		a = _mm512_mul_ps(_mm512_add_ps(a, p3), c2);
+		a = _mm512_mul_ps(_mm512_add_ps(a, p1), c);
+
+		a = _mm512_mask_sub_ps(a, _mm512_cmp_ps_mask(ax, ay, _CMP_LT_OQ), _90, a);
+		a = _mm512_mask_sub_ps(a, _mm512_cmp_ps_mask(x, zero, _CMP_LT_OQ), _180, a);
+		a = _mm512_mask_sub_ps(a, _mm512_cmp_ps_mask(y, zero, _CMP_LT_OQ), _360, a);
+		a = _mm512_mask_sub_ps(a, _mm512_cmp_ps_mask(a, _180, _CMP_GE_OQ), a, _180);
+
+		_mm512_mask_storeu_ps(angle + i, mask, a);
+	}
+}
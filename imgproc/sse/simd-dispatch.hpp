@@ -0,0 +1,112 @@
+/** @file simd-dispatch.hpp
+ *
+ *  @brief SIMD kernels of different instruction sets and runtime selection.
+ *
+ *  sse-imgproc.cpp is built for SSE2 baseline, avx2-imgproc.cpp and
+ *  avx512-imgproc.cpp are built with their own compiler flags and called
+ *  only when cpuid (and OS, via xgetbv) report the instruction set support.
+ *  Public sse_gradient*, sse_integral_* and sse_box_sums_* entry points
+ *  pick the best available implementation on the first call.
+ */
+
+#ifndef AIFIL_SIMD_DISPATCH_H
+#define AIFIL_SIMD_DISPATCH_H
+
+#if defined(_MSC_VER) && _MSC_VER <= 1310
+typedef unsigned char uint8_t;
+#else
+#include <stdint.h>
+#endif
+
+enum SIMD_LEVEL
+{
+	SIMD_SSE2 = 1,
+	SIMD_AVX2 = 2,
+	SIMD_AVX512 = 3
+};
+
+/**
+ * @brief Instruction set used by dispatched kernels.
+ * Best supported one by default, AIFIL_SIMD environment variable
+ * ("sse2", "avx2", "avx512") limits it.
+ */
+extern "C" int simd_level();
+
+/**
+ * @brief Limit dispatched kernels to level (for benchmarks and tests).
+ * Switching is atomic, but must not be done while imgproc work is in
+ * flight: parts of one image could be processed by different kernels.
+ * @return Level actually set: min(level, best supported).
+ */
+extern "C" int simd_set_level(int level);
+
+// kernels, count is elements amount, no alignment requirements
+void avx2_sqrt_sum_of_squares(const float *src_x, const float *src_y, float *dst, int count);
+void avx2_atan2_0_180(const float *src_x, const float *src_y, float *angle, int count);
+void avx2_integral_c10_32f(int height, int width, const float *src, float *dst);
+void avx2_integral_c10_64f(int height, int width, const float *src, double *dst);
+void avx2_integral_c10_32s(int height, int width, const uint8_t *src, int *dst);
+
+// box sums over integral image: offsets has 4 values per box
+// (top-left, top-right, bottom-left, bottom-right), base is added to all of them
+void avx2_box_sums_32s(const int *sum, const int *offsets, int count, int base, int *dst);
+void avx2_box_sums_32f(const float *sum, const int *offsets, int count, int base, float *dst);
+void avx2_box_sums_64f(const double *sum, const int *offsets, int count, int base, double *dst);
+
+// quantized gradient (see imgproc::gradient2()) of count pixels of 1-channel row,
+// up, mid and down point to the first pixel in rows above, at and below it
+void avx2_gradient2_8u(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+	uint8_t *angle, uint8_t *magnitude, int count, int threshold);
+
+void avx512_sqrt_sum_of_squares(const float *src_x, const float *src_y, float *dst, int count);
+void avx512_atan2_0_180(const float *src_x, const float *src_y, float *angle, int count);
+
+// scalar version of sse_atan2_0_180() for tails, same polynomial
+inline float atan2_0_180_pix(float x, float y)
+{
+	static const float to_degrees = 180.0f / 3.141592653589793238462643f;
+	static const float p1 = 0.9997878412794807f * to_degrees;
+	static const float p3 = -0.3258083974640975f * to_degrees;
+	static const float p5 = 0.1555786518463281f * to_degrees;
+	static const float p7 = -0.04432655554792128f * to_degrees;
+
+	float ax = x < 0 ? -x : x;
+	float ay = y < 0 ? -y : y;
+	float tmin = ax < ay ? ax : ay;
+	float tmax = ax < ay ? ay : ax;
+	float c = tmin / (tmax + 1e-6f);
+	float c2 = c * c;
+	float a = (((c2 * p7 + p5) * c2 + p3) * c2 + p1) * c;
+	if (ax < ay)
+		a = 90.0f - a;
+	if (x < 0)
+		a = 180.0f - a;
+	if (y < 0)
+		a = 360.0f - a;
+	if (a >= 180.0f)
+		a -= 180.0f;
+	return a;
+}
+
+// scalar gradient2 pixel for tails: the largest of 4 opposite neighbours
+// differences above threshold, the first one wins on equality
+inline void gradient2_pix(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+	uint8_t *angle, uint8_t *magnitude, int threshold)
+{
+	int d[4] = { mid[1] - mid[-1], down[1] - up[-1], down[0] - up[0], down[-1] - up[1] };
+	int max_diff = threshold;
+	*angle = 0;
+	*magnitude = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		int diff = d[i] < 0 ? -d[i] : d[i];
+		if (diff > max_diff)
+		{
+			max_diff = diff;
+			*angle = uint8_t(i + 1);
+			*magnitude = uint8_t(diff);
+		}
+	}
+}
+
+#endif  // AIFIL_SIMD_DISPATCH_H
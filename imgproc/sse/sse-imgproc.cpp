@@ -11,9 +11,15 @@
 //#include <immintrin.h> //AVX and post-32nm
 //#include <zmmintrin.h> //AVX-512
 
+#include "simd-dispatch.hpp"
+
 #include <malloc.h>
+#include <math.h> //sqrtf
+#include <stdlib.h> //getenv
 #include <string.h> //memset
 
+#include <atomic>
+
 #if defined(_MSC_VER) && _MSC_VER <= 1310
 #define UGLY_VC71
 #include <mmintrin.h> //MMX
@@ -42,6 +48,15 @@ static void inline cpuid(int cpuinfo[4], int info_type)
         pop    ebx
     }
 }
+//no AVX with this compiler: leaf 7 and XCR0 are reported empty
+static void cpuidex(int cpu_info[4], int, int)
+{
+	cpu_info[0] = cpu_info[1] = cpu_info[2] = cpu_info[3] = 0;
+}
+static unsigned long long xgetbv0()
+{
+	return 0;
+}
 #else //not VC 7.1
 #include <stdint.h>
 #endif
@@ -49,6 +64,14 @@ static void inline cpuid(int cpuinfo[4], int info_type)
 #if defined(_MSC_VER) && _MSC_VER > 1310
 #define cpuid __cpuid
 #include <intrin.h> //get CPUID capability and all other headers
+static void cpuidex(int cpu_info[4], int info_type, int sub_type)
+{
+	__cpuidex(cpu_info, info_type, sub_type);
+}
+static unsigned long long xgetbv0()
+{
+	return _xgetbv(0);
+}
 #endif
 
 #ifdef _MSC_VER //VVRR
@@ -68,6 +91,20 @@ void cpuid(int cpu_info[4], int info_type)
 		: "a" (info_type)
     );
 }
+static void cpuidex(int cpu_info[4], int info_type, int sub_type)
+{
+    __asm__ __volatile__ (
+        "cpuid"
+		: "=a" (cpu_info[0]), "=b" (cpu_info[1]), "=c" (cpu_info[2]), "=d" (cpu_info[3])
+		: "a" (info_type), "c" (sub_type)
+    );
+}
+static unsigned long long xgetbv0()
+{
+	unsigned eax, edx;
+	__asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	return ((unsigned long long)edx << 32) | eax;
+}
 #define ALIGN16(a)	a __attribute__ ((aligned (16)))
 #endif
 
@@ -79,7 +116,9 @@ void cpuid(int cpu_info[4], int info_type)
 //ICC-specific code
 #endif
 
+#ifndef M_PIf
 #define M_PIf 3.141592653589793238462643f
+#endif
 
 struct SSECapabilities
 {
@@ -96,6 +135,10 @@ struct SSECapabilities
 	bool xop;
 	bool fma3;
 	bool fma4;
+	// AVX2 and AVX-512 are set only if OS saves ymm/zmm registers
+	bool avx2;
+	bool avx512f;
+	bool avx512bw;
 
 	bool checked;
 
@@ -116,6 +159,9 @@ struct SSECapabilities
 		xop = false;
 		fma3 = false;
 		fma4 = false;
+		avx2 = false;
+		avx512f = false;
+		avx512bw = false;
 	}
 
 	void check()
@@ -143,6 +189,20 @@ struct SSECapabilities
 
 			avx   = !!(info[2] & (1 << 28));
 			fma3  = !!(info[2] & (1 << 12));
+
+			//xgetbv is available if OSXSAVE bit is set
+			unsigned long long xcr0 = (info[2] & (1 << 27)) ? xgetbv0() : 0;
+			bool os_avx = (xcr0 & 0x06) == 0x06;     //xmm, ymm
+			bool os_avx512 = (xcr0 & 0xe6) == 0xe6;  //and opmask, zmm
+			avx = avx && os_avx;
+
+			if (n_ids >= 7)
+			{
+				cpuidex(info, 7, 0);
+				avx2     = avx && !!(info[1] & (1 <<  5));
+				avx512f  = avx2 && os_avx512 && !!(info[1] & (1 << 16));
+				avx512bw = avx512f && !!(info[1] & (1 << 30));
+			}
 		}
 
 		if (n_ext_ids >= 0x80000001)
@@ -159,11 +219,30 @@ struct SSECapabilities
 
 static SSECapabilities sse_capabilities;
 
+//kernels selected by simd_level()
+struct SimdKernels
+{
+	int level;
+	void (*sqrt_sum_of_squares)(const float *src_x, const float *src_y, float *dst, int count);
+	void (*atan2_0_180)(const float *src_x, const float *src_y, float *angle, int count);
+	void (*integral_c10_32f)(int height, int width, const float *src, float *dst);
+	void (*integral_c10_64f)(int height, int width, const float *src, double *dst);
+	void (*integral_c10_32s)(int height, int width, const uint8_t *src, int *dst);
+	void (*box_sums_32s)(const int *sum, const int *offsets, int count, int base, int *dst);
+	void (*box_sums_32f)(const float *sum, const int *offsets, int count, int base, float *dst);
+	void (*box_sums_64f)(const double *sum, const int *offsets, int count, int base, double *dst);
+	void (*gradient2_8u)(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+		uint8_t *angle, uint8_t *magnitude, int count, int threshold);
+};
+
+static const SimdKernels& simd_kernels();
+
 void sse_sqrt_sum_of_squares(float* src_x, float* src_y, float* dst, uint32_t count)
 {
 	//dst aligned?
 
-	for (uint32_t i = 0; i < count; i += 4)
+	uint32_t i = 0;
+	for ( ; i + 4 <= count; i += 4)
 	{
 		__m128 x = _mm_loadu_ps(src_x + i);
 		__m128 y = _mm_loadu_ps(src_y + i);
@@ -173,12 +252,15 @@ void sse_sqrt_sum_of_squares(float* src_x, float* src_y, float* dst, uint32_t co
 		_mm_storeu_ps(dst + i, x);
 		//_mm_store_ps(dst + i, x);
 	}
+	for ( ; i < count; ++i)
+		dst[i] = sqrtf(src_x[i] * src_x[i] + src_y[i] * src_y[i]);
 }
 
 void sse_subs_180(float* pangle, uint32_t count)
 {
 	__m128 pi = _mm_set1_ps(180.0f);
-	for (uint32_t i = 0; i < count; i += 4)
+	uint32_t i = 0;
+	for ( ; i + 4 <= count; i += 4)
 	{
 		__m128 a = _mm_loadu_ps(pangle + i);
 		__m128 greater = _mm_cmpge_ps(a, pi);
@@ -186,6 +268,9 @@ void sse_subs_180(float* pangle, uint32_t count)
 		__m128 res = _mm_sub_ps(a, pi_masked);
 		_mm_storeu_ps(pangle + i, res);
 	}
+	for ( ; i < count; ++i)
+		if (pangle[i] >= 180.0f)
+			pangle[i] -= 180.0f;
 }
 
 void sse_atan2_0_180(float *src_x, float *src_y, float *angle, int count)
@@ -211,7 +296,8 @@ void sse_atan2_0_180(float *src_x, float *src_y, float *angle, int count)
     __m128 p5 = _mm_set1_ps(atan2_p5);
 	__m128 p7 = _mm_set1_ps(atan2_p7);
 
-	for(int i = 0; i < count; i += 4)
+	int i = 0;
+	for ( ; i + 4 <= count; i += 4)
 	{
 		__m128 x = _mm_loadu_ps(src_x + i);
 		__m128 y = _mm_loadu_ps(src_y + i);
@@ -245,6 +331,18 @@ void sse_atan2_0_180(float *src_x, float *src_y, float *angle, int count)
 
 		_mm_storeu_ps(angle + i, a);
 	}
+	for ( ; i < count; ++i)
+		angle[i] = atan2_0_180_pix(src_x[i], src_y[i]);
+}
+
+static void sse2_sqrt_sum_of_squares(const float *src_x, const float *src_y, float *dst, int count)
+{
+	sse_sqrt_sum_of_squares((float*)src_x, (float*)src_y, dst, count);
+}
+
+static void sse2_atan2_0_180(const float *src_x, const float *src_y, float *angle, int count)
+{
+	sse_atan2_0_180((float*)src_x, (float*)src_y, angle, count);
 }
 
 void sse_max_diff_mag_c3(const float *src_x, const float *src_y, const float *src_mag,
@@ -295,7 +393,7 @@ void sse_gradient_c1(int height, int width, float *pdx, float *pdy,
 	float *pangle, float *pmag)
 {
 	int len = width * height;
-	sse_sqrt_sum_of_squares(pdx, pdy, pmag, len);
+	simd_kernels().sqrt_sum_of_squares(pdx, pdy, pmag, len);
 
 	//float *tpangle = pangle;
 	//float *tpdx = pdx;
@@ -304,22 +402,25 @@ void sse_gradient_c1(int height, int width, float *pdx, float *pdy,
 	//	*tpangle = cv::fastAtan2(pdy, pdx);
 	//sse_subs_180(pangle, len);
 
-	sse_atan2_0_180(pdx, pdy, pangle, len);
+	simd_kernels().atan2_0_180(pdx, pdy, pangle, len);
 }
 
+//buf is temporary of 5 * width * height floats, no alignment is required:
+//its dx1 and dy1 parts start at 3 * len and 4 * len floats, which are not
+//16-byte aligned unless len is a multiple of 4, so kernels use unaligned loads
 extern "C"
 void sse_gradient_c3(int height, int width, float *pdx, float *pdy,
-	float *pangle, float *pmag)
+	float *pangle, float *pmag, float *buf)
 {
 	int len = width * height;
 
-	float *squares = (float*)aligned_malloc((len * 3) * sizeof(float), 16);
-	float *pdx1 = (float*)aligned_malloc(len * sizeof(float), 16);
-	float *pdy1 = (float*)aligned_malloc(len * sizeof(float), 16);
+	float *squares = buf;
+	float *pdx1 = squares + len * 3;
+	float *pdy1 = pdx1 + len;
 	float *tpdx1 = pdx1;
 	float *tpdy1 = pdy1;
 	//printf("squares\n");
-	sse_sqrt_sum_of_squares(pdx, pdy, squares, len * 3);
+	simd_kernels().sqrt_sum_of_squares(pdx, pdy, squares, len * 3);
 	//printf("max\n");
 	//sse_max_diff_mag_c3(pdx, pdy, squares, pdx1, pdy1, pmag, len * 3);
 	for (int i = 0; i < len; ++i, pdx += 3, pdy += 3, ++pmag, ++tpdx1, ++tpdy1)
@@ -344,14 +445,10 @@ void sse_gradient_c3(int height, int width, float *pdx, float *pdy,
 	//	*tpangle = cv::fastAtan2(pdy1, pdx1);
 	//sse_subs_180(pangle, len);
 
-	sse_atan2_0_180(pdx1, pdy1, pangle, len);
-	aligned_free(squares);
-	aligned_free(pdx1);
-	aligned_free(pdy1);
+	simd_kernels().atan2_0_180(pdx1, pdy1, pangle, len);
 }
 
-extern "C"
-void sse_integral_c10_32f(int height, int width, float *src, float *dst)
+static void sse2_integral_c10_32f(int height, int width, const float *src, float *dst)
 {
 	static const int channels = 10;
 	const int src_step = width * channels;
@@ -384,12 +481,12 @@ void sse_integral_c10_32f(int height, int width, float *src, float *dst)
 			dst1 = _mm_add_ps(dst1, sum_x1);
 			dst2 = _mm_add_ps(dst2, sum_x2);
 			_mm_storeu_ps(dst + x, dst0);
-			_mm_storeu_ps(dst + x + 4, dst0);
-			_mm_storeu_ps(dst + x + 8, dst0);
+			_mm_storeu_ps(dst + x + 4, dst1);
+			_mm_storeu_ps(dst + x + 8, dst2);
 		}
 
 		src += src_step;
-		dst += sum_step;
+		dst += sum_step - channels;
 	}
 
 	//last row must be processed separately
@@ -415,8 +512,8 @@ void sse_integral_c10_32f(int height, int width, float *src, float *dst)
 		dst1 = _mm_add_ps(dst1, sum_x1);
 		dst2 = _mm_add_ps(dst2, sum_x2);
 		_mm_storeu_ps(dst + x, dst0);
-		_mm_storeu_ps(dst + x + 4, dst0);
-		_mm_storeu_ps(dst + x + 8, dst0);
+		_mm_storeu_ps(dst + x + 4, dst1);
+		_mm_storeu_ps(dst + x + 8, dst2);
 	}
 
 	//last row, last column
@@ -442,8 +539,7 @@ void sse_integral_c10_32f(int height, int width, float *src, float *dst)
 	dst[x + 9] = last_dst_row_col[1];
 }
 
-extern "C"
-void sse_integral_c10_64f(int height, int width, float *src, double *dst)
+static void sse2_integral_c10_64f(int height, int width, const float *src, double *dst)
 {
 	static const int channels = 10;
 	const int src_step = width * channels;
@@ -607,8 +703,7 @@ void sse_integral_c10_64f(int height, int width, float *src, double *dst)
 	_mm_storeu_pd(dst + x + 8, dst4);
 }
 
-extern "C"
-void sse_integral_c10_32s(int height, int width, uint8_t *src, int *dst)
+static void sse2_integral_c10_32s(int height, int width, const uint8_t *src, int *dst)
 {
 	static const int channels = 10;
 	const int src_step = width * channels;
@@ -725,6 +820,220 @@ void sse_integral_c10_32s(int height, int width, uint8_t *src, int *dst)
 	dst[x + 9] = tmp_dst[1];
 }
 
+//SSE2 has no gathers, box sums are scalar
+template<typename T>
+static void box_sums(const T *sum, const int *offsets, int count, int base, T *dst)
+{
+	for (int i = 0; i < count; ++i, offsets += 4)
+		dst[i] = sum[base + offsets[3]] - sum[base + offsets[1]] -
+			sum[base + offsets[2]] + sum[base + offsets[0]];
+}
+
+//SSE2 has no unsigned bytes comparison: a > b if max(a, b) != b
+static inline __m128i gt_epu8(__m128i a, __m128i b)
+{
+	return _mm_andnot_si128(_mm_cmpeq_epi8(_mm_max_epu8(a, b), b), _mm_set1_epi8(-1));
+}
+
+static inline __m128i absdiff_epu8(__m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+static inline __m128i loadu_epi8(const uint8_t *p)
+{
+	return _mm_loadu_si128((const __m128i*)p);
+}
+
+//16 pixels at once: saturating differences, max and compare + blend for argmax
+static void sse2_gradient2_8u(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+	uint8_t *angle, uint8_t *magnitude, int count, int threshold)
+{
+	const bool keep_first = threshold < 0;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i thr = _mm_set1_epi8(char(threshold < 0 ? 0 : (threshold > 255 ? 255 : threshold)));
+	int x = 0;
+	for ( ; x + 16 <= count; x += 16)
+	{
+		__m128i d[4] = {
+			absdiff_epu8(loadu_epi8(mid + x + 1), loadu_epi8(mid + x - 1)),
+			absdiff_epu8(loadu_epi8(down + x + 1), loadu_epi8(up + x - 1)),
+			absdiff_epu8(loadu_epi8(down + x), loadu_epi8(up + x)),
+			absdiff_epu8(loadu_epi8(down + x - 1), loadu_epi8(up + x + 1))
+		};
+		__m128i m = keep_first ? d[0] : thr;
+		__m128i a = keep_first ? _mm_set1_epi8(1) : zero;
+		for (int k = keep_first ? 1 : 0; k < 4; ++k)
+		{
+			__m128i gt = gt_epu8(d[k], m);
+			a = _mm_or_si128(_mm_and_si128(gt, _mm_set1_epi8(char(k + 1))), _mm_andnot_si128(gt, a));
+			m = _mm_max_epu8(d[k], m);
+		}
+		//no direction above threshold
+		m = _mm_andnot_si128(_mm_cmpeq_epi8(a, zero), m);
+		_mm_storeu_si128((__m128i*)(angle + x), a);
+		_mm_storeu_si128((__m128i*)(magnitude + x), m);
+	}
+	for ( ; x < count; ++x)
+		gradient2_pix(up + x, mid + x, down + x, angle + x, magnitude + x, threshold);
+}
+
+static int best_simd_level()
+{
+	sse_capabilities.check();
+	int level = SIMD_SSE2;
+#ifdef HAVE_AVX2
+	if (sse_capabilities.avx2)
+		level = SIMD_AVX2;
+#endif
+#ifdef HAVE_AVX512
+	if (sse_capabilities.avx512f)
+		level = SIMD_AVX512;
+#endif
+	return level;
+}
+
+static SimdKernels make_simd_kernels(int level)
+{
+	int best = best_simd_level();
+	if (level > best)
+		level = best;
+	if (level < SIMD_SSE2)
+		level = SIMD_SSE2;
+
+	SimdKernels k;
+	k.level = level;
+	k.sqrt_sum_of_squares = sse2_sqrt_sum_of_squares;
+	k.atan2_0_180 = sse2_atan2_0_180;
+	k.integral_c10_32f = sse2_integral_c10_32f;
+	k.integral_c10_64f = sse2_integral_c10_64f;
+	k.integral_c10_32s = sse2_integral_c10_32s;
+	k.box_sums_32s = box_sums<int>;
+	k.box_sums_32f = box_sums<float>;
+	k.box_sums_64f = box_sums<double>;
+	k.gradient2_8u = sse2_gradient2_8u;
+#ifdef HAVE_AVX2
+	if (level >= SIMD_AVX2)
+	{
+		k.sqrt_sum_of_squares = avx2_sqrt_sum_of_squares;
+		k.atan2_0_180 = avx2_atan2_0_180;
+		k.integral_c10_32f = avx2_integral_c10_32f;
+		k.integral_c10_64f = avx2_integral_c10_64f;
+		k.integral_c10_32s = avx2_integral_c10_32s;
+		k.box_sums_32s = avx2_box_sums_32s;
+		k.box_sums_32f = avx2_box_sums_32f;
+		k.box_sums_64f = avx2_box_sums_64f;
+		k.gradient2_8u = avx2_gradient2_8u;
+	}
+#endif
+#ifdef HAVE_AVX512
+	//integrals are bound by loads/stores of 10 channels, AVX2 ones are kept
+	if (level >= SIMD_AVX512)
+	{
+		k.sqrt_sum_of_squares = avx512_sqrt_sum_of_squares;
+		k.atan2_0_180 = avx512_atan2_0_180;
+	}
+#endif
+	return k;
+}
+
+//AIFIL_SIMD environment variable limits instruction set
+static int env_simd_level()
+{
+	const char *env = getenv("AIFIL_SIMD");
+	if (env && !strcmp(env, "sse2"))
+		return SIMD_SSE2;
+	if (env && !strcmp(env, "avx2"))
+		return SIMD_AVX2;
+	return SIMD_AVX512;
+}
+
+//immutable tables of all levels, built once (function-local static is thread-safe)
+static const SimdKernels& simd_table(int level)
+{
+	static const SimdKernels tables[] = {
+		make_simd_kernels(SIMD_SSE2),
+		make_simd_kernels(SIMD_AVX2),
+		make_simd_kernels(SIMD_AVX512) };
+	if (level < SIMD_SSE2)
+		level = SIMD_SSE2;
+	if (level > SIMD_AVX512)
+		level = SIMD_AVX512;
+	return tables[level - SIMD_SSE2];
+}
+
+//tables are never modified, so switching is publishing a pointer
+static std::atomic<const SimdKernels*> current_kernels(nullptr);
+
+static const SimdKernels& simd_kernels()
+{
+	const SimdKernels *k = current_kernels.load(std::memory_order_acquire);
+	if (k)
+		return *k;
+	//chosen on first call unless simd_set_level() was called before
+	const SimdKernels *initial = &simd_table(env_simd_level());
+	if (current_kernels.compare_exchange_strong(k, initial, std::memory_order_acq_rel))
+		k = initial;
+	return *k;
+}
+
+extern "C"
+int simd_level()
+{
+	return simd_kernels().level;
+}
+
+extern "C"
+int simd_set_level(int level)
+{
+	const SimdKernels &k = simd_table(level);
+	current_kernels.store(&k, std::memory_order_release);
+	return k.level;
+}
+
+extern "C"
+void sse_integral_c10_32f(int height, int width, float *src, float *dst)
+{
+	simd_kernels().integral_c10_32f(height, width, src, dst);
+}
+
+extern "C"
+void sse_integral_c10_64f(int height, int width, float *src, double *dst)
+{
+	simd_kernels().integral_c10_64f(height, width, src, dst);
+}
+
+extern "C"
+void sse_integral_c10_32s(int height, int width, uint8_t *src, int *dst)
+{
+	simd_kernels().integral_c10_32s(height, width, src, dst);
+}
+
+extern "C"
+void sse_box_sums_32s(const int *sum, const int *offsets, int count, int base, int *dst)
+{
+	simd_kernels().box_sums_32s(sum, offsets, count, base, dst);
+}
+
+extern "C"
+void sse_box_sums_32f(const float *sum, const int *offsets, int count, int base, float *dst)
+{
+	simd_kernels().box_sums_32f(sum, offsets, count, base, dst);
+}
+
+extern "C"
+void sse_box_sums_64f(const double *sum, const int *offsets, int count, int base, double *dst)
+{
+	simd_kernels().box_sums_64f(sum, offsets, count, base, dst);
+}
+
+extern "C"
+void sse_gradient2_8u(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+	uint8_t *angle, uint8_t *magnitude, int count, int threshold)
+{
+	simd_kernels().gradient2_8u(up, mid, down, angle, magnitude, count, threshold);
+}
+
 //float* rgb2luv_setup(float z, float *mr, float *mg, float *mb,
 //					 float &minu, float &minv, float &un, float &vn)
 //{
@@ -860,11 +1169,6 @@ void sse_quantize_soft_6_10(int height, int width, float *psrc, float *pweight,
 	static const int channels = 10;
 	const int len = width * height;
 
-	int *indexes0 = (int*)aligned_malloc(len * sizeof(float), 16);
-	int *indexes1 = (int*)aligned_malloc(len * sizeof(float), 16);
-	float *vals0 = (float*)aligned_malloc(len * sizeof(float), 16);
-	float *vals1 = (float*)aligned_malloc(len * sizeof(float), 16);
-
 //	__m128 mult = _mm_set1_ps(6.0f / 179.99f);
 //	__m128i one = _mm_set1_pi32(1);
 //	__m128i seven = _mm_set1_pi32(7);
@@ -890,9 +1194,4 @@ void sse_quantize_soft_6_10(int height, int width, float *psrc, float *pweight,
 //		__m128 sum_x1 = _mm_setzero_ps();
 //		__m128 sum_x2 = _mm_setzero_ps();
 //	}
-
-	aligned_free(indexes0);
-	aligned_free(indexes1);
-	aligned_free(vals0);
-	aligned_free(vals1);
 }
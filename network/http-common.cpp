@@ -275,24 +275,41 @@ void HttpStreamSplitter::process_line_buffer()
 
 void HttpRequestParser::parse(const std::string &request_str, SimpleHttpRequest &out_request) const
 {
-	std::vector<std::string> split_str = aifil::split_by_substr(request_str, " ");
-	if (split_str.size() < 2)
+	// only method, url and the last token are needed: walk tokens without copying
+	aifil::StringSlice method;
+	aifil::StringSlice url;
+	aifil::StringSlice last;
+	size_t tokens = 0;
+	for (const auto &token: aifil::split_slices_by_substr(request_str, " "))
+	{
+		if (tokens == 0)
+			method = token;
+		else if (tokens == 1)
+			url = token;
+		last = token;
+		++tokens;
+	}
+	if (tokens < 2)
 		af_exception("Invalid http header: " << request_str);
-	if (split_str[0] == "GET")
+	if (method == "GET")
 	{
 		out_request.method = SimpleHttpRequest::GET;
-		out_request.url = split_str[1];
+		out_request.url = url.str();
 		parse_url(out_request.url, out_request);
 	}
-	else if (split_str[0] == "POST")
+	else if (method == "POST")
 	{
 		out_request.method = SimpleHttpRequest::POST;
-		out_request.url = split_str[1];
+		out_request.url = url.str();
 		parse_url(out_request.url, out_request);
-		std::string last = *split_str.rbegin();
-		split_str = aifil::split_by_substr(last, "\r\n");
-		if (split_str.size() == 2)
-			parse_params(split_str[1], out_request.params);
+		aifil::SplitRange lines = aifil::split_slices_by_substr(last, "\r\n");
+		auto line = lines.begin();
+		if (line != lines.end() && ++line != lines.end())
+		{
+			aifil::StringSlice params = *line;
+			if (++line == lines.end())
+				parse_params(params.str(), out_request.params);
+		}
 	}
 }
 
@@ -2,9 +2,16 @@
 // Created by mar on 17.02.17.
 //
 #include "test-adjacency-matrix.h"
+#include "common/stringutils.hpp"
 #include <gflags/gflags.h>
 #include <gtest/gtest.h>
 
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
+
 
 using test_adjacency_matrix::MatrixAndExpValue;
 namespace test_adjacency_matrix
@@ -164,3 +171,189 @@ TEST_P(MatrixAdjacencyTest, TestOfRegexEqForPatterns)
 INSTANTIATE_TEST_CASE_P(
 		MatrixAdjacencyTest, MatrixAdjacencyTest,
 		testing::Range(0, int(test_adjacency_matrix::cases.size()) ));
+
+TEST(MatrixAdjacencyTest, SparseEqualsDense)
+{
+	std::vector<std::string> b = {"a", "b", "c", "d", "e"};
+	AdjacencyMatrix dense(b);
+	SparseAdjacencyMatrix sparse(b);
+	dense("a", "e") = 50;
+	dense("c", "c") = 30;
+	++dense("a", "a");
+	sparse("a", "e") = 50;
+	sparse("c", "c") = 30;
+	++sparse("a", "a");
+
+	EXPECT_TRUE(sparse.to_dense() == dense);
+	EXPECT_EQ(sparse.nonzeros(), 3u);
+
+	sparse.compress();
+	EXPECT_EQ(sparse.row_offsets().size(), b.size() + 1);
+	EXPECT_EQ(sparse.col_indices()[0], 0);
+	EXPECT_EQ(sparse.col_indices()[1], 4);
+	EXPECT_DOUBLE_EQ(sparse.sum_row(0), dense.sum_row(0));
+	EXPECT_DOUBLE_EQ(sparse.sum(), dense.sum());
+
+	AdjacencyMatrix sorted = dense;
+	sorted.sort();
+	EXPECT_TRUE(sorted == dense);
+	sorted += dense;
+	EXPECT_DOUBLE_EQ(sorted("a", "e"), 100);
+}
+
+TEST(MatrixAdjacencyTest, ResultEqualsPrintf)
+{
+	std::vector<std::string> b = {"a", "b", "c", "d", "e"};
+	AdjacencyMatrix matrix(b);
+	std::mt19937 rng(31);
+	std::uniform_real_distribution<double> weight(0, 1e9);
+	for (int i = 0; i < matrix.vertex_count(); ++i)
+		for (int j = 0; j < matrix.vertex_count(); ++j)
+			matrix.at(i, j) = weight(rng);
+
+	for (bool norm: {false, true})
+	{
+		std::string ref = "\t";
+		for (const std::string &name: b)
+			ref += name + "\t";
+		ref += "\n";
+		for (int i = 0; i < matrix.vertex_count(); ++i)
+		{
+			ref += b[i] + "\t";
+			double sum = 0;
+			for (int j = 0; j < matrix.vertex_count(); ++j)
+				sum += matrix.at(i, j);
+			for (int j = 0; j < matrix.vertex_count(); ++j)
+				ref += aifil::stdprintf("%.2lf\t", norm ? matrix.at(i, j) * 100 / sum : matrix.at(i, j));
+			ref += "\n";
+		}
+		EXPECT_EQ(matrix.result_to_string(norm), ref);
+	}
+}
+
+TEST(MatrixAdjacencyTest, CsvEqualsPrintfAndRoundTrips)
+{
+	std::vector<std::string> b = {"a", "b,c", "d\"e"};
+	AdjacencyMatrix matrix(b);
+	std::mt19937 rng(32);
+	std::uniform_real_distribution<double> weight(0, 1e6);
+	for (int i = 0; i < matrix.vertex_count(); ++i)
+		for (int j = 0; j < matrix.vertex_count(); ++j)
+			matrix.at(i, j) = weight(rng);
+
+	for (int precision: {0, 2, 7, 9})
+	{
+		std::ostringstream out;
+		matrix.write_csv(out, false, precision);
+		std::string ref = ",a,\"b,c\",\"d\"\"e\"\n";
+		for (int i = 0; i < matrix.vertex_count(); ++i)
+		{
+			ref += i == 0 ? "a" : i == 1 ? "\"b,c\"" : "\"d\"\"e\"";
+			for (int j = 0; j < matrix.vertex_count(); ++j)
+				ref += aifil::stdprintf(",%.*f", precision, matrix.at(i, j));
+			ref += "\n";
+		}
+		EXPECT_EQ(out.str(), ref) << "precision " << precision;
+	}
+
+	// values are read back to the written precision, fields from the right
+	// as names may hold separators
+	std::ostringstream out;
+	matrix.write_csv(out, false, 9);
+	std::istringstream in(out.str());
+	std::string line;
+	std::getline(in, line);
+	for (int i = 0; i < matrix.vertex_count(); ++i)
+	{
+		std::getline(in, line);
+		size_t pos = line.rfind(',', line.size());
+		for (int j = matrix.vertex_count() - 1; j >= 0; --j)
+		{
+			EXPECT_NEAR(std::stod(line.substr(pos + 1)), matrix.at(i, j), 1e-9);
+			line.erase(pos);
+			pos = line.rfind(',');
+		}
+	}
+}
+
+TEST(MatrixAdjacencyTest, StreamedResultEqualsPrintf)
+{
+	std::vector<std::string> b;
+	for (int i = 0; i < 12; ++i)
+		b.push_back(aifil::stdprintf("v%d", (i * 7) % 12));
+	AdjacencyMatrix matrix(b);
+	std::mt19937 rng(32);
+	std::uniform_real_distribution<double> weight(0, 1e4);
+	// the last row is empty
+	for (int i = 0; i + 1 < matrix.vertex_count(); ++i)
+		for (int j = 0; j < matrix.vertex_count(); ++j)
+			matrix.at(i, j) = rng() % 3 ? weight(rng) : 0;
+
+	for (bool sorted: {false, true})
+	{
+		if (sorted)
+			matrix.sort();
+		for (bool norm: {false, true})
+			for (int width: {0, 1, 5, 12})
+				for (int height: {0, 3, 12})
+				{
+					std::string ref = test_adjacency_matrix::printf_result(matrix, norm, width, height);
+					EXPECT_EQ(matrix.result_to_string(norm, width, height), ref)
+						<< norm << " " << width << "x" << height;
+					std::ostringstream out;
+					matrix.write_result(out, norm, width, height);
+					EXPECT_EQ(out.str(), ref);
+				}
+	}
+}
+
+TEST(MatrixAdjacencyTest, ShardedMergeEqualsSerialSum)
+{
+	std::vector<std::string> b;
+	for (int i = 0; i < 37; ++i)
+		b.push_back(aifil::stdprintf("v%d", i));
+	const int n = b.size();
+
+	// integer weights, so the sum does not depend on the order
+	std::mt19937 rng(32);
+	std::vector<int> truth(20000), detected(truth.size());
+	for (size_t i = 0; i < truth.size(); ++i)
+	{
+		truth[i] = int(rng() % n);
+		detected[i] = rng() % 4 ? truth[i] : int(rng() % n);
+	}
+	AdjacencyMatrix serial(b);
+	for (size_t i = 0; i < truth.size(); ++i)
+		serial.at(truth[i], detected[i]) += 1;
+
+	aifil::ThreadPool pool(4);
+	ShardedAdjacencyMatrix acc(b);
+	std::mutex threads_mutex;
+	std::set<std::thread::id> threads;
+	auto accumulate = [&] {
+		aifil::parallel_for(0, int(truth.size()), [&](int begin, int end) {
+			AdjacencyMatrix &m = acc.local();
+			EXPECT_EQ(&m, &acc.local());
+			for (int i = begin; i < end; ++i)
+				m.at(truth[i], detected[i]) += 1;
+			std::lock_guard<std::mutex> lock(threads_mutex);
+			threads.insert(std::this_thread::get_id());
+		}, 100, pool);
+	};
+
+	accumulate();
+	EXPECT_EQ(acc.shards_count(), int(threads.size()));
+	EXPECT_LE(acc.shards_count(), pool.size() + 1);
+	EXPECT_TRUE(acc.merge(pool) == serial);
+	// merge does not change shards
+	EXPECT_TRUE(acc.merge() == serial);
+
+	// reset() zeroes all shards and keeps them
+	int shards = acc.shards_count();
+	acc.reset();
+	EXPECT_EQ(acc.shards_count(), shards);
+	EXPECT_TRUE(acc.merge(pool) == AdjacencyMatrix(b));
+
+	accumulate();
+	EXPECT_TRUE(acc.merge(pool) == serial);
+}
@@ -6,6 +6,7 @@
 #define TEST_ADJACENCY_MATRIX_H
 
 #include "common/adjacency-matrix.h"
+#include "common/stringutils.hpp"
 #include <string>
 
 
@@ -28,6 +29,34 @@ namespace test_adjacency_matrix
 
 	void init_cases();
 
+	// result_to_string() as it was before streaming: one printf per cell
+	inline std::string printf_result(const AdjacencyMatrix &matrix, bool norm,
+			int width = 0, int height = 0)
+	{
+		int size = matrix.vertex_count();
+		if (width <= 0 || width > size)
+			width = size;
+		if (height <= 0 || height > size)
+			height = size;
+
+		std::string result = "\t";
+		for (int i = 0; i < size; ++i)
+			result += matrix.x_name(i) + "\t";
+		result += "\n";
+		for (int i = 0; i < height; ++i)
+		{
+			result += matrix.y_name(i) + "\t";
+			double sum = 0;
+			for (int j = 0; j < size; ++j)
+				sum += matrix.at(i, j);
+			for (int j = 0; j < width; ++j)
+				result += aifil::stdprintf("%.2lf\t",
+					norm ? (sum ? matrix.at(i, j) * 100 / sum : 0) : matrix.at(i, j));
+			result += "\n";
+		}
+		return result;
+	}
+
 }
 
 #endif //AIFIL_UTILS_TEST_ADJACENCY_MATRIX_H
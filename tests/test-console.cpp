@@ -0,0 +1,132 @@
+#include "common/console.hpp"
+
+#include <gtest/gtest.h>
+
+#include <limits.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+aifil::ArgParser parse(std::vector<const char*> args)
+{
+	args.insert(args.begin(), "prog");
+	aifil::ArgParser parser;
+	parser.parse_args(int(args.size()), const_cast<char**>(args.data()));
+	return parser;
+}
+
+size_t count_of(const std::string &text, char c)
+{
+	return size_t(std::count(text.begin(), text.end(), c));
+}
+
+// progress lines end with '\r' or '\n', previous unfinished output
+// is separated by a leading '\n'
+size_t progress_lines(const std::string &out)
+{
+	size_t separator = !out.empty() && out[0] == '\n';
+	return count_of(out, '\r') + count_of(out, '\n') - separator;
+}
+
+}  // namespace
+
+TEST(ConsoleTest, ArgParserGetters)
+{
+	aifil::ArgParser args = parse({"input.txt", "--name=abc", "-n", "42", "--neg=-7",
+		"--ratio", "0.5", "--exp=1e3", "--flag", "--off=no", "--empty=", "--text", "12abc"});
+
+	ASSERT_EQ(args.positional.size(), 1u);
+	EXPECT_EQ(args.positional[0], "input.txt");
+	EXPECT_TRUE(args.has_param("flag"));
+	EXPECT_FALSE(args.has_param("missing"));
+
+	EXPECT_EQ(args.get_string("name"), "abc");
+	EXPECT_EQ(args.get_string("missing", "default"), "default");
+	EXPECT_EQ(args.get_string("empty", "default"), "");
+
+	EXPECT_EQ(args.get_int("n", 0), 42);
+	EXPECT_EQ(args.get_int("neg", 0), -7);
+	EXPECT_EQ(args.get_int("missing", 5), 5);
+	EXPECT_EQ(args.get_int("empty", 5), 5);
+	EXPECT_EQ(args.get_int("text", 5), 5);
+	EXPECT_EQ(args.get_int("ratio", 5), 5);
+
+	EXPECT_DOUBLE_EQ(args.get_double("ratio", 0), 0.5);
+	EXPECT_DOUBLE_EQ(args.get_double("exp", 0), 1000);
+	EXPECT_DOUBLE_EQ(args.get_double("n", 0), 42);
+	EXPECT_DOUBLE_EQ(args.get_double("name", 2.5), 2.5);
+	EXPECT_DOUBLE_EQ(args.get_double("empty", 2.5), 2.5);
+
+	EXPECT_TRUE(args.get_bool("flag"));
+	EXPECT_FALSE(args.get_bool("off", true));
+	EXPECT_TRUE(args.get_bool("missing", true));
+	EXPECT_FALSE(args.get_bool("name", false));
+	EXPECT_TRUE(args.get_bool("name", true));
+	for (const char *value: {"1", "true", "yes", "on"})
+		EXPECT_TRUE(parse({"--b", value}).get_bool("b", false)) << value;
+	for (const char *value: {"0", "false", "no", "off"})
+		EXPECT_FALSE(parse({"--b", value}).get_bool("b", true)) << value;
+}
+
+TEST(ConsoleTest, ArgParserRejectsIntOverflow)
+{
+	aifil::ArgParser args = parse({"--max=2147483647", "--min=-2147483648",
+		"--above=2147483648", "--below=-2147483649",
+		"--long=99999999999", "--huge=999999999999999999999999", "--nhuge=-999999999999999999999999"});
+	EXPECT_EQ(args.get_int("max", 0), INT_MAX);
+	EXPECT_EQ(args.get_int("min", 0), INT_MIN);
+	for (const char *name: {"above", "below", "long", "huge", "nhuge"})
+		EXPECT_EQ(args.get_int(name, 17), 17) << name;
+}
+
+TEST(ConsoleTest, ProgressMeterIsThrottled)
+{
+	// the first update and the last one are printed within the long interval
+	testing::internal::CaptureStdout();
+	{
+		aifil::ProgressMeter meter(40000, "work", 3600 * 1000);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; ++t)
+			threads.emplace_back([&meter] {
+				for (int i = 0; i < 10000; ++i)
+					meter.add();
+			});
+		for (auto &thread: threads)
+			thread.join();
+		EXPECT_EQ(meter.done(), 40000);
+		meter.finish();
+		meter.finish();
+	}
+	std::string out = testing::internal::GetCapturedStdout();
+	EXPECT_LE(progress_lines(out), 3u) << out;
+	EXPECT_LE(count_of(out, '\n'), 2u) << out;
+	EXPECT_EQ(out[out.size() - 1], '\n');
+	EXPECT_NE(out.rfind("work: 100.00% (40000/40000)"), std::string::npos) << out;
+
+	// lines are not printed more often than the interval
+	testing::internal::CaptureStdout();
+	auto start = std::chrono::steady_clock::now();
+	{
+		aifil::ProgressMeter meter(0, "", 20);
+		for (int i = 0; i < 200; ++i)
+		{
+			meter.add(2);
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	double elapsed_ms = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+	out = testing::internal::GetCapturedStdout();
+	size_t lines = progress_lines(out);
+	EXPECT_GE(lines, 2u) << out;
+	EXPECT_LE(lines, size_t(elapsed_ms / 20) + 2) << out;
+	// the final line of unknown total is the value only
+	std::string text = out.substr(0, out.find_last_not_of("\r\n") + 1);
+	size_t last = text.rfind('\r');
+	EXPECT_EQ(text.compare(last == std::string::npos ? 0 : last + 1, 4, "400 "), 0) << out;
+}
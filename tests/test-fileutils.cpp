@@ -0,0 +1,313 @@
+#include "common/fileutils.hpp"
+#include "common/thread-pool.hpp"
+
+#include <gtest/gtest.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <list>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+// temporary directory removed with all content
+class TempDir
+{
+public:
+	TempDir()
+	{
+		namespace fs = boost::filesystem;
+		path = (fs::temp_directory_path() / fs::unique_path("aifil-test-%%%%-%%%%")).string();
+		aifil::makedirs(path);
+	}
+	~TempDir() { aifil::rmtree(path); }
+
+	TempDir(const TempDir&) = delete;
+	TempDir& operator=(const TempDir&) = delete;
+
+	std::string file(const std::string &name, const std::string &content = std::string()) const
+	{
+		std::string res = path + "/" + name;
+		aifil::makedirs(aifil::parent_path(res));
+		std::ofstream f(res, std::ios::binary);
+		f << content;
+		return res;
+	}
+
+	std::string path;
+};
+
+// old std::getline based line_count_in_file()
+std::vector<std::string> getline_lines(const std::string &file_name)
+{
+	std::ifstream f(file_name);
+	std::vector<std::string> res;
+	std::string line;
+	while (std::getline(f, line))
+		res.push_back(line);
+	return res;
+}
+
+std::vector<std::string> text_samples()
+{
+	std::vector<std::string> res = {
+		"",
+		"a",
+		"\n",
+		"a\n",
+		"\n\n\n",
+		"first\nsecond",
+		"shorter\nthan\nblock",
+		"crlf\r\nlines\r\n\r\nend",
+		"crlf\r\n",
+	};
+
+	// many lines of random length, also past the SIMD counters overflow
+	std::mt19937 rng(29);
+	std::uniform_int_distribution<int> len(0, 80);
+	for (size_t total: {15, 16, 17, 31, 32, 33, 1000, 100000})
+	{
+		std::string text;
+		while (text.size() < total)
+		{
+			text.append(len(rng), char('a' + rng() % 26));
+			text += rng() % 4 ? "\n" : "\r\n";
+		}
+		text.resize(total);
+		res.push_back(text);
+	}
+	return res;
+}
+
+}  // namespace
+
+TEST(FileUtilsTest, MappedFileMatchesContent)
+{
+	TempDir dir;
+	for (const std::string &text: text_samples())
+	{
+		std::string name = dir.file("text.txt", text);
+		aifil::MappedFile f(name);
+		ASSERT_TRUE(f.is_open());
+		ASSERT_EQ(f.size(), text.size());
+		EXPECT_EQ(f.slice().str(), text);
+		EXPECT_EQ(std::string(f.data(), f.size()), text);
+
+		f.close();
+		EXPECT_FALSE(f.is_open());
+		EXPECT_EQ(f.size(), 0u);
+		EXPECT_TRUE(f.slice().empty());
+		EXPECT_TRUE(f.open(name));
+		EXPECT_EQ(f.size(), text.size());
+	}
+
+	aifil::MappedFile missing;
+	EXPECT_FALSE(missing.open(dir.path + "/missing.txt"));
+	EXPECT_FALSE(missing.is_open());
+	EXPECT_FALSE(missing.open(dir.path));
+}
+
+TEST(FileUtilsTest, LineCountEqualsGetline)
+{
+	TempDir dir;
+	for (const std::string &text: text_samples())
+	{
+		std::string name = dir.file("text.txt", text);
+		size_t expected = getline_lines(name).size();
+		EXPECT_EQ(aifil::line_count_in_file(name), int(expected)) << text.size() << " bytes";
+		EXPECT_EQ(aifil::line_count(text.data(), text.size()), expected);
+	}
+	EXPECT_EQ(aifil::line_count_in_file(dir.path + "/missing.txt"), 0);
+}
+
+TEST(FileUtilsTest, SplitAtLinesJoinsBack)
+{
+	for (const std::string &text: text_samples())
+	{
+		size_t lines = aifil::line_count(text.data(), text.size());
+		// also more parts than lines
+		for (int count: {0, 1, 2, 3, 7, 64, int(lines) + 5})
+		{
+			std::vector<aifil::StringSlice> parts = aifil::split_at_lines(text, count);
+			EXPECT_LE(parts.size(), size_t(std::max(count, 1)));
+			EXPECT_EQ(parts.empty(), text.empty());
+
+			std::string joined;
+			for (size_t i = 0; i < parts.size(); ++i)
+			{
+				EXPECT_FALSE(parts[i].empty());
+				if (i + 1 < parts.size())
+				{
+					EXPECT_EQ(parts[i][parts[i].size() - 1], '\n');
+				}
+				// parts point into the text
+				EXPECT_EQ(parts[i].data(), text.data() + joined.size());
+				joined += parts[i].str();
+			}
+			EXPECT_EQ(joined, text) << text.size() << " bytes, " << count << " parts";
+		}
+	}
+}
+
+TEST(FileUtilsTest, ProcessFileEqualsGetline)
+{
+	TempDir dir;
+	for (const std::string &text: text_samples())
+	{
+		std::string name = dir.file("text.txt", text);
+		std::vector<std::string> expected = getline_lines(name);
+		for (int chunks: {0, 1, 3, int(expected.size()) + 5})
+		{
+			// every chunk is touched by one task only
+			std::vector<std::string> parts(chunks ? chunks : aifil::ThreadPool::global().size());
+			ASSERT_TRUE(aifil::process_file_chunks(name, chunks,
+				[&parts](int i, const aifil::StringSlice &chunk) { parts[i] = chunk.str(); }));
+			std::string joined;
+			for (const std::string &part: parts)
+				joined += part;
+			EXPECT_EQ(joined, text);
+
+			std::vector<std::vector<std::string>> lines(parts.size());
+			ASSERT_TRUE(aifil::process_file_lines(name, chunks,
+				[&lines](int i, const aifil::StringSlice &line) { lines[i].push_back(line.str()); }));
+			std::vector<std::string> flat;
+			for (const auto &chunk: lines)
+				flat.insert(flat.end(), chunk.begin(), chunk.end());
+			EXPECT_EQ(flat, expected) << text.size() << " bytes, " << chunks << " chunks";
+		}
+	}
+
+	EXPECT_FALSE(aifil::process_file_chunks(dir.path + "/missing.txt", 1,
+		[](int, const aifil::StringSlice&) {}));
+}
+
+namespace {
+
+typedef std::set<std::string> PathSet;
+
+// old ls_directory() built on boost iterators
+PathSet iterator_listing(const std::string &my_dir, aifil::PATH_TYPE path_types,
+		bool recursive, std::set<std::string> extensions)
+{
+	namespace fs = boost::filesystem;
+	std::set<std::string> exts;
+	for (std::string ext: extensions)
+	{
+		boost::algorithm::to_lower(ext);
+		exts.insert(ext.empty() || ext[0] == '.' ? ext : "." + ext);
+	}
+
+	PathSet res;
+	auto add = [&](const fs::path &p) {
+		if (fs::is_directory(p) && !(path_types & aifil::PATH_FOLDER))
+			return;
+		if (fs::is_symlink(p) && !(path_types & aifil::PATH_SYMLINK))
+			return;
+		if (fs::is_regular_file(p) && !(path_types & aifil::PATH_FILE))
+			return;
+		std::string ext = p.extension().string();
+		boost::algorithm::to_lower(ext);
+		if (!exts.empty() && !exts.count(ext))
+			return;
+		res.insert(p.generic_string());
+	};
+	if (recursive)
+		for (fs::recursive_directory_iterator it(my_dir); it != fs::recursive_directory_iterator(); ++it)
+			add(it->path());
+	else
+		for (fs::directory_iterator it(my_dir); it != fs::directory_iterator(); ++it)
+			add(it->path());
+	return res;
+}
+
+void make_tree(const TempDir &dir)
+{
+	for (const char *name: {"a.jpg", "b.JPG", "c.Jpg", "d.png", "noext", ".hidden",
+			"sub/e.jpg", "sub/f.jpeg", "sub/deep/g.txt", "sub/deep/h.PNG"})
+		dir.file(name);
+	aifil::makedirs(dir.path + "/empty");
+	// more entries than one walker batch
+	for (int i = 0; i < 300; ++i)
+		dir.file(aifil::stdprintf("many/%03d.%s", i, i % 3 ? "jpg" : "txt"));
+	// symlinked directories are listed but not followed
+	boost::filesystem::create_directory_symlink(dir.path + "/sub", dir.path + "/link");
+}
+
+}  // namespace
+
+TEST(FileUtilsTest, DirectoryListingsAgree)
+{
+	TempDir dir;
+	make_tree(dir);
+
+	const std::set<std::string> extension_sets[] = {
+		{}, {".jpg"}, {"jpg"}, {".JPG"}, {"Jpg", ".png"}, {""},
+	};
+	for (aifil::PATH_TYPE types: {aifil::PATH_ALL, aifil::PATH_FILE, aifil::PATH_FOLDER})
+		for (bool recursive: {false, true})
+			for (const auto &exts: extension_sets)
+			{
+				SCOPED_TRACE(testing::Message() << "types " << types
+					<< (recursive ? ", recursive" : "") << ", " << exts.size() << " extensions");
+				PathSet expected = iterator_listing(dir.path, types, recursive, exts);
+
+				std::list<std::string> listed = aifil::ls_directory(dir.path, types, recursive, exts);
+				EXPECT_EQ(listed.size(), expected.size());
+				EXPECT_EQ(PathSet(listed.begin(), listed.end()), expected);
+
+				std::list<std::string> sorted = aifil::ls_directory(dir.path, types, recursive, exts, true);
+				EXPECT_TRUE(std::is_sorted(sorted.begin(), sorted.end()));
+				EXPECT_EQ(PathSet(sorted.begin(), sorted.end()), expected);
+
+				PathSet walked;
+				aifil::scan_directory(dir.path, [&walked](const std::string &path) {
+					EXPECT_TRUE(walked.insert(path).second);
+					return true;
+				}, types, recursive, exts);
+				EXPECT_EQ(walked, expected);
+
+				// tiny queue makes the scanning threads wait for the consumer
+				for (size_t queue_limit: {size_t(1), size_t(4096)})
+				{
+					aifil::DirectoryScanner scanner(dir.path, types, recursive, exts, queue_limit, 2);
+					PathSet streamed;
+					std::string path;
+					while (scanner.next(path))
+						EXPECT_TRUE(streamed.insert(path).second);
+					EXPECT_EQ(streamed, expected);
+				}
+			}
+
+	// extension matching is case-insensitive and dot is optional
+	EXPECT_EQ(aifil::ls_directory(dir.path + "/many", {"JPG"}).size(), 200u);
+	EXPECT_EQ(aifil::ls_directory(dir.path, {".jpg"}, false).size(), 3u);
+	EXPECT_EQ(aifil::ls_directory(dir.path, {"png"}, true).size(), 2u);
+}
+
+TEST(FileUtilsTest, DirectoryScannerStops)
+{
+	TempDir dir;
+	make_tree(dir);
+
+	aifil::DirectoryScanner scanner(dir.path, aifil::PATH_ALL, true, {}, 1, 2);
+	std::string path;
+	for (int i = 0; i < 3; ++i)
+		EXPECT_TRUE(scanner.next(path));
+	scanner.stop();
+	EXPECT_FALSE(scanner.next(path));
+
+	// destructor stops blocked threads
+	{
+		aifil::DirectoryScanner abandoned(dir.path, aifil::PATH_ALL, true, {}, 1, 2);
+	}
+
+	aifil::DirectoryScanner missing(dir.path + "/missing");
+	EXPECT_FALSE(missing.next(path));
+	EXPECT_TRUE(aifil::ls_directory(dir.path + "/missing").empty());
+}
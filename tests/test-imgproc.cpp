@@ -0,0 +1,1151 @@
+//
+// imgproc kernels vs. OpenCV reference implementations.
+//
+#include "imgproc/histogram.hpp"
+#include "imgproc/imgproc.hpp"
+#include "imgproc/integral.hpp"
+#include "imgproc/parallel.hpp"
+#include "imgproc/pixel.hpp"
+#include "imgproc/scratch.hpp"
+
+#include <gtest/gtest.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <initializer_list>
+#include <limits>
+#include <vector>
+
+using namespace aifil;
+
+namespace {
+
+cv::Mat random_image(int rows, int cols, int type)
+{
+	cv::Mat m(rows, cols, type);
+	double max = CV_MAT_DEPTH(type) == CV_8U ? 256 : CV_MAT_DEPTH(type) == CV_16U ? 65536 : 1;
+	cv::randu(m, cv::Scalar(0), cv::Scalar(max));
+	return m;
+}
+
+// max absolute difference, both matrices as CV_64F
+double max_diff(const cv::Mat &a, const cv::Mat &b)
+{
+	cv::Mat a64, b64;
+	a.convertTo(a64, CV_64F);
+	b.convertTo(b64, CV_64F);
+	return cv::norm(a64, b64, cv::NORM_INF);
+}
+
+// imgproc thread count for a scope, the previous one is restored on exit
+// (also when an ASSERT_* returns early)
+class ThreadsGuard
+{
+public:
+	explicit ThreadsGuard(int threads) : saved(imgproc::threads())
+	{
+		imgproc::set_threads(threads);
+	}
+	~ThreadsGuard()
+	{
+		imgproc::set_threads(saved);
+	}
+
+private:
+	ThreadsGuard(const ThreadsGuard&) = delete;
+	ThreadsGuard &operator=(const ThreadsGuard&) = delete;
+
+	int saved;
+};
+
+// body(threads) run with every thread count
+template<typename Body>
+void for_threads(std::initializer_list<int> counts, Body body)
+{
+	for (int threads: counts)
+	{
+		ThreadsGuard guard(threads);
+		body(threads);
+	}
+}
+
+// single- and multi-threaded
+template<typename Body>
+void for_threads(Body body)
+{
+	for_threads({1, 4}, body);
+}
+
+// integer sums are exact, float ones differ by summation order of SIMD kernels
+void expect_integral_eq(const cv::Mat &src, const cv::Mat &sum, int sdepth)
+{
+	cv::Mat ref;
+	cv::integral(src, ref, CV_64F);
+	ASSERT_EQ(sum.rows, src.rows + 1);
+	ASSERT_EQ(sum.cols, src.cols + 1);
+	ASSERT_EQ(sum.type(), CV_MAKETYPE(sdepth, src.channels()));
+
+	double tolerance = 0;
+	if (sdepth == CV_32F || src.depth() == CV_32F)
+	{
+		cv::Mat ref_last = ref.row(ref.rows - 1);
+		double max = 0;
+		for (int i = 0; i < ref_last.cols * ref_last.channels(); ++i)
+			max = std::max(max, ref_last.at<double>(0, i));
+		tolerance = 1e-4 * max;
+	}
+	EXPECT_LE(max_diff(sum, ref), tolerance) << "depth " << src.depth() << ", sdepth " <<
+		sdepth << ", channels " << src.channels() << ", " << src.cols << "x" << src.rows;
+}
+
+}  // namespace
+
+TEST(IntegralTest, EqualsOpenCV)
+{
+	const int depths[][2] = {
+		{CV_8U, CV_32S}, {CV_8U, CV_32F}, {CV_8U, CV_64F},
+		{CV_16U, CV_32S}, {CV_16U, CV_32F}, {CV_16U, CV_64F},
+		{CV_32F, CV_32F}, {CV_32F, CV_64F}};
+	const int channels[] = {1, 2, 3, 4, 5, 10};
+	const cv::Size sizes[] = {cv::Size(1, 1), cv::Size(13, 7), cv::Size(33, 64), cv::Size(257, 100)};
+
+	ThreadPool pool(3);
+	for (const auto &d: depths)
+	{
+		for (int ch: channels)
+		{
+			for (const cv::Size &size: sizes)
+			{
+				cv::Mat src = random_image(size.height, size.width, CV_MAKETYPE(d[0], ch));
+				cv::Mat sum;
+				imgproc::integral(src, sum, d[1]);
+				expect_integral_eq(src, sum, d[1]);
+
+				cv::Mat sum_parallel;
+				imgproc::integral_parallel(src, sum_parallel, d[1], pool);
+				expect_integral_eq(src, sum_parallel, d[1]);
+			}
+		}
+	}
+}
+
+TEST(IntegralTest, RegionOfInterest)
+{
+	cv::Mat image = random_image(120, 90, CV_8UC3);
+	cv::Mat roi = image(cv::Rect(5, 3, 71, 100));
+	ASSERT_FALSE(roi.isContinuous());
+
+	cv::Mat sum;
+	imgproc::integral(roi, sum);
+	expect_integral_eq(roi, sum, CV_32S);
+
+	ThreadPool pool(2);
+	imgproc::integral_parallel(roi, sum, -1, pool);
+	expect_integral_eq(roi, sum, CV_32S);
+}
+
+TEST(IntegralTest, IntegrateKeepsDepths)
+{
+	cv::Mat src8 = random_image(40, 30, CV_8UC(10));
+	cv::Mat src32 = random_image(40, 30, CV_32FC(10));
+	cv::Mat sum;
+	imgproc::integrate(src8, sum);
+	expect_integral_eq(src8, sum, CV_32S);
+	imgproc::integrate(src32, sum);
+	expect_integral_eq(src32, sum, CV_64F);
+}
+
+TEST(IntegralImageTest, BandIsComputedIncrementally)
+{
+	cv::Mat src = random_image(90, 120, CV_8UC(10));
+	cv::Rect roi(7, 11, 100, 60);
+	imgproc::IntegralImage ii;
+	ii.reset(src, roi);
+	EXPECT_EQ(ii.rows_ready(), 0);
+	ii.update(roi.y + 25);
+	EXPECT_EQ(ii.rows_ready(), 25);
+	ii.update(1000);
+	EXPECT_EQ(ii.rows_ready(), roi.height);
+	expect_integral_eq(src(roi), ii.sum(), CV_32S);
+
+	// smaller band reuses buffer
+	const uint8_t *data = ii.sum().data;
+	ii.compute(src, cv::Rect(0, 0, 50, 40));
+	EXPECT_EQ(ii.sum().data, data);
+	expect_integral_eq(src(cv::Rect(0, 0, 50, 40)), ii.sum(), CV_32S);
+}
+
+TEST(IntegralImageTest, BoxSums)
+{
+	cv::Mat src = random_image(64, 80, CV_8UC3);
+	cv::Mat src32f = random_image(64, 80, CV_32FC3);
+	std::vector<cv::Rect> boxes;
+	for (int i = 0; i < 21; ++i)
+		boxes.push_back(cv::Rect(i % 5, i % 7, 1 + i % 11, 1 + i % 13));
+
+	imgproc::IntegralImage ii, ii32f, ii64f;
+	ii.compute(src, cv::Rect(2, 3, 70, 60));
+	ii32f.compute(src32f, cv::Rect(2, 3, 70, 60), CV_32F);
+	ii64f.compute(src32f, cv::Rect(2, 3, 70, 60), CV_64F);
+
+	const int channel = 1;
+	std::vector<int> offsets(boxes.size() * 4);
+	ii.box_offsets(boxes.data(), int(boxes.size()), channel, offsets.data());
+	std::vector<int> offsets32f(boxes.size() * 4), offsets64f(boxes.size() * 4);
+	ii32f.box_offsets(boxes.data(), int(boxes.size()), channel, offsets32f.data());
+	ii64f.box_offsets(boxes.data(), int(boxes.size()), channel, offsets64f.data());
+
+	const cv::Point windows[] = {cv::Point(2, 3), cv::Point(10, 20), cv::Point(50, 40)};
+	for (const cv::Point &w: windows)
+	{
+		std::vector<int> sums(boxes.size());
+		std::vector<float> sums32f(boxes.size());
+		std::vector<double> sums64f(boxes.size());
+		ii.box_sums(offsets.data(), int(boxes.size()), ii.offset(w.x, w.y), sums.data());
+		ii32f.box_sums(offsets32f.data(), int(boxes.size()), ii32f.offset(w.x, w.y), sums32f.data());
+		ii64f.box_sums(offsets64f.data(), int(boxes.size()), ii64f.offset(w.x, w.y), sums64f.data());
+		for (size_t i = 0; i < boxes.size(); ++i)
+		{
+			cv::Rect box(boxes[i].x + w.x, boxes[i].y + w.y, boxes[i].width, boxes[i].height);
+			double ref = 0, ref32f = 0;
+			for (int y = box.y; y < box.y + box.height; ++y)
+				for (int x = box.x; x < box.x + box.width; ++x)
+				{
+					ref += src.ptr<uint8_t>(y)[x * 3 + channel];
+					ref32f += src32f.ptr<float>(y)[x * 3 + channel];
+				}
+			EXPECT_EQ(sums[i], int(ref));
+			EXPECT_EQ(ii.box_sum(box, channel), ref);
+			EXPECT_NEAR(sums32f[i], ref32f, 1e-3);
+			EXPECT_NEAR(sums64f[i], ref32f, 1e-9);
+		}
+	}
+}
+
+TEST(ParallelTest, RowsAndTilesCoverImageOnce)
+{
+	ThreadsGuard guard(4);
+	EXPECT_EQ(imgproc::threads(), 4);
+
+	std::vector<std::atomic<int> > rows(1000);
+	for (auto &r: rows)
+		r = 0;
+	imgproc::parallel_rows(int(rows.size()), [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+			++rows[i];
+	});
+	for (auto &r: rows)
+		EXPECT_EQ(r, 1);
+
+	cv::Mat hits = cv::Mat::zeros(100, 70, CV_32SC1);
+	imgproc::parallel_tiles(hits.size(), cv::Size(16, 16), 2, [&](const imgproc::Tile &t) {
+		EXPECT_EQ(t.halo.x, std::max(0, t.rect.x - 2));
+		EXPECT_EQ(t.halo.y, std::max(0, t.rect.y - 2));
+		EXPECT_EQ(t.halo.x + t.halo.width, std::min(70, t.rect.x + t.rect.width + 2));
+		EXPECT_EQ(t.halo.y + t.halo.height, std::min(100, t.rect.y + t.rect.height + 2));
+		for (int y = t.rect.y; y < t.rect.y + t.rect.height; ++y)
+			for (int x = t.rect.x; x < t.rect.x + t.rect.width; ++x)
+				++hits.at<int>(y, x);
+	});
+	for (int y = 0; y < hits.rows; ++y)
+		for (int x = 0; x < hits.cols; ++x)
+			EXPECT_EQ(hits.at<int>(y, x), 1);
+
+}
+
+TEST(ParallelTest, SameResultAsSingleThreaded)
+{
+	cv::Mat angle = random_image(300, 200, CV_32FC1);
+	cv::Mat magnitude = random_image(300, 200, CV_32FC1);
+	cv::Mat single = cv::Mat::zeros(300, 200, CV_32FC(10));
+	cv::Mat multi = cv::Mat::zeros(300, 200, CV_32FC(10));
+
+	for_threads([&](int threads) {
+		imgproc::quantize_soft_32f(angle, magnitude, threads == 1 ? single : multi, 9, 0, 0, 1);
+	});
+	EXPECT_EQ(max_diff(single, multi), 0);
+}
+
+namespace {
+
+// straightforward per-pixel version of hog_classic() in double precision
+cv::Mat hog_reference(const cv::Mat &angle, const cv::Mat &magnitude,
+	int nbins, int cell_w, int cell_h)
+{
+	const int drows = angle.rows / cell_h;
+	const int dcols = angle.cols / cell_w;
+	const int cnbins = nbins * 2;
+	std::vector<double> cells(drows * dcols * cnbins, 0.0);
+	for (int y = 0; y < drows * cell_h; ++y)
+	{
+		for (int x = 0; x < dcols * cell_w; ++x)
+		{
+			double agv = angle.at<float>(y, x) * cnbins / 360.0;
+			int ag0 = int(agv) % cnbins;
+			int ag1 = (ag0 + 1) % cnbins;
+			double agr = agv - int(agv);
+			double mgv = magnitude.at<float>(y, x) / 255.0;
+			double yp = (y + 0.5) / cell_h - 0.5;
+			double xp = (x + 0.5) / cell_w - 0.5;
+			int iy = int(std::floor(yp));
+			int ix = int(std::floor(xp));
+			for (int cy = iy; cy <= iy + 1; ++cy)
+			{
+				for (int cx = ix; cx <= ix + 1; ++cx)
+				{
+					if (cy < 0 || cy >= drows || cx < 0 || cx >= dcols)
+						continue;
+					double w = (1.0 - std::abs(yp - cy)) * (1.0 - std::abs(xp - cx)) * mgv;
+					double *h = &cells[(cy * dcols + cx) * cnbins];
+					h[ag0] += w * (1.0 - agr);
+					h[ag1] += w * agr;
+				}
+			}
+		}
+	}
+
+	auto cell = [&](int row, int col) {
+		row = std::min(std::max(row, 0), drows - 1);
+		col = std::min(std::max(col, 0), dcols - 1);
+		return &cells[(row * dcols + col) * cnbins];
+	};
+	auto energy = [&](int row, int col) {
+		const double *h = cell(row, col);
+		double e = 0;
+		for (int k = 0; k < nbins; ++k)
+			e += (h[k] + h[k + nbins]) * (h[k] + h[k + nbins]);
+		return e;
+	};
+
+	cv::Mat dst = cv::Mat::zeros(drows, dcols, CV_32FC(3 * nbins + 4));
+	const int dy[4] = { 1, -1, 1, -1 };
+	const int dx[4] = { 1, 1, -1, -1 };
+	for (int row = 0; row < drows; ++row)
+	{
+		for (int col = 0; col < dcols; ++col)
+		{
+			const double *h = cell(row, col);
+			float *d = dst.ptr<float>(row) + col * dst.channels();
+			for (int idx = 0; idx < 4; ++idx)
+			{
+				double norm = 1.0 / std::sqrt(0.0001 + energy(row, col) +
+					energy(row, col + dx[idx]) + energy(row + dy[idx], col) +
+					energy(row + dy[idx], col + dx[idx]));
+				double texture = 0;
+				for (int k = 0; k < cnbins; ++k)
+				{
+					double v = 0.5 * std::min(h[k] * norm, 0.2);
+					d[4 + nbins + k] += float(v);
+					texture += v;
+				}
+				d[idx] = float(0.2357 * texture);
+				for (int k = 0; k < nbins; ++k)
+					d[4 + k] += float(0.5 * std::min((h[k] + h[k + nbins]) * norm, 0.2));
+			}
+		}
+	}
+	return dst;
+}
+
+}  // namespace
+
+TEST(HogTest, ClassicEqualsReference)
+{
+	const int nbins = 9;
+	struct { int rows, cols, cell_w, cell_h; } cases[] = {
+		{ 64, 64, 8, 8 },
+		{ 77, 131, 8, 6 },   // not a whole number of cells, non-square cells
+		{ 40, 9, 4, 5 },     // single column of cells after trimming
+		{ 300, 200, 6, 8 },  // enough cell rows for several bands
+	};
+	for (auto &c: cases)
+	{
+		cv::Mat angle(c.rows, c.cols, CV_32FC1);
+		cv::Mat magnitude(c.rows, c.cols, CV_32FC1);
+		cv::randu(angle, cv::Scalar(0), cv::Scalar(360));
+		cv::randu(magnitude, cv::Scalar(0), cv::Scalar(255));
+		cv::Mat ref = hog_reference(angle, magnitude, nbins, c.cell_w, c.cell_h);
+
+		for_threads([&](int threads) {
+			cv::Mat dst(c.rows / c.cell_h, c.cols / c.cell_w, CV_32FC(3 * nbins + 4));
+			cv::Mat cn, ca;
+			imgproc::hog_classic(angle, magnitude, dst, nbins, c.cell_w, c.cell_h, cn, ca);
+			EXPECT_LE(max_diff(dst, ref), 1e-4) << c.cols << "x" << c.rows <<
+				", cell " << c.cell_w << "x" << c.cell_h << ", threads " << threads;
+		});
+	}
+}
+
+TEST(HogTest, KernelEqualsReference)
+{
+	const int nbins = 9;
+	const int ksize = 5;
+	cv::Mat angle(90, 123, CV_32FC1);
+	cv::Mat magnitude(90, 123, CV_32FC1);
+	cv::randu(angle, cv::Scalar(0), cv::Scalar(180));
+	cv::randu(magnitude, cv::Scalar(0), cv::Scalar(255));
+
+	//5x5 Gaussian window with sigma 2.5 at the top-left corner of each output pixel
+	double kernel[ksize][ksize];
+	double ksum = 0;
+	for (int y = 0; y < ksize; ++y)
+		for (int x = 0; x < ksize; ++x)
+			ksum += kernel[y][x] = std::exp(-((x - 2) * (x - 2) + (y - 2) * (y - 2)) / 12.5);
+
+	const int start_ch = 2;
+	cv::Mat ref = cv::Mat::zeros(angle.rows - ksize, angle.cols - ksize, CV_32FC(nbins + start_ch));
+	for (int row = 0; row < ref.rows; ++row)
+	{
+		for (int col = 0; col < ref.cols; ++col)
+		{
+			double hist[nbins] = { 0 };
+			for (int y = 0; y < ksize; ++y)
+			{
+				for (int x = 0; x < ksize; ++x)
+				{
+					double binf = angle.at<float>(row + y, col + x) * nbins / 180.0;
+					int bin = int(binf) % nbins;
+					double w = magnitude.at<float>(row + y, col + x) * kernel[y][x] / ksum;
+					hist[bin] += w * (1.0 - (binf - int(binf)));
+					hist[(bin + 1) % nbins] += w * (binf - int(binf));
+				}
+			}
+			for (int b = 0; b < nbins; ++b)
+				ref.ptr<float>(row)[col * ref.channels() + start_ch + b] = float(hist[b]);
+		}
+	}
+
+	for_threads([&](int threads) {
+		cv::Mat dst = cv::Mat::zeros(ref.rows, ref.cols, ref.type());
+		imgproc::hog_kernel(angle, magnitude, dst, start_ch);
+		EXPECT_LE(max_diff(dst, ref), 1e-3) << "threads " << threads;
+	});
+}
+
+TEST(GradientTest, FusedEqualsSobel)
+{
+	for (int type: { CV_32FC1, CV_32FC3, CV_8UC1, CV_8UC3 })
+	{
+		cv::Mat src = random_image(67, 93, type);
+		cv::Mat src32f, sdx, sdy;
+		src.convertTo(src32f, CV_32F);
+		cv::Sobel(src32f, sdx, -1, 1, 0, 3);
+		cv::Sobel(src32f, sdy, -1, 0, 1, 3);
+
+		for_threads([&](int) {
+			cv::Mat angle, magnitude, dx, dy;
+			imgproc::gradient_fused(src, angle, magnitude, &dx, &dy);
+			EXPECT_LE(max_diff(dx, sdx), 1e-3);
+			EXPECT_LE(max_diff(dy, sdy), 1e-3);
+
+			//single channel output takes the strongest source channel
+			const int ch = src.channels();
+			ASSERT_EQ(angle.type(), CV_32FC1);
+			for (int y = 0; y < src.rows; ++y)
+			{
+				for (int x = 0; x < src.cols; ++x)
+				{
+					const float *px = sdx.ptr<float>(y) + x * ch;
+					const float *py = sdy.ptr<float>(y) + x * ch;
+					int best = 0;
+					for (int c = 1; c < ch; ++c)
+						if (px[c] * px[c] + py[c] * py[c] > px[best] * px[best] + py[best] * py[best])
+							best = c;
+					float mag = std::sqrt(px[best] * px[best] + py[best] * py[best]);
+					float ang = cv::fastAtan2(py[best], px[best]);
+					if (ang >= 180.0f)
+						ang -= 180.0f;
+					EXPECT_NEAR(magnitude.at<float>(y, x), mag, 1e-3f * std::max(1.0f, mag));
+					//0 and 180 degrees are the same direction
+					float da = std::abs(angle.at<float>(y, x) - ang);
+					if (mag > 1e-3f)
+					{
+						EXPECT_LE(std::min(da, 180.0f - da), 0.05f) << x << ", " << y;
+					}
+				}
+			}
+		});
+	}
+}
+
+TEST(GradientTest, Gradient2EqualsReference)
+{
+	for (int type: { CV_8UC1, CV_8UC3 })
+	{
+		cv::Mat src = random_image(61, 131, type);
+		const int ch = src.channels();
+		for (int threshold: { -1, 0, 40, 255 })
+		{
+			//largest of 4 opposite neighbours differences, the first one on equality
+			cv::Mat ref_angle = cv::Mat::zeros(src.size(), CV_8UC1);
+			cv::Mat ref_mag = cv::Mat::zeros(src.size(), CV_8UC1);
+			const int dy[4] = { 0, 1, 1, 1 };
+			const int dx[4] = { 1, 1, 0, -1 };
+			for (int y = 1; y < src.rows - 1; ++y)
+			{
+				for (int x = 1; x < src.cols - 1; ++x)
+				{
+					int max_diff = threshold;
+					for (int i = 0; i < 4; ++i)
+					{
+						const uint8_t *a = src.ptr<uint8_t>(y + dy[i]) + (x + dx[i]) * ch;
+						const uint8_t *b = src.ptr<uint8_t>(y - dy[i]) + (x - dx[i]) * ch;
+						int diff = 0;
+						for (int c = 0; c < ch; ++c)
+							diff = std::max(diff, std::abs(a[c] - b[c]));
+						if (diff > max_diff)
+						{
+							max_diff = diff;
+							ref_angle.at<uint8_t>(y, x) = uint8_t(i + 1);
+							ref_mag.at<uint8_t>(y, x) = uint8_t(diff);
+						}
+					}
+				}
+			}
+
+			for_threads([&](int threads) {
+				cv::Mat angle, magnitude;
+				imgproc::gradient2(src, angle, magnitude, threshold);
+				EXPECT_EQ(max_diff(angle, ref_angle), 0) << "channels " << ch <<
+					", threshold " << threshold << ", threads " << threads;
+				EXPECT_EQ(max_diff(magnitude, ref_mag), 0) << "channels " << ch <<
+					", threshold " << threshold << ", threads " << threads;
+			});
+		}
+	}
+}
+
+TEST(CornersTest, StrongestLocalMaximaOfReference)
+{
+	cv::Mat dx = random_image(97, 143, CV_8UC1);
+	cv::Mat dy = random_image(97, 143, CV_8UC1);
+	const int block_size = 5;
+	const int half = block_size / 2;
+	const int nms_cell = 8;
+	const int max_corners = 50;
+
+	for (int metric: { imgproc::CORNER_HARRIS, imgproc::CORNER_SHI_TOMASI })
+	{
+		//direct mean of the clipped window
+		cv::Mat ref(dx.size(), CV_64FC1);
+		for (int y = 0; y < dx.rows; ++y)
+		{
+			for (int x = 0; x < dx.cols; ++x)
+			{
+				double a = 0, b = 0, c = 0;
+				int n = 0;
+				for (int j = std::max(0, y - half); j <= std::min(dx.rows - 1, y + half); ++j)
+				{
+					for (int i = std::max(0, x - half); i <= std::min(dx.cols - 1, x + half); ++i, ++n)
+					{
+						double gx = dx.at<uint8_t>(j, i);
+						double gy = dy.at<uint8_t>(j, i);
+						a += gx * gx;
+						b += gx * gy;
+						c += gy * gy;
+					}
+				}
+				a /= n;
+				b /= n;
+				c /= n;
+				ref.at<double>(y, x) = metric == imgproc::CORNER_HARRIS ?
+					(a * c - b * b) - 0.04 * (a + c) * (a + c) :
+					(a + c) * 0.5 - std::sqrt(b * b + (a - c) * (a - c) * 0.25);
+			}
+		}
+
+		std::vector<imgproc::Corner> single, multi;
+		for_threads([&](int threads) {
+			imgproc::corners(dx, dy, threads == 1 ? single : multi, block_size, max_corners, 0,
+				imgproc::CORNER_METRIC(metric), 0.04, nms_cell);
+		});
+
+		ASSERT_EQ(single.size(), multi.size());
+		ASSERT_GT(single.size(), 0u);
+		EXPECT_LE(int(single.size()), max_corners);
+		std::vector<int> cells;
+		for (size_t k = 0; k < single.size(); ++k)
+		{
+			const imgproc::Corner &c = single[k];
+			EXPECT_EQ(c.pt, multi[k].pt);
+			EXPECT_EQ(c.response, multi[k].response);
+			if (k)
+			{
+				EXPECT_GE(single[k - 1].response, c.response);
+			}
+
+			double r = ref.at<double>(c.pt);
+			double tolerance = 1e-5 * std::max(1.0, std::abs(r));
+			EXPECT_NEAR(c.response, r, tolerance);
+			for (int j = std::max(0, c.pt.y - 1); j <= std::min(dx.rows - 1, c.pt.y + 1); ++j)
+				for (int i = std::max(0, c.pt.x - 1); i <= std::min(dx.cols - 1, c.pt.x + 1); ++i)
+					EXPECT_LE(ref.at<double>(j, i), r + tolerance);
+			cells.push_back((c.pt.y / nms_cell) * 1000 + c.pt.x / nms_cell);
+		}
+		std::sort(cells.begin(), cells.end());
+		EXPECT_TRUE(std::unique(cells.begin(), cells.end()) == cells.end());
+
+		//the global maximum is always a corner
+		double max_ref = 0;
+		cv::minMaxLoc(ref, 0, &max_ref);
+		EXPECT_NEAR(single[0].response, max_ref, 1e-5 * std::abs(max_ref));
+	}
+}
+
+TEST(CornersTest, EvenBlockSizeIsAnchoredLikeOpenCV)
+{
+	cv::Mat dx = random_image(31, 37, CV_8UC1);
+	cv::Mat dy = random_image(31, 37, CV_8UC1);
+	const int block_size = 4;
+	std::vector<imgproc::Corner> corners;
+	imgproc::corners(dx, dy, corners, block_size, 0, 0, imgproc::CORNER_HARRIS, 0.04, 4);
+	ASSERT_GT(corners.size(), 0u);
+
+	//block_size / 2 pixels before the center, one less after it
+	for (const imgproc::Corner &c: corners)
+	{
+		double a = 0, b = 0, s = 0;
+		int n = 0;
+		for (int j = std::max(0, c.pt.y - 2); j <= std::min(dx.rows - 1, c.pt.y + 1); ++j)
+			for (int i = std::max(0, c.pt.x - 2); i <= std::min(dx.cols - 1, c.pt.x + 1); ++i, ++n)
+			{
+				double gx = dx.at<uint8_t>(j, i);
+				double gy = dy.at<uint8_t>(j, i);
+				a += gx * gx;
+				b += gx * gy;
+				s += gy * gy;
+			}
+		a /= n;
+		b /= n;
+		s /= n;
+		double r = (a * s - b * b) - 0.04 * (a + s) * (a + s);
+		EXPECT_NEAR(c.response, r, 1e-5 * std::max(1.0, std::abs(r))) << c.pt;
+	}
+}
+
+TEST(HistogramTest, AllChannelsEqualReference)
+{
+	struct { int type; int nbins; double min, max; } cases[] = {
+		{ CV_8UC3, 256, 0, 256 },
+		{ CV_8UC3, 7, 10, 200 },
+		{ CV_16UC2, 100, 1000, 60000 },
+		{ CV_32FC1, 13, 0.1, 0.9 },
+	};
+	for (auto &c: cases)
+	{
+		cv::Mat src = random_image(211, 157, c.type);
+		if (src.depth() == CV_32F)
+			src.at<float>(3, 5) = std::numeric_limits<float>::quiet_NaN();
+		const int ch = src.channels();
+
+		std::vector<std::vector<int> > ref(ch, std::vector<int>(c.nbins, 0));
+		cv::Mat src64;
+		src.convertTo(src64, CV_64F);
+		for (int y = 0; y < src.rows; ++y)
+		{
+			for (int x = 0; x < src.cols * ch; ++x)
+			{
+				double bin = (src64.ptr<double>(y)[x] - c.min) * (c.nbins / (c.max - c.min));
+				if (bin >= 0 && bin < c.nbins)
+					++ref[x % ch][int(bin)];
+			}
+		}
+
+		for_threads([&](int threads) {
+			std::vector<std::vector<int> > hists;
+			imgproc::histograms(src, hists, c.nbins, c.min, c.max);
+			EXPECT_EQ(hists, ref) << "type " << c.type << ", threads " << threads;
+
+			std::vector<int> hist;
+			imgproc::histogram_channel(src, hist, c.nbins, c.min, c.max, ch - 1);
+			EXPECT_EQ(hist, ref[ch - 1]);
+		});
+	}
+}
+
+TEST(HistogramTest, LocalWindowIsMirrored)
+{
+	cv::Mat src = random_image(40, 30, CV_8UC1);
+	const cv::Rect windows[] = {
+		cv::Rect(5, 5, 9, 9), cv::Rect(-4, -3, 9, 9), cv::Rect(25, 35, 9, 9), cv::Rect(0, 0, 30, 40)
+	};
+	auto mirror = [](int i, int size) { return i < 0 ? -i - 1 : (i >= size ? 2 * size - 1 - i : i); };
+	for (const cv::Rect &w: windows)
+	{
+		std::vector<int> ref(256, 0);
+		for (int y = w.y; y < w.y + w.height; ++y)
+			for (int x = w.x; x < w.x + w.width; ++x)
+				++ref[src.at<uint8_t>(mirror(y, src.rows), mirror(x, src.cols))];
+
+		std::vector<std::vector<int> > hists;
+		imgproc::histogram_local(src, hists, w);
+		ASSERT_EQ(hists.size(), 1u);
+		EXPECT_EQ(hists[0], ref) << w.x << ", " << w.y;
+	}
+}
+
+TEST(ContrastTest, AdaptiveEqualizationEqualsReference)
+{
+	cv::Mat noise = random_image(37, 29, CV_8UC1);
+	// ramp puts far columns in other coarse bins, their fine bins go stale
+	cv::Mat ramp(noise.size(), CV_8UC1);
+	for (int y = 0; y < ramp.rows; ++y)
+		for (int x = 0; x < ramp.cols; ++x)
+			ramp.at<uint8_t>(y, x) = uint8_t(x * 8 + noise.at<uint8_t>(y, x) % 8);
+	auto mirror = [](int i, int size) { return i < 0 ? -i - 1 : (i >= size ? 2 * size - 1 - i : i); };
+	for (const cv::Mat &src: {noise, ramp})
+	for (int window: {9, 8, 1, 23})
+	{
+		cv::Mat ref(src.size(), CV_8UC1);
+		for (int y = 0; y < src.rows; ++y)
+			for (int x = 0; x < src.cols; ++x)
+			{
+				const int v = src.at<uint8_t>(y, x);
+				int rank = 0;
+				for (int i = y - window / 2; i < y - window / 2 + window; ++i)
+					for (int j = x - window / 2; j < x - window / 2 + window; ++j)
+						rank += src.at<uint8_t>(mirror(i, src.rows), mirror(j, src.cols)) <= v;
+				ref.at<uint8_t>(y, x) = to_uint8_t(255.0f / (float(window) * window) * rank);
+			}
+
+		for_threads({1, 3}, [&](int threads) {
+			cv::Mat dst;
+			imgproc::contrast_adaptive_equalization(src, dst, window);
+			EXPECT_EQ(max_diff(dst, ref), 0) << "window " << window << ", threads " << threads;
+		});
+	}
+}
+
+TEST(ContrastTest, SingleTileClaheIsHistogramEqualization)
+{
+	cv::Mat src = random_image(40, 30, CV_8UC1);
+	cv::Mat ref;
+	imgproc::contrast_histogram_equalize(src, ref);
+
+	// no clipping with maxval above any bin
+	cv::Mat dst;
+	imgproc::contrast_limit_adaptive_equalization(src, dst, 40, 40 * 40);
+	EXPECT_LE(max_diff(dst, ref), 1);
+
+	// clipping at one pixel per bin flattens the histogram, mapping is near identity
+	imgproc::contrast_limit_adaptive_equalization(src, dst, 40, 2);
+	EXPECT_LE(max_diff(dst, src), 2);
+}
+
+TEST(MedianTest, EqualsSortedWindow)
+{
+	struct Case { int type; cv::Size window; cv::BorderTypes border; cv::Size image; };
+	const Case cases[] = {
+		{ CV_8UC1, cv::Size(5, 5), cv::BORDER_WRAP, cv::Size(38, 45) },
+		{ CV_8UC3, cv::Size(3, 7), cv::BORDER_REFLECT_101, cv::Size(38, 45) },
+		{ CV_16UC1, cv::Size(9, 3), cv::BORDER_REPLICATE, cv::Size(38, 45) },
+		{ CV_32FC1, cv::Size(7, 5), cv::BORDER_REFLECT, cv::Size(38, 45) },
+		{ CV_32FC1, cv::Size(1, 1), cv::BORDER_WRAP, cv::Size(38, 45) },
+		{ CV_32FC1, cv::Size(41, 61), cv::BORDER_REFLECT, cv::Size(38, 45) },
+		// more than 65536 distinct values
+		{ CV_32FC1, cv::Size(3, 5), cv::BORDER_REPLICATE, cv::Size(320, 240) },
+	};
+	for (const Case &c: cases)
+	{
+		cv::Mat src = random_image(c.image.height, c.image.width, c.type);
+		if (c.type == CV_16UC1)
+			src.convertTo(src, c.type, 1.0 / 64);  // repeated values
+		const int ch = src.channels();
+		cv::Mat expsrc;
+		cv::copyMakeBorder(src, expsrc, c.window.height / 2, c.window.height / 2,
+			c.window.width / 2, c.window.width / 2, c.border);
+		expsrc.convertTo(expsrc, CV_MAKETYPE(CV_64F, ch));
+
+		cv::Mat ref(src.size(), CV_MAKETYPE(CV_64F, ch));
+		std::vector<double> window;
+		for (int y = 0; y < src.rows; ++y)
+			for (int x = 0; x < src.cols * ch; ++x)
+			{
+				window.clear();
+				for (int i = 0; i < c.window.height; ++i)
+					for (int j = 0; j < c.window.width; ++j)
+						window.push_back(expsrc.ptr<double>(y + i)[x + j * ch]);
+				std::nth_element(window.begin(), window.begin() + window.size() / 2, window.end());
+				ref.ptr<double>(y)[x] = window[window.size() / 2];
+			}
+
+		for_threads([&](int threads) {
+			cv::Mat dst = imgproc::filter_median(src, c.window, c.border);
+			ASSERT_EQ(dst.type(), src.type());
+			EXPECT_EQ(max_diff(dst, ref), 0) << "type " << c.type << ", threads " << threads;
+		});
+
+		if (ch == 1)
+		{
+			cv::Mat_<float> adaptive = imgproc::filter_adaptive_median(src, c.window, c.border);
+			cv::Mat src64;
+			src.convertTo(src64, CV_64F);
+			double err = 0;
+			for (int y = 0; y < src.rows; ++y)
+				for (int x = 0; x < src.cols; ++x)
+					err = std::max(err, std::fabs(adaptive(y, x) -
+						(src64.at<double>(y, x) - ref.at<double>(y, x))));
+			EXPECT_LE(err, 1e-6);
+		}
+	}
+}
+
+TEST(ConvolutionTest, KernelsEqualWrapper)
+{
+	cv::Mat src = random_image(300, 270, CV_32FC1);
+	const cv::Size window(5, 3);
+	// weighted sum, weights differ by position
+	auto weight = [](int y, int x) { return float((y + 1) * (2 * x + 1)); };
+
+	std::function<float(const cv::Mat &)> func = [&](const cv::Mat &roi) {
+		float s = 0;
+		for (int y = 0; y < roi.rows; ++y)
+			for (int x = 0; x < roi.cols; ++x)
+				s += weight(y, x) * roi.at<float>(y, x);
+		return s;
+	};
+	cv::Mat_<float> ref = imgproc::convolution(src, window, func, cv::BORDER_REFLECT);
+
+	for_threads([&](int threads) {
+		cv::Mat_<float> fixed = imgproc::convolution_kernel<float, float, 5, 3>(
+			src, cv::Size(), [&](const imgproc::ConvolutionWindow<float, 5, 3> &w) {
+				float s = 0;
+				for (int y = 0; y < w.height(); ++y)
+					for (int x = 0; x < w.width(); ++x)
+						s += weight(y, x) * w[y][x];
+				return s;
+			}, cv::BORDER_REFLECT);
+		EXPECT_LE(max_diff(fixed, ref), 1e-3) << "threads " << threads;
+
+		cv::Mat_<float> separable = imgproc::convolution_separable<float, float>(
+			src, window,
+			[](const imgproc::ConvolutionWindow<float, 0, 1> &w) {
+				float s = 0;
+				for (int x = 0; x < w.width(); ++x)
+					s += float(2 * x + 1) * w[0][x];
+				return s;
+			},
+			[](const imgproc::ConvolutionWindow<float, 1, 0> &w) {
+				float s = 0;
+				for (int y = 0; y < w.height(); ++y)
+					s += float(y + 1) * w[y][0];
+				return s;
+			}, cv::BORDER_REFLECT);
+		EXPECT_LE(max_diff(separable, ref), 1e-3) << "threads " << threads;
+
+		cv::Mat_<float> center = imgproc::convolution_kernel<float, float>(
+			src, window, [](const imgproc::ConvolutionWindow<float> &w) { return w.center(); });
+		EXPECT_EQ(max_diff(center, src), 0);
+	});
+}
+
+TEST(PixelTest, ValuesAndReferences)
+{
+	typedef pixel_val_<3, float> pixel3f;
+	pixel3f a(1.0f);
+	pixel3f b(a);
+	b[1] = 4;
+	EXPECT_EQ((a + b)[1], 5);
+	EXPECT_EQ((b - a * 2.0f)[0], -1);
+	EXPECT_EQ((b / 2.0f)[1], 2);
+	EXPECT_TRUE(a != b);
+	EXPECT_FALSE(bool(pixel3f(0.0f)));
+
+	cv::Mat m(2, 2, CV_8UC3, cv::Scalar(10, 20, 30));
+	pixel_ref_<3, uint8_t> p = pixel_at<3, uint8_t>(m, 1, 1);
+	p += pixel_val_<3, uint8_t>(uint8_t(5));
+	EXPECT_EQ(m.at<cv::Vec3b>(1, 1)[2], 35);
+	pixel_at<3, uint8_t>(m, 0, 0) = pixel_at<3, uint8_t>(m, 1, 1) * 2.0f;
+	EXPECT_EQ(m.at<cv::Vec3b>(0, 0)[0], 30);
+	EXPECT_EQ(m.at<cv::Vec3b>(0, 1)[0], 10);
+	const cv::Mat &cm = m;
+	pixel3f c(pixel_at<3, uint8_t>(cm, 0, 0).val());
+	EXPECT_EQ(c[1], 50);
+}
+
+TEST(PixelTest, TransformEqualsLoop)
+{
+	cv::Mat src1 = random_image(67, 41, CV_8UC3);
+	cv::Mat src2 = random_image(67, 41, CV_8UC3);
+	cv::Mat ref(src1.size(), CV_32FC1);
+	for (int y = 0; y < src1.rows; ++y)
+		for (int x = 0; x < src1.cols; ++x)
+		{
+			const uint8_t *p1 = src1.ptr(y) + 3 * x;
+			const uint8_t *p2 = src2.ptr(y) + 3 * x;
+			float s = 0;
+			for (int c = 0; c < 3; ++c)
+				s += 0.5f * (float(p1[c]) - float(p2[c]));
+			ref.at<float>(y, x) = s;
+		}
+
+	for_threads([&](int) {
+		cv::Mat dst;
+		pixels_transform<3, uint8_t>(src1, src2, dst,
+			[](const pixel_val_<3, uint8_t> &a, const pixel_val_<3, uint8_t> &b) {
+				pixel_val_<3, float> d = (pixel_val_<3, float>(a) - pixel_val_<3, float>(b)) * 0.5f;
+				return pixel_val_<1, float>(d[0] + d[1] + d[2]);
+			});
+		ASSERT_EQ(dst.type(), CV_32FC1);
+		EXPECT_EQ(max_diff(dst, ref), 0);
+
+		cv::Mat inv = src1.clone();
+		pixels_transform<3, uint8_t>(inv, inv, [](const pixel_val_<3, uint8_t> &a) {
+			pixel_val_<3, uint8_t> r(uint8_t(255));
+			return r -= a;
+		});
+		for (int y = 0; y < src1.rows; ++y)
+			for (int x = 0; x < src1.cols * 3; ++x)
+				ASSERT_EQ(inv.ptr(y)[x] + src1.ptr(y)[x], 255);
+	});
+}
+
+TEST(ComponentsTest, LabelsEqualFloodFill)
+{
+	cv::Mat src = random_image(70, 53, CV_8UC1);
+	for (int connectivity: {4, 8})
+		for (int gap: {0, 1, 2})
+		{
+			// reference: breadth-first fill from pixels in raster order
+			cv::Mat ref = cv::Mat::zeros(src.size(), CV_32S);
+			std::vector<imgproc::Component> ref_components;
+			for (int y = 0; y < src.rows; ++y)
+				for (int x = 0; x < src.cols; ++x)
+				{
+					if (src.at<uint8_t>(y, x) < 150 || ref.at<int>(y, x))
+						continue;
+					const int label = int(ref_components.size()) + 1;
+					std::vector<cv::Point> queue(1, cv::Point(x, y));
+					ref.at<int>(y, x) = label;
+					cv::Point tl(x, y), br(x, y);
+					for (size_t q = 0; q < queue.size(); ++q)
+					{
+						cv::Point p = queue[q];
+						tl = cv::Point(std::min(tl.x, p.x), std::min(tl.y, p.y));
+						br = cv::Point(std::max(br.x, p.x), std::max(br.y, p.y));
+						for (int dy = -gap; dy <= gap; ++dy)
+							for (int dx = -gap; dx <= gap; ++dx)
+							{
+								cv::Point n(p.x + dx, p.y + dy);
+								if (connectivity == 4 && std::abs(dx) + std::abs(dy) > gap)
+									continue;
+								if (n.x < 0 || n.y < 0 || n.x >= src.cols || n.y >= src.rows ||
+										src.at<uint8_t>(n.y, n.x) < 150 || ref.at<int>(n.y, n.x))
+									continue;
+								ref.at<int>(n.y, n.x) = label;
+								queue.push_back(n);
+							}
+					}
+					imgproc::Component c;
+					c.rect = cv::Rect(tl.x, tl.y, br.x - tl.x + 1, br.y - tl.y + 1);
+					c.area = int(queue.size());
+					ref_components.push_back(c);
+				}
+
+			for_threads([&](int threads) {
+				cv::Mat labels;
+				std::vector<imgproc::Component> components;
+				int count = imgproc::connected_components(
+					src, labels, components, connectivity, gap, 150, 255);
+				ASSERT_EQ(count, int(ref_components.size()));
+				EXPECT_EQ(max_diff(labels, ref), 0)
+					<< "connectivity " << connectivity << ", gap " << gap << ", threads " << threads;
+				for (int i = 0; i < count; ++i)
+				{
+					EXPECT_EQ(components[i].rect, ref_components[i].rect);
+					EXPECT_EQ(components[i].area, ref_components[i].area);
+				}
+			});
+		}
+}
+
+TEST(ComponentsTest, SnakeIsOneComponent)
+{
+	// rows joined at alternating ends: long union-find chains without halving
+	cv::Mat src = cv::Mat::zeros(401, 400, CV_8UC1);
+	int area = 0;
+	for (int y = 0; y < src.rows; ++y)
+		for (int x = 0; x < src.cols; ++x)
+		{
+			const bool on = y % 2 == 0 || (y % 4 == 1 ? x == src.cols - 1 : x == 0);
+			src.at<uint8_t>(y, x) = on ? 255 : 0;
+			area += on;
+		}
+
+	for_threads([&](int threads) {
+		cv::Mat labels;
+		std::vector<imgproc::Component> components;
+		ASSERT_EQ(imgproc::connected_components(src, labels, components, 4), 1);
+		EXPECT_EQ(components[0].area, area);
+		EXPECT_EQ(components[0].rect, cv::Rect(0, 0, src.cols, src.rows));
+		cv::Mat ref;
+		src.convertTo(ref, CV_32S, 1.0 / 255);
+		EXPECT_EQ(max_diff(labels, ref), 0) << "threads " << threads;
+	});
+}
+
+TEST(ComponentsTest, FloodfillAndFindRects)
+{
+	const uint8_t data[6][8] = {
+		{ 9, 9, 0, 0, 0, 0, 0, 5 },
+		{ 0, 9, 0, 5, 5, 0, 0, 0 },
+		{ 0, 0, 0, 5, 0, 5, 0, 0 },
+		{ 0, 0, 0, 0, 0, 0, 0, 0 },
+		{ 9, 0, 0, 0, 0, 0, 9, 9 },
+		{ 0, 0, 5, 0, 0, 0, 9, 9 },
+	};
+	cv::Mat src(6, 8, CV_8UC1);
+	for (int y = 0; y < src.rows; ++y)
+		for (int x = 0; x < src.cols; ++x)
+			src.at<uint8_t>(y, x) = data[y][x];
+
+	// areas of 9: 3, 1, 4 pixels
+	cv::Mat img = src.clone();
+	imgproc::floodfill(img, 9, 7, 3);
+	EXPECT_EQ(img.at<uint8_t>(0, 0), 7);
+	EXPECT_EQ(img.at<uint8_t>(4, 0), 0);
+	EXPECT_EQ(img.at<uint8_t>(5, 7), 7);
+	EXPECT_EQ(img.at<uint8_t>(1, 3), 5);
+
+	// components of >= 5 with a 9 pixel, rects are (max - min) wide
+	// and pushed only if wider than min_obj_size percents
+	img = src.clone();
+	std::vector<cv::Rect> rects;
+	int max_square = imgproc::find_rects(img, 9, 5, 1, rects, 0, 1);
+	ASSERT_EQ(rects.size(), 2u);
+	EXPECT_EQ(rects[0], cv::Rect(0, 0, 1, 1));
+	EXPECT_EQ(rects[1], cv::Rect(6, 4, 1, 1));
+	EXPECT_EQ(max_square, 1);
+	EXPECT_EQ(img.at<uint8_t>(1, 3), 5);
+	EXPECT_EQ(img.at<uint8_t>(4, 0), 1);
+
+	// gap 2 joins everything but the bottom-left pair
+	img = src.clone();
+	rects.clear();
+	max_square = imgproc::find_rects(img, 9, 5, 1, rects, 0, 2);
+	ASSERT_EQ(rects.size(), 2u);
+	EXPECT_EQ(rects[0], cv::Rect(0, 0, 7, 5));
+	EXPECT_EQ(rects[1], cv::Rect(0, 4, 2, 1));
+	EXPECT_EQ(max_square, 35);
+	EXPECT_EQ(img.at<uint8_t>(1, 3), 1);
+
+	img = src.clone();
+	cv::Rect rect = imgproc::find_bounding_rect(img.data, img.cols, img.rows, 5, 1, 3, 1, 2);
+	EXPECT_EQ(rect, cv::Rect(0, 0, 7, 5));
+	EXPECT_EQ(img.at<uint8_t>(0, 7), 1);
+	EXPECT_EQ(img.at<uint8_t>(5, 2), 5);
+	// 8-connected zeros, seed included
+	EXPECT_EQ(imgproc::floodfill_pixel(img.data, img.cols, img.rows, 0, 3, 2, 0), 34);
+	EXPECT_EQ(img.at<uint8_t>(3, 3), 3);
+}
+
+TEST(ScratchTest, FramesAreStackedAndMerged)
+{
+	imgproc::ScratchArena &arena = imgproc::ScratchArena::local();
+	arena.release();
+	const uint64_t heap = arena.stats().heap_allocations;
+	{
+		imgproc::ScratchFrame outer;
+		uint8_t *a = outer.alloc<uint8_t>(3);
+		EXPECT_EQ(size_t(a) % imgproc::ScratchArena::ALIGN, 0u);
+		float *b = nullptr;
+		{
+			imgproc::ScratchFrame inner;
+			b = inner.alloc<float>(100);
+			EXPECT_EQ(size_t(b) % imgproc::ScratchArena::ALIGN, 0u);
+			EXPECT_GE(b, reinterpret_cast<float*>(a + 3));
+		}
+		// inner frame memory is reused
+		imgproc::ScratchFrame inner;
+		EXPECT_EQ(inner.alloc<float>(100), b);
+
+		// the second block is needed
+		cv::Mat m = inner.mat(1000, 1000, CV_32FC1);
+		EXPECT_TRUE(m.isContinuous());
+		EXPECT_EQ(size_t(m.data) % imgproc::ScratchArena::ALIGN, 0u);
+		EXPECT_EQ(arena.stats().heap_allocations, heap + 2);
+	}
+	// blocks are merged into one of peak size
+	EXPECT_EQ(arena.stats().heap_allocations, heap + 3);
+	EXPECT_EQ(arena.stats().used, 0u);
+	EXPECT_GE(arena.stats().capacity, arena.stats().peak);
+	{
+		imgproc::ScratchFrame frame;
+		frame.alloc<uint8_t>(3);
+		frame.alloc<float>(100);
+		frame.mat(1000, 1000, CV_32FC1);
+	}
+	EXPECT_EQ(arena.stats().heap_allocations, heap + 3);
+}
+
+namespace {
+
+// pipeline run repeated with the same image size takes no new scratch blocks
+void expect_repeated_run_reuses_scratch(cv::Size size)
+{
+	cv::Mat gray = random_image(size.height, size.width, CV_8UC1);
+	cv::Mat color = random_image(size.height, size.width, CV_8UC3);
+	cv::Mat depth = random_image(size.height, size.width, CV_16UC1);
+	cv::Mat real = random_image(size.height, size.width, CV_32FC1);
+	cv::Mat mask = random_image(size.height, size.width, CV_8UC1) > 128;
+	cv::Mat angle(size, CV_32FC1), magnitude(size, CV_32FC1);
+	cv::randu(angle, cv::Scalar(0), cv::Scalar(360));
+	cv::randu(magnitude, cv::Scalar(0), cv::Scalar(255));
+	cv::Mat dx, dy;
+	gray.convertTo(dx, CV_32F, 1.0, -128.0);
+	random_image(size.height, size.width, CV_8UC1).convertTo(dy, CV_32F, 1.0, -128.0);
+
+	// outputs are allocated by the first run and reused
+	cv::Mat dst, labels, filled, cn, ca;
+	cv::Mat hog(size.height / 8, size.width / 8, CV_32FC(3 * 9 + 4));
+	cv::Mat hog_dense(size, CV_32FC(9));
+	std::vector<imgproc::Component> components;
+	std::vector<imgproc::Corner> corners;
+	std::vector<std::vector<int> > hists;
+	auto pipeline = [&]() {
+		imgproc::contrast_adaptive_equalization(color, dst, 15);
+		imgproc::contrast_limit_adaptive_equalization(gray, dst, 32, 40);
+		imgproc::filter_median(color, cv::Size(5, 5));
+		imgproc::filter_median(depth, cv::Size(3, 3));
+		imgproc::filter_median(real, cv::Size(7, 7));
+		imgproc::connected_components(mask, labels, components);
+		mask.copyTo(filled);
+		imgproc::floodfill(filled, 0, 100, 10);
+		imgproc::hog_classic(angle, magnitude, hog, 9, 8, 8, cn, ca);
+		imgproc::hog_kernel(angle, magnitude, hog_dense, 0);
+		imgproc::corners(dx, dy, corners, 4, 100, 0, imgproc::CORNER_HARRIS, 0.04, 8);
+		imgproc::histograms(color, hists, 64, 0, 256);
+		imgproc::convolution_separable<float, uint8_t>(gray, cv::Size(5, 3),
+			[](const imgproc::ConvolutionWindow<uint8_t, 0, 1> &w) {
+				return float(w[0][0] + w[0][w.width() - 1]);
+			},
+			[](const imgproc::ConvolutionWindow<float, 1, 0> &w) {
+				return w[0][0] - w[w.height() - 1][0];
+			});
+	};
+
+	pipeline();
+	const uint64_t heap = imgproc::scratch_heap_allocations();
+	const imgproc::ScratchArena::Stats stats = imgproc::ScratchArena::local().stats();
+	pipeline();
+	pipeline();
+	// temporaries of all kernels come from the arenas, which do not grow
+	EXPECT_EQ(imgproc::scratch_heap_allocations(), heap) << size.width << "x" << size.height;
+	EXPECT_EQ(imgproc::ScratchArena::local().stats().heap_allocations, stats.heap_allocations);
+	EXPECT_EQ(imgproc::ScratchArena::local().stats().capacity, stats.capacity);
+	EXPECT_EQ(imgproc::ScratchArena::local().stats().used, 0u);
+}
+
+}  // namespace
+
+TEST(ScratchTest, RepeatedCallsDoNotAllocate)
+{
+	// single thread: which pool worker first meets which band is not fixed
+	ThreadsGuard guard(1);
+	expect_repeated_run_reuses_scratch(cv::Size(320, 64));
+	expect_repeated_run_reuses_scratch(cv::Size(640, 160));
+}
@@ -0,0 +1,330 @@
+#include "common/stringutils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+TEST(StringUtilsTest, DoubleToCharsEqualsPrintf)
+{
+	std::mt19937_64 rng(2017);
+	std::uniform_real_distribution<double> exponent(-12, 12);
+	char buf[512];
+	char ref[512];
+	for (int i = 0; i < 200000; ++i)
+	{
+		double value = pow(10.0, exponent(rng));
+		// values close to decimal ties
+		if (i % 5 == 0)
+			value = floor(value * 1000) / 1000 + 0.0005;
+		if (i % 2)
+			value = -value;
+		const int precision = i % 10;
+
+		char *end = aifil::to_chars(buf, buf + sizeof(buf), value, precision);
+		ASSERT_TRUE(end != 0);
+		snprintf(ref, sizeof(ref), "%.*f", precision, value);
+		ASSERT_EQ(std::string(buf, end), std::string(ref)) <<
+			"value " << value << ", precision " << precision;
+	}
+
+	EXPECT_EQ(std::string(buf, aifil::to_chars(buf, buf + sizeof(buf), 940185753.1237326, 7)),
+		"940185753.1237326");
+	EXPECT_EQ(std::string(buf, aifil::to_chars(buf, buf + sizeof(buf), -0.001, 2)), "-0.00");
+	EXPECT_EQ(std::string(buf, aifil::to_chars(buf, buf + sizeof(buf), 0.125, 2)), "0.12");
+	EXPECT_TRUE(aifil::to_chars(buf, buf + 3, 12.5, 1) == 0);
+}
+
+namespace {
+
+// scalar references: one code point at a time
+void append_utf8(std::string &dst, uint32_t cp)
+{
+	if (cp < 0x80)
+		dst += char(cp);
+	else if (cp < 0x800)
+	{
+		dst += char(0xC0 | (cp >> 6));
+		dst += char(0x80 | (cp & 0x3F));
+	}
+	else if (cp < 0x10000)
+	{
+		dst += char(0xE0 | (cp >> 12));
+		dst += char(0x80 | ((cp >> 6) & 0x3F));
+		dst += char(0x80 | (cp & 0x3F));
+	}
+	else
+	{
+		dst += char(0xF0 | (cp >> 18));
+		dst += char(0x80 | ((cp >> 12) & 0x3F));
+		dst += char(0x80 | ((cp >> 6) & 0x3F));
+		dst += char(0x80 | (cp & 0x3F));
+	}
+}
+
+void append_utf16(aifil::utf8::string &dst, uint32_t cp)
+{
+	if (cp < 0x10000)
+		dst += char16_t(cp);
+	else
+	{
+		dst += char16_t(0xD800 | ((cp - 0x10000) >> 10));
+		dst += char16_t(0xDC00 | ((cp - 0x10000) & 0x3FF));
+	}
+}
+
+// both directions and lengths against the references
+void expect_transcoding(const std::vector<uint32_t> &cps)
+{
+	std::string u8;
+	aifil::utf8::string u16;
+	for (uint32_t cp: cps)
+	{
+		append_utf8(u8, cp);
+		append_utf16(u16, cp);
+	}
+
+	size_t pos = 0;
+	EXPECT_TRUE(aifil::utf8::validate(u8, &pos)) << "error at " << pos;
+	ASSERT_EQ(aifil::utf8::decoded_length(u8.data(), u8.size()), u16.size());
+	ASSERT_EQ(aifil::utf8::encoded_length(u16.data(), u16.size()), u8.size());
+	EXPECT_TRUE(aifil::utf8::decode(u8) == u16);
+	EXPECT_EQ(aifil::utf8::encode(u16), u8);
+
+	// raw buffers are not overrun
+	std::vector<char16_t> wide(u16.size() + 1, char16_t(0xBEEF));
+	EXPECT_EQ(aifil::utf8::decode(u8.data(), u8.size(), wide.data()), u16.size());
+	EXPECT_TRUE(aifil::utf8::string(wide.data(), u16.size()) == u16);
+	EXPECT_EQ(wide.back(), char16_t(0xBEEF));
+	std::vector<char> narrow(u8.size() + 1, '#');
+	EXPECT_EQ(aifil::utf8::encode(u16.data(), u16.size(), narrow.data()), u8.size());
+	EXPECT_EQ(std::string(narrow.data(), u8.size()), u8);
+	EXPECT_EQ(narrow.back(), '#');
+}
+
+}  // namespace
+
+TEST(Utf8Test, AsciiRunsAcrossBlocks)
+{
+	// one non-ASCII code point at every position of runs around 16 and 32 bytes
+	for (uint32_t wide: {0xE9u, 0x20ACu, 0x1F600u})
+		for (size_t len = 0; len <= 80; ++len)
+			for (size_t at = 0; at <= len; at += (len > 40 ? 7 : 1))
+			{
+				std::vector<uint32_t> cps;
+				for (size_t i = 0; i < len; ++i)
+					cps.push_back(i == at ? wide : 'a' + i % 26);
+				SCOPED_TRACE(testing::Message() << "length " << len << ", at " << at);
+				expect_transcoding(cps);
+			}
+}
+
+TEST(Utf8Test, RandomTextEqualsReference)
+{
+	std::mt19937 rng(27);
+	// ASCII runs, 2-, 3- (around surrogates) and 4-byte sequences
+	std::uniform_int_distribution<int> kind(0, 4);
+	std::uniform_int_distribution<int> run(0, 40);
+	for (int t = 0; t < 2000; ++t)
+	{
+		std::vector<uint32_t> cps;
+		for (int n = 0; n < 20; ++n)
+		{
+			switch (kind(rng))
+			{
+			case 0:
+				for (int i = run(rng); i > 0; --i)
+					cps.push_back(uint32_t(rng() % 0x80));
+				break;
+			case 1:
+				cps.push_back(0x80 + rng() % (0x800 - 0x80));
+				break;
+			case 2:
+				cps.push_back(0x800 + rng() % (0xD800 - 0x800));
+				break;
+			case 3:
+				cps.push_back(0xE000 + rng() % (0x10000 - 0xE000));
+				break;
+			default:
+				cps.push_back(0x10000 + rng() % (0x110000 - 0x10000));
+			}
+		}
+		expect_transcoding(cps);
+	}
+	expect_transcoding({0x7F, 0x80, 0x7FF, 0x800, 0xD7FF, 0xE000, 0xFFFF, 0x10000, 0x10FFFF});
+}
+
+TEST(Utf8Test, InvalidInputIsRejected)
+{
+	struct Case { const char *bytes; size_t error; };
+	const Case cases[] = {
+		// overlong forms
+		{ "\xC0\xAF", 0 },
+		{ "\xC1\xBF", 0 },
+		{ "\xE0\x80\xAF", 0 },
+		{ "\xE0\x9F\xBF", 0 },
+		{ "\xF0\x80\x80\xAF", 0 },
+		{ "\xF0\x8F\xBF\xBF", 0 },
+		// truncated tails
+		{ "ab\xC3", 2 },
+		{ "ab\xE2\x82", 2 },
+		{ "ab\xF0\x9F\x98", 2 },
+		{ "\xE2\x82z", 0 },
+		// stray continuation bytes
+		{ "a\x80z", 1 },
+		{ "\xC3\xA9\xBF", 2 },
+		// surrogates
+		{ "\xED\xA0\x80", 0 },
+		{ "x\xED\xBF\xBF", 1 },
+		// above U+10FFFF
+		{ "\xF4\x90\x80\x80", 0 },
+		{ "\xF5\x80\x80\x80", 0 },
+		{ "\xFF", 0 },
+	};
+	// invalid bytes also after ASCII prefixes handled by SIMD blocks
+	for (size_t prefix: {0, 15, 16, 31, 33, 70})
+		for (const Case &c: cases)
+		{
+			const std::string text = std::string(prefix, 'p') + c.bytes + "tail";
+			size_t pos = size_t(-1);
+			EXPECT_FALSE(aifil::utf8::validate(text, &pos)) << prefix << " + " << c.bytes;
+			EXPECT_EQ(pos, prefix + c.error) << prefix << " + " << c.bytes;
+			EXPECT_THROW(aifil::utf8::decode(text), std::range_error);
+		}
+
+	// unpaired UTF-16 surrogates
+	for (size_t prefix: {0, 7, 16, 40})
+	{
+		const aifil::utf8::string ascii(prefix, u'p');
+		EXPECT_THROW(aifil::utf8::encode(ascii + u'\xD800'), std::range_error);
+		EXPECT_THROW(aifil::utf8::encode(ascii + u'\xD800' + u"z"), std::range_error);
+		EXPECT_THROW(aifil::utf8::encode(ascii + u'\xDC00' + u"z"), std::range_error);
+		EXPECT_EQ(aifil::utf8::encode(ascii + u"\xD83D\xDE00"),
+			std::string(prefix, 'p') + "\xF0\x9F\x98\x80");
+	}
+}
+
+namespace {
+
+std::vector<std::string> slices_to_strings(const aifil::SplitRange &range)
+{
+	std::vector<std::string> res;
+	for (const auto &token: range)
+		res.push_back(token.str());
+
+	std::vector<aifil::StringSlice> slices;
+	range.to_vector(slices);
+	EXPECT_EQ(slices.size(), res.size());
+	EXPECT_EQ(range.count(), res.size());
+	return res;
+}
+
+}  // namespace
+
+TEST(StringUtilsTest, SplitSlicesEqualsSplit)
+{
+	const char *inputs[] = {
+		"", ",", ",,", "a", "a,b", "a,,b", ",a", "a,", ",a,", "a,b,,", ",,a,,b,,",
+		"::", ":::", "a::b", "::a::::b::", "a:b::c:::d", "abcabc", "xabcyabcabcz",
+		" \t a \t\n b\n\n", "\t\t \t", "no delimiters at all",
+	};
+	for (const char *input: inputs)
+	{
+		SCOPED_TRACE(input);
+		for (char delim: {',', ':', ' '})
+			EXPECT_EQ(slices_to_strings(aifil::split_slices(input, delim)),
+				aifil::split(input, delim));
+		for (const char *delims: {",", ":", " \t\n", ",:"})
+			EXPECT_EQ(slices_to_strings(aifil::split_slices(input, aifil::StringSlice(delims))),
+				aifil::split(input, std::string(delims)));
+		for (const char *sub: {",", "::", ":::", "abc"})
+			EXPECT_EQ(slices_to_strings(aifil::split_slices_by_substr(input, sub)),
+				aifil::split_by_substr(input, sub, false));
+	}
+
+	// tokens point into the input
+	std::string text = "a,bb,,ccc";
+	std::vector<aifil::StringSlice> tokens;
+	aifil::split_slices(text, ',').to_vector(tokens);
+	ASSERT_EQ(tokens.size(), 4u);
+	EXPECT_EQ(tokens[1].data(), text.data() + 2);
+	EXPECT_TRUE(tokens[2].empty());
+}
+
+TEST(StringUtilsTest, FormatBufferGrowsAndReuses)
+{
+	aifil::FormatBuffer buf;
+	EXPECT_STREQ(buf.c_str(), "");
+	EXPECT_EQ(buf.size(), 0u);
+
+	EXPECT_STREQ(buf.printf("%d-%s", 42, "x"), "42-x");
+	EXPECT_EQ(buf.size(), 4u);
+	EXPECT_STREQ(buf.printf("%s", "y"), "y");
+	EXPECT_STREQ(buf.append("%03d", 7), "y007");
+	EXPECT_EQ(buf.str(), "y007");
+	EXPECT_TRUE(buf.slice() == aifil::StringSlice("y007"));
+
+	// appending past the inplace storage moves content to heap
+	const std::string long_part(250, 'a');
+	buf.printf("%s", long_part.c_str());
+	const char *inplace = buf.c_str();
+	const char *appended = buf.append("%s|%d", "tail-tail", 123456);
+	EXPECT_EQ(appended, buf.c_str());
+	EXPECT_NE(buf.c_str(), inplace);
+	EXPECT_EQ(buf.str(), long_part + "tail-tail|123456");
+	EXPECT_EQ(buf.size(), long_part.size() + 16);
+
+	// heap storage is kept for the next calls
+	const std::string huge(1000, 'h');
+	buf.printf("%s%d", huge.c_str(), 1);
+	const char *heap = buf.c_str();
+	EXPECT_EQ(buf.str(), huge + "1");
+	EXPECT_STREQ(buf.printf("%s", "short"), "short");
+	EXPECT_EQ(buf.c_str(), heap);
+	buf.printf("%s%d", huge.c_str(), 2);
+	EXPECT_EQ(buf.c_str(), heap);
+	EXPECT_EQ(buf.str(), huge + "2");
+	EXPECT_EQ(buf.str(), aifil::stdprintf("%s%d", huge.c_str(), 2));
+
+	buf.clear();
+	EXPECT_EQ(buf.size(), 0u);
+	EXPECT_STREQ(buf.printf("%.1f", 2.25), "2.2");
+	EXPECT_NE(buf.c_str(), heap);
+}
+
+TEST(StringUtilsTest, StdprintfIntoString)
+{
+	std::string dst = "previous content";
+	EXPECT_EQ(aifil::stdprintf(dst, "%d:%s", 5, "five"), 6u);
+	EXPECT_EQ(dst, "5:five");
+	EXPECT_EQ(aifil::stdprintf_append(dst, "/%x", 255), 3u);
+	EXPECT_EQ(dst, "5:five/ff");
+	EXPECT_EQ(aifil::stdprintf(dst, "%s", ""), 0u);
+	EXPECT_TRUE(dst.empty());
+
+	// long results, also around the stack buffer size
+	for (size_t len: {255, 256, 257, 4000})
+	{
+		const std::string text(len, 'q');
+		EXPECT_EQ(aifil::stdprintf(dst, "%s", text.c_str()), len);
+		EXPECT_EQ(dst, text);
+		EXPECT_EQ(aifil::stdprintf_append(dst, "<%s>", text.c_str()), len + 2);
+		EXPECT_EQ(dst, text + "<" + text + ">");
+		EXPECT_EQ(aifil::stdprintf("%s", text.c_str()), text);
+	}
+
+	// capacity is reused
+	dst.reserve(10000);
+	const char *data = dst.data();
+	aifil::stdprintf(dst, "%s", std::string(5000, 'w').c_str());
+	aifil::stdprintf(dst, "%d", 1);
+	aifil::stdprintf_append(dst, "%s", std::string(3000, 'e').c_str());
+	EXPECT_EQ(dst.data(), data);
+	EXPECT_EQ(dst, "1" + std::string(3000, 'e'));
+}
@@ -0,0 +1,206 @@
+#include "common/stringutils.hpp"
+#include "common/timeutils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <boost/date_time.hpp>
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <random>
+#include <sstream>
+#include <string>
+
+namespace {
+
+// the boost parser of the default format, used before the strict one
+bool boost_parse(const std::string &datetime, int64_t &utc)
+{
+	utc = 0;
+	try
+	{
+		std::stringstream ss(datetime);
+		ss.imbue(std::locale(ss.getloc(),
+			new boost::local_time::local_time_input_facet("%Y-%m-%d %H:%M:%S%F %ZP")));
+		boost::local_time::local_date_time ldt(boost::local_time::not_a_date_time);
+		if (!(ss >> ldt))
+			return false;
+		boost::posix_time::ptime const epoch(boost::gregorian::date(1970, 1, 1));
+		utc = (ldt.utc_time() - epoch).total_milliseconds();
+	}
+	catch (...)
+	{
+		return false;
+	}
+	return true;
+}
+
+void expect_parsed(const std::string &text, int64_t expected)
+{
+	int64_t utc = -1;
+	EXPECT_TRUE(aifil::parse_datetime(text.data(), text.size(), utc)) << text;
+	EXPECT_EQ(utc, expected) << text;
+	int64_t ref = -1;
+	EXPECT_TRUE(boost_parse(text, ref)) << text;
+	EXPECT_EQ(ref, expected) << text;
+}
+
+// strftime() based formatting of the shifted time
+std::string strftime_datetime(int64_t utc, int tz_offset, int flags, bool local = false)
+{
+	int64_t ms = utc + int64_t(tz_offset) * 60000;
+	int64_t sec = ms / 1000 - (ms % 1000 < 0);
+	time_t t = time_t(local ? utc / 1000 - (utc % 1000 < 0) : sec);
+	std::tm tm_value = local ? *std::localtime(&t) : *std::gmtime(&t);
+	const char *fmt = flags & aifil::DATETIME_T ? "%Y-%m-%dT%H:%M:%S" :
+		flags & aifil::DATETIME_DASH ? "%Y-%m-%d-%H:%M:%S" : "%Y-%m-%d %H:%M:%S";
+	char buf[40];
+	std::string res(buf, strftime(buf, sizeof(buf), fmt, &tm_value));
+	if (flags & aifil::DATETIME_MS)
+		res += aifil::stdprintf(".%03d", int(ms - sec * 1000));
+	if (flags & aifil::DATETIME_TZ)
+	{
+		int abs_offset = tz_offset < 0 ? -tz_offset : tz_offset;
+		res += aifil::stdprintf("%c%02d:%02d", tz_offset < 0 ? '-' : '+',
+			abs_offset / 60, abs_offset % 60);
+	}
+	return res;
+}
+
+}  // namespace
+
+TEST(TimeUtilsTest, ParseDocumentedFormats)
+{
+	expect_parsed("2017-04-09 12:00:00", 1491739200000);
+	expect_parsed("2017-04-09T12:00:00", 1491739200000);
+	expect_parsed("2017-04-09 12:00:00Z", 1491739200000);
+	expect_parsed("2017-04-09 12:00:00+05", 1491721200000);
+	expect_parsed("2017-04-09T12:00:00+05", 1491721200000);
+	expect_parsed("2017-04-09 12:00:00-03:30", 1491751800000);
+	expect_parsed("2017-04-09 12:00:00+05:45", 1491718500000);
+
+	// fractional seconds are truncated to milliseconds
+	expect_parsed("2017-04-09 12:00:00.5", 1491739200500);
+	expect_parsed("2017-04-09 12:00:00.123", 1491739200123);
+	expect_parsed("2017-04-09 12:00:00.123999", 1491739200123);
+	expect_parsed("2017-04-09 12:00:00.000001+01", 1491735600000);
+	expect_parsed("1969-12-31 23:59:59.999", -1);
+
+	// leap days
+	expect_parsed("2016-02-29 00:00:00", 1456704000000);
+	expect_parsed("2000-02-29 23:59:59", 951868799000);
+	// day boundary crossed by the offset
+	expect_parsed("2017-01-01 01:00:00+02", 1483225200000);
+}
+
+TEST(TimeUtilsTest, ParseMalformedLikeBoost)
+{
+	const char *inputs[] = {
+		"",
+		"2017-04-09",
+		"2017-04-09 12:00",
+		"2017-04-09 12:00:00+130",
+		"2017-04-09 12:00:00+0130",
+		"2017-04-09 12:00:00+05:60",
+		"2017-04-09 12:00:00+15",
+		"2017-04-09 12:00:00.",
+		"2017-04-09 12:00:00.1234567891",
+		"2017-13-09 12:00:00",
+		"2017-04-31 12:00:00",
+		"2017-02-29 12:00:00",
+		"1900-02-29 12:00:00",
+		"2017-04-09 24:00:00",
+		"2017-04-09 12:60:00",
+		"2017-04-09 12:00:60",
+		"2017-04-09 12:00:00 ",
+		"2017-04-09 12:00:00garbage",
+		"2017/04/09 12:00:00",
+		"17-04-09 12:00:00",
+		"2017-4-9 12:00:00",
+		"abcd-ef-gh ij:kl:mn",
+	};
+	for (const char *text: inputs)
+	{
+		int64_t utc = -1, ref = -1;
+		bool ok = aifil::parse_datetime(text, strlen(text), utc);
+		EXPECT_EQ(ok, boost_parse(text, ref)) << text;
+		EXPECT_EQ(utc, ref) << text;
+	}
+
+	// invalid dates are not accepted in any case
+	for (const char *text: {"2017-02-29 12:00:00", "2017-04-31 12:00:00",
+			"2017-13-09 12:00:00", "2017-04-09 12:00:00+130", "2017-04-09 12:00:00+0130"})
+	{
+		int64_t utc = -1;
+		EXPECT_FALSE(aifil::parse_datetime(text, strlen(text), utc)) << text;
+	}
+}
+
+TEST(TimeUtilsTest, FormatEqualsStrftime)
+{
+	std::mt19937 rng(30);
+	// 1901..2099, also before the epoch
+	std::uniform_int_distribution<int64_t> moment(-2145916800000, 4102444799999);
+	for (int i = 0; i < 2000; ++i)
+	{
+		int64_t utc = i < 4 ? int64_t(i) - 2 : moment(rng);
+		int tz_offset = int(rng() % (26 * 60)) - 12 * 60;
+		int flags = int(rng() % 16);
+		if ((flags & aifil::DATETIME_T) && (flags & aifil::DATETIME_DASH))
+			flags &= ~aifil::DATETIME_DASH;
+		std::string expected = strftime_datetime(utc, tz_offset, flags);
+		EXPECT_EQ(aifil::format_datetime(utc, tz_offset, flags), expected) << utc;
+
+		// formatted with offset is parsed back
+		if ((flags & aifil::DATETIME_MS) && (flags & aifil::DATETIME_TZ) &&
+			!(flags & aifil::DATETIME_DASH))
+		{
+			int64_t parsed = -1;
+			EXPECT_TRUE(aifil::parse_datetime(expected.data(), expected.size(), parsed));
+			EXPECT_EQ(parsed, utc) << expected;
+		}
+	}
+
+	// too small buffer and years out of 0..9999
+	char buf[40];
+	EXPECT_TRUE(aifil::format_datetime(buf, buf + 19, 0, 0, 0) == buf + 19);
+	EXPECT_TRUE(aifil::format_datetime(buf, buf + 18, 0, 0, 0) == 0);
+	EXPECT_TRUE(aifil::format_datetime(buf, buf + 22, 0, 0, aifil::DATETIME_MS) == 0);
+	EXPECT_TRUE(aifil::format_datetime(buf, buf + 28, 0, 0,
+		aifil::DATETIME_MS | aifil::DATETIME_TZ) == 0);
+	EXPECT_EQ(aifil::format_datetime(253402300800000), "");
+	EXPECT_EQ(aifil::format_datetime(253402300799999), "9999-12-31 23:59:59.999");
+}
+
+TEST(TimeUtilsTest, FormatterCachedSecondRollsOver)
+{
+	// around second, minute, day, leap day and year boundaries, also backwards
+	const int64_t moments[] = {
+		1491739199998, 1491739199999, 1491739200000, 1491739200001, 1491739200999,
+		1491739201000, 1491739199000, 1491695999999, 1491696000000, 1456703999999,
+		1456704000000, 1456790399999, 1456790400000, 1483228799999, 1483228800000,
+		1483228800000, 1483228800500, 1491739200000, -1, 0, -1000, -1001,
+	};
+	for (int flags: {0, int(aifil::DATETIME_MS), aifil::DATETIME_MS | aifil::DATETIME_T,
+			int(aifil::DATETIME_DASH), aifil::DATETIME_MS | aifil::DATETIME_TZ})
+	{
+		aifil::TimestampFormatter utc_formatter(false, flags);
+		aifil::TimestampFormatter local_formatter(true, flags & ~aifil::DATETIME_TZ);
+		for (int64_t utc: moments)
+		{
+			std::string expected = aifil::format_datetime(utc, 0, flags);
+			EXPECT_EQ(utc_formatter.format(utc), expected) << utc;
+			EXPECT_EQ(utc_formatter.size(), expected.size());
+			EXPECT_EQ(local_formatter.format(utc),
+				strftime_datetime(utc, 0, flags & ~aifil::DATETIME_TZ, true)) << utc;
+		}
+	}
+
+	// out of range moment does not break the next one
+	aifil::TimestampFormatter formatter(false);
+	EXPECT_STREQ(formatter.format(253402300800000), "");
+	EXPECT_EQ(formatter.size(), 0u);
+	EXPECT_STREQ(formatter.format(1491739200001), "2017-04-09 12:00:00.001");
+}
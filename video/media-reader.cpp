@@ -422,15 +422,16 @@ void SequentialReader::setup(const std::string &input_path, int fps)
 					aifil::log_warning("can't find file '%s'", full_name.c_str());
 			}
 			fclose(file_index);
+			// equalize photos order
+			photos.sort();
 		}
 		else
 		{
 			photos.clear();
 			//std::set<std::string> extensions = {".png", ".pgm", ".jpg", ".jpeg" };
-			photos = aifil::ls_directory(input_path, PATH_FILE);
+			// parallel scan, sorted once at the end to equalize photos order
+			photos = aifil::ls_directory(input_path, PATH_FILE, true, std::set<std::string>(), true);
 		}
-		// equalize photos order
-		photos.sort();
 		except(!photos.empty(), "can't find any image");
 		next_photo = photos.begin();
 		aifil::log_state("photos mode (%s)", input_path.c_str());